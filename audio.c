@@ -307,6 +307,8 @@ static void go_to_another_file ()
 			before_queue_fname = xstrdup (curr_playing_fname);
 
 		curr_plist = &queue;
+		if (plist_needs_compaction (&queue))
+			plist_compact (&queue, -1);
 		curr_playing = plist_next (&queue, -1);
 
 		server_queue_pop (queue.items[curr_playing].file);
@@ -542,6 +544,8 @@ void audio_play (const char *fname)
 	 * playing file from the queue. */
 	if (plist_count(&queue) && !(*fname)) {
 		curr_plist = &queue;
+		if (plist_needs_compaction (&queue))
+			plist_compact (&queue, -1);
 		curr_playing = plist_next (&queue, -1);
 
 		/* remove the file from queue */
@@ -1105,30 +1109,55 @@ void audio_set_mixer (const int val)
 		hw.set_mixer (val);
 }
 
+/* Remove deleted items from the playlist if there are many of them,
+ * keeping curr_playing on the same item.  The item being played is still
+ * needed even if deleted, so wait with the compaction then.  Must be
+ * called with curr_playing_mtx and plist_mtx locked. */
+static void compact_plist (struct plist *plist)
+{
+	if (!plist_needs_compaction (plist))
+		return;
+
+	if (curr_plist != plist)
+		plist_compact (plist, -1);
+	else if (curr_playing == -1 || !plist_deleted (plist, curr_playing))
+		curr_playing = plist_compact (plist, curr_playing);
+}
+
 void audio_plist_delete (const char *file)
 {
 	int num;
 
+	LOCK (curr_playing_mtx);
 	LOCK (plist_mtx);
 	num = plist_find_fname (&playlist, file);
-	if (num != -1)
+	if (num != -1) {
 		plist_delete (&playlist, num);
+		compact_plist (&playlist);
+	}
 
 	num = plist_find_fname (&shuffled_plist, file);
-	if (num != -1)
+	if (num != -1) {
 		plist_delete (&shuffled_plist, num);
+		compact_plist (&shuffled_plist);
+	}
 	UNLOCK (plist_mtx);
+	UNLOCK (curr_playing_mtx);
 }
 
 void audio_queue_delete (const char *file)
 {
 	int num;
 
+	LOCK (curr_playing_mtx);
 	LOCK (plist_mtx);
 	num = plist_find_fname (&queue, file);
-	if (num != -1)
+	if (num != -1) {
 		plist_delete (&queue, num);
+		compact_plist (&queue);
+	}
 	UNLOCK (plist_mtx);
+	UNLOCK (curr_playing_mtx);
 }
 
 /* Get the time of a file if the file is on the playlist and
@@ -378,6 +378,17 @@ int get_realtime (struct timespec *ts)
     return result;
 }
 
+/* Return the real time in seconds with a fraction, 0.0 on error. */
+double get_realtime_sec ()
+{
+	struct timespec ts;
+
+	if (get_realtime (&ts) == -1)
+		return 0.0;
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
 /* Convert time in second to min:sec text format. buff must be 6 chars long. */
 void sec_to_min (char *buff, const int seconds)
 {
@@ -143,6 +143,7 @@ char *format_msg_va (const char *format, va_list va);
 bool is_valid_symbol (const char *candidate);
 char *create_file_name (const char *file);
 int get_realtime (struct timespec *ts);
+double get_realtime_sec ();
 void sec_to_min (char *buff, const int seconds);
 const char *get_home ();
 void common_cleanup ();
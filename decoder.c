@@ -20,6 +20,10 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <ltdl.h>
 
 #include "common.h"
@@ -29,10 +33,48 @@
 #include "io.h"
 #include "options.h"
 
+#ifndef LT_MODULE_EXT
+# define LT_MODULE_EXT ".so"
+#endif
+
+/* Plugins are found when a decoder is needed for the first time, but each
+ * one is loaded and initialised only when it must be asked about a file.
+ * What they answered about filename extensions and MIME types is kept in
+ * the manifest file, so later runs don't have to load plugins which aren't
+ * used for the files at hand. */
+#define MANIFEST_FILE		"decoders"
+
+/* The manifest is only valid for the MOC build which wrote it.  Plugins
+ * can be rebuilt against other libraries along with MOC without their
+ * size or modification time telling. */
+#ifdef PACKAGE_REVISION
+# define MANIFEST_VERSION	PACKAGE_VERSION "-" PACKAGE_REVISION
+#else
+# define MANIFEST_VERSION	PACKAGE_VERSION
+#endif
+#if defined(__DATE__) && defined(__TIME__)
+# define MANIFEST_BUILD		MANIFEST_VERSION " " __DATE__ " " __TIME__
+#else
+# define MANIFEST_BUILD		MANIFEST_VERSION
+#endif
+
+/* Answers of a plugin about filename extensions or MIME types. */
+struct plugin_answers {
+	lists_t_strs *yes;
+	lists_t_strs *no;
+};
+
 static struct plugin {
 	char *name;
+	char *file;		/* as found by lt_dlforeachfile() */
+	time_t mtime;		/* of the file, to validate the manifest */
+	off_t size;
+	int api_version;	/* -1 if not known yet */
+	bool failed;		/* couldn't be loaded, don't try again */
 	lt_dlhandle handle;
-	struct decoder *decoder;
+	struct decoder *decoder;	/* NULL until loaded */
+	struct plugin_answers extns;
+	struct plugin_answers mimes;
 } plugins[16];
 
 #define PLUGINS_NUM			(ARRAY_SIZE(plugins))
@@ -41,6 +83,20 @@ static int plugins_num = 0;
 
 static bool have_tremor = false;
 
+/* Protects loading plugins, their answers and manifest_dirty. */
+static pthread_mutex_t plugins_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t plugins_once = PTHREAD_ONCE_INIT;
+static bool plugins_found = false;
+static bool manifest_dirty = false;
+static char *manifest_file = NULL;
+
+/* Errors of loading plugins not reported yet.  Plugins are loaded by
+ * whichever thread needs them first, but error() can be used only in the
+ * main one, so these wait for decoder_report_errors(). */
+static lists_t_strs *plugin_errors = NULL;
+
+static void plugins_setup ();
+
 /* This structure holds the user's decoder preferences for audio formats. */
 struct decoder_s_preference {
 	struct decoder_s_preference *next;    /* chain pointer */
@@ -56,6 +112,20 @@ typedef struct decoder_s_preference decoder_t_preference;
 static decoder_t_preference *preferences = NULL;
 static int default_decoder_list[PLUGINS_NUM];
 
+/* Decoders found for filename extensions, so that find_type() doesn't need
+ * to ask the plugins about every file.  Not used when the decoder can
+ * depend on the file content (MIME type preferences with UseMimeMagic). */
+#define EXTN_CACHE_SIZE		256	/* must be a power of 2 */
+#define EXTN_CACHE_MAX_LEN	15
+
+static struct extn_cache_entry {
+	char extn[EXTN_CACHE_MAX_LEN + 1];	/* empty if the slot is free */
+	int decoder;
+} extn_cache[EXTN_CACHE_SIZE];
+static int extn_cache_used = 0;
+static bool extn_cache_enabled = false;
+static pthread_mutex_t extn_cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static char *clean_mime_subtype (char *subtype)
 {
 	char *ptr;
@@ -72,6 +142,170 @@ static char *clean_mime_subtype (char *subtype)
 	return subtype;
 }
 
+/* Log the error of loading a plugin and keep it for
+ * decoder_report_errors().  plugins_mtx must be locked. */
+static void plugin_error (const char *format, ...)
+{
+	va_list va;
+	char *msg;
+
+	va_start (va, format);
+	msg = format_msg_va (format, va);
+	va_end (va);
+
+	logit ("%s", msg);
+
+	if (!plugin_errors)
+		plugin_errors = lists_strs_new (4);
+	lists_strs_push (plugin_errors, msg);
+}
+
+/* Report the errors of loading plugins, from the main thread. */
+void decoder_report_errors ()
+{
+	lists_t_strs *errors;
+	int ix;
+
+	LOCK (plugins_mtx);
+	errors = plugin_errors;
+	plugin_errors = NULL;
+	UNLOCK (plugins_mtx);
+
+	if (!errors)
+		return;
+
+	for (ix = 0; ix < lists_strs_size (errors); ix += 1)
+		error ("%s", lists_strs_at (errors, ix));
+	lists_strs_free (errors);
+}
+
+/* Load and initialise the plugin.  plugins_mtx must be locked.  If it
+ * fails, the plugin isn't tried again in this run; only a different API
+ * version is recorded in the manifest, other failures may be temporary. */
+static void load_plugin (struct plugin *plugin)
+{
+	lt_dlhandle handle;
+	struct decoder *decoder;
+	union {
+		void *data;
+		plugin_init_func *func;
+	} init;
+
+	handle = lt_dlopenext (plugin->file);
+	if (!handle) {
+		plugin_error ("Can't load plugin %s: %s", plugin->name,
+		              lt_dlerror ());
+		plugin->failed = true;
+		return;
+	}
+
+	init.data = lt_dlsym (handle, "plugin_init");
+	if (!init.data) {
+		plugin_error ("No init function in the %s plugin!",
+		              plugin->name);
+		goto err;
+	}
+
+	/* If this call to init.func() fails with memory access or illegal
+	 * instruction errors then read the commit log message for r2831. */
+	decoder = init.func ();
+	if (!decoder) {
+		plugin_error ("NULL decoder in the %s plugin!", plugin->name);
+		goto err;
+	}
+
+	plugin->api_version = decoder->api_version;
+	manifest_dirty = true;
+	if (decoder->api_version != DECODER_API_VERSION) {
+		plugin_error ("Plugin %s uses different API version",
+		              plugin->name);
+		goto err;
+	}
+
+	/* Is the Vorbis decoder using Tremor? */
+	if (!strcmp (plugin->name, "vorbis"))
+		have_tremor = lt_dlsym (handle, "vorbis_has_tremor") != NULL;
+
+	if (decoder->init)
+		decoder->init ();
+
+	plugin->handle = handle;
+	plugin->decoder = decoder;
+	logit ("Loaded %s decoder", plugin->name);
+
+	return;
+
+err:
+	plugin->failed = true;
+	if (lt_dlclose (handle))
+		logit ("Error unloading plugin: %s", lt_dlerror ());
+}
+
+/* Return the plugin's decoder, loading the plugin if it's not loaded yet,
+ * or NULL if it can't be loaded. */
+static struct decoder *plugin_decoder (const int ix)
+{
+	struct decoder *result;
+
+	assert (RANGE(0, ix, plugins_num - 1));
+
+	LOCK (plugins_mtx);
+	if (!plugins[ix].decoder && !plugins[ix].failed)
+		load_plugin (&plugins[ix]);
+	result = plugins[ix].decoder;
+	UNLOCK (plugins_mtx);
+
+	return result;
+}
+
+/* Can the plugin handle the given filename extension (or MIME type if
+ * 'mime' is true)?  Use its earlier answer if there is one, so that the
+ * plugin doesn't need to be loaded. */
+static bool plugin_handles (const int ix, const bool mime, const char *what)
+{
+	struct plugin_answers *answers;
+	struct decoder *decoder;
+	bool result;
+
+	assert (RANGE(0, ix, plugins_num - 1));
+	assert (what && what[0]);
+
+	answers = mime ? &plugins[ix].mimes : &plugins[ix].extns;
+
+	LOCK (plugins_mtx);
+	if (lists_strs_exists (answers->yes, what)) {
+		UNLOCK (plugins_mtx);
+		return true;
+	}
+	if (lists_strs_exists (answers->no, what)) {
+		UNLOCK (plugins_mtx);
+		return false;
+	}
+	UNLOCK (plugins_mtx);
+
+	decoder = plugin_decoder (ix);
+	if (!decoder)
+		return false;
+
+	if (mime)
+		result = decoder->our_format_mime && decoder->our_format_mime (what);
+	else
+		result = decoder->our_format_ext && decoder->our_format_ext (what);
+
+	/* The manifest is line and tab separated. */
+	if (!strpbrk (what, "\t\r\n")) {
+		LOCK (plugins_mtx);
+		if (!lists_strs_exists (answers->yes, what)
+		                    && !lists_strs_exists (answers->no, what)) {
+			lists_strs_append (result ? answers->yes : answers->no, what);
+			manifest_dirty = true;
+		}
+		UNLOCK (plugins_mtx);
+	}
+
+	return result;
+}
+
 /* Find a preference entry matching the given filename extension and/or
  * MIME media type, or NULL. */
 static decoder_t_preference *lookup_preference (const char *extn,
@@ -131,8 +365,7 @@ static int find_extn_decoder (int *decoder_list, int count, const char *extn)
 	assert (extn && extn[0]);
 
 	for (ix = 0; ix < count; ix += 1) {
-		if (plugins[decoder_list[ix]].decoder->our_format_ext &&
-		    plugins[decoder_list[ix]].decoder->our_format_ext (extn))
+		if (plugin_handles (decoder_list[ix], false, extn))
 			return decoder_list[ix];
 	}
 
@@ -150,8 +383,7 @@ static int find_mime_decoder (int *decoder_list, int count, const char *mime)
 	assert (mime && mime[0]);
 
 	for (ix = 0; ix < count; ix += 1) {
-		if (plugins[decoder_list[ix]].decoder->our_format_mime &&
-		    plugins[decoder_list[ix]].decoder->our_format_mime (mime))
+		if (plugin_handles (decoder_list[ix], true, mime))
 			return decoder_list[ix];
 	}
 
@@ -184,6 +416,78 @@ static int find_decoder (const char *extn, const char *file, char **mime)
 	return result;
 }
 
+/* Empty the extension cache and decide if it can be used with the
+ * current preferences. */
+static void extn_cache_reset ()
+{
+	decoder_t_preference *pref;
+
+	LOCK (extn_cache_mtx);
+
+	memset (extn_cache, 0, sizeof (extn_cache));
+	extn_cache_used = 0;
+
+	extn_cache_enabled = true;
+	if (options_get_bool ("UseMimeMagic")) {
+		for (pref = preferences; pref; pref = pref->next) {
+			if (pref->subtype) {
+				extn_cache_enabled = false;
+				break;
+			}
+		}
+	}
+
+	UNLOCK (extn_cache_mtx);
+}
+
+/* Find the extension's slot in the cache: the one holding it or the empty
+ * slot where it belongs. */
+static struct extn_cache_entry *extn_cache_slot (const char *extn)
+{
+	unsigned int hash = 5381;
+	const char *c;
+
+	for (c = extn; *c; c++)
+		hash = hash * 33 + (unsigned char)*c;
+
+	while (extn_cache[hash & (EXTN_CACHE_SIZE - 1)].extn[0]
+	       && strcmp (extn_cache[hash & (EXTN_CACHE_SIZE - 1)].extn, extn))
+		hash += 1;
+
+	return &extn_cache[hash & (EXTN_CACHE_SIZE - 1)];
+}
+
+/* Like find_decoder() for an extension only, using the cache. */
+static int find_extn_decoder_cached (const char *extn)
+{
+	struct extn_cache_entry *entry;
+	char *mime = NULL;
+	int result;
+
+	LOCK (extn_cache_mtx);
+	entry = extn_cache_slot (extn);
+	if (entry->extn[0]) {
+		result = entry->decoder;
+		UNLOCK (extn_cache_mtx);
+		return result;
+	}
+	UNLOCK (extn_cache_mtx);
+
+	result = find_decoder (extn, NULL, &mime);
+	free (mime);
+
+	LOCK (extn_cache_mtx);
+	entry = extn_cache_slot (extn);
+	if (!entry->extn[0] && extn_cache_used < EXTN_CACHE_SIZE / 2) {
+		strcpy (entry->extn, extn);
+		entry->decoder = result;
+		extn_cache_used += 1;
+	}
+	UNLOCK (extn_cache_mtx);
+
+	return result;
+}
+
 /* Find the index in plugins table for the given file.
  * Return -1 if not found. */
 static int find_type (const char *file)
@@ -191,9 +495,15 @@ static int find_type (const char *file)
 	int result = -1;
 	char *extn, *mime;
 
+	plugins_setup ();
+
 	extn = ext_pos (file);
 	mime = NULL;
 
+	if (extn && extn[0] && extn_cache_enabled
+	         && strlen (extn) <= EXTN_CACHE_MAX_LEN)
+		return find_extn_decoder_cached (extn);
+
 	result = find_decoder (extn, file, &mime);
 
 	free (mime);
@@ -210,6 +520,7 @@ int is_sound_file (const char *name)
 char *file_type_name (const char *file)
 {
 	int i;
+	struct decoder *decoder;
 	static char buf[4];
 
 	if (file_type (file) == F_URL) {
@@ -222,8 +533,9 @@ char *file_type_name (const char *file)
 		return NULL;
 
 	memset (buf, 0, sizeof (buf));
-	if (plugins[i].decoder->get_name)
-		plugins[i].decoder->get_name (file, buf);
+	decoder = plugin_decoder (i);
+	if (decoder && decoder->get_name)
+		decoder->get_name (file, buf);
 
 	/* Attempt a default name if we have nothing else. */
 	if (!buf[0]) {
@@ -259,7 +571,7 @@ struct decoder *get_decoder (const char *file)
 
 	i = find_type (file);
 	if (i != -1)
-		return plugins[i].decoder;
+		return plugin_decoder (i);
 
 	return NULL;
 }
@@ -298,7 +610,7 @@ static struct decoder *get_decoder_by_mime_type (struct io_stream *stream)
 		i = find_decoder (NULL, NULL, &mime);
 		if (i != -1) {
 			logit ("Found decoder for MIME type %s: %s", mime, plugins[i].name);
-			result = plugins[i].decoder;
+			result = plugin_decoder (i);
 		}
 		free (mime);
 	}
@@ -314,10 +626,12 @@ struct decoder *get_decoder_by_content (struct io_stream *stream)
 	char buf[8096];
 	ssize_t res;
 	int i;
-	struct decoder *decoder_by_mime_type;
+	struct decoder *decoder, *decoder_by_mime_type;
 
 	assert (stream != NULL);
 
+	plugins_setup ();
+
 	/* Peek at the start of the stream to check if sufficient data is
 	 * available.  If not, there is no sense in trying the decoders as
 	 * each of them would issue an error.  The data is also needed to
@@ -339,10 +653,10 @@ struct decoder *get_decoder_by_content (struct io_stream *stream)
 		return decoder_by_mime_type;
 
 	for (i = 0; i < plugins_num; i++) {
-		if (plugins[i].decoder->can_decode
-				&& plugins[i].decoder->can_decode (stream)) {
+		decoder = plugin_decoder (i);
+		if (decoder && decoder->can_decode && decoder->can_decode (stream)) {
 			logit ("Found decoder for stream: %s", plugins[i].name);
-			return plugins[i].decoder;
+			return decoder;
 		}
 	}
 
@@ -425,99 +739,62 @@ static char *list_decoder_names (int *decoder_list, int count)
 	return result;
 }
 
-/* Check if this handle is already present in the plugins table.
- * Returns 1 if so. */
-static int present_handle (const lt_dlhandle h)
+/* Find the plugin's file (as lt_dlopenext() would) and remember its
+ * modification time and size. */
+static void stat_plugin (struct plugin *plugin)
 {
-	int i;
-
-	for (i = 0; i < plugins_num; i++) {
-		if (plugins[i].handle == h)
-			return 1;
+	struct stat st;
+	char *path;
+
+	path = format_msg ("%s%s", plugin->file, LT_MODULE_EXT);
+	if (stat (path, &st) == -1) {
+		free (path);
+		path = format_msg ("%s.la", plugin->file);
+		if (stat (path, &st) == -1)
+			memset (&st, 0, sizeof (st));
 	}
+	free (path);
 
-	return 0;
+	plugin->mtime = st.st_mtime;
+	plugin->size = st.st_size;
 }
 
-static int lt_load_plugin (const char *file, lt_ptr debug_info_ptr)
+/* Add a plugin found in the plugin directory to the table without
+ * loading it. */
+static int lt_find_plugin (const char *file, lt_ptr unused ATTR_UNUSED)
 {
-	int debug_info;
-	const char *name;
-	union {
-		void *data;
-		plugin_init_func *func;
-	} init;
-
-	debug_info = *(int *)debug_info_ptr;
-	name = strrchr (file, '/');
-	name = name ? (name + 1) : file;
-	if (debug_info)
-		printf ("Loading plugin %s...\n", name);
-
-	if (plugins_num == PLUGINS_NUM) {
-		fprintf (stderr, "Can't load plugin, because maximum number "
-		                                    "of plugins reached!\n");
-		return 0;
-	}
-
-	plugins[plugins_num].handle = lt_dlopenext (file);
-	if (!plugins[plugins_num].handle) {
-		fprintf (stderr, "Can't load plugin %s: %s\n", name, lt_dlerror ());
-		return 0;
-	}
-
-	if (present_handle (plugins[plugins_num].handle)) {
-		if (debug_info)
-			printf ("Already loaded\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
-		return 0;
-	}
+	const char *base;
+	char *name;
+	struct plugin *plugin;
 
-	init.data = lt_dlsym (plugins[plugins_num].handle, "plugin_init");
-	if (!init.data) {
-		fprintf (stderr, "No init function in the plugin!\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
-		return 0;
-	}
+	base = strrchr (file, '/');
+	name = extract_decoder_name (base ? (base + 1) : file);
 
-	/* If this call to init.func() fails with memory access or illegal
-	 * instruction errors then read the commit log message for r2831. */
-	plugins[plugins_num].decoder = init.func ();
-	if (!plugins[plugins_num].decoder) {
-		fprintf (stderr, "NULL decoder!\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
+	/* The same plugin can be found as different files. */
+	if (lookup_decoder_by_name (name) < plugins_num) {
+		free (name);
 		return 0;
 	}
 
-	if (plugins[plugins_num].decoder->api_version != DECODER_API_VERSION) {
-		fprintf (stderr, "Plugin uses different API version\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
+	if (plugins_num == PLUGINS_NUM) {
+		LOCK (plugins_mtx);
+		plugin_error ("Can't load plugin %s, because maximum number "
+		              "of plugins reached!", name);
+		UNLOCK (plugins_mtx);
+		free (name);
 		return 0;
 	}
 
-	plugins[plugins_num].name = extract_decoder_name (name);
-
-	/* Is the Vorbis decoder using Tremor? */
-	if (!strcmp (plugins[plugins_num].name, "vorbis")) {
-		void *vorbis_has_tremor;
-
-		vorbis_has_tremor = lt_dlsym (plugins[plugins_num].handle,
-		                              "vorbis_has_tremor");
-		have_tremor = vorbis_has_tremor != NULL;
-	}
-
-	debug ("Loaded %s decoder", plugins[plugins_num].name);
-
-	if (plugins[plugins_num].decoder->init)
-		plugins[plugins_num].decoder->init ();
-	plugins_num += 1;
-
-	if (debug_info)
-		printf ("OK\n");
+	plugin = &plugins[plugins_num++];
+	memset (plugin, 0, sizeof (*plugin));
+	plugin->name = name;
+	plugin->file = xstrdup (file);
+	plugin->api_version = -1;
+	plugin->extns.yes = lists_strs_new (8);
+	plugin->extns.no = lists_strs_new (8);
+	plugin->mimes.yes = lists_strs_new (8);
+	plugin->mimes.no = lists_strs_new (8);
+	stat_plugin (plugin);
 
 	return 0;
 }
@@ -678,48 +955,272 @@ static void load_preferences ()
 		}
 	}
 #endif
+
+	extn_cache_reset ();
 }
 
-static void load_plugins (int debug_info)
+/* The first line of the manifest, it's not valid for other builds. */
+static char *manifest_header ()
+{
+	return format_msg ("MOC decoder manifest\t%s\t%d", MANIFEST_BUILD,
+	                   DECODER_API_VERSION);
+}
+
+/* Take a line of the manifest into the plugins table.  Lines for plugins
+ * whose files have changed, or which were written by another build or
+ * for another API version, are ignored. */
+static void manifest_parse_line (lists_t_strs *tokens, bool *valid)
+{
+	int ix, answer;
+	const char *kind;
+	struct plugin *plugin;
+	struct plugin_answers *answers;
+
+	if (lists_strs_size (tokens) < 4)
+		return;
+
+	kind = lists_strs_at (tokens, 0);
+	ix = lookup_decoder_by_name (lists_strs_at (tokens, 1));
+	if (ix == plugins_num)
+		return;
+	plugin = &plugins[ix];
+
+	if (!strcmp (kind, "plugin")) {
+		long long mtime, size;
+		int api_version;
+
+		if (lists_strs_size (tokens) != 7
+		         || sscanf (lists_strs_at (tokens, 2), "%lld", &mtime) != 1
+		         || sscanf (lists_strs_at (tokens, 3), "%lld", &size) != 1
+		         || sscanf (lists_strs_at (tokens, 4), "%d", &api_version) != 1)
+			return;
+
+		valid[ix] = mtime == (long long)plugin->mtime
+		            && size == (long long)plugin->size
+		            && !strcmp (lists_strs_at (tokens, 5), MANIFEST_BUILD)
+		            && atoi (lists_strs_at (tokens, 6)) == DECODER_API_VERSION;
+		if (valid[ix] && plugin->api_version == -1)
+			plugin->api_version = api_version;
+
+		return;
+	}
+
+	if (!valid[ix])
+		return;
+
+	if (!strcmp (kind, "extn"))
+		answers = &plugin->extns;
+	else if (!strcmp (kind, "mime"))
+		answers = &plugin->mimes;
+	else
+		return;
+
+	if (lists_strs_exists (answers->yes, lists_strs_at (tokens, 3))
+	         || lists_strs_exists (answers->no, lists_strs_at (tokens, 3)))
+		return;
+
+	answer = atoi (lists_strs_at (tokens, 2));
+	lists_strs_append (answer ? answers->yes : answers->no,
+	                   lists_strs_at (tokens, 3));
+}
+
+/* Read what the plugins said in previous runs (or other processes). */
+static void manifest_load ()
+{
+	int ix;
+	char *line, *header;
+	bool valid[PLUGINS_NUM];
+	FILE *file;
+	lists_t_strs *tokens;
+
+	file = fopen (manifest_file, "r");
+	if (!file)
+		return;
+
+	header = manifest_header ();
+	line = read_line (file);
+	if (!line || strcmp (line, header)) {
+		logit ("Decoder manifest was written by another build, "
+		       "discarding it");
+		manifest_dirty = true;
+		goto out;
+	}
+
+	memset (valid, 0, sizeof (valid));
+	tokens = lists_strs_new (5);
+	while (line) {
+		free (line);
+		line = read_line (file);
+		if (line) {
+			lists_strs_split (tokens, line, "\t");
+			manifest_parse_line (tokens, valid);
+			lists_strs_clear (tokens);
+		}
+	}
+	lists_strs_free (tokens);
+
+	/* Plugins the manifest doesn't know must be added to it, and those
+	 * which couldn't be loaded don't need to be tried. */
+	for (ix = 0; ix < plugins_num; ix += 1) {
+		if (plugins[ix].api_version == -1)
+			manifest_dirty = true;
+		else if (plugins[ix].api_version != DECODER_API_VERSION)
+			plugins[ix].failed = true;
+	}
+
+out:
+	free (line);
+	free (header);
+	fclose (file);
+}
+
+static void manifest_save_answers (FILE *file, const char *kind,
+                                   const char *name, lists_t_strs *list,
+                                   const int answer)
+{
+	int ix;
+
+	for (ix = 0; ix < lists_strs_size (list); ix += 1)
+		fprintf (file, "%s\t%s\t%d\t%s\n", kind, name, answer,
+		         lists_strs_at (list, ix));
+}
+
+/* Write the manifest if the plugins said something new. */
+static void manifest_save ()
+{
+	int ix;
+	char *tmp, *header;
+	FILE *file;
+	struct plugin *plugin;
+
+	if (!manifest_dirty)
+		return;
+
+	/* Keep what another process has written meanwhile. */
+	manifest_load ();
+
+	tmp = format_msg ("%s.%d", manifest_file, (int)getpid ());
+
+	file = fopen (tmp, "w");
+	if (!file) {
+		log_errno ("Can't write the decoder manifest", errno);
+		goto out;
+	}
+
+	header = manifest_header ();
+	fprintf (file, "%s\n", header);
+	free (header);
+
+	for (ix = 0; ix < plugins_num; ix += 1) {
+		plugin = &plugins[ix];
+		if (plugin->api_version == -1)
+			continue;
+
+		fprintf (file, "plugin\t%s\t%lld\t%lld\t%d\t%s\t%d\n",
+		         plugin->name, (long long)plugin->mtime,
+		         (long long)plugin->size, plugin->api_version,
+		         MANIFEST_BUILD, DECODER_API_VERSION);
+		manifest_save_answers (file, "extn", plugin->name,
+		                       plugin->extns.yes, 1);
+		manifest_save_answers (file, "extn", plugin->name,
+		                       plugin->extns.no, 0);
+		manifest_save_answers (file, "mime", plugin->name,
+		                       plugin->mimes.yes, 1);
+		manifest_save_answers (file, "mime", plugin->name,
+		                       plugin->mimes.no, 0);
+	}
+
+	if (fclose (file) || rename (tmp, manifest_file) == -1) {
+		log_errno ("Can't write the decoder manifest", errno);
+		unlink (tmp);
+	}
+	else
+		manifest_dirty = false;
+
+out:
+	free (tmp);
+}
+
+/* Find the plugins and read the manifest, done when a decoder is needed
+ * for the first time. */
+static void find_plugins ()
 {
 	int ix;
 	char *names;
+	const char *moc_dir;
+
+	logit ("Looking for plugins in %s", PLUGIN_DIR);
 
-	if (debug_info)
-		printf ("Loading plugins from %s...\n", PLUGIN_DIR);
 	if (lt_dlinit ())
 		fatal ("lt_dlinit() failed: %s", lt_dlerror ());
 
-	if (lt_dlforeachfile (PLUGIN_DIR, &lt_load_plugin, &debug_info))
-		fatal ("Can't load plugins: %s", lt_dlerror ());
+	if (lt_dlforeachfile (PLUGIN_DIR, &lt_find_plugin, NULL))
+		fatal ("Can't find plugins: %s", lt_dlerror ());
 
 	if (plugins_num == 0)
-		fatal ("No decoder plugins have been loaded!");
+		fatal ("No decoder plugins have been found!");
 
 	for (ix = 0; ix < plugins_num; ix += 1)
 		default_decoder_list[ix] = ix;
 
 	names = list_decoder_names (default_decoder_list, plugins_num);
-	logit ("Loaded %d decoders:%s", plugins_num, names);
+	logit ("Found %d decoders:%s", plugins_num, names);
 	free (names);
+
+	/* The options are gone by the time the manifest is saved.  Not
+	 * create_file_name(), the caller may still be using its buffer. */
+	moc_dir = options_get_str ("MOCDir");
+	if (moc_dir[0] == '~')
+		manifest_file = format_msg ("%s/%s/%s", get_home (),
+		                (moc_dir[1] == '/') ? moc_dir + 2 : moc_dir + 1,
+		                MANIFEST_FILE);
+	else
+		manifest_file = format_msg ("%s/%s", moc_dir, MANIFEST_FILE);
+	manifest_load ();
+	load_preferences ();
+
+	plugins_found = true;
 }
 
-void decoder_init (int debug_info)
+static void plugins_setup ()
 {
-	load_plugins (debug_info);
-	load_preferences ();
+	int rc;
+
+	rc = pthread_once (&plugins_once, find_plugins);
+	if (rc)
+		fatal ("pthread_once() failed: %s", xstrerror (rc));
 }
 
 static void cleanup_decoders ()
 {
 	int ix;
 
+	if (!plugins_found)
+		return;
+
+	manifest_save ();
+
 	for (ix = 0; ix < plugins_num; ix++) {
-		if (plugins[ix].decoder->destroy)
+		if (plugins[ix].decoder && plugins[ix].decoder->destroy)
 			plugins[ix].decoder->destroy ();
-		free (plugins[ix].name);
 		if (plugins[ix].handle)
 			lt_dlclose (plugins[ix].handle);
+		free (plugins[ix].name);
+		free (plugins[ix].file);
+		lists_strs_free (plugins[ix].extns.yes);
+		lists_strs_free (plugins[ix].extns.no);
+		lists_strs_free (plugins[ix].mimes.yes);
+		lists_strs_free (plugins[ix].mimes.no);
+	}
+
+	plugins_num = 0;
+	plugins_found = false;
+	free (manifest_file);
+	manifest_file = NULL;
+
+	if (plugin_errors) {
+		lists_strs_free (plugin_errors);
+		plugin_errors = NULL;
 	}
 
 	if (lt_dlexit ())
@@ -737,6 +1238,7 @@ static void cleanup_preferences ()
 	}
 
 	preferences = NULL;
+	extn_cache_enabled = false;
 }
 
 void decoder_cleanup ()
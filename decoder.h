@@ -268,8 +268,8 @@ int is_sound_file (const char *name);
 struct decoder *get_decoder (const char *file);
 struct decoder *get_decoder_by_content (struct io_stream *stream);
 const char *get_decoder_name (const struct decoder *decoder);
-void decoder_init (int debug_info);
 void decoder_cleanup ();
+void decoder_report_errors ();
 char *file_type_name (const char *file);
 
 /** @defgroup decoder_error_funcs Decoder error functions
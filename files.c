@@ -24,9 +24,11 @@
 #include <stdlib.h>
 #include <dirent.h>
 
+#include <pthread.h>
+#include <time.h>
+
 #ifdef HAVE_LIBMAGIC
 #include <magic.h>
-#include <pthread.h>
 #endif
 
 #define DEBUG
@@ -112,15 +114,28 @@ int can_read_file (const char *file)
 }
 
 enum file_type file_type (const char *file)
+{
+	time_t mtime;
+
+	return file_type_mtime (file, &mtime);
+}
+
+/* Like file_type(), but also put the modification time of the file (or -1)
+ * in mtime, using a single stat(). */
+enum file_type file_type_mtime (const char *file, time_t *mtime)
 {
 	struct stat file_stat;
 
 	assert (file != NULL);
+	assert (mtime != NULL);
+
+	*mtime = (time_t)-1;
 
 	if (is_url(file))
 		return F_URL;
 	if (stat(file, &file_stat) == -1)
 		return F_OTHER; /* Ignore the file if stat() failed */
+	*mtime = file_stat.st_mtime;
 	if (S_ISDIR(file_stat.st_mode))
 		return F_DIR;
 	if (is_sound_file(file))
@@ -172,7 +187,7 @@ void make_file_title (struct plist *plist, const int num,
 	assert (LIMIT(num, plist->num));
 	assert (!plist_deleted (plist, num));
 
-	if (file_type (plist->items[num].file) != F_URL) {
+	if (!is_url (plist->items[num].file)) {
 		char *file = xstrdup (plist->items[num].file);
 
 		if (hide_extension) {
@@ -201,13 +216,13 @@ void make_file_title (struct plist *plist, const int num,
 void make_tags_title (struct plist *plist, const int num)
 {
 	bool hide_extn;
-	char *title;
+	char title[512];
 
 	assert (plist != NULL);
 	assert (LIMIT(num, plist->num));
 	assert (!plist_deleted (plist, num));
 
-	if (file_type (plist->items[num].file) == F_URL) {
+	if (is_url (plist->items[num].file)) {
 		make_file_title (plist, num, false);
 		return;
 	}
@@ -218,9 +233,9 @@ void make_tags_title (struct plist *plist, const int num)
 	assert (plist->items[num].file != NULL);
 
 	if (plist->items[num].tags->title) {
-		title = build_title (plist->items[num].tags);
+		build_title_into (title, sizeof(title), plist->items[num].tags,
+		                  options_get_str ("FormatString"));
 		plist_set_title_tags (plist, num, title);
-		free (title);
 		return;
 	}
 
@@ -230,13 +245,19 @@ void make_tags_title (struct plist *plist, const int num)
 
 /* Switch playlist titles to title_file */
 void switch_titles_file (struct plist *plist)
+{
+	switch_titles_file_from (plist, 0);
+}
+
+/* Like switch_titles_file() for the items from position 'from' on. */
+void switch_titles_file_from (struct plist *plist, const int from)
 {
 	int i;
 	bool hide_extn;
 
 	hide_extn = options_get_bool ("HideFileExtension");
 
-	for (i = 0; i < plist->num; i++) {
+	for (i = from; i < plist->num; i++) {
 		if (plist_deleted (plist, i))
 			continue;
 
@@ -366,54 +387,76 @@ struct file_tags *read_file_tags (const char *file,
 	return tags;
 }
 
-/* Read the content of the directory, make an array of absolute paths for
- * all recognized files. Put directories, playlists and sound files
- * in proper structures. Return 0 on error.*/
-int read_directory (const char *directory, lists_t_strs *dirs,
-		lists_t_strs *playlists, struct plist *plist)
+/* Directory being read by read_directory_next(). */
+struct dir_reader
 {
 	DIR *dir;
-	struct dirent *entry;
-	bool show_hidden = options_get_bool ("ShowHiddenFiles");
-	int dir_is_root;
+	char *path;
+	int is_root;
+	bool show_hidden;
+};
+
+/* Open the directory for reading with read_directory_next().  Return NULL
+ * on error. */
+struct dir_reader *read_directory_open (const char *directory)
+{
+	DIR *dir;
+	struct dir_reader *r;
 
 	assert (directory != NULL);
 	assert (*directory == '/');
-	assert (dirs != NULL);
-	assert (playlists != NULL);
-	assert (plist != NULL);
 
 	if (!(dir = opendir(directory))) {
 		error_errno ("Can't read directory", errno);
-		return 0;
+		return NULL;
 	}
 
-	if (!strcmp(directory, "/"))
-		dir_is_root = 1;
-	else
-		dir_is_root = 0;
+	r = (struct dir_reader *)xmalloc (sizeof (struct dir_reader));
+	r->dir = dir;
+	r->path = xstrdup (directory);
+	r->is_root = !strcmp (directory, "/");
+	r->show_hidden = options_get_bool ("ShowHiddenFiles");
 
-	while ((entry = readdir(dir))) {
+	return r;
+}
+
+/* Read at most 'max' next entries of the directory (all of them if 'max' is
+ * -1) adding sound files to the playlist and directories and playlists to
+ * the lists.  Return 1 if there are more entries to read, 0 if the whole
+ * directory was read and -1 on error. */
+int read_directory_next (struct dir_reader *r, lists_t_strs *dirs,
+		lists_t_strs *playlists, struct plist *plist, int max)
+{
+	struct dirent *entry;
+
+	assert (r != NULL);
+	assert (dirs != NULL);
+	assert (playlists != NULL);
+	assert (plist != NULL);
+
+	while (max-- != 0) {
 		int rc;
 		char file[PATH_MAX];
 		enum file_type type;
 
+		if (!(entry = readdir(r->dir)))
+			return 0;
+
 		if (user_wants_interrupt()) {
 			error ("Interrupted! Not all files read!");
-			break;
+			return 0;
 		}
 
 		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
 			continue;
-		if (!show_hidden && entry->d_name[0] == '.')
+		if (!r->show_hidden && entry->d_name[0] == '.')
 			continue;
 
 		rc = snprintf(file, sizeof(file), "%s/%s",
-		              dir_is_root ? "" : directory, entry->d_name);
+		              r->is_root ? "" : r->path, entry->d_name);
 		if (rc >= ssizeof(file)) {
 			error ("Path too long!");
-			closedir (dir);
-			return 0;
+			return -1;
 		}
 
 		type = file_type (file);
@@ -425,100 +468,409 @@ int read_directory (const char *directory, lists_t_strs *dirs,
 			lists_strs_append (playlists, file);
 	}
 
-	closedir (dir);
-
 	return 1;
 }
 
-static int dir_symlink_loop (const ino_t inode_no, const ino_t *dir_stack,
-		const int depth)
+void read_directory_close (struct dir_reader *r)
 {
-	int i;
+	assert (r != NULL);
 
-	for (i = 0; i < depth; i++)
-		if (dir_stack[i] == inode_no)
-			return 1;
+	closedir (r->dir);
+	free (r->path);
+	free (r);
+}
 
-	return 0;
+/* Read the content of the directory, make an array of absolute paths for
+ * all recognized files. Put directories, playlists and sound files
+ * in proper structures. Return 0 on error.*/
+int read_directory (const char *directory, lists_t_strs *dirs,
+		lists_t_strs *playlists, struct plist *plist)
+{
+	struct dir_reader *r;
+	int rc;
+
+	if (!(r = read_directory_open (directory)))
+		return 0;
+
+	rc = read_directory_next (r, dirs, playlists, plist, -1);
+	read_directory_close (r);
+
+	return rc != -1;
 }
 
-/* Recursively add files from the directory to the playlist.
- * Return 1 if OK (and even some errors), 0 if the user interrupted. */
-static int read_directory_recurr_internal (const char *directory, struct plist *plist,
-		ino_t **dir_stack, int *depth)
+/* Directory to be scanned by read_directory_recurr(). */
+struct scan_dir
+{
+	char *path;
+	dev_t dev;		/* device and inode, filled when scanned */
+	ino_t ino;
+	const struct scan_dir *parent;	/* used to detect symlink loops */
+	struct scan_dir *next;	/* list of scanned directories to free */
+};
+
+/* Double ended queue of directories owned by a scanning thread.  The owner
+ * takes directories from the tail, idle threads steal from the head. */
+struct scan_worker
+{
+	pthread_t tid;
+	struct scan *scan;
+	pthread_mutex_t mtx;	/* for the queue */
+	struct scan_dir **dirs;
+	int head, tail, allocated;
+
+	/* Private to the worker's thread: */
+	struct scan_dir *done;	/* scanned directories */
+	char **files;		/* sound files found */
+	int files_num, files_allocated;
+	int errors;
+};
+
+struct scan
+{
+	struct scan_worker *workers;
+	int workers_num;
+	pthread_mutex_t mtx;	/* for the fields below */
+	pthread_cond_t work_cond;	/* a directory was queued */
+	pthread_cond_t done_cond;	/* all directories were scanned */
+	int queued;		/* directories waiting in queues */
+	int pending;		/* directories queued or being scanned */
+	int cancelled;
+};
+
+static void scan_push (struct scan_worker *w, struct scan_dir *d)
+{
+	struct scan *scan = w->scan;
+
+	LOCK (w->mtx);
+	if (w->tail == w->allocated) {
+		if (w->head > 0) {
+			memmove (w->dirs, w->dirs + w->head,
+			         (w->tail - w->head) * sizeof (w->dirs[0]));
+			w->tail -= w->head;
+			w->head = 0;
+		}
+		else {
+			w->allocated = w->allocated ? 2 * w->allocated : 64;
+			w->dirs = (struct scan_dir **)xrealloc (w->dirs,
+			                     w->allocated * sizeof (w->dirs[0]));
+		}
+	}
+	w->dirs[w->tail++] = d;
+	UNLOCK (w->mtx);
+
+	LOCK (scan->mtx);
+	scan->queued += 1;
+	scan->pending += 1;
+	pthread_cond_signal (&scan->work_cond);
+	UNLOCK (scan->mtx);
+}
+
+/* Take a directory from the worker's queue: the newest one if 'own',
+ * the oldest one if stealing.  Return NULL if the queue is empty. */
+static struct scan_dir *scan_take (struct scan_worker *w, const int own)
+{
+	struct scan_dir *d = NULL;
+
+	LOCK (w->mtx);
+	if (w->head < w->tail)
+		d = own ? w->dirs[--w->tail] : w->dirs[w->head++];
+	UNLOCK (w->mtx);
+
+	if (d) {
+		LOCK (w->scan->mtx);
+		w->scan->queued -= 1;
+		UNLOCK (w->scan->mtx);
+	}
+
+	return d;
+}
+
+static void scan_add_file (struct scan_worker *w, const char *file)
+{
+	if (w->files_num == w->files_allocated) {
+		w->files_allocated = w->files_allocated
+		                     ? 2 * w->files_allocated : 256;
+		w->files = (char **)xrealloc (w->files,
+		                      w->files_allocated * sizeof (char *));
+	}
+	w->files[w->files_num++] = xstrdup (file);
+}
+
+/* Read one directory: record sound files and queue subdirectories.  The
+ * d_type field spares us stat()ing most of the entries. */
+static void scan_dir (struct scan_worker *w, struct scan_dir *d)
 {
 	DIR *dir;
 	struct dirent *entry;
 	struct stat st;
+	const struct scan_dir *anc;
 
-	if (stat (directory, &st)) {
+	if (!(dir = opendir (d->path))) {
 		char *err = xstrerror (errno);
-		error ("Can't stat %s: %s", directory, err);
+		logit ("Can't read directory %s: %s", d->path, err);
 		free (err);
-		return 0;
+		w->errors += 1;
+		return;
 	}
 
-	assert (plist != NULL);
-	assert (directory != NULL);
-
-	if (*dir_stack && dir_symlink_loop(st.st_ino, *dir_stack, *depth)) {
-		logit ("Detected symlink loop on %s", directory);
-		return 1;
+	if (fstat (dirfd (dir), &st) == -1) {
+		closedir (dir);
+		w->errors += 1;
+		return;
 	}
 
-	if (!(dir = opendir(directory))) {
-		error_errno ("Can't read directory", errno);
-		return 1;
+	d->dev = st.st_dev;
+	d->ino = st.st_ino;
+	for (anc = d->parent; anc; anc = anc->parent) {
+		if (anc->dev == d->dev && anc->ino == d->ino) {
+			logit ("Detected symlink loop on %s", d->path);
+			closedir (dir);
+			return;
+		}
 	}
 
-	(*depth)++;
-	*dir_stack = (ino_t *)xrealloc (*dir_stack, sizeof(ino_t) * (*depth));
-	(*dir_stack)[*depth - 1] = st.st_ino;
-
-	while ((entry = readdir(dir))) {
-		int rc;
+	while ((entry = readdir (dir)) && !w->scan->cancelled) {
+		int rc, is_dir;
 		char file[PATH_MAX];
-		enum file_type type;
-
-		if (user_wants_interrupt()) {
-			error ("Interrupted! Not all files read!");
-			break;
-		}
 
 		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
 			continue;
-		rc = snprintf(file, sizeof(file), "%s/%s", directory, entry->d_name);
+
+		rc = snprintf (file, sizeof(file), "%s/%s",
+		               strcmp (d->path, "/") ? d->path : "",
+		               entry->d_name);
 		if (rc >= ssizeof(file)) {
-			error ("Path too long!");
+			logit ("Path too long: %s/%s", d->path, entry->d_name);
+			w->errors += 1;
 			continue;
 		}
-		type = file_type (file);
-		if (type == F_DIR)
-			read_directory_recurr_internal(file, plist, dir_stack, depth);
-		else if (type == F_SOUND && plist_find_fname(plist, file) == -1)
-			plist_add (plist, file);
-	}
 
-	(*depth)--;
-	*dir_stack = (ino_t *)xrealloc (*dir_stack, sizeof(ino_t) * (*depth));
+#ifdef _DIRENT_HAVE_D_TYPE
+		if (entry->d_type == DT_DIR)
+			is_dir = 1;
+		else if (entry->d_type == DT_REG)
+			is_dir = 0;
+		else
+#endif
+		if (stat (file, &st) == -1)
+			continue;
+		else
+			is_dir = S_ISDIR(st.st_mode);
+
+		if (is_dir) {
+			struct scan_dir *sub;
+
+			sub = (struct scan_dir *)xmalloc (sizeof (struct scan_dir));
+			sub->path = xstrdup (file);
+			sub->parent = d;
+			sub->next = NULL;
+			scan_push (w, sub);
+		}
+		else if (is_sound_file (file))
+			scan_add_file (w, file);
+	}
 
 	closedir (dir);
-	return 1;
 }
 
+static void *scan_thread (void *worker)
+{
+	struct scan_worker *w = (struct scan_worker *)worker;
+	struct scan *scan = w->scan;
+	int ix = w - scan->workers;
+
+	while (1) {
+		struct scan_dir *d;
+		int i;
+
+		d = scan_take (w, 1);
+		for (i = 1; !d && i < scan->workers_num; i++)
+			d = scan_take (&scan->workers[(ix + i) % scan->workers_num], 0);
+
+		if (d) {
+			if (!scan->cancelled)
+				scan_dir (w, d);
+
+			/* Parents must outlive their subdirectories (for the
+			 * symlink loop check), so free them all at the end. */
+			d->next = w->done;
+			w->done = d;
+
+			LOCK (scan->mtx);
+			if (--scan->pending == 0) {
+				pthread_cond_broadcast (&scan->work_cond);
+				pthread_cond_signal (&scan->done_cond);
+			}
+			UNLOCK (scan->mtx);
+			continue;
+		}
+
+		LOCK (scan->mtx);
+		while (!scan->queued && scan->pending && !scan->cancelled)
+			pthread_cond_wait (&scan->work_cond, &scan->mtx);
+		if (!scan->pending || scan->cancelled) {
+			UNLOCK (scan->mtx);
+			break;
+		}
+		UNLOCK (scan->mtx);
+	}
+
+	return NULL;
+}
+
+/* Compare paths component by component ('/' sorts before any other
+ * character), so the files under a directory stay together and entries
+ * of a directory are ordered by name whether they are files or
+ * subdirectories. */
+static int path_cmp (const void *a, const void *b)
+{
+	const unsigned char *pa = *(const unsigned char **)a;
+	const unsigned char *pb = *(const unsigned char **)b;
+
+	while (*pa && *pa == *pb) {
+		pa++;
+		pb++;
+	}
+
+	if (*pa == *pb)
+		return 0;
+	if (*pa == '/')
+		return -1;
+	if (*pb == '/')
+		return 1;
+
+	return *pa - *pb;
+}
+
+/* Recursively add files from the directory to the playlist.  Directories
+ * are read by a pool of threads and the files are added in sorted order.
+ * Return 1 if OK (and even some errors), 0 if the user interrupted. */
 int read_directory_recurr (const char *directory, struct plist *plist)
 {
-	int ret;
-	int depth = 0;
-	ino_t *dir_stack = NULL;
+	struct scan scan;
+	struct scan_dir *root;
+	char **files;
+	int i, j, files_num, errors, rc, plist_num;
+	long cpus;
+
+	assert (directory != NULL);
+	assert (plist != NULL);
+
+	cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	scan.workers_num = CLAMP(2, cpus, 8);
+	scan.workers = (struct scan_worker *)xcalloc (scan.workers_num,
+	                                      sizeof (struct scan_worker));
+	scan.queued = 0;
+	scan.pending = 0;
+	scan.cancelled = 0;
+	pthread_mutex_init (&scan.mtx, NULL);
+	pthread_cond_init (&scan.work_cond, NULL);
+	pthread_cond_init (&scan.done_cond, NULL);
+
+	for (i = 0; i < scan.workers_num; i++) {
+		scan.workers[i].scan = &scan;
+		pthread_mutex_init (&scan.workers[i].mtx, NULL);
+	}
+
+	root = (struct scan_dir *)xmalloc (sizeof (struct scan_dir));
+	root->path = xstrdup (directory);
+	root->parent = NULL;
+	root->next = NULL;
+	scan_push (&scan.workers[0], root);
+
+	for (i = 0; i < scan.workers_num; i++) {
+		rc = pthread_create (&scan.workers[i].tid, NULL, scan_thread,
+		                     &scan.workers[i]);
+		if (rc != 0)
+			fatal ("Can't create directory scanning thread: %s",
+			       xstrerror (rc));
+	}
+
+	/* Wait for the workers, checking if the user wants to interrupt. */
+	LOCK (scan.mtx);
+	while (scan.pending && !scan.cancelled) {
+		struct timespec ts;
 
-	ret = read_directory_recurr_internal (directory, plist, &dir_stack,
-			&depth);
+		get_realtime (&ts);
+		ts.tv_nsec += 100000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait (&scan.done_cond, &scan.mtx, &ts);
+
+		if (scan.pending && user_wants_interrupt ()) {
+			scan.cancelled = 1;
+			pthread_cond_broadcast (&scan.work_cond);
+		}
+	}
+	UNLOCK (scan.mtx);
+
+	files_num = 0;
+	errors = 0;
+	for (i = 0; i < scan.workers_num; i++) {
+		rc = pthread_join (scan.workers[i].tid, NULL);
+		if (rc != 0)
+			fatal ("pthread_join() on directory scanning thread "
+			       "failed: %s", xstrerror (rc));
+		files_num += scan.workers[i].files_num;
+		errors += scan.workers[i].errors;
+	}
+
+	files = (char **)xmalloc ((files_num + 1) * sizeof (char *));
+	files_num = 0;
+	for (i = 0; i < scan.workers_num; i++) {
+		struct scan_worker *w = &scan.workers[i];
 
-	if (dir_stack)
-		free (dir_stack);
+		memcpy (files + files_num, w->files, w->files_num * sizeof (char *));
+		files_num += w->files_num;
+		free (w->files);
 
-	return ret;
+		while (w->done) {
+			struct scan_dir *d = w->done;
+
+			w->done = d->next;
+			free (d->path);
+			free (d);
+		}
+
+		/* Directories left behind after an interruption. */
+		for (j = w->head; j < w->tail; j++) {
+			free (w->dirs[j]->path);
+			free (w->dirs[j]);
+		}
+		free (w->dirs);
+		pthread_mutex_destroy (&w->mtx);
+	}
+
+	qsort (files, files_num, sizeof (char *), path_cmp);
+
+	/* Only the files which were on the playlist before can be there
+	 * twice, the new ones are unique after sorting. */
+	plist_num = plist->num;
+	for (i = 0; i < files_num; i++) {
+		if ((i == 0 || strcmp (files[i], files[i - 1]))
+		        && (plist_num == 0 || plist_find_fname (plist, files[i]) == -1))
+			plist_add (plist, files[i]);
+	}
+
+	for (i = 0; i < files_num; i++)
+		free (files[i]);
+	free (files);
+	free (scan.workers);
+	pthread_mutex_destroy (&scan.mtx);
+	pthread_cond_destroy (&scan.work_cond);
+	pthread_cond_destroy (&scan.done_cond);
+
+	if (errors)
+		error ("Some directories could not be read, see the log.");
+
+	if (scan.cancelled) {
+		error ("Interrupted! Not all files read!");
+		return 0;
+	}
+
+	return 1;
 }
 
 /* Return the file extension position or NULL if the file has no extension. */
@@ -11,14 +11,21 @@ extern "C" {
 
 #define FILES_LIST_INIT_SIZE	64
 
+struct dir_reader;
+
 void files_init ();
 void files_cleanup ();
 int read_directory (const char *directory, lists_t_strs *dirs,
 		lists_t_strs *playlists, struct plist *plist);
+struct dir_reader *read_directory_open (const char *directory);
+int read_directory_next (struct dir_reader *r, lists_t_strs *dirs,
+		lists_t_strs *playlists, struct plist *plist, int max);
+void read_directory_close (struct dir_reader *r);
 int read_directory_recurr (const char *directory, struct plist *plist);
 void resolve_path (char *buf, const int size, const char *file);
 char *ext_pos (const char *file);
 enum file_type file_type (const char *file);
+enum file_type file_type_mtime (const char *file, time_t *mtime);
 char *file_mime_type (const char *file);
 int is_url (const char *str);
 char *read_line (FILE *file);
@@ -28,6 +35,7 @@ time_t get_mtime (const char *file);
 struct file_tags *read_file_tags (const char *file,
 		struct file_tags *present_tags, const int tags_sel);
 void switch_titles_file (struct plist *plist);
+void switch_titles_file_from (struct plist *plist, const int from);
 void switch_titles_tags (struct plist *plist);
 void make_tags_title (struct plist *plist, const int num);
 void make_file_title (struct plist *plist, const int num,
@@ -0,0 +1,530 @@
+/*
+ * MOC - music on console
+ * Copyright (C) 2026 The MOC developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* The library indexer is a server thread which walks MusicDir at idle
+ * I/O priority filling the tags cache and the library, and then keeps them
+ * current using inotify so that lookups for files in the library need not
+ * stat() them. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
+#define DEBUG
+
+#include "common.h"
+#include "log.h"
+#include "options.h"
+#include "playlist.h"
+#include "decoder.h"
+#include "files.h"
+#include "tags_cache.h"
+#include "indexer.h"
+#include "library.h"
+
+/* Tags read for every indexed file. */
+#define INDEXER_TAGS	(TAGS_COMMENTS | TAGS_TIME)
+
+#ifdef HAVE_SYS_INOTIFY_H
+# define INDEXER_WATCH_MASK	(IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO \
+                         | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR)
+#endif
+
+/* How often the library is saved while it's being changed (seconds). */
+#define INDEXER_SAVE_INTERVAL	60
+
+/* I/O priority constants from linux/ioprio.h (not always installed). */
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_WHO_PROCESS	1
+
+/* Directory being walked, used to detect symlink loops. */
+struct dir_ancestor
+{
+	dev_t dev;
+	ino_t ino;
+	const struct dir_ancestor *parent;
+};
+
+static struct
+{
+	struct tags_cache *cache;
+	char *root;		/* the indexed directory (MusicDir) */
+	pthread_t tid;
+	int running;		/* is the thread running? */
+	volatile int stop;	/* request for stopping the thread */
+	int stop_pipe[2];	/* used to wake up the thread from select() */
+	int inotify_fd;		/* -1 if we are not watching */
+	int watch_failed;	/* was adding a watch refused? */
+	char **watches;		/* directory path indexed by watch descriptor */
+	int watches_size;
+	int indexed;		/* files put into the cache by this walk */
+	int cache_size;		/* don't index more files than this */
+} indexer = {
+	.running = 0,
+	.inotify_fd = -1
+};
+
+/* Lower the I/O and CPU priority of the calling thread so that walking
+ * the library doesn't get in the way of playback or client requests. */
+static void set_idle_priority ()
+{
+#if defined(SYS_ioprio_set) && defined(SYS_gettid)
+	if (syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS,
+	             (int)syscall (SYS_gettid),
+	             IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1)
+		log_errno ("Can't set idle I/O priority", errno);
+#endif
+
+#ifdef SCHED_IDLE
+	{
+		int rc;
+		struct sched_param param;
+
+		param.sched_priority = 0;
+		rc = pthread_setschedparam (pthread_self (), SCHED_IDLE, &param);
+		if (rc != 0)
+			log_errno ("Can't set idle scheduling policy", rc);
+	}
+#endif
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void forget_watch (int wd)
+{
+	if (LIMIT(wd, indexer.watches_size) && indexer.watches[wd]) {
+		free (indexer.watches[wd]);
+		indexer.watches[wd] = NULL;
+	}
+}
+
+/* Stop watching the directory and all directories below it. */
+static void forget_watches_under (const char *dir)
+{
+	int wd;
+	size_t len = strlen (dir);
+
+	for (wd = 0; wd < indexer.watches_size; wd++) {
+		const char *path = indexer.watches[wd];
+
+		if (path && !strncmp (path, dir, len)
+		         && (path[len] == '/' || path[len] == 0)) {
+			inotify_rm_watch (indexer.inotify_fd, wd);
+			forget_watch (wd);
+		}
+	}
+}
+#endif
+
+/* Start watching the directory for changes. */
+static void add_watch (const char *dir ATTR_UNUSED)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	int wd;
+
+	if (indexer.inotify_fd == -1 || indexer.watch_failed)
+		return;
+
+	wd = inotify_add_watch (indexer.inotify_fd, dir, INDEXER_WATCH_MASK);
+	if (wd == -1) {
+		char *err = xstrerror (errno);
+		logit ("Can't watch %s: %s (consider raising "
+		       "fs.inotify.max_user_watches)", dir, err);
+		free (err);
+		indexer.watch_failed = 1;
+		return;
+	}
+
+	if (wd >= indexer.watches_size) {
+		int old_size = indexer.watches_size;
+
+		indexer.watches_size = MAX(wd + 1, 2 * old_size);
+		indexer.watches = (char **)xrealloc (indexer.watches,
+		                        indexer.watches_size * sizeof (char *));
+		memset (indexer.watches + old_size, 0,
+		        (indexer.watches_size - old_size) * sizeof (char *));
+	}
+
+	free (indexer.watches[wd]);
+	indexer.watches[wd] = xstrdup (dir);
+#endif
+}
+
+/* Put the tags of the file into the library and the cache.  Files the
+ * library has current tags for are skipped unless 'force' is set. */
+static void index_file (const char *file, int force)
+{
+	struct file_tags *tags;
+	time_t mtime;
+
+	if (!is_sound_file (file))
+		return;
+
+	mtime = get_mtime (file);
+	if (!force && library_is_current (file, mtime))
+		return;
+
+	if (force || indexer.indexed < indexer.cache_size) {
+		tags = tags_cache_refresh (indexer.cache, file, INDEXER_TAGS,
+		                           force);
+		indexer.indexed += 1;
+
+		if (indexer.indexed == indexer.cache_size)
+			logit ("The tags cache is full (TagsCacheSize = %d), "
+			       "not caching more files", indexer.cache_size);
+	}
+	else
+		tags = read_file_tags (file, NULL, INDEXER_TAGS);
+
+	library_update (file, tags, mtime);
+	tags_free (tags);
+}
+
+/* Recursively index the directory, passing 'force' on to index_file().
+ * Return 0 if the walk was stopped. */
+static int index_dir (const char *path, const struct dir_ancestor *parent,
+                      int force)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	struct dir_ancestor self;
+	const struct dir_ancestor *anc;
+
+	if (stat (path, &st) == -1)
+		return 1;
+
+	for (anc = parent; anc; anc = anc->parent) {
+		if (anc->dev == st.st_dev && anc->ino == st.st_ino) {
+			logit ("Detected symlink loop on %s", path);
+			return 1;
+		}
+	}
+
+	self.dev = st.st_dev;
+	self.ino = st.st_ino;
+	self.parent = parent;
+
+	/* Watch before reading, so no change can slip in between. */
+	add_watch (path);
+
+	dir = opendir (path);
+	if (!dir) {
+		char *err = xstrerror (errno);
+		logit ("Can't read directory %s: %s", path, err);
+		free (err);
+		return 1;
+	}
+
+	while ((entry = readdir (dir)) && !indexer.stop) {
+		char file[PATH_MAX];
+		int is_dir, rc;
+
+		if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+			continue;
+
+		rc = snprintf (file, sizeof (file), "%s/%s",
+		               strcmp (path, "/") ? path : "", entry->d_name);
+		if (rc >= ssizeof(file))
+			continue;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+		if (entry->d_type == DT_DIR)
+			is_dir = 1;
+		else if (entry->d_type == DT_REG)
+			is_dir = 0;
+		else
+#endif
+		if (stat (file, &st) == -1)
+			continue;
+		else
+			is_dir = S_ISDIR(st.st_mode);
+
+		if (is_dir) {
+			if (!index_dir (file, &self, force))
+				break;
+		}
+		else
+			index_file (file, force);
+	}
+
+	closedir (dir);
+
+	return !indexer.stop;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Update the cache according to a single inotify event.  Return 0 if the
+ * whole library must be walked again. */
+static int handle_event (const struct inotify_event *ev)
+{
+	char file[PATH_MAX];
+	const char *dir;
+	int rc;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		logit ("Inotify queue overflow, rescanning the library");
+		return 0;
+	}
+
+	if (!LIMIT(ev->wd, indexer.watches_size) || !indexer.watches[ev->wd])
+		return 1;
+
+	dir = indexer.watches[ev->wd];
+
+	if (ev->mask & IN_IGNORED) {
+		if (!strcmp (dir, indexer.root)) {
+			logit ("The library directory was removed");
+			indexer.stop = 1;
+		}
+		forget_watch (ev->wd);
+		return 1;
+	}
+
+	if (!ev->len)
+		return 1;
+
+	rc = snprintf (file, sizeof (file), "%s/%s",
+	               strcmp (dir, "/") ? dir : "", ev->name);
+	if (rc >= ssizeof(file))
+		return 1;
+
+	if (ev->mask & IN_ISDIR) {
+		/* A directory moved in may hold files whose old records are
+		 * still in the cache, so don't trust them. */
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			index_dir (file, NULL, 1);
+		else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			forget_watches_under (file);
+			tags_cache_forget_under (indexer.cache, file);
+			library_remove_under (file);
+		}
+	}
+	else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		debug ("%s is gone", file);
+		tags_cache_forget (indexer.cache, file);
+		library_remove (file);
+	}
+	else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+		debug ("%s has changed", file);
+		index_file (file, 1);
+	}
+	else if (ev->mask & IN_CREATE) {
+		struct stat st;
+
+		/* New regular files are indexed when closed after writing,
+		 * symlinks are never written so index them now. */
+		if (lstat (file, &st) == 0 && S_ISLNK(st.st_mode))
+			index_file (file, 1);
+	}
+
+	return 1;
+}
+
+/* Process inotify events until stopped, saving the library when it has
+ * changed.  Return 0 if the library must be walked again. */
+static int watch_loop ()
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	while (!indexer.stop) {
+		fd_set fds;
+		ssize_t len;
+		char *ptr;
+		struct timeval timeout;
+		int rc;
+
+		FD_ZERO (&fds);
+		FD_SET (indexer.inotify_fd, &fds);
+		FD_SET (indexer.stop_pipe[0], &fds);
+
+		timeout.tv_sec = INDEXER_SAVE_INTERVAL;
+		timeout.tv_usec = 0;
+
+		rc = select (MAX(indexer.inotify_fd, indexer.stop_pipe[0]) + 1,
+		             &fds, NULL, NULL,
+		             library_is_dirty () ? &timeout : NULL);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			log_errno ("select() failed", errno);
+			break;
+		}
+
+		if (rc == 0) {
+			library_save ();
+			continue;
+		}
+
+		if (!FD_ISSET(indexer.inotify_fd, &fds))
+			continue;
+
+		len = read (indexer.inotify_fd, buf, sizeof (buf));
+		if (len == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			log_errno ("Can't read inotify events", errno);
+			break;
+		}
+
+		for (ptr = buf; ptr < buf + len && !indexer.stop;
+		     ptr += sizeof (struct inotify_event)
+		            + ((struct inotify_event *)ptr)->len) {
+			if (!handle_event ((struct inotify_event *)ptr))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+#endif
+
+static void *indexer_thread (void *unused ATTR_UNUSED)
+{
+	logit ("Library indexer thread started");
+
+	set_idle_priority ();
+
+	while (!indexer.stop) {
+		tags_cache_trust_dir (indexer.cache, NULL);
+		indexer.indexed = 0;
+		indexer.watch_failed = 0;
+
+		logit ("Indexing %s", indexer.root);
+		library_begin_walk ();
+		if (!index_dir (indexer.root, NULL, 0))
+			break;
+		library_end_walk ();
+		library_save ();
+		logit ("Library indexed");
+
+#ifdef HAVE_SYS_INOTIFY_H
+		if (indexer.inotify_fd != -1 && !indexer.watch_failed) {
+			tags_cache_trust_dir (indexer.cache, indexer.root);
+			if (watch_loop ())
+				break;
+			continue;
+		}
+#endif
+
+		logit ("Not watching the library for changes");
+		break;
+	}
+
+	tags_cache_trust_dir (indexer.cache, NULL);
+	logit ("Exiting library indexer thread");
+
+	return NULL;
+}
+
+/* Start the library indexer if enabled. */
+void indexer_init (struct tags_cache *c)
+{
+	int rc;
+	char *music_dir;
+	struct stat st;
+
+	assert (c != NULL);
+	assert (!indexer.running);
+
+	if (!options_get_bool ("LibraryIndexer"))
+		return;
+
+	music_dir = options_get_str ("MusicDir");
+	if (!music_dir || music_dir[0] != '/'
+	               || stat (music_dir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+		logit ("MusicDir is not an absolute path to a directory, "
+		       "not indexing");
+		return;
+	}
+
+	indexer.cache_size = tags_cache_size (c);
+	indexer.cache = c;
+	indexer.root = xstrdup (music_dir);
+	if (strlen (indexer.root) > 1
+	        && indexer.root[strlen (indexer.root) - 1] == '/')
+		indexer.root[strlen (indexer.root) - 1] = 0;
+	indexer.stop = 0;
+
+	library_init ();
+
+	if (pipe (indexer.stop_pipe) == -1)
+		fatal ("pipe() failed: %s", xstrerror (errno));
+
+#ifdef HAVE_SYS_INOTIFY_H
+	indexer.inotify_fd = inotify_init ();
+	if (indexer.inotify_fd == -1)
+		log_errno ("Can't initialise inotify", errno);
+#endif
+
+	rc = pthread_create (&indexer.tid, NULL, indexer_thread, NULL);
+	if (rc != 0)
+		fatal ("Can't create library indexer thread: %s", xstrerror (rc));
+
+	indexer.running = 1;
+}
+
+/* Stop the library indexer and free its resources. */
+void indexer_cleanup ()
+{
+	int rc, i;
+
+	if (!indexer.running)
+		return;
+
+	indexer.stop = 1;
+	if (write (indexer.stop_pipe[1], "s", 1) == -1)
+		log_errno ("Can't wake up the indexer thread", errno);
+
+	rc = pthread_join (indexer.tid, NULL);
+	if (rc != 0)
+		fatal ("pthread_join() on library indexer thread failed: %s",
+		        xstrerror (rc));
+
+	close (indexer.stop_pipe[0]);
+	close (indexer.stop_pipe[1]);
+	if (indexer.inotify_fd != -1) {
+		close (indexer.inotify_fd);
+		indexer.inotify_fd = -1;
+	}
+
+	for (i = 0; i < indexer.watches_size; i++)
+		free (indexer.watches[i]);
+	free (indexer.watches);
+	indexer.watches = NULL;
+	indexer.watches_size = 0;
+
+	library_cleanup ();
+
+	free (indexer.root);
+	indexer.root = NULL;
+	indexer.running = 0;
+}
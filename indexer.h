@@ -0,0 +1,17 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tags_cache;
+
+void indexer_init (struct tags_cache *c);
+void indexer_cleanup ();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,6 +19,7 @@
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -29,6 +30,7 @@
 #include <sys/wait.h>
 #include <dirent.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 
 #define DEBUG
 
@@ -39,6 +41,7 @@
 #include "lists.h"
 #include "playlist.h"
 #include "playlist_file.h"
+#include "playlist_sort.h"
 #include "protocol.h"
 #include "keys.h"
 #include "options.h"
@@ -47,9 +50,12 @@
 #include "themes.h"
 #include "softmixer.h"
 #include "utf8.h"
+#include "server.h"
+#include "status_page.h"
 
 #define INTERFACE_LOG	"mocp_client_log"
 #define PLAYLIST_FILE	"playlist.m3u"
+#define PLAYLIST_SNAPSHOT_FILE	"playlist.snap"
 
 #define QUEUE_CLEAR_THRESH 128
 
@@ -63,6 +69,84 @@ static struct plist *dir_plist = NULL; /* contents of the current directory */
 /* Queue for events coming from the server. */
 static struct event_queue events;
 
+/* Maximum number of CMD_TAGGED commands sent and not answered yet.  The
+ * server blocks when sending responses nobody reads, so we don't send more
+ * without reading the replies. */
+#define REQUESTS_MAX	64
+
+/* What follows EV_REPLY for a command. */
+enum reply_type
+{
+	REPLY_NONE,	/* nothing */
+	REPLY_INT,	/* EV_DATA and an integer */
+	REPLY_STR	/* EV_DATA and a string */
+};
+
+/* Commands sent with CMD_TAGGED, indexed by the request ID modulo
+ * REQUESTS_MAX. */
+static struct
+{
+	int used;
+	int done;	/* the reply has arrived */
+	int id;
+	enum reply_type type;
+	int int_val;
+	char *str_val;
+} requests[REQUESTS_MAX];
+
+/* ID of the next CMD_TAGGED command. */
+static int next_request_id = 0;
+
+/* Number of directory entries read before the menu is first shown, and
+ * then in each iteration of the main loop until the directory is read. */
+#define DIR_LISTING_FIRST	256
+#define DIR_LISTING_CHUNK	2048
+
+/* Directory being read into dir_plist while the interface is running. */
+static struct
+{
+	struct dir_reader *reader;	/* NULL if not listing */
+	lists_t_strs *dirs;
+	lists_t_strs *playlists;
+	char *select_dir;	/* directory we came from, selected when read */
+	char *select_title;
+} dir_listing = { NULL, NULL, NULL, NULL, NULL };
+
+/* Number of files from the playlist snapshot checked for modification in
+ * each iteration of the main loop. */
+#define SNAPSHOT_CHECK_CHUNK	256
+
+/* Files loaded from the playlist snapshot with their modification times
+ * from the snapshot.  They are checked in the main loop and the tags are
+ * read again for files which have changed. */
+static struct
+{
+	char **files;	/* NULL if not checking */
+	time_t *mtimes;
+	int num;
+	int pos;
+} snapshot_check = { NULL, NULL, 0, 0 };
+
+/* Number of items beyond the visible ones asked for tags in the direction
+ * of scrolling. */
+#define TAGS_PREFETCH	64
+
+/* Tags for the directory and playlist menus are asked for what is on the
+ * screen first, then for TAGS_PREFETCH items ahead of it, and for the rest
+ * of the lists in the background when nothing else is pending.  When the
+ * view changes, our requests still queued in the server are aborted; other
+ * tags requests are left alone. */
+static struct
+{
+	lists_t_strs *view;	/* files shown when we last looked */
+	lists_t_strs *sent;	/* files asked for and not answered yet */
+	int bg_pos[2];		/* next item of dir_plist and playlist to look
+				   at in the background */
+} tags_sched = { NULL, NULL, { 0, 0 } };
+
+/* Queue from the playlist snapshot to be restored on the server. */
+static struct plist snapshot_queue;
+
 /* Current working directory (the directory we show). */
 static char cwd[PATH_MAX] = "";
 
@@ -81,9 +165,17 @@ static volatile int want_resize = 0;
 /* Are we waiting for the playlist we have loaded and sent to the clients? */
 static int waiting_for_plist_load = 0;
 
+/* File to select when it comes back with EV_PLIST_ADD after sorting the
+ * synchronized playlist. */
+static char *plist_select_pending = NULL;
+
 /* Information about the currently played file. */
 static struct file_info curr_file;
 
+/* When curr_file.curr_time was got from the server.  With the Tickless
+ * option the time is counted from it while playing. */
+static double curr_time_when = 0.0;
+
 /* Silent seeking - where we are in seconds. -1 - no seeking. */
 static int silent_seek_pos = -1;
 static time_t silent_seek_key_last = (time_t)0; /* when the silent seek key was
@@ -221,6 +313,16 @@ static struct tag_ev_response *recv_tags_data_from_srv ()
 	return r;
 }
 
+static struct tag_ev_batch *recv_tags_batch_from_srv ()
+{
+	struct tag_ev_batch *b;
+
+	if (!(b = recv_tag_ev_batch(srv_sock)))
+		fatal ("Can't receive tags batch from the server!");
+
+	return b;
+}
+
 static struct move_ev_data *recv_move_ev_data_from_srv ()
 {
 	struct move_ev_data *d;
@@ -231,6 +333,16 @@ static struct move_ev_data *recv_move_ev_data_from_srv ()
 	return d;
 }
 
+static struct plist_sync_base *recv_plist_sync_base_from_srv ()
+{
+	struct plist_sync_base *base;
+
+	if (!(base = recv_plist_sync_base(srv_sock)))
+		fatal ("Can't receive playlist sync data from the server!");
+
+	return base;
+}
+
 /* Receive data for the given type of event and return them. Return NULL if
  * there is no data for the event. */
 static void *get_event_data (const int type)
@@ -246,14 +358,129 @@ static void *get_event_data (const int type)
 			return get_str_from_srv ();
 		case EV_FILE_TAGS:
 			return recv_tags_data_from_srv ();
+		case EV_FILE_TAGS_BATCH:
+			return recv_tags_batch_from_srv ();
 		case EV_PLIST_MOVE:
 		case EV_QUEUE_MOVE:
 			return recv_move_ev_data_from_srv ();
+		case EV_PLIST_SYNC:
+			return recv_plist_sync_base_from_srv ();
 	}
 
 	return NULL;
 }
 
+/* Receive EV_REPLY's data (the event is already read) and store the
+ * response for the request. */
+static void recv_reply ()
+{
+	int id = get_int_from_srv ();
+	int slot = id % REQUESTS_MAX;
+
+	if (id < 0 || !requests[slot].used || requests[slot].id != id
+			|| requests[slot].done)
+		fatal ("Server replied to an unknown request %d!", id);
+
+	if (requests[slot].type != REPLY_NONE
+			&& get_int_from_srv () != EV_DATA)
+		fatal ("Server sent a bad reply for request %d!", id);
+
+	switch (requests[slot].type) {
+		case REPLY_NONE:
+			requests[slot].used = 0;
+			break;
+		case REPLY_INT:
+			requests[slot].int_val = get_int_from_srv ();
+			break;
+		case REPLY_STR:
+			requests[slot].str_val = get_str_from_srv ();
+			break;
+	}
+
+	requests[slot].done = 1;
+}
+
+/* Read events from the server until the reply for the request arrives,
+ * queue other events. */
+static void wait_for_reply (const int id)
+{
+	int slot = id % REQUESTS_MAX;
+
+	while (requests[slot].used && requests[slot].id == id
+			&& !requests[slot].done) {
+		int event = get_int_from_srv ();
+
+		if (event == EV_EXIT)
+			interface_fatal ("The server exited!");
+		if (event == EV_REPLY)
+			recv_reply ();
+		else
+			event_push (&events, event, get_event_data(event));
+	}
+}
+
+/* Send the command as CMD_TAGGED without waiting for the response.  Its
+ * arguments are sent after it as usual.  Return the request ID, which must
+ * be passed to get_reply_int() or get_reply_str() if the command has a
+ * response. */
+static int send_tagged_cmd (const int cmd, const enum reply_type type)
+{
+	int id = next_request_id;
+	int slot = id % REQUESTS_MAX;
+
+	next_request_id = (next_request_id + 1) & INT_MAX;
+
+	if (requests[slot].used) {
+		wait_for_reply (requests[slot].id);
+		if (requests[slot].used) {
+			logit ("Dropping unused reply for request %d",
+			       requests[slot].id);
+			free (requests[slot].str_val);
+		}
+	}
+
+	requests[slot].used = 1;
+	requests[slot].done = 0;
+	requests[slot].id = id;
+	requests[slot].type = type;
+	requests[slot].str_val = NULL;
+
+	send_int_to_srv (CMD_TAGGED);
+	send_int_to_srv (id);
+	send_int_to_srv (cmd);
+
+	return id;
+}
+
+/* Get the integer response for the request sent with send_tagged_cmd(). */
+static int get_reply_int (const int id)
+{
+	int slot = id % REQUESTS_MAX;
+
+	assert (requests[slot].used && requests[slot].id == id);
+	assert (requests[slot].type == REPLY_INT);
+
+	wait_for_reply (id);
+	requests[slot].used = 0;
+
+	return requests[slot].int_val;
+}
+
+/* Get the string response for the request sent with send_tagged_cmd().
+ * Returned memory is malloc()ed. */
+static char *get_reply_str (const int id)
+{
+	int slot = id % REQUESTS_MAX;
+
+	assert (requests[slot].used && requests[slot].id == id);
+	assert (requests[slot].type == REPLY_STR);
+
+	wait_for_reply (id);
+	requests[slot].used = 0;
+
+	return requests[slot].str_val;
+}
+
 /* Wait for EV_DATA handling other events. */
 static void wait_for_data ()
 {
@@ -263,7 +490,9 @@ static void wait_for_data ()
 		event = get_int_from_srv ();
 		if (event == EV_EXIT)
 			interface_fatal ("The server exited!");
-		if (event != EV_DATA)
+		if (event == EV_REPLY)
+			recv_reply ();
+		else if (event != EV_DATA)
 			event_push (&events, event, get_event_data(event));
 	 } while (event != EV_DATA);
 }
@@ -314,6 +543,44 @@ static int send_tags_request (const char *file, const int tags_sel)
 	}
 }
 
+/* Send a batch of tags requests and free the file names. */
+static void send_tags_batch_to_srv (char **files, const int count,
+                                    const int tags_sel)
+{
+	int i;
+
+	if (!send_tags_batch_request(srv_sock, (const char **)files, count,
+	                             tags_sel))
+		fatal ("Can't send() tags request to the server!");
+
+	for (i = 0; i < count; i++)
+		free (files[i]);
+}
+
+/* Find the response for the file in an EV_FILE_TAGS or EV_FILE_TAGS_BATCH
+ * event data.  Return NULL if there is none. */
+static struct tag_ev_response *find_tags_response (const int type,
+                                                   void *data,
+                                                   const char *file)
+{
+	if (type == EV_FILE_TAGS) {
+		struct tag_ev_response *ev = (struct tag_ev_response *)data;
+
+		if (!strcmp(ev->file, file))
+			return ev;
+	}
+	else if (type == EV_FILE_TAGS_BATCH) {
+		struct tag_ev_batch *b = (struct tag_ev_batch *)data;
+		int i;
+
+		for (i = 0; i < b->count; i++)
+			if (!strcmp(b->items[i].file, file))
+				return &b->items[i];
+	}
+
+	return NULL;
+}
+
 /* Send all items from this playlist to other clients. */
 static void send_items_to_clients (const struct plist *plist)
 {
@@ -334,6 +601,7 @@ static void init_playlists ()
 	plist_init (playlist);
 	queue = (struct plist *)xmalloc (sizeof(struct plist));
 	plist_init (queue);
+	plist_init (&snapshot_queue);
 
 	/* set serial numbers for the playlist */
 	send_int_to_srv (CMD_GET_SERIAL);
@@ -413,9 +681,21 @@ static void sync_bool_option (const char *name)
 /* Get the server options and set our options like them. */
 static void get_server_options ()
 {
-	sync_bool_option ("Shuffle");
-	sync_bool_option ("Repeat");
-	sync_bool_option ("AutoNext");
+	static const char *names[] = { "Shuffle", "Repeat", "AutoNext" };
+	int reqs[ARRAY_SIZE(names)];
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		reqs[i] = send_tagged_cmd (CMD_GET_OPTION, REPLY_INT);
+		send_str_to_srv (names[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		bool value = get_reply_int (reqs[i]) == 1;
+
+		options_set_bool (names[i], value);
+		iface_set_option_state (names[i], value);
+	}
 }
 
 static int get_server_plist_serial ()
@@ -430,12 +710,6 @@ static int get_mixer_value ()
 	return get_data_int ();
 }
 
-static int get_state ()
-{
-	send_int_to_srv (CMD_GET_STATE);
-	return get_data_int ();
-}
-
 static int get_channels ()
 {
 	send_int_to_srv (CMD_GET_CHANNELS);
@@ -582,6 +856,8 @@ static int ask_for_tags (const struct plist *plist, const int tags_sel)
 {
 	int i;
 	int req = 0;
+	int batch_count = 0;
+	char *batch[TAGS_BATCH_MAX];
 
 	assert (plist != NULL);
 
@@ -590,18 +866,201 @@ static int ask_for_tags (const struct plist *plist, const int tags_sel)
 			if (!plist_deleted(plist, i) &&
 			    (!plist->items[i].tags ||
 			     ~plist->items[i].tags->filled & tags_sel)) {
-				char *file;
+				if (plist->items[i].type != F_SOUND) {
+					debug ("Not sending tags request for URL "
+					       "(%s)", plist->items[i].file);
+					continue;
+				}
 
-				file = plist_get_file (plist, i);
-				req += send_tags_request (file, tags_sel);
-				free (file);
+				batch[batch_count++] = plist_get_file (plist, i);
+				if (batch_count == TAGS_BATCH_MAX) {
+					send_tags_batch_to_srv (batch, batch_count,
+					                        tags_sel);
+					batch_count = 0;
+				}
+				req += 1;
 			}
 		}
+
+		if (batch_count)
+			send_tags_batch_to_srv (batch, batch_count, tags_sel);
 	}
 
 	return req;
 }
 
+/* Return the tags which the item needs and which were not asked for. */
+static int item_needs_tags (const struct plist *plist, const int num,
+		const int tags_sel)
+{
+	const struct plist_item *item = &plist->items[num];
+	int missing;
+
+	if (plist_deleted(plist, num) || item->type != F_SOUND)
+		return 0;
+
+	missing = item->tags ? ~item->tags->filled & tags_sel : tags_sel;
+
+	return missing & ~item->tags_asked;
+}
+
+/* Set the tags asked for the file on both lists. */
+static void set_tags_asked (const char *file, const int tags_asked)
+{
+	int n;
+
+	if ((n = plist_find_fname(dir_plist, file)) != -1)
+		dir_plist->items[n].tags_asked = tags_asked;
+	if ((n = plist_find_fname(playlist, file)) != -1)
+		playlist->items[n].tags_asked = tags_asked;
+}
+
+/* Add the file to the batch of tags requests, send the batch if it's
+ * full. */
+static void tags_sched_ask (const char *file, const int tags_sel,
+		char **batch, int *count)
+{
+	set_tags_asked (file, tags_sel);
+	lists_strs_append (tags_sched.sent, file);
+
+	batch[(*count)++] = xstrdup (file);
+	if (*count == TAGS_BATCH_MAX) {
+		send_tags_batch_to_srv (batch, *count, tags_sel);
+		*count = 0;
+	}
+}
+
+/* Abort our tags requests queued in the server, the files can be asked
+ * for again. */
+static void tags_sched_abort ()
+{
+	const char *batch[TAGS_BATCH_MAX];
+	int i, num, count = 0;
+
+	num = lists_strs_size (tags_sched.sent);
+	debug ("Aborting %d tags requests", num);
+
+	for (i = 0; i < num; i++) {
+		const char *file = lists_strs_at (tags_sched.sent, i);
+
+		set_tags_asked (file, 0);
+		batch[count++] = file;
+		if (count == TAGS_BATCH_MAX || i == num - 1) {
+			if (!send_tags_abort_batch (srv_sock, batch, count))
+				fatal ("Can't send() tags request to the server!");
+			count = 0;
+		}
+	}
+
+	lists_strs_clear (tags_sched.sent);
+	tags_sched.bg_pos[0] = 0;
+	tags_sched.bg_pos[1] = 0;
+}
+
+/* Forget the file asked for by us, the response has come. */
+static void tags_sched_answered (const char *file)
+{
+	int i, last;
+
+	if (!tags_sched.sent)
+		return;
+
+	last = lists_strs_size (tags_sched.sent) - 1;
+	for (i = 0; i <= last; i++) {
+		if (!strcmp (lists_strs_at (tags_sched.sent, i), file)) {
+			char *moved = lists_strs_pop (tags_sched.sent);
+
+			if (i < last)
+				free (lists_strs_swap (tags_sched.sent, i, moved));
+			else
+				free (moved);
+			break;
+		}
+	}
+}
+
+/* Look at the lists again in the background, their content has changed. */
+static void tags_sched_reset ()
+{
+	tags_sched.bg_pos[0] = 0;
+	tags_sched.bg_pos[1] = 0;
+}
+
+/* Send tags requests for the items on the screen, or for the next items
+ * of the lists if there is nothing else to do. */
+static void schedule_tags ()
+{
+	struct plist *plists[2] = { dir_plist, playlist };
+	char *batch[TAGS_BATCH_MAX];
+	lists_t_strs *view;
+	int tags_sel, i, m, count = 0;
+	bool need = false;
+
+	if (!(tags_sel = get_tags_setting()))
+		return;
+
+	if (!tags_sched.sent)
+		tags_sched.sent = lists_strs_new (TAGS_BATCH_MAX);
+
+	view = lists_strs_new (2 * TAGS_PREFETCH);
+	iface_get_visible_files (IFACE_MENU_DIR, TAGS_PREFETCH, view);
+	iface_get_visible_files (IFACE_MENU_PLIST, TAGS_PREFETCH, view);
+
+	for (i = 0; i < lists_strs_size (view) && !need; i++) {
+		const char *file = lists_strs_at (view, i);
+
+		for (m = 0; m < 2; m++) {
+			int n = plist_find_fname (plists[m], file);
+
+			if (n != -1 && item_needs_tags (plists[m], n, tags_sel))
+				need = true;
+		}
+	}
+
+	if (need) {
+		if (!lists_strs_empty (tags_sched.sent) && (!tags_sched.view
+		                 || !lists_strs_equal (view, tags_sched.view)))
+			tags_sched_abort ();
+
+		for (i = 0; i < lists_strs_size (view); i++) {
+			const char *file = lists_strs_at (view, i);
+
+			for (m = 0; m < 2; m++) {
+				int n = plist_find_fname (plists[m], file);
+
+				if (n != -1 && item_needs_tags (plists[m], n,
+				                                tags_sel)) {
+					tags_sched_ask (file, tags_sel,
+					                batch, &count);
+					break;
+				}
+			}
+		}
+	}
+
+	if (tags_sched.view)
+		lists_strs_free (tags_sched.view);
+	tags_sched.view = view;
+
+	if (lists_strs_empty (tags_sched.sent)) {
+		for (m = 0; m < 2 && lists_strs_size (tags_sched.sent)
+		                     < TAGS_BATCH_MAX; m++) {
+			int *pos = &tags_sched.bg_pos[m];
+
+			for (; *pos < plists[m]->num
+			       && lists_strs_size (tags_sched.sent)
+			          < TAGS_BATCH_MAX; (*pos)++) {
+				if (item_needs_tags (plists[m], *pos, tags_sel))
+					tags_sched_ask (plists[m]->items[*pos].file,
+					                tags_sel, batch, &count);
+			}
+		}
+	}
+
+	if (count)
+		send_tags_batch_to_srv (batch, count, tags_sel);
+}
+
 static void interface_message (const char *format, ...)
 {
 	va_list va;
@@ -673,6 +1132,8 @@ static void ev_file_tags (const struct tag_ev_response *data)
 
 	debug ("Received tags for %s", data->file);
 
+	tags_sched_answered (data->file);
+
 	sanitise_string (data->tags->title);
 	sanitise_string (data->tags->artist);
 	sanitise_string (data->tags->album);
@@ -720,9 +1181,10 @@ static void ev_file_tags (const struct tag_ev_response *data)
 }
 
 /* Update the current time. */
-static void update_ctime ()
+static void update_ctime (const int ctime)
 {
-	curr_file.curr_time = get_curr_time ();
+	curr_file.curr_time = ctime;
+	curr_time_when = get_realtime_sec ();
 	if (silent_seek_pos == -1)
 		iface_set_curr_time (curr_file.curr_time);
 }
@@ -762,12 +1224,9 @@ static void follow_curr_file ()
 	}
 }
 
-static void update_curr_file ()
+/* Show the file being played, file is malloc()ed. */
+static void update_curr_file (char *file)
 {
-	char *file;
-
-	file = get_curr_file ();
-
 	if (!file[0] || curr_file.state == STATE_STOP) {
 
 		/* Nothing is played/paused. */
@@ -828,21 +1287,21 @@ static void update_curr_file ()
 		free (file);
 }
 
-static void update_rate ()
+static void update_rate (const int rate)
 {
-	curr_file.rate = get_rate ();
+	curr_file.rate = rate;
 	iface_set_rate (curr_file.rate);
 }
 
-static void update_channels ()
+static void update_channels (const int channels)
 {
-	curr_file.channels = get_channels () == 2 ? 2 : 1;
+	curr_file.channels = channels == 2 ? 2 : 1;
 	iface_set_channels (curr_file.channels);
 }
 
-static void update_bitrate ()
+static void update_bitrate (const int bitrate)
 {
-	curr_file.bitrate = get_bitrate ();
+	curr_file.bitrate = bitrate;
 	iface_set_bitrate (curr_file.bitrate);
 }
 
@@ -850,21 +1309,30 @@ static void update_bitrate ()
 static void update_state ()
 {
 	int old_state = curr_file.state;
+	int state_req, file_req, channels_req, bitrate_req, rate_req, ctime_req;
+
+	/* Ask for everything at once and then read the replies. */
+	state_req = send_tagged_cmd (CMD_GET_STATE, REPLY_INT);
+	file_req = send_tagged_cmd (CMD_GET_SNAME, REPLY_STR);
+	channels_req = send_tagged_cmd (CMD_GET_CHANNELS, REPLY_INT);
+	bitrate_req = send_tagged_cmd (CMD_GET_BITRATE, REPLY_INT);
+	rate_req = send_tagged_cmd (CMD_GET_RATE, REPLY_INT);
+	ctime_req = send_tagged_cmd (CMD_GET_CTIME, REPLY_INT);
 
 	/* play | stop | pause */
-	curr_file.state = get_state ();
+	curr_file.state = get_reply_int (state_req);
 	iface_set_state (curr_file.state);
 
 	/* Silent seeking makes no sense if the state has changed. */
 	if (old_state != curr_file.state)
 		silent_seek_pos = -1;
 
-	update_curr_file ();
+	update_curr_file (get_reply_str(file_req));
 
-	update_channels ();
-	update_bitrate ();
-	update_rate ();
-	update_ctime ();
+	update_channels (get_reply_int(channels_req));
+	update_bitrate (get_reply_int(bitrate_req));
+	update_rate (get_reply_int(rate_req));
+	update_ctime (get_reply_int(ctime_req));
 }
 
 /* Handle EV_PLIST_ADD. */
@@ -909,6 +1377,14 @@ static void event_plist_add (const struct plist_item *item)
 				iface_switch_to_plist ();
 			waiting_for_plist_load = 0;
 		}
+
+		if (plist_select_pending
+				&& !strcmp (item->file, plist_select_pending)) {
+			if (iface_in_plist_menu())
+				iface_select_file (item->file);
+			free (plist_select_pending);
+			plist_select_pending = NULL;
+		}
 	}
 }
 
@@ -948,13 +1424,41 @@ static void forward_playlist ()
 	send_item_to_srv (NULL);
 }
 
-static int recv_server_plist (struct plist *plist)
+/* Send the playlist packed to the server to be forwarded to the client
+ * which has the part of it described by base.  If it's the beginning of
+ * our playlist, only the rest is sent. */
+static void forward_playlist_packed (const struct plist_sync_base *base)
 {
-	int end_of_list = 0;
-	struct plist_item *item;
+	int from = 0;
+
+	if (base->count == -1)
+		from = plist_count (playlist);
+	else if (base->count > 0 && base->serial == plist_get_serial(playlist)
+			&& base->count <= plist_count(playlist)
+			&& base->hash == plist_files_hash(playlist, base->count))
+		from = base->count;
 
+	debug ("Forwarding the playlist after %d items...", from);
+
+	send_int_to_srv (CMD_SEND_PLIST_PACKED);
+	send_int_to_srv (plist_get_serial(playlist));
+	send_int_to_srv (from);
+
+	if (!send_plist_packed(srv_sock, playlist, from))
+		fatal ("Can't send() the playlist to the server!");
+}
+
+/* Ask the server for the playlist from another client, telling that we
+ * have its first base->count items (-1 if we need only the serial number).
+ * Return 0 if no client has a playlist.  Otherwise, put its serial number
+ * and the number of our items to keep in serial and keep and return 1;
+ * the rest of the items must be then read by recv_server_plist_items(). */
+static int request_server_plist (const struct plist_sync_base *base,
+                                 int *serial, int *keep)
+{
 	logit ("Asking server for the playlist from other client.");
-	send_int_to_srv (CMD_GET_PLIST);
+	if (!send_plist_sync_base(srv_sock, CMD_PLIST_SYNC, base))
+		fatal ("Can't send() playlist request to the server!");
 	logit ("Waiting for response");
 	wait_for_data ();
 
@@ -966,23 +1470,75 @@ static int recv_server_plist (struct plist *plist)
 	logit ("There is a playlist, getting...");
 	wait_for_data ();
 
+	*serial = get_int_from_srv ();
+	*keep = get_int_from_srv ();
+
+	return 1;
+}
+
+/* Receive the items following request_server_plist() into the playlist.
+ * Return 0 if the transfer failed on the sending client's side, then the
+ * playlist is cleared. */
+static int recv_server_plist_items (struct plist *plist)
+{
+	int res;
+
 	logit ("Transfer...");
 
-	plist_set_serial (plist, get_int_from_srv());
+	res = recv_plist_packed (srv_sock, plist);
+	if (!res)
+		fatal ("Can't receive the playlist from the server!");
+	if (res == -1) {
+		plist_clear (plist);
+		return 0;
+	}
 
-	do {
-		item = recv_item_from_srv ();
-		if (item->file[0])
-			plist_add_from_item (plist, item);
-		else
-			end_of_list = 1;
-		plist_free_item_fields (item);
-		free (item);
-	} while (!end_of_list);
+	return 1;
+}
+
+/* Get the playlist from another client.  Only the items we don't have are
+ * transferred if plist has the beginning of that playlist.  Return 0 if
+ * there is no client with a playlist. */
+static int recv_server_plist (struct plist *plist)
+{
+	struct plist_sync_base base;
+	int serial, keep;
+
+	base.serial = plist_get_serial (plist);
+	base.count = plist_count (plist);
+	base.hash = plist_files_hash (plist, base.count);
+
+	if (!request_server_plist (&base, &serial, &keep))
+		return 0;
+
+	if (keep < base.count)
+		plist_clear (plist);
+	if (!recv_server_plist_items (plist))
+		return 0;
+	plist_set_serial (plist, serial);
 
 	return 1;
 }
 
+/* Get the serial number of another client's playlist without the playlist.
+ * Return -1 if there is no client with a playlist. */
+static int recv_server_plist_serial ()
+{
+	struct plist_sync_base base = { -1, -1, 0 };
+	struct plist plist;
+	int serial, keep;
+
+	if (!request_server_plist (&base, &serial, &keep))
+		return -1;
+
+	plist_init (&plist);
+	if (!recv_server_plist_items (&plist))
+		serial = -1;
+	plist_free (&plist);
+
+	return serial;
+}
+
 static void recv_server_queue (struct plist *queue)
 {
 	int end_of_list = 0;
@@ -1039,6 +1595,8 @@ static void event_plist_del (char *file)
 
 		file = plist_get_file (playlist, item);
 		plist_delete (playlist, item);
+		if (plist_needs_compaction (playlist))
+			plist_compact (playlist, -1);
 
 		iface_del_plist_item (file);
 		playlist_total_time = plist_total_time (playlist,
@@ -1069,6 +1627,8 @@ static void event_queue_del (char *file)
 		if (plist_count(queue) == 0
 				&& queue->num >= QUEUE_CLEAR_THRESH)
 			plist_clear (queue);
+		else if (plist_needs_compaction (queue))
+			plist_compact (queue, -1);
 
 		iface_set_files_in_queue (plist_count(queue));
 		iface_update_queue_positions (queue, playlist, dir_plist, file);
@@ -1120,7 +1680,7 @@ static void server_event (const int event, void *data)
 			                 "too many other clients are connected!");
 			break;
 		case EV_CTIME:
-			update_ctime ();
+			update_ctime (get_curr_time());
 			break;
 		case EV_STATE:
 			update_state ();
@@ -1129,13 +1689,13 @@ static void server_event (const int event, void *data)
 			interface_fatal ("The server exited!");
 			break;
 		case EV_BITRATE:
-			update_bitrate ();
+			update_bitrate (get_bitrate());
 			break;
 		case EV_RATE:
-			update_rate ();
+			update_rate (get_rate());
 			break;
 		case EV_CHANNELS:
-			update_channels ();
+			update_channels (get_channels());
 			break;
 		case EV_SRV_ERROR:
 			update_error ((char *)data);
@@ -1146,6 +1706,9 @@ static void server_event (const int event, void *data)
 		case EV_SEND_PLIST:
 			forward_playlist ();
 			break;
+		case EV_PLIST_SYNC:
+			forward_playlist_packed ((struct plist_sync_base *)data);
+			break;
 		case EV_PLIST_ADD:
 			if (options_get_bool("SyncPlaylist"))
 				event_plist_add ((struct plist_item *)data);
@@ -1174,6 +1737,15 @@ static void server_event (const int event, void *data)
 		case EV_FILE_TAGS:
 			ev_file_tags ((struct tag_ev_response *)data);
 			break;
+		case EV_FILE_TAGS_BATCH:
+			{
+				struct tag_ev_batch *b = (struct tag_ev_batch *)data;
+				int i;
+
+				for (i = 0; i < b->count; i++)
+					ev_file_tags (&b->items[i]);
+			}
+			break;
 		case EV_AVG_BITRATE:
 			curr_file.avg_bitrate = get_avg_bitrate ();
 			break;
@@ -1234,15 +1806,27 @@ static void fill_tags (struct plist *plist, const int tags_sel,
 			data = get_event_data (type);
 		}
 
-		if (type == EV_FILE_TAGS) {
-			struct tag_ev_response *ev
-				= (struct tag_ev_response *)data;
-			int n;
+		if (type == EV_FILE_TAGS || type == EV_FILE_TAGS_BATCH) {
+			struct tag_ev_response *ev;
+			int i, count;
+
+			if (type == EV_FILE_TAGS) {
+				ev = (struct tag_ev_response *)data;
+				count = 1;
+			}
+			else {
+				ev = ((struct tag_ev_batch *)data)->items;
+				count = ((struct tag_ev_batch *)data)->count;
+			}
+
+			for (i = 0; i < count; i++) {
+				int n;
 
-			if ((n = plist_find_fname(plist, ev->file)) != -1) {
-				if ((ev->tags->filled & tags_sel))
-					files--;
-				update_item_tags (plist, n, ev->tags);
+				if ((n = plist_find_fname(plist, ev[i].file)) != -1) {
+					if ((ev[i].tags->filled & tags_sel))
+						files--;
+					update_item_tags (plist, n, ev[i].tags);
+				}
 			}
 		}
 		else if (no_iface)
@@ -1257,17 +1841,97 @@ static void fill_tags (struct plist *plist, const int tags_sel,
 	iface_set_status ("");
 }
 
+/* Stop reading the directory in the background, keeping what was read. */
+static void stop_dir_listing ()
+{
+	if (!dir_listing.reader)
+		return;
+
+	read_directory_close (dir_listing.reader);
+	lists_strs_free (dir_listing.dirs);
+	lists_strs_free (dir_listing.playlists);
+	free (dir_listing.select_dir);
+	free (dir_listing.select_title);
+	memset (&dir_listing, 0, sizeof (dir_listing));
+
+	iface_set_status ("");
+}
+
+/* Read the next part of the directory being listed into dir_plist and
+ * merge it into the menu.  Only the new entries are sorted, dir_plist is
+ * sorted when the whole directory is read. */
+static void continue_dir_listing (const int max)
+{
+	int rc, i, files_from, dirs_from, playlists_from;
+	char *curr_file;
+
+	assert (dir_listing.reader != NULL);
+
+	files_from = dir_plist->num;
+	dirs_from = lists_strs_size (dir_listing.dirs);
+	playlists_from = lists_strs_size (dir_listing.playlists);
+
+	rc = read_directory_next (dir_listing.reader, dir_listing.dirs,
+			dir_listing.playlists, dir_plist, max);
+
+	switch_titles_file_from (dir_plist, files_from);
+
+	iface_add_dir_content (dir_plist, files_from, dir_listing.dirs,
+			dirs_from, dir_listing.playlists, playlists_from);
+
+	/* Select the directory we came from when it's read if the cursor
+	 * is still on "..". */
+	if (dir_listing.select_dir && iface_in_dir_menu ()) {
+		curr_file = iface_get_curr_file ();
+		for (i = dirs_from; i < lists_strs_size (dir_listing.dirs); i++) {
+			if (!strcmp (lists_strs_at (dir_listing.dirs, i),
+			             dir_listing.select_dir))
+				break;
+		}
+		if (curr_file && !strcmp (curr_file, "..")
+				&& i < lists_strs_size (dir_listing.dirs)) {
+			iface_set_curr_item_title (dir_listing.select_title);
+			free (dir_listing.select_dir);
+			free (dir_listing.select_title);
+			dir_listing.select_dir = NULL;
+			dir_listing.select_title = NULL;
+		}
+		free (curr_file);
+	}
+
+	iface_update_queue_positions (queue, NULL, dir_plist, NULL);
+
+	tags_sched_reset ();
+
+	if (rc != 1) {
+		plist_sort_fname (dir_plist);
+		stop_dir_listing ();
+	}
+}
+
+/* Read the rest of the directory being listed now. */
+static void finish_dir_listing ()
+{
+	while (dir_listing.reader)
+		continue_dir_listing (-1);
+}
+
 /* Load the directory content into dir_plist and switch the menu to it.
  * If dir is NULL, go to the cwd.  If reload is not zero, we are reloading
- * the current directory, so use iface_update_dir_content().
+ * the current directory, so use iface_update_dir_content().  Only the
+ * beginning of the directory is read here, the rest is read in the main
+ * loop by continue_dir_listing().
  * Return 1 on success, 0 on error. */
 static int go_to_dir (const char *dir, const int reload)
 {
 	struct plist *old_dir_plist;
 	char last_dir[PATH_MAX];
 	const char *new_dir = dir ? dir : cwd;
-	int going_up = 0;
+	int going_up = 0, rc;
 	lists_t_strs *dirs, *playlists;
+	struct dir_reader *reader;
+
+	stop_dir_listing ();
 
 	iface_set_status ("Reading directory...");
 
@@ -1283,7 +1947,12 @@ static int go_to_dir (const char *dir, const int reload)
 	dirs = lists_strs_new (FILES_LIST_INIT_SIZE);
 	playlists = lists_strs_new (FILES_LIST_INIT_SIZE);
 
-	if (!read_directory(new_dir, dirs, playlists, dir_plist)) {
+	reader = read_directory_open (new_dir);
+	rc = reader ? read_directory_next (reader, dirs, playlists, dir_plist,
+	                                   DIR_LISTING_FIRST) : -1;
+	if (rc == -1) {
+		if (reader)
+			read_directory_close (reader);
 		iface_set_status ("");
 		plist_free (dir_plist);
 		lists_strs_free (dirs);
@@ -1293,12 +1962,21 @@ static int go_to_dir (const char *dir, const int reload)
 		return 0;
 	}
 
-	/* TODO: use CMD_ABORT_TAGS_REQUESTS (what if we requested tags for the
-	 playlist?) */
-
 	plist_free (old_dir_plist);
 	free (old_dir_plist);
 
+	if (rc == 1) {
+		dir_listing.reader = reader;
+		dir_listing.dirs = dirs;
+		dir_listing.playlists = playlists;
+		if (going_up && !lists_strs_exists (dirs, cwd)) {
+			dir_listing.select_dir = xstrdup (cwd);
+			dir_listing.select_title = xstrdup (last_dir);
+		}
+	}
+	else
+		read_directory_close (reader);
+
 	if (dir) /* if dir is NULL, we went to cwd */
 		strcpy (cwd, dir);
 
@@ -1308,14 +1986,17 @@ static int go_to_dir (const char *dir, const int reload)
 	lists_strs_sort (dirs, sort_dirs_func);
 	lists_strs_sort (playlists, sort_strcmp_func);
 
-	ask_for_tags (dir_plist, get_tags_setting());
+	tags_sched_reset ();
 
 	if (reload)
 		iface_update_dir_content (IFACE_MENU_DIR, dir_plist, dirs, playlists);
 	else
 		iface_set_dir_content (IFACE_MENU_DIR, dir_plist, dirs, playlists);
-	lists_strs_free (dirs);
-	lists_strs_free (playlists);
+	if (!dir_listing.reader) {
+		lists_strs_free (dirs);
+		lists_strs_free (playlists);
+		iface_set_status ("");
+	}
 	if (going_up)
 		iface_set_curr_item_title (last_dir);
 
@@ -1363,6 +2044,115 @@ static void toggle_menu ()
 		error ("The playlist is empty.");
 }
 
+/* Stop checking the files from the playlist snapshot. */
+static void stop_snapshot_check ()
+{
+	while (snapshot_check.pos < snapshot_check.num)
+		free (snapshot_check.files[snapshot_check.pos++]);
+
+	free (snapshot_check.files);
+	free (snapshot_check.mtimes);
+	memset (&snapshot_check, 0, sizeof (snapshot_check));
+}
+
+/* Check the next max files from the playlist snapshot and ask for the tags
+ * of those modified since the snapshot was made. */
+static void continue_snapshot_check (const int max)
+{
+	char *batch[TAGS_BATCH_MAX];
+	int batch_count = 0;
+	int end, tags_sel;
+
+	assert (snapshot_check.files != NULL);
+
+	tags_sel = get_tags_setting ();
+	end = MIN(snapshot_check.pos + max, snapshot_check.num);
+
+	for (; snapshot_check.pos < end; snapshot_check.pos++) {
+		char *file = snapshot_check.files[snapshot_check.pos];
+
+		if (!tags_sel || get_mtime (file)
+				== snapshot_check.mtimes[snapshot_check.pos]) {
+			free (file);
+			continue;
+		}
+
+		debug ("%s has changed since the playlist snapshot", file);
+		batch[batch_count++] = file;
+		if (batch_count == TAGS_BATCH_MAX) {
+			send_tags_batch_to_srv (batch, batch_count, tags_sel);
+			batch_count = 0;
+		}
+	}
+
+	if (batch_count)
+		send_tags_batch_to_srv (batch, batch_count, tags_sel);
+
+	if (snapshot_check.pos == snapshot_check.num)
+		stop_snapshot_check ();
+}
+
+/* Load the playlist saved in the .moc directory from its snapshot if it's
+ * up to date with the m3u file.  Tags from the snapshot are used, the
+ * files are checked for modification later in the main loop.  Return the
+ * number of items loaded. */
+static int load_playlist_snapshot (const char *plist_file)
+{
+	char *snapshot_file = xstrdup (create_file_name (PLAYLIST_SNAPSHOT_FILE));
+	int i, num;
+
+	num = plist_load_snapshot (playlist, &snapshot_queue, snapshot_file,
+	                           plist_file);
+	free (snapshot_file);
+
+	if (!num)
+		return 0;
+
+	if (options_get_bool ("ReadTags"))
+		switch_titles_tags (playlist);
+	else
+		switch_titles_file (playlist);
+
+	stop_snapshot_check ();
+	snapshot_check.files = (char **)xmalloc (num * sizeof (char *));
+	snapshot_check.mtimes = (time_t *)xmalloc (num * sizeof (time_t));
+	for (i = 0; i < playlist->num; i++) {
+		if (plist_deleted (playlist, i)
+				|| playlist->items[i].type != F_SOUND)
+			continue;
+		snapshot_check.files[snapshot_check.num] =
+			xstrdup (playlist->items[i].file);
+		snapshot_check.mtimes[snapshot_check.num++] =
+			playlist->items[i].mtime;
+	}
+
+	return num;
+}
+
+/* Put the files from the playlist snapshot on the server's queue if it
+ * is empty because the server was started after the snapshot was made. */
+static void restore_snapshot_queue ()
+{
+	struct stat snapshot_st, pid_st;
+	int i;
+
+	if (plist_count (&snapshot_queue) && plist_count (queue) == 0
+			&& !stat (create_file_name (PLAYLIST_SNAPSHOT_FILE),
+			          &snapshot_st)
+			&& !stat (create_file_name (PID_FILE), &pid_st)
+			&& pid_st.st_mtime >= snapshot_st.st_mtime) {
+		logit ("Restoring the queue from the playlist snapshot");
+		for (i = 0; i < snapshot_queue.num; i++) {
+			if (plist_deleted (&snapshot_queue, i))
+				continue;
+			send_int_to_srv (CMD_QUEUE_ADD);
+			send_str_to_srv (snapshot_queue.items[i].file);
+		}
+	}
+
+	plist_clear (&snapshot_queue);
+}
+
 /* Load the playlist file and switch the menu to it. Return 1 on success. */
 static int go_to_playlist (const char *file, const int load_serial,
                            bool default_playlist)
@@ -1376,7 +2166,8 @@ static int go_to_playlist (const char *file, const int load_serial,
 	plist_clear (playlist);
 
 	iface_set_status ("Loading playlist...");
-	if (plist_load(playlist, file, cwd, load_serial)) {
+	if ((default_playlist && load_playlist_snapshot (file))
+			|| plist_load (playlist, file, cwd, load_serial)) {
 
 		if (options_get_bool("SyncPlaylist")) {
 			send_int_to_srv (CMD_LOCK);
@@ -1448,38 +2239,61 @@ static void enter_first_dir ()
 	first_run = 0;
 }
 
-/* Request the playlist from the server (given by another client).  Make
- * the titles.  Return 0 if such a list doesn't exist. */
-static int get_server_playlist (struct plist *plist)
+/* Get the playlist from another client and use it as our playlist.  If
+ * our playlist snapshot has the beginning of it, only the rest is
+ * transferred.  Return 0 if there is no client with a playlist. */
+static int use_server_playlist ()
 {
+	struct plist_sync_base base;
+	char *plist_file = xstrdup (create_file_name (PLAYLIST_FILE));
+	int serial, keep, found;
+
+	if (!plist_snapshot_info (create_file_name (PLAYLIST_SNAPSHOT_FILE),
+	                          plist_file, &base.serial, &base.count,
+	                          &base.hash)) {
+		base.serial = -1;
+		base.count = 0;
+		base.hash = 0;
+	}
+
 	iface_set_status ("Getting the playlist...");
 	debug ("Getting the playlist...");
-	if (recv_server_plist(plist)) {
-		ask_for_tags (plist, get_tags_setting());
-		if (options_get_bool ("ReadTags"))
-			switch_titles_tags (plist);
+
+	found = request_server_plist (&base, &serial, &keep);
+	if (found && keep > 0 && load_playlist_snapshot (plist_file) != keep) {
+
+		/* The snapshot has changed in the meantime. */
+		found = recv_server_plist_items (playlist);
+		plist_clear (playlist);
+		stop_snapshot_check ();
+		if (found)
+			found = recv_server_plist (playlist);
+	}
+	else if (found) {
+		found = recv_server_plist_items (playlist);
+		if (found)
+			plist_set_serial (playlist, serial);
 		else
-			switch_titles_file (plist);
-		iface_set_status ("");
-		return 1;
+			stop_snapshot_check ();
 	}
 
-	iface_set_status ("");
-
-	return 0;
-}
+	/* The queue is the server's while another client has the playlist. */
+	plist_clear (&snapshot_queue);
 
-/* Get the playlist from another client and use it as our playlist.
- * Return 0 if there is no client with a playlist. */
-static int use_server_playlist ()
-{
-	if (get_server_playlist(playlist)) {
+	if (found) {
+		tags_sched_reset ();
+		if (options_get_bool ("ReadTags"))
+			switch_titles_tags (playlist);
+		else
+			switch_titles_file (playlist);
 		iface_set_dir_content (IFACE_MENU_PLIST, playlist, NULL, NULL);
 		iface_update_queue_positions (queue, playlist, NULL, NULL);
-		return 1;
 	}
 
-	return 0;
+	iface_set_status ("");
+	free (plist_file);
+
+	return found;
 }
 
 static void use_server_queue ()
@@ -1600,7 +2414,7 @@ static void process_args (lists_t_strs *args)
 
 	if (plist_count (playlist) && !options_get_bool ("SyncPlaylist")) {
 		switch_titles_file (playlist);
-		ask_for_tags (playlist, get_tags_setting ());
+		tags_sched_reset ();
 		iface_set_dir_content (IFACE_MENU_PLIST, playlist, NULL, NULL);
 		iface_update_queue_positions (queue, playlist, NULL, NULL);
 		iface_switch_to_plist ();
@@ -1612,7 +2426,8 @@ static void process_args (lists_t_strs *args)
 /* Load the playlist from .moc directory. */
 static void load_playlist ()
 {
-	char *plist_file = create_file_name (PLAYLIST_FILE);
+	/* A copy, loading the snapshot uses create_file_name() again. */
+	char *plist_file = xstrdup (create_file_name (PLAYLIST_FILE));
 
 	if (file_type(plist_file) == F_PLAYLIST) {
 		go_to_playlist (plist_file, 1, true);
@@ -1620,6 +2435,8 @@ static void load_playlist ()
 		/* We don't want to switch to the playlist after loading. */
 		waiting_for_plist_load = 0;
 	}
+
+	free (plist_file);
 }
 
 #ifdef SIGWINCH
@@ -1702,8 +2519,10 @@ static void play_it (const char *file)
 
 	assert (file != NULL);
 
-	if (iface_in_dir_menu())
+	if (iface_in_dir_menu()) {
+		finish_dir_listing ();
 		curr_plist = dir_plist;
+	}
 	else
 		curr_plist = playlist;
 
@@ -1838,12 +2657,12 @@ static void add_dir_plist ()
 		int i;
 
 		switch_titles_file (&plist);
-		ask_for_tags (&plist, get_tags_setting());
 
 		for (i = 0; i < plist.num; i++)
 			if (!plist_deleted(&plist, i))
 				iface_add_to_plist (&plist, i);
 		plist_cat (playlist, &plist);
+		tags_sched_reset ();
 	}
 
 	send_int_to_srv (CMD_UNLOCK);
@@ -1872,6 +2691,8 @@ static void remove_file_from_playlist (const char *file)
 		assert (n != -1);
 
 		plist_delete (playlist, n);
+		if (plist_needs_compaction (playlist))
+			plist_compact (playlist, -1);
 		iface_del_plist_item (file);
 
 		if (plist_count(playlist) == 0)
@@ -2021,8 +2842,7 @@ static void toggle_show_time ()
 	else if (!strcasecmp (options_get_symb ("ShowTime"), "no")) {
 		options_set_symb ("ShowTime", "yes");
 		iface_update_show_time ();
-		ask_for_tags (dir_plist, TAGS_TIME);
-		ask_for_tags (playlist, TAGS_TIME);
+		tags_sched_reset ();
 		iface_set_status ("ShowTime: yes");
 
 	}
@@ -2357,17 +3177,23 @@ static void entry_key_search (const struct iface_key *k)
 		iface_entry_handle_key (k);
 }
 
-static void save_playlist (const char *file, const int save_serial)
+/* Save the playlist to the file.  Return 1 if it was saved. */
+static int save_playlist (const char *file, const int save_serial)
 {
+	int saved = 0;
+
 	iface_set_status ("Saving the playlist...");
 	fill_tags (playlist, TAGS_COMMENTS | TAGS_TIME, 0);
 	if (!user_wants_interrupt()) {
-		if (plist_save (playlist, file, save_serial))
+		saved = plist_save (playlist, file, save_serial);
+		if (saved)
 			interface_message ("Playlist saved");
 	}
 	else
 		iface_set_status ("Aborted");
 	iface_set_status ("");
+
+	return saved;
 }
 
 static void entry_key_plist_save (const struct iface_key *k)
@@ -2500,8 +3326,7 @@ static void switch_read_tags ()
 	}
 	else {
 		options_set_bool ("ReadTags", true);
-		ask_for_tags (dir_plist, TAGS_COMMENTS);
-		ask_for_tags (playlist, TAGS_COMMENTS);
+		tags_sched_reset ();
 		switch_titles_tags (dir_plist);
 		switch_titles_tags (playlist);
 		iface_set_status ("ReadTags: yes");
@@ -2662,6 +3487,59 @@ static void move_item (const int direction)
 	free (file);
 }
 
+/* Sort the playlist using the PlaylistSortKeys option.  The selected item
+ * stays selected. */
+static void sort_playlist ()
+{
+	char *file = NULL;
+
+	if (!plist_count(playlist)) {
+		error ("The playlist is empty.");
+		return;
+	}
+
+	iface_set_status ("Sorting the playlist...");
+
+	if (!plist_sort_tags (playlist, options_get_list ("PlaylistSortKeys"))) {
+		iface_set_status ("");
+		error ("Invalid PlaylistSortKeys option.");
+		return;
+	}
+
+	if (iface_in_plist_menu())
+		file = iface_get_curr_file ();
+
+	/* The server finds the next file by the name of the current one,
+	 * so it can get the sorted playlist while playing. */
+	send_int_to_srv (CMD_LOCK);
+	if (get_server_plist_serial() == plist_get_serial(playlist))
+		send_playlist (playlist, 1);
+
+	if (options_get_bool("SyncPlaylist")) {
+
+		/* Like loading a playlist: the clients, we too, get the
+		 * sorted items with EV_PLIST_ADD. */
+		send_int_to_srv (CMD_CLI_PLIST_CLEAR);
+		iface_set_status ("Notifying clients...");
+		send_items_to_clients (playlist);
+		plist_clear (playlist);
+		waiting_for_plist_load = iface_in_plist_menu ();
+
+		free (plist_select_pending);
+		plist_select_pending = file;
+	}
+	else {
+		iface_update_dir_content (IFACE_MENU_PLIST, playlist, NULL, NULL);
+		if (file)
+			iface_select_file (file);
+		free (file);
+	}
+
+	send_int_to_srv (CMD_UNLOCK);
+
+	iface_set_status ("");
+}
+
 /* Handle releasing silent seek key. */
 static void do_silent_seek ()
 {
@@ -2867,13 +3745,8 @@ static void make_sure_tags_exist (const char *file)
 			int type = get_int_from_srv ();
 			void *data = get_event_data (type);
 
-			if (type == EV_FILE_TAGS) {
-				struct tag_ev_response *ev
-					= (struct tag_ev_response *)data;
-
-				if (!strcmp(ev->file, file))
-					got_it = 1;
-			}
+			if (find_tags_response (type, data, file))
+				got_it = 1;
 
 			server_event (type, data);
 		}
@@ -3268,6 +4141,7 @@ static void menu_key (const struct iface_key *k)
 				delete_item ();
 				break;
 			case KEY_CMD_MENU_SEARCH:
+				finish_dir_listing ();
 				iface_make_entry (ENTRY_SEARCH);
 				break;
 			case KEY_CMD_PLIST_SAVE:
@@ -3406,6 +4280,9 @@ static void menu_key (const struct iface_key *k)
 			case KEY_CMD_PLIST_MOVE_DOWN:
 				move_item (-1);
 				break;
+			case KEY_CMD_PLIST_SORT:
+				sort_playlist ();
+				break;
 			case KEY_CMD_ADD_STREAM:
 				iface_make_entry (ENTRY_ADD_URL);
 				break;
@@ -3464,7 +4341,10 @@ static void get_and_handle_event ()
 		return;
 	}
 
-	server_event (type, get_event_data(type));
+	if (type == EV_REPLY)
+		recv_reply ();
+	else
+		server_event (type, get_event_data(type));
 }
 
 /* Handle events from the queue. */
@@ -3536,24 +4416,19 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 			send_int_to_srv (CMD_SEND_PLIST_EVENTS);
 		}
 		else if (options_get_bool("SyncPlaylist")) {
-			struct plist tmp_plist;
-
 			/* We have made the playlist from command line. */
 
-			/* The playlist should be now clear, but this will give
-			 * us the serial number of the playlist used by other
+			/* The playlist should be now clear, but we need the
+			 * serial number of the playlist used by other
 			 * clients. */
-			plist_init (&tmp_plist);
-			get_server_playlist (&tmp_plist);
+			int serial = recv_server_plist_serial ();
 
 			send_int_to_srv (CMD_SEND_PLIST_EVENTS);
 
 			send_int_to_srv (CMD_LOCK);
 			send_int_to_srv (CMD_CLI_PLIST_CLEAR);
 
-			plist_set_serial (playlist,
-					plist_get_serial(&tmp_plist));
-			plist_free (&tmp_plist);
+			plist_set_serial (playlist, serial);
 
 			change_srv_plist_serial ();
 
@@ -3578,10 +4453,14 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 
 	/* Ask the server for queue. */
 	use_server_queue ();
+	restore_snapshot_queue ();
 
 	if (options_get_bool("SyncPlaylist"))
 		send_int_to_srv (CMD_CAN_SEND_PLIST);
 
+	if (options_get_bool("Tickless"))
+		send_int_to_srv (CMD_TICKLESS);
+
 	update_state ();
 
 	if (options_get_bool("CanStartInPlaylist")
@@ -3590,24 +4469,110 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 		iface_switch_to_plist ();
 }
 
+/* In the tickless mode: show the playing time counted from the last time
+ * got from the server. */
+static void count_curr_time ()
+{
+	int elapsed, ctime;
+
+	if (curr_file.state != STATE_PLAY || curr_file.curr_time < 0)
+		return;
+
+	elapsed = (int)(get_realtime_sec () - curr_time_when);
+	if (elapsed <= 0)
+		return;
+
+	curr_time_when += elapsed;
+	ctime = curr_file.curr_time + elapsed;
+	if (curr_file.total_time > 0)
+		ctime = MIN(ctime, curr_file.total_time);
+
+	if (ctime != curr_file.curr_time) {
+		curr_file.curr_time = ctime;
+		if (silent_seek_pos == -1)
+			iface_set_curr_time (ctime);
+	}
+}
+
+static void sec_to_timespec (const double sec, struct timespec *ts)
+{
+	ts->tv_sec = (time_t)sec;
+	ts->tv_nsec = (long)((sec - ts->tv_sec) * 1000000000.0);
+}
+
+/* In the tickless mode: set the time to wait for something to do in the
+ * main loop, return NULL if there is nothing to do until an event or a
+ * key arrives. */
+static struct timespec *tickless_timeout (struct timespec *timeout)
+{
+	if (silent_seek_pos != -1 || iface_has_message ()) {
+		timeout->tv_sec = 1;
+		timeout->tv_nsec = 0;
+		return timeout;
+	}
+
+	if (curr_file.state == STATE_PLAY && curr_file.curr_time >= 0) {
+		double left = 1.0 - (get_realtime_sec () - curr_time_when);
+
+		sec_to_timespec (CLAMP(0.0, left, 1.0), timeout);
+		return timeout;
+	}
+
+	return NULL;
+}
+
 void interface_loop ()
 {
+	int tickless = options_get_bool ("Tickless");
+
 	log_circular_start ();
 
 	while (want_quit == NO_QUIT) {
 		fd_set fds;
 		int ret;
+		double refresh_due;
 		struct timespec timeout = { 1, 0 };
+		struct timespec *timeout_ptr = &timeout;
+
+		/* Don't wait if there is a directory to read, files to
+		 * check or an event already read from the socket. */
+		if (dir_listing.reader || snapshot_check.files
+				|| sock_pending(srv_sock))
+			timeout.tv_sec = 0;
+		else if (tickless)
+			timeout_ptr = tickless_timeout (&timeout);
+
+		/* Wake up to show delayed changes of the screen. */
+		refresh_due = iface_refresh_due ();
+		if (refresh_due >= 0.0 && (!timeout_ptr
+					|| timeout.tv_sec + timeout.tv_nsec
+					/ 1000000000.0 > refresh_due)) {
+			sec_to_timespec (refresh_due, &timeout);
+			timeout_ptr = &timeout;
+		}
 
 		FD_ZERO (&fds);
 		FD_SET (srv_sock, &fds);
 		FD_SET (STDIN_FILENO, &fds);
 
+		decoder_report_errors ();
+		schedule_tags ();
 		dequeue_events ();
-		ret = pselect (srv_sock + 1, &fds, NULL, NULL, &timeout, NULL);
+		if (!sock_flush(srv_sock))
+			interface_fatal ("Can't send commands to the server!");
+		ret = pselect (srv_sock + 1, &fds, NULL, NULL, timeout_ptr,
+				NULL);
 		if (ret == -1 && !want_quit && errno != EINTR)
 			interface_fatal ("pselect() failed: %s", xstrerror (errno));
 
+		if (ret >= 0 && sock_pending(srv_sock)) {
+			if (!FD_ISSET(srv_sock, &fds))
+				ret++;
+			FD_SET (srv_sock, &fds);
+		}
+
+		if (tickless)
+			count_curr_time ();
 		iface_tick ();
 
 		if (ret == 0)
@@ -3637,8 +4602,15 @@ void interface_loop ()
 		else if (user_wants_interrupt())
 			handle_interrupt ();
 
-		if (!want_quit)
+		/* Tickless: not on every timeout, the server would wake up
+		 * every second. */
+		if (!want_quit && (!tickless || ret != 0))
 			update_mixer_value ();
+
+		if (!want_quit && dir_listing.reader)
+			continue_dir_listing (DIR_LISTING_CHUNK);
+		else if (!want_quit && snapshot_check.files)
+			continue_snapshot_check (SNAPSHOT_CHECK_CHUNK);
 	}
 
 	log_circular_log ();
@@ -3663,22 +4635,35 @@ static void save_curr_dir ()
  * playlist is empty. */
 static void save_playlist_in_moc ()
 {
-	char *plist_file = create_file_name (PLAYLIST_FILE);
+	char *plist_file = xstrdup (create_file_name (PLAYLIST_FILE));
+	char *snapshot_file = xstrdup (create_file_name (PLAYLIST_SNAPSHOT_FILE));
 
-	if (plist_count(playlist) && options_get_bool("SavePlaylist"))
-		save_playlist (plist_file, 1);
-	else
+	if (plist_count(playlist) && options_get_bool("SavePlaylist")) {
+		if (!save_playlist (plist_file, 1)
+				|| !plist_save_snapshot (playlist, queue,
+				                         snapshot_file, plist_file))
+			unlink (snapshot_file);
+	}
+	else {
 		unlink (plist_file);
+		unlink (snapshot_file);
+	}
+
+	free (plist_file);
+	free (snapshot_file);
 }
 
 void interface_end ()
 {
+	stop_dir_listing ();
+	stop_snapshot_check ();
 	save_curr_dir ();
 	save_playlist_in_moc ();
 	if (want_quit == QUIT_SERVER)
 		send_int_to_srv (CMD_QUIT);
 	else
 		send_int_to_srv (CMD_DISCONNECT);
+	sock_flush (srv_sock);
 	srv_sock = -1;
 
 	windows_end ();
@@ -3687,10 +4672,16 @@ void interface_end ()
 	plist_free (dir_plist);
 	plist_free (playlist);
 	plist_free (queue);
+	plist_free (&snapshot_queue);
 	free (dir_plist);
 	free (playlist);
 	free (queue);
 
+	if (tags_sched.view)
+		lists_strs_free (tags_sched.view);
+	if (tags_sched.sent)
+		lists_strs_free (tags_sched.sent);
+
 	event_queue_free (&events);
 
 	logit ("Interface exited");
@@ -3740,6 +4731,7 @@ void interface_cmdline_clear_plist (int server_sock)
 	}
 
 	unlink (create_file_name (PLAYLIST_FILE));
+	unlink (create_file_name (PLAYLIST_SNAPSHOT_FILE));
 
 	plist_free (&plist);
 }
@@ -3903,14 +4895,14 @@ static struct file_tags *get_tags_no_iface (const char *file,
 		int type = get_int_from_srv ();
 		void *data = get_event_data (type);
 
-		if (type == EV_FILE_TAGS) {
-			struct tag_ev_response *ev
-				= (struct tag_ev_response *)data;
+		if (type == EV_FILE_TAGS || type == EV_FILE_TAGS_BATCH) {
+			struct tag_ev_response *ev;
 
-			if (!strcmp(ev->file, file))
+			ev = find_tags_response (type, data, file);
+			if (ev)
 				tags = tags_dup (ev->tags);
 
-			free_tag_ev_data (ev);
+			free_event_data (type, data);
 		}
 		else {
 			/* We can't handle other events, since this function
@@ -3923,15 +4915,115 @@ static struct file_tags *get_tags_no_iface (const char *file,
 	return tags;
 }
 
+/* The server's status read from the status page for the command line
+ * functions, NULL if they must ask the server. */
+static struct server_status *cmdline_status = NULL;
+
+/* Read the status page, so that interface_cmdline_file_info() and
+ * interface_cmdline_formatted_info() can be used without connecting to
+ * the server (server_sock == -1).  Return 0 if the page is not
+ * available. */
+int interface_cmdline_status_page ()
+{
+	struct server_status *st;
+
+	st = (struct server_status *)xmalloc (sizeof(struct server_status));
+	if (!status_page_read (create_file_name (STATUS_PAGE_FILE), st)) {
+		free (st);
+		return 0;
+	}
+
+	free (cmdline_status);
+	cmdline_status = st;
+
+	return 1;
+}
+
+/* Make a string tag from the status page. */
+static char *status_tag (const char *str)
+{
+	return str[0] ? xstrdup (str) : NULL;
+}
+
+/* Fill curr_file with the state, the current file and its tags, time,
+ * bitrate etc. */
+static void get_cmdline_status ()
+{
+	const struct server_status *st = cmdline_status;
+
+	if (!st) {
+		int state_req, file_req, channels_req, rate_req, bitrate_req,
+		    ctime_req, avg_bitrate_req;
+
+		/* One round trip instead of one for each value. */
+		state_req = send_tagged_cmd (CMD_GET_STATE, REPLY_INT);
+		file_req = send_tagged_cmd (CMD_GET_SNAME, REPLY_STR);
+		channels_req = send_tagged_cmd (CMD_GET_CHANNELS, REPLY_INT);
+		rate_req = send_tagged_cmd (CMD_GET_RATE, REPLY_INT);
+		bitrate_req = send_tagged_cmd (CMD_GET_BITRATE, REPLY_INT);
+		ctime_req = send_tagged_cmd (CMD_GET_CTIME, REPLY_INT);
+		avg_bitrate_req = send_tagged_cmd (CMD_GET_AVG_BITRATE,
+				REPLY_INT);
+
+		curr_file.state = get_reply_int (state_req);
+		curr_file.file = get_reply_str (file_req);
+		curr_file.channels = get_reply_int (channels_req);
+		curr_file.rate = get_reply_int (rate_req);
+		curr_file.bitrate = get_reply_int (bitrate_req);
+		curr_file.curr_time = get_reply_int (ctime_req);
+		curr_file.avg_bitrate = get_reply_int (avg_bitrate_req);
+
+		if (curr_file.state == STATE_STOP) {
+			file_info_cleanup (&curr_file);
+			file_info_reset (&curr_file);
+			return;
+		}
+
+		if (curr_file.file[0]) {
+			if (file_type(curr_file.file) == F_URL) {
+				send_int_to_srv (CMD_GET_TAGS);
+				curr_file.tags = get_data_tags ();
+			}
+			else
+				curr_file.tags = get_tags_no_iface (
+						curr_file.file,
+						TAGS_COMMENTS | TAGS_TIME);
+		}
+
+		return;
+	}
+
+	curr_file.state = st->state;
+	if (curr_file.state == STATE_STOP)
+		return;
+
+	curr_file.file = xstrdup (st->file);
+
+	if (curr_file.file[0]) {
+		curr_file.tags = tags_new ();
+		curr_file.tags->title = status_tag (st->title);
+		curr_file.tags->artist = status_tag (st->artist);
+		curr_file.tags->album = status_tag (st->album);
+		curr_file.tags->track = st->track;
+		curr_file.tags->time = st->time;
+		curr_file.tags->filled = st->tags_filled;
+	}
+
+	curr_file.channels = st->channels;
+	curr_file.rate = st->rate;
+	curr_file.bitrate = st->bitrate;
+	curr_file.curr_time = st->curr_time;
+	curr_file.avg_bitrate = st->avg_bitrate;
+}
+
 void interface_cmdline_file_info (const int server_sock)
 {
 	srv_sock = server_sock;	/* the interface is not initialized, so set it
 				   here */
-	init_playlists ();
 	file_info_reset (&curr_file);
 	file_info_block_init (&curr_file);
 
-	curr_file.state = get_state ();
+	get_cmdline_status ();
 
 	if (curr_file.state == STATE_STOP)
 		puts ("State: STOP");
@@ -3947,35 +5039,12 @@ void interface_cmdline_file_info (const int server_sock)
 		else if (curr_file.state == STATE_PAUSE)
 			puts ("State: PAUSE");
 
-		curr_file.file = get_curr_file ();
-
-		if (curr_file.file[0]) {
-
-			/* get tags */
-			if (file_type(curr_file.file) == F_URL) {
-				send_int_to_srv (CMD_GET_TAGS);
-				curr_file.tags = get_data_tags ();
-			}
-			else
-				curr_file.tags = get_tags_no_iface (
-						curr_file.file,
-						TAGS_COMMENTS | TAGS_TIME);
-
-			/* get the title */
-			if (curr_file.tags->title)
-				title = build_title (curr_file.tags);
-			else
-				title = xstrdup ("");
-		}
+		/* get the title */
+		if (curr_file.file[0] && curr_file.tags->title)
+			title = build_title (curr_file.tags);
 		else
 			title = xstrdup ("");
 
-		curr_file.channels = get_channels ();
-		curr_file.rate = get_rate ();
-		curr_file.bitrate = get_bitrate ();
-		curr_file.curr_time = get_curr_time ();
-		curr_file.avg_bitrate = get_avg_bitrate ();
-
 		if (curr_file.tags->time != -1)
 			sec_to_min (time_str, curr_file.tags->time);
 		else
@@ -4027,10 +5096,6 @@ void interface_cmdline_file_info (const int server_sock)
 		file_info_cleanup (&curr_file);
 		free (title);
 	}
-
-	plist_free (dir_plist);
-	plist_free (playlist);
-	plist_free (queue);
 }
 
 void interface_cmdline_enqueue (int server_sock, lists_t_strs *args)
@@ -4056,6 +5121,32 @@ void interface_cmdline_enqueue (int server_sock, lists_t_strs *args)
 	}
 }
 
+/* Print files from the server's library matching the query, the best
+ * matches first. */
+void interface_cmdline_search (int server_sock, const char *query)
+{
+	int end_of_list = 0;
+	struct plist_item *item;
+
+	srv_sock = server_sock;	/* the interface is not initialized, so set it
+				   here */
+
+	send_int_to_srv (CMD_LIBRARY_SEARCH);
+	send_str_to_srv (query);
+	send_int_to_srv (LIBRARY_SEARCH_MAX);
+	wait_for_data ();
+
+	do {
+		item = recv_item_from_srv ();
+		if (item->file[0])
+			puts (item->file);
+		else
+			end_of_list = 1;
+		plist_free_item_fields (item);
+		free (item);
+	} while (!end_of_list);
+}
+
 void interface_cmdline_playit (int server_sock, lists_t_strs *args)
 {
 	int ix, serial;
@@ -4238,11 +5329,10 @@ void interface_cmdline_formatted_info (const int server_sock,
 
 	srv_sock = server_sock;	/* the interface is not initialized, so set it
 				   here */
-	init_playlists ();
 	file_info_reset (&curr_file);
 	file_info_block_init (&curr_file);
 
-	curr_file.state = get_state ();
+	get_cmdline_status ();
 
 	/* extra paranoid about struct data */
 	memset(&str_info, 0, sizeof(str_info));
@@ -4268,34 +5358,12 @@ void interface_cmdline_formatted_info (const int server_sock,
 		else if (curr_file.state == STATE_PAUSE)
 			str_info.state = "PAUSE";
 
-		curr_file.file = get_curr_file ();
-
-		if (curr_file.file[0]) {
-
-			/* get tags */
-			if (file_type(curr_file.file) == F_URL) {
-				send_int_to_srv (CMD_GET_TAGS);
-				curr_file.tags = get_data_tags ();
-			}
-			else
-				curr_file.tags = get_tags_no_iface (
-						curr_file.file,
-						TAGS_COMMENTS | TAGS_TIME);
-
-			/* get the title */
-			if (curr_file.tags->title)
-				str_info.title = build_title (curr_file.tags);
-			else
-				str_info.title = xstrdup ("");
-		}
+		/* get the title */
+		if (curr_file.file[0] && curr_file.tags->title)
+			str_info.title = build_title (curr_file.tags);
 		else
 			str_info.title = xstrdup ("");
 
-		curr_file.channels = get_channels ();
-		curr_file.rate = get_rate ();
-		curr_file.bitrate = get_bitrate ();
-		curr_file.curr_time = get_curr_time ();
-
 		if (curr_file.tags->time != -1)
 			sec_to_min (time_str, curr_file.tags->time);
 		else
@@ -4372,8 +5440,4 @@ void interface_cmdline_formatted_info (const int server_sock,
 
 	if (curr_file.state != STATE_STOP)
 		file_info_cleanup (&curr_file);
-
-	plist_free (dir_plist);
-	plist_free (playlist);
-	plist_free (queue);
 }
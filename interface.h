@@ -42,6 +42,7 @@ void interface_fatal (const char *format, ...) ATTR_PRINTF(1, 2);
 void interface_cmdline_clear_plist (int server_sock);
 void interface_cmdline_append (int server_sock, lists_t_strs *args);
 void interface_cmdline_play_first (int server_sock);
+int interface_cmdline_status_page ();
 void interface_cmdline_file_info (const int server_sock);
 void interface_cmdline_playit (int server_sock, lists_t_strs *args);
 void interface_cmdline_seek_by (int server_sock, const int seek_by);
@@ -51,6 +52,7 @@ void interface_cmdline_adj_volume (int server_sock, const char *arg);
 void interface_cmdline_set (int server_sock, char *arg, const int val);
 void interface_cmdline_formatted_info (const int server_sock, const char *format_str);
 void interface_cmdline_enqueue (int server_sock, lists_t_strs *args);
+void interface_cmdline_search (int server_sock, const char *query);
 
 #ifdef __cplusplus
 }
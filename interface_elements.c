@@ -197,6 +197,15 @@ struct queued_message
 	void *data;
 };
 
+/* Changes of the screen which are not urgent are sent to the terminal not
+ * sooner than this time (in seconds) after the previous update. */
+#define REFRESH_DELAY	0.04
+
+/* Are there changes not sent to the terminal and when were they sent last
+ * time? */
+static int refresh_pending = 0;
+static double last_refresh = 0.0;
+
 static struct info_win
 {
 	WINDOW *win;
@@ -751,6 +760,7 @@ static void side_menu_init_menu (struct side_menu *m)
 
 	m->menu.list.main = menu_new (m->win, m->posx + 1, m->posy + 1,
 			m->width - 2, side_menu_get_menu_height (m));
+	menu_set_bg_attr (m->menu.list.main, get_color(CLR_BACKGROUND));
 }
 
 static void side_menu_init (struct side_menu *m, const enum side_menu_type type,
@@ -1091,13 +1101,94 @@ static void side_menu_clear (struct side_menu *m)
 	menu_set_info_attr_sel_marked (m->menu.list.main, get_color(CLR_MENU_ITEM_INFO_MARKED_SELECTED));
 }
 
+/* Add the directories from the list starting at 'from' to the menu. */
+static void side_menu_add_dirs (struct side_menu *m, const lists_t_strs *dirs,
+		const int from)
+{
+	struct menu_item *added;
+	int i;
+
+	for (i = from; i < lists_strs_size (dirs) ; i++) {
+		char title[PATH_MAX];
+
+#ifdef HAVE_RCC
+		char *t_str = NULL;
+		if (options_get_bool("UseRCCForFilesystem")) {
+			strcpy (title, strrchr (lists_strs_at (dirs, i), '/') + 1);
+			strcat (title, "/");
+			t_str = xstrdup (title);
+			t_str = rcc_reencode (t_str);
+			snprintf(title, PATH_MAX, "%s", t_str);
+			free(t_str);
+		}
+		else
+#endif
+		if (options_get_bool ("FileNamesIconv"))
+		{
+			char *conv_title = files_iconv_str (
+					strrchr (lists_strs_at (dirs, i), '/') + 1);
+
+			strcpy (title, conv_title);
+			strcat (title, "/");
+
+			free (conv_title);
+		}
+		else
+		{
+			strcpy (title, strrchr (lists_strs_at (dirs, i), '/') + 1);
+			strcat (title, "/");
+		}
+
+		added = menu_add (m->menu.list.main, title, F_DIR,
+				lists_strs_at (dirs, i));
+		menu_item_set_attr_normal (added,
+				get_color(CLR_MENU_ITEM_DIR));
+		menu_item_set_attr_sel (added,
+				get_color(CLR_MENU_ITEM_DIR_SELECTED));
+	}
+}
+
+/* Add the playlists from the list starting at 'from' to the menu. */
+static void side_menu_add_playlists (struct side_menu *m,
+		const lists_t_strs *playlists, const int from)
+{
+	struct menu_item *added;
+	int i;
+
+	for (i = from; i < lists_strs_size (playlists); i++){
+		added = menu_add (m->menu.list.main,
+				strrchr (lists_strs_at (playlists, i), '/') + 1,
+				F_PLAYLIST, lists_strs_at (playlists, i));
+		menu_item_set_attr_normal (added,
+				get_color(CLR_MENU_ITEM_PLAYLIST));
+		menu_item_set_attr_sel (added,
+				get_color(
+				CLR_MENU_ITEM_PLAYLIST_SELECTED));
+	}
+}
+
+/* Add the items of the playlist starting at 'from' to the menu. */
+static void side_menu_add_files (struct side_menu *m,
+		const struct plist *files, const int from)
+{
+	int i;
+
+	for (i = from; i < files->num; i++) {
+		if (!plist_deleted(files, i))
+			add_to_menu (m->menu.list.main, files, i,
+					m->type == MENU_PLAYLIST
+					&& options_get_bool("PlaylistFullPaths"));
+	}
+
+	m->total_time = plist_total_time (files, &m->total_time_for_all);
+}
+
 /* Fill the directory or playlist side menu with this content. */
 static void side_menu_make_list_content (struct side_menu *m,
 		const struct plist *files, const lists_t_strs *dirs,
 		const lists_t_strs *playlists, const int add_up_dir)
 {
 	struct menu_item *added;
-	int i;
 
 	assert (m != NULL);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
@@ -1114,66 +1205,58 @@ static void side_menu_make_list_content (struct side_menu *m,
 	}
 
 	if (dirs)
-		for (i = 0; i < lists_strs_size (dirs) ; i++) {
-			char title[PATH_MAX];
+		side_menu_add_dirs (m, dirs, 0);
+	if (playlists)
+		side_menu_add_playlists (m, playlists, 0);
+	side_menu_add_files (m, files, 0);
+}
 
-#ifdef HAVE_RCC
-			char *t_str = NULL;
-			if (options_get_bool("UseRCCForFilesystem")) {
-				strcpy (title, strrchr (lists_strs_at (dirs, i), '/') + 1);
-				strcat (title, "/");
-				t_str = xstrdup (title);
-				t_str = rcc_reencode (t_str);
-				snprintf(title, PATH_MAX, "%s", t_str);
-				free(t_str);
-			}
-			else
-#endif
-			if (options_get_bool ("FileNamesIconv"))
-			{
-				char *conv_title = files_iconv_str (
-						strrchr (lists_strs_at (dirs, i), '/') + 1);
+/* Order of the directory menu: "../", directories, playlists and files,
+ * each sorted by the file name as go_to_dir() sorts them. */
+static int dir_menu_item_rank (const struct menu_item *mi)
+{
+	if (!strcmp (mi->file, ".."))
+		return 0;
+	if (mi->type == F_DIR)
+		return 1;
+	if (mi->type == F_PLAYLIST)
+		return 2;
+	return 3;
+}
 
-				strcpy (title, conv_title);
-				strcat (title, "/");
+static int dir_menu_item_cmp (const void *a, const void *b)
+{
+	const struct menu_item *ma = *(struct menu_item * const *)a;
+	const struct menu_item *mb = *(struct menu_item * const *)b;
+	int ra, rb;
 
-				free (conv_title);
-			}
-			else
-			{
-				strcpy (title, strrchr (lists_strs_at (dirs, i), '/') + 1);
-				strcat (title, "/");
-			}
+	ra = dir_menu_item_rank (ma);
+	rb = dir_menu_item_rank (mb);
+	if (ra != rb)
+		return ra - rb;
 
-			added = menu_add (m->menu.list.main, title, F_DIR,
-					lists_strs_at (dirs, i));
-			menu_item_set_attr_normal (added,
-					get_color(CLR_MENU_ITEM_DIR));
-			menu_item_set_attr_sel (added,
-					get_color(CLR_MENU_ITEM_DIR_SELECTED));
-		}
+	return strcoll (ma->file, mb->file);
+}
 
-	if (playlists)
-		for (i = 0; i < lists_strs_size (playlists); i++){
-			added = menu_add (m->menu.list.main,
-					strrchr (lists_strs_at (playlists, i), '/') + 1,
-					F_PLAYLIST, lists_strs_at (playlists, i));
-			menu_item_set_attr_normal (added,
-					get_color(CLR_MENU_ITEM_PLAYLIST));
-			menu_item_set_attr_sel (added,
-					get_color(
-					CLR_MENU_ITEM_PLAYLIST_SELECTED));
-		}
+/* Add the entries read from the given positions of the lists on to the
+ * directory menu, merging them into the items already there. */
+static void side_menu_add_dir_content (struct side_menu *m,
+		const struct plist *files, const int files_from,
+		const lists_t_strs *dirs, const int dirs_from,
+		const lists_t_strs *playlists, const int playlists_from)
+{
+	int from;
 
-	/* playlist items */
-	for (i = 0; i < files->num; i++) {
-		if (!plist_deleted(files, i))
-			add_to_menu (m->menu.list.main, files, i,
-					m->type == MENU_PLAYLIST
-					&& options_get_bool("PlaylistFullPaths"));
-	}
+	assert (m != NULL);
+	assert (m->type == MENU_DIR);
+	assert (m->menu.list.main != NULL);
+	assert (m->menu.list.copy == NULL);
 
-	m->total_time = plist_total_time (files, &m->total_time_for_all);
+	from = menu_nitems (m->menu.list.main);
+	side_menu_add_dirs (m, dirs, dirs_from);
+	side_menu_add_playlists (m, playlists, playlists_from);
+	side_menu_add_files (m, files, files_from);
+	menu_merge_items (m->menu.list.main, from, dir_menu_item_cmp);
 }
 
 static void clear_area (WINDOW *w, const int posx, const int posy,
@@ -1288,6 +1371,19 @@ static void side_menu_draw (const struct side_menu *m, const int active)
 		abort ();
 }
 
+/* Draw only the items of the menu which have changed. */
+static void side_menu_draw_changed (const struct side_menu *m,
+		const int active)
+{
+	assert (m != NULL);
+	assert (m->visible);
+	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
+
+	menu_draw_changed (m->menu.list.main, active);
+	if (options_get_bool("UseCursorSelection"))
+		menu_set_cursor (m->menu.list.main);
+}
+
 static void side_menu_cmd (struct side_menu *m, const enum key_cmd cmd)
 {
 	assert (m != NULL);
@@ -1599,6 +1695,7 @@ static void side_menu_set_plist_time (struct side_menu *m, const int time,
 }
 
 /* Replace the menu with one having only those items which contain 'pattern'.
+ * If the pattern was extended, only the items shown are searched.
  * If no items match, don't do anything.
  * Return the number of matching items. */
 static int side_menu_filter (struct side_menu *m, const char *pattern)
@@ -1609,8 +1706,13 @@ static int side_menu_filter (struct side_menu *m, const char *pattern)
 	assert (pattern != NULL);
 	assert (m->menu.list.main != NULL);
 
-	filtered_menu = menu_filter_pattern (m->menu.list.copy
-			? m->menu.list.copy : m->menu.list.main, pattern);
+	if (m->menu.list.copy && menu_filter_narrows (m->menu.list.main,
+	                                              pattern))
+		filtered_menu = menu_filter_pattern (m->menu.list.main, pattern);
+	else
+		filtered_menu = menu_filter_pattern (m->menu.list.copy
+				? m->menu.list.copy : m->menu.list.main,
+				pattern);
 
 	if (menu_nitems(filtered_menu) == 0) {
 		menu_free (filtered_menu);
@@ -1636,6 +1738,7 @@ static void side_menu_use_main (struct side_menu *m)
 		menu_free (m->menu.list.main);
 		m->menu.list.main = m->menu.list.copy;
 		m->menu.list.copy = NULL;
+		menu_filter_end (m->menu.list.main);
 	}
 }
 
@@ -1650,6 +1753,23 @@ static void side_menu_make_visible (struct side_menu *m, const char *file)
 		menu_make_visible (m->menu.list.main, file);
 }
 
+/* Is the file's item shown on the screen? */
+static int side_menu_is_file_visible (struct side_menu *m, const char *file)
+{
+	struct menu_item *mi;
+
+	assert (m != NULL);
+	assert (m->type == MENU_PLAYLIST || m->type == MENU_DIR);
+	assert (file != NULL);
+
+	if (!m->visible)
+		return 0;
+
+	mi = menu_find (m->menu.list.main, file);
+
+	return mi && menu_is_visible (m->menu.list.main, mi);
+}
+
 static void side_menu_swap_items (struct side_menu *m, const char *file1,
 		const char *file2)
 {
@@ -1786,6 +1906,35 @@ static void main_win_draw_lyrics_screen (const struct main_win *w)
 	lists_strs_free (lyrics_array);
 }
 
+/* Return != 0 if a part of the menu is covered by another menu drawn after
+ * it by main_win_draw(). */
+static int main_win_menu_covered (const struct main_win *w,
+		const struct side_menu *m)
+{
+	size_t ix;
+
+	assert (w != NULL);
+	assert (m != NULL);
+
+	if (m == &w->menus[w->selected_menu])
+		return 0;
+
+	for (ix = 0; ix < ARRAY_SIZE(w->menus); ix += 1) {
+		const struct side_menu *o = &w->menus[ix];
+
+		if (o == m || !o->visible
+				|| (o < m && ix != (size_t)w->selected_menu))
+			continue;
+
+		if (o->posx < m->posx + m->width && m->posx < o->posx + o->width
+				&& o->posy < m->posy + m->height
+				&& m->posy < o->posy + o->height)
+			return 1;
+	}
+
+	return 0;
+}
+
 static void main_win_draw (struct main_win *w)
 {
 	size_t ix;
@@ -1871,6 +2020,24 @@ static void main_win_update_dir_content (struct main_win *w,
 	main_win_draw (w);
 }
 
+static void main_win_add_dir_content (struct main_win *w,
+		const struct plist *files, const int files_from,
+		const lists_t_strs *dirs, const int dirs_from,
+		const lists_t_strs *playlists, const int playlists_from)
+{
+	struct side_menu *m;
+
+	assert (w != NULL);
+
+	m = find_side_menu (w, MENU_DIR);
+
+	side_menu_add_dir_content (m, files, files_from, dirs, dirs_from,
+			playlists, playlists_from);
+	if (w->curr_file)
+		side_menu_mark_file (m, w->curr_file);
+	main_win_draw (w);
+}
+
 static void main_win_switch_to (struct main_win *w,
 		const enum side_menu_type menu)
 {
@@ -2002,8 +2169,14 @@ static void main_win_update_item (struct main_win *w,
 
 	m = find_side_menu (w, iface_to_side_menu(iface_menu));
 
-	if (side_menu_update_item(m, plist, n))
+	if (!side_menu_update_item(m, plist, n)
+			|| w->in_help || w->in_lyrics || w->too_small)
+		return;
+
+	if (main_win_menu_covered (w, m))
 		main_win_draw (w);
+	else
+		side_menu_draw_changed (m, m == &w->menus[w->selected_menu]);
 }
 
 /* Mark the played file on all lists of files or unmark it when file is NULL. */
@@ -2288,6 +2461,15 @@ static void main_win_make_visible (struct main_win *w,
 	main_win_draw (w);
 }
 
+static int main_win_is_file_visible (struct main_win *w,
+		const enum side_menu_type type, const char *file)
+{
+	assert (w != NULL);
+	assert (file != NULL);
+
+	return side_menu_is_file_visible (find_side_menu (w, type), file);
+}
+
 static void main_win_update_show_time (struct main_win *w)
 {
 	size_t ix;
@@ -2919,6 +3101,9 @@ static void info_win_set_curr_time (struct info_win *w, const int time)
 	assert (w != NULL);
 	assert (time >= -1);
 
+	if (w->curr_time == time)
+		return;
+
 	w->curr_time = time;
 	if (w->total_time > 0 && w->curr_time >= 0)
 		bar_set_fill (&w->time_bar, w->curr_time * 100.0 / w->total_time);
@@ -3041,6 +3226,9 @@ static void info_win_set_bitrate (struct info_win *w, const int bitrate)
 	assert (w != NULL);
 	assert (bitrate >= -1);
 
+	if (w->bitrate == (bitrate > 0 ? bitrate : -1))
+		return;
+
 	w->bitrate = bitrate > 0 ? bitrate : -1;
 	info_win_draw_bitrate (w);
 }
@@ -3050,6 +3238,9 @@ static void info_win_set_rate (struct info_win *w, const int rate)
 	assert (w != NULL);
 	assert (rate >= -1);
 
+	if (w->rate == (rate > 0 ? rate : -1))
+		return;
+
 	w->rate = rate > 0 ? rate : -1;
 	info_win_draw_rate (w);
 }
@@ -3058,6 +3249,9 @@ static void info_win_set_mixer_value (struct info_win *w, const int value)
 {
 	assert (w != NULL);
 
+	if (w->mixer_bar.filled == (float)MIN(value, 100))
+		return;
+
 	bar_set_fill (&w->mixer_bar, (double) value);
 	if (!w->in_entry && !w->too_small)
 		bar_draw (&w->mixer_bar, w->win, COLS - 37, 0);
@@ -3123,8 +3317,9 @@ static void info_win_make_entry (struct info_win *w, const enum entry_type type)
 	entry_draw (&w->entry, w->win, 1, 0);
 }
 
-/* Display the next queued message. */
-static void info_win_display_msg (struct info_win *w)
+/* Display the next queued message if it's time for it.  Return != 0 if
+ * the message has changed. */
+static int info_win_display_msg (struct info_win *w)
 {
 	int msg_changed;
 
@@ -3179,6 +3374,8 @@ static void info_win_display_msg (struct info_win *w)
 
 	if (msg_changed)
 		info_win_draw_title (w);
+
+	return msg_changed;
 }
 
 /* Force the next queued message to be displayed. */
@@ -3268,6 +3465,9 @@ static void info_win_set_channels (struct info_win *w, const int channels)
 	assert (w != NULL);
 	assert (channels == 1 || channels == 2);
 
+	if (w->state_stereo == (channels == 2))
+		return;
+
 	w->state_stereo = (channels == 2);
 	info_win_draw_options_state (w);
 }
@@ -3355,10 +3555,11 @@ static void info_win_set_files_time (struct info_win *w, const int time,
 	info_win_draw_files_time (w);
 }
 
-/* Update the message timeout, redraw the window if needed. */
-static void info_win_tick (struct info_win *w)
+/* Update the message timeout, redraw the window if needed.  Return != 0
+ * if something was drawn. */
+static int info_win_tick (struct info_win *w)
 {
-	info_win_display_msg (w);
+	return info_win_display_msg (w);
 }
 
 /* Draw static elements of info_win: frames, legend etc. */
@@ -3684,6 +3885,31 @@ static void iface_refresh_screen ()
 		wnoutrefresh (main_win.win);
 	}
 	doupdate ();
+
+	refresh_pending = 0;
+	last_refresh = get_realtime_sec ();
+}
+
+/* Update the screen with iface_tick() later, so that changes made in a
+ * short time (like tags arriving for many files) are sent to the terminal
+ * at once. */
+static void iface_refresh_later ()
+{
+	refresh_pending = 1;
+}
+
+/* Return the time (in seconds) after which iface_tick() should be called
+ * to show delayed changes of the screen, -1.0 if there are none. */
+double iface_refresh_due ()
+{
+	double left;
+
+	if (!refresh_pending)
+		return -1.0;
+
+	left = last_refresh + REFRESH_DELAY - get_realtime_sec ();
+
+	return MAX(left, 0.0);
 }
 
 /* Set state of the options displayed in the information window. */
@@ -3769,6 +3995,8 @@ void iface_update_attrs ()
 		struct menu *menu = m->menu.list.main;
 		struct menu_item *mi;
 
+		menu_set_bg_attr (menu, get_color (CLR_BACKGROUND));
+
 		if (m->type == MENU_DIR || m->type == MENU_PLAYLIST) {
 			menu_set_info_attr_normal (menu, get_color (CLR_MENU_ITEM_INFO));
 			menu_set_info_attr_sel (menu, get_color (CLR_MENU_ITEM_INFO_SELECTED));
@@ -3834,6 +4062,25 @@ void iface_update_dir_content (const enum iface_menu iface_menu,
 	iface_refresh_screen ();
 }
 
+/* Add the directory entries read after those already in the directory
+ * menu: the playlist items, directories and playlists from the given
+ * positions on. */
+void iface_add_dir_content (const struct plist *files, const int files_from,
+		const lists_t_strs *dirs, const int dirs_from,
+		const lists_t_strs *playlists, const int playlists_from)
+{
+	main_win_add_dir_content (&main_win, files, files_from, dirs, dirs_from,
+			playlists, playlists_from);
+	info_win_set_files_time (&info_win,
+			main_win_get_files_time(&main_win, IFACE_MENU_DIR),
+			main_win_is_time_for_all(&main_win, IFACE_MENU_DIR));
+
+	iface_show_num_files (plist_count(files) + lists_strs_size (dirs)
+			+ lists_strs_size (playlists));
+
+	iface_refresh_screen ();
+}
+
 /* Update item title and time in the menu. */
 void iface_update_item (const enum iface_menu menu,
 		const struct plist *plist, const int n)
@@ -3844,7 +4091,7 @@ void iface_update_item (const enum iface_menu menu,
 	info_win_set_files_time (&info_win,
 			main_win_get_curr_files_time(&main_win),
 			main_win_is_curr_time_for_all(&main_win));
-	iface_refresh_screen ();
+	iface_refresh_later ();
 }
 
 /* Change the current item in the directory menu to this item. */
@@ -3978,7 +4225,7 @@ char *iface_get_curr_file ()
 void iface_set_curr_time (const int time)
 {
 	info_win_set_curr_time (&info_win, time);
-	iface_refresh_screen ();
+	iface_refresh_later ();
 }
 
 /* Set the total time for the currently played file. */
@@ -4009,7 +4256,7 @@ void iface_set_bitrate (const int bitrate)
 	assert (bitrate >= -1);
 
 	info_win_set_bitrate (&info_win, bitrate);
-	iface_refresh_screen ();
+	iface_refresh_later ();
 }
 
 /* Set the rate (in kHz). 0 or -1 means no rate information. */
@@ -4018,7 +4265,7 @@ void iface_set_rate (const int rate)
 	assert (rate >= -1);
 
 	info_win_set_rate (&info_win, rate);
-	iface_refresh_screen ();
+	iface_refresh_later ();
 }
 
 /* Set the number of channels. */
@@ -4027,7 +4274,7 @@ void iface_set_channels (const int channels)
 	assert (channels == 1 || channels == 2);
 
 	info_win_set_channels (&info_win, channels);
-	iface_refresh_screen ();
+	iface_refresh_later ();
 }
 
 /* Set the currently played file. If file is NULL, nothing is played. */
@@ -4061,11 +4308,20 @@ void iface_set_played_file_title (const char *title)
 }
 
 /* Update timeouts, refresh the screen if needed. This should be called at
- * least once a second. */
+ * least once a second and when iface_refresh_due() says so. */
 void iface_tick ()
 {
-	info_win_tick (&info_win);
-	iface_refresh_screen ();
+	if (info_win_tick (&info_win))
+		refresh_pending = 1;
+	if (refresh_pending && iface_refresh_due () == 0.0)
+		iface_refresh_screen ();
+}
+
+/* Return != 0 if a message is displayed or waiting to be displayed, so
+ * iface_tick() must be called to take it down when its time is up. */
+int iface_has_message ()
+{
+	return info_win.current_message || info_win.queued_message_head;
 }
 
 void iface_set_mixer_value (const int value)
@@ -4073,7 +4329,7 @@ void iface_set_mixer_value (const int value)
 	assert (value >= 0);
 
 	info_win_set_mixer_value (&info_win, value);
-	iface_refresh_screen ();
+	iface_refresh_later ();
 }
 
 /* Switch to the playlist menu. */
@@ -4367,6 +4623,34 @@ void iface_make_visible (const enum iface_menu menu, const char *file)
 	iface_refresh_screen ();
 }
 
+/* Is the file's item on the screen (not scrolled out of the menu)? */
+int iface_file_is_visible (const enum iface_menu menu, const char *file)
+{
+	assert (file != NULL);
+
+	return main_win_is_file_visible (&main_win,
+			menu == IFACE_MENU_DIR ? MENU_DIR : MENU_PLAYLIST,
+			file);
+}
+
+/* Add the files shown in the menu to the list, then up to prefetch files
+ * beyond them in the direction of scrolling.  Nothing is added if the menu
+ * is not on the screen. */
+void iface_get_visible_files (const enum iface_menu iface_menu,
+		const int prefetch, lists_t_strs *files)
+{
+	struct side_menu *m;
+
+	assert (files != NULL);
+
+	if (main_win.in_help || main_win.in_lyrics || main_win.too_small)
+		return;
+
+	m = find_side_menu (&main_win, iface_to_side_menu(iface_menu));
+	if (!main_win_menu_covered (&main_win, m))
+		menu_get_visible_files (m->menu.list.main, prefetch, files);
+}
+
 void iface_switch_to_theme_menu ()
 {
 	main_win_create_themes_menu (&main_win);
@@ -73,6 +73,9 @@ void iface_update_dir_content (const enum iface_menu iface_menu,
 		const struct plist *files,
 		const lists_t_strs *dirs,
 		const lists_t_strs *playlists);
+void iface_add_dir_content (const struct plist *files, const int files_from,
+		const lists_t_strs *dirs, const int dirs_from,
+		const lists_t_strs *playlists, const int playlists_from);
 void iface_set_curr_item_title (const char *title);
 void iface_get_key (struct iface_key *k);
 int iface_key_is_resize (const struct iface_key *k);
@@ -96,6 +99,8 @@ void iface_set_played_file_title (const char *title);
 void iface_set_mixer_value (const int value);
 void iface_set_files_in_queue (const int num);
 void iface_tick ();
+double iface_refresh_due ();
+int iface_has_message ();
 void iface_switch_to_plist ();
 void iface_switch_to_dir ();
 void iface_add_to_plist (const struct plist *plist, const int num);
@@ -134,6 +139,9 @@ void iface_toggle_layout ();
 void iface_toggle_percent ();
 void iface_swap_plist_items (const char *file1, const char *file2);
 void iface_make_visible (const enum iface_menu menu, const char *file);
+int iface_file_is_visible (const enum iface_menu menu, const char *file);
+void iface_get_visible_files (const enum iface_menu iface_menu,
+		const int prefetch, lists_t_strs *files);
 void iface_switch_to_theme_menu ();
 void iface_add_file (const char *file, const char *title,
 		const enum file_type type);
@@ -830,6 +830,14 @@ static struct command commands[] = {
 		CON_MENU,
 		{ 'Z', -1 },
 		1
+	},
+	{
+		KEY_CMD_PLIST_SORT,
+		"sort_playlist",
+		"Sort the playlist by tags",
+		CON_MENU,
+		{ 'O', -1 },
+		1
 	}
 };
 
@@ -105,6 +105,7 @@ enum key_cmd
 	KEY_CMD_LYRICS,
 	KEY_CMD_QUEUE_TOGGLE_FILE,
 	KEY_CMD_QUEUE_CLEAR,
+	KEY_CMD_PLIST_SORT,
 	KEY_CMD_WRONG
 };
 
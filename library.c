@@ -0,0 +1,923 @@
+/*
+ * MOC - music on console
+ * Copyright (C) 2026 The MOC developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* The library is the server's list of all sound files under MusicDir with
+ * their tags.  It's filled by the library indexer, kept on disk between
+ * runs and searched using a trigram index over titles, artists, albums and
+ * file names. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEBUG
+
+#include "common.h"
+#include "log.h"
+#include "options.h"
+#include "playlist.h"
+#include "library.h"
+
+#define LIBRARY_FILE	"library"
+#define LIBRARY_MAGIC	"MOCLIB"
+
+/* Increase this if the format of the file changes. */
+#define LIBRARY_VERSION	1
+
+/* Searched fields of an entry; the name is the file name without the
+ * directory. */
+enum lib_field
+{
+	LF_TITLE,
+	LF_ARTIST,
+	LF_ALBUM,
+	LF_NAME,
+	LF_COUNT
+};
+
+/* How much a match in each field counts when ranking results. */
+static const int field_weight[LF_COUNT] = { 4, 3, 2, 1 };
+
+struct lib_entry
+{
+	char *file;
+	char *tags[LF_NAME];	/* title, artist, album or NULL */
+	int track;
+	int time;
+	time_t mtime;		/* mtime of the file when tags were read */
+	unsigned int generation; /* the walk in which the file was seen */
+	int deleted;
+};
+
+/* Entries containing a trigram (three bytes folded to lower case). */
+struct gram_postings
+{
+	uint32_t gram;		/* zero if the slot is empty */
+	int *ids;		/* sorted entry indexes */
+	int num;
+	int allocated;
+};
+
+/* Values of the file name hash table slots other than entry indexes. */
+#define SLOT_EMPTY	(-1)
+#define SLOT_REMOVED	(-2)
+
+static struct
+{
+	pthread_mutex_t mtx;
+	int initialized;
+
+	struct lib_entry *entries;
+	int num;
+	int allocated;
+	int deleted_num;
+
+	/* File name -> entry index, open addressing. */
+	int *slots;
+	int slots_size;
+	int slots_used;		/* including SLOT_REMOVED */
+
+	/* Trigram -> postings, open addressing. */
+	struct gram_postings *grams;
+	int grams_size;
+	int grams_used;
+
+	unsigned int generation;
+	int dirty;		/* changed since last saved? */
+} library = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER
+};
+
+static inline int fold (const int c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static uint32_t hash_str (const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static inline uint32_t hash_gram (const uint32_t gram)
+{
+	return gram * 2654435761u;
+}
+
+static const char *entry_field (const struct lib_entry *e,
+                                const enum lib_field f)
+{
+	if (f == LF_NAME) {
+		const char *slash = strrchr (e->file, '/');
+
+		return slash ? slash + 1 : e->file;
+	}
+
+	return e->tags[f];
+}
+
+/* Find the slot for the file: the one holding it or an empty one. */
+static int find_slot (const char *file)
+{
+	int i, removed = -1;
+
+	i = hash_str (file) & (library.slots_size - 1);
+	while (library.slots[i] != SLOT_EMPTY) {
+		if (library.slots[i] == SLOT_REMOVED) {
+			if (removed == -1)
+				removed = i;
+		}
+		else if (!strcmp (library.entries[library.slots[i]].file, file))
+			return i;
+
+		i = (i + 1) & (library.slots_size - 1);
+	}
+
+	return removed != -1 ? removed : i;
+}
+
+static int find_entry (const char *file)
+{
+	int slot;
+
+	if (!library.slots_size)
+		return -1;
+
+	slot = find_slot (file);
+
+	return library.slots[slot] >= 0 ? library.slots[slot] : -1;
+}
+
+static void rebuild_slots (const int size)
+{
+	int i;
+
+	free (library.slots);
+	library.slots_size = size;
+	library.slots = (int *)xmalloc (size * sizeof (int));
+	for (i = 0; i < size; i++)
+		library.slots[i] = SLOT_EMPTY;
+	library.slots_used = 0;
+
+	for (i = 0; i < library.num; i++) {
+		if (!library.entries[i].deleted) {
+			library.slots[find_slot (library.entries[i].file)] = i;
+			library.slots_used += 1;
+		}
+	}
+}
+
+static struct gram_postings *find_gram (const uint32_t gram)
+{
+	int i;
+
+	i = hash_gram (gram) & (library.grams_size - 1);
+	while (library.grams[i].gram && library.grams[i].gram != gram)
+		i = (i + 1) & (library.grams_size - 1);
+
+	return &library.grams[i];
+}
+
+static void grams_grow ()
+{
+	int i, old_size = library.grams_size;
+	struct gram_postings *old = library.grams;
+
+	library.grams_size = old_size ? 2 * old_size : 4096;
+	library.grams = (struct gram_postings *)xcalloc (library.grams_size,
+	                                        sizeof (struct gram_postings));
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].gram)
+			*find_gram (old[i].gram) = old[i];
+
+	free (old);
+}
+
+static void add_posting (const uint32_t gram, const int id)
+{
+	struct gram_postings *p;
+
+	if (4 * (library.grams_used + 1) > 3 * library.grams_size)
+		grams_grow ();
+
+	p = find_gram (gram);
+	if (!p->gram) {
+		p->gram = gram;
+		library.grams_used += 1;
+	}
+
+	if (p->num && p->ids[p->num - 1] == id)
+		return;
+
+	if (p->num == p->allocated) {
+		p->allocated = p->allocated ? 2 * p->allocated : 4;
+		p->ids = (int *)xrealloc (p->ids, p->allocated * sizeof (int));
+	}
+	p->ids[p->num++] = id;
+}
+
+static void index_entry (const int id)
+{
+	int f;
+	const struct lib_entry *e = &library.entries[id];
+
+	for (f = 0; f < LF_COUNT; f++) {
+		const unsigned char *s;
+
+		s = (const unsigned char *)entry_field (e, f);
+		if (!s)
+			continue;
+
+		for (; s[0] && s[1] && s[2]; s++)
+			add_posting ((fold (s[0]) << 16) | (fold (s[1]) << 8)
+			             | fold (s[2]), id);
+	}
+}
+
+static void free_entry (struct lib_entry *e)
+{
+	int f;
+
+	free (e->file);
+	for (f = 0; f < LF_NAME; f++)
+		free (e->tags[f]);
+}
+
+static void free_index ()
+{
+	int i;
+
+	for (i = 0; i < library.grams_size; i++)
+		free (library.grams[i].ids);
+	free (library.grams);
+	library.grams = NULL;
+	library.grams_size = 0;
+	library.grams_used = 0;
+}
+
+/* Drop deleted entries and rebuild the indexes. */
+static void compact ()
+{
+	int i, j;
+
+	for (i = j = 0; i < library.num; i++) {
+		if (library.entries[i].deleted)
+			free_entry (&library.entries[i]);
+		else
+			library.entries[j++] = library.entries[i];
+	}
+	library.num = j;
+	library.deleted_num = 0;
+
+	free_index ();
+	for (i = 0; i < library.num; i++)
+		index_entry (i);
+
+	rebuild_slots (library.slots_size);
+}
+
+static void delete_entry (const int id)
+{
+	library.entries[id].deleted = 1;
+	library.slots[find_slot (library.entries[id].file)] = SLOT_REMOVED;
+	library.deleted_num += 1;
+	library.dirty = 1;
+}
+
+/* Compact the library if most entries are deleted.  This changes entry
+ * indexes, so it's never done in the middle of a loop over entries. */
+static void maybe_compact ()
+{
+	if (library.deleted_num > 1024 && 2 * library.deleted_num > library.num)
+		compact ();
+}
+
+/* Append an entry taking ownership of the strings and index it. */
+static void append_entry (const struct lib_entry *e)
+{
+	int id;
+
+	if (4 * (library.slots_used + 1) > 3 * library.slots_size) {
+		int size = library.slots_size;
+
+		while (2 * (library.num - library.deleted_num + 1) > size)
+			size *= 2;
+		rebuild_slots (size);
+	}
+
+	if (library.num == library.allocated) {
+		library.allocated = library.allocated ? 2 * library.allocated : 1024;
+		library.entries = (struct lib_entry *)xrealloc (library.entries,
+		                     library.allocated * sizeof (struct lib_entry));
+	}
+
+	id = library.num++;
+	library.entries[id] = *e;
+	library.entries[id].deleted = 0;
+
+	library.slots[find_slot (e->file)] = id;
+	library.slots_used += 1;
+	index_entry (id);
+}
+
+static void write_str (FILE *f, const char *s)
+{
+	int len = s ? strlen (s) : 0;
+
+	fwrite (&len, sizeof (len), 1, f);
+	fwrite (s ? s : "", 1, len, f);
+}
+
+/* Read a string from the buffer, return NULL on error.  An empty string
+ * is returned as NULL in *str if 'null_empty' is set. */
+static int read_str (const char **pos, const char *end, char **str,
+                     const int null_empty)
+{
+	int len;
+
+	if (end - *pos < ssizeof(len))
+		return 0;
+	memcpy (&len, *pos, sizeof (len));
+	*pos += sizeof (len);
+
+	if (len < 0 || len > end - *pos)
+		return 0;
+
+	if (len == 0 && null_empty)
+		*str = NULL;
+	else {
+		*str = (char *)xmalloc (len + 1);
+		memcpy (*str, *pos, len);
+		(*str)[len] = 0;
+	}
+	*pos += len;
+
+	return 1;
+}
+
+static int read_int (const char **pos, const char *end, void *val,
+                     const size_t size)
+{
+	if (end - *pos < (ssize_t)size)
+		return 0;
+	memcpy (val, *pos, size);
+	*pos += size;
+
+	return 1;
+}
+
+/* Load the library from the file.  Return 0 on error. */
+static int load (const char *file_name)
+{
+	FILE *f;
+	struct stat st;
+	char *buf;
+	const char *pos, *end;
+	int version, count, i;
+
+	if (!(f = fopen (file_name, "r")))
+		return errno == ENOENT;
+
+	if (fstat (fileno (f), &st) == -1) {
+		fclose (f);
+		return 0;
+	}
+
+	buf = (char *)xmalloc (st.st_size + 1);
+	if (fread (buf, 1, st.st_size, f) != (size_t)st.st_size) {
+		fclose (f);
+		free (buf);
+		return 0;
+	}
+	fclose (f);
+
+	pos = buf;
+	end = buf + st.st_size;
+
+	if (end - pos < ssizeof(LIBRARY_MAGIC) - 1
+	        || memcmp (pos, LIBRARY_MAGIC, sizeof (LIBRARY_MAGIC) - 1)) {
+		free (buf);
+		return 0;
+	}
+	pos += sizeof (LIBRARY_MAGIC) - 1;
+
+	if (!read_int (&pos, end, &version, sizeof (version))
+	        || version != LIBRARY_VERSION
+	        || !read_int (&pos, end, &count, sizeof (count))
+	        || count < 0) {
+		free (buf);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct lib_entry e;
+		int64_t mtime;
+
+		memset (&e, 0, sizeof (e));
+		if (!read_str (&pos, end, &e.file, 0)
+		        || !read_str (&pos, end, &e.tags[LF_TITLE], 1)
+		        || !read_str (&pos, end, &e.tags[LF_ARTIST], 1)
+		        || !read_str (&pos, end, &e.tags[LF_ALBUM], 1)
+		        || !read_int (&pos, end, &e.track, sizeof (e.track))
+		        || !read_int (&pos, end, &e.time, sizeof (e.time))
+		        || !read_int (&pos, end, &mtime, sizeof (mtime))
+		        || find_entry (e.file) != -1) {
+			free_entry (&e);
+			free (buf);
+			return 0;
+		}
+
+		e.mtime = mtime;
+		append_entry (&e);
+	}
+
+	free (buf);
+
+	return 1;
+}
+
+/* Load the library from disk. */
+void library_init ()
+{
+	char *file_name;
+
+	LOCK (library.mtx);
+
+	assert (!library.initialized);
+
+	library.initialized = 1;
+	library.generation = 1;
+	rebuild_slots (1024);
+
+	file_name = create_file_name (LIBRARY_FILE);
+	if (!load (file_name)) {
+		logit ("Library file %s is broken, starting with an empty "
+		       "library", file_name);
+		while (library.num > 0)
+			free_entry (&library.entries[--library.num]);
+		library.deleted_num = 0;
+		free_index ();
+		rebuild_slots (1024);
+	}
+	else
+		logit ("Loaded %d library entries", library.num);
+
+	library.dirty = 0;
+
+	UNLOCK (library.mtx);
+}
+
+/* Write the library to disk if it has changed. */
+void library_save ()
+{
+	FILE *f;
+	char *file_name, *tmp_name;
+	int i, count, version = LIBRARY_VERSION;
+
+	LOCK (library.mtx);
+
+	if (!library.initialized || !library.dirty) {
+		UNLOCK (library.mtx);
+		return;
+	}
+
+	file_name = create_file_name (LIBRARY_FILE);
+	tmp_name = (char *)xmalloc (strlen (file_name) + 5);
+	sprintf (tmp_name, "%s.tmp", file_name);
+
+	if (!(f = fopen (tmp_name, "w"))) {
+		char *err = xstrerror (errno);
+		logit ("Can't write %s: %s", tmp_name, err);
+		free (err);
+		free (tmp_name);
+		UNLOCK (library.mtx);
+		return;
+	}
+
+	count = library.num - library.deleted_num;
+	fwrite (LIBRARY_MAGIC, 1, sizeof (LIBRARY_MAGIC) - 1, f);
+	fwrite (&version, sizeof (version), 1, f);
+	fwrite (&count, sizeof (count), 1, f);
+
+	for (i = 0; i < library.num; i++) {
+		const struct lib_entry *e = &library.entries[i];
+		int64_t mtime = e->mtime;
+
+		if (e->deleted)
+			continue;
+
+		write_str (f, e->file);
+		write_str (f, e->tags[LF_TITLE]);
+		write_str (f, e->tags[LF_ARTIST]);
+		write_str (f, e->tags[LF_ALBUM]);
+		fwrite (&e->track, sizeof (e->track), 1, f);
+		fwrite (&e->time, sizeof (e->time), 1, f);
+		fwrite (&mtime, sizeof (mtime), 1, f);
+	}
+
+	if (ferror (f) | fclose (f) || rename (tmp_name, file_name) == -1) {
+		logit ("Error writing the library file");
+		unlink (tmp_name);
+	}
+	else {
+		library.dirty = 0;
+		debug ("Library saved (%d entries)", count);
+	}
+
+	free (tmp_name);
+	UNLOCK (library.mtx);
+}
+
+/* Has the library changed since it was saved? */
+int library_is_dirty ()
+{
+	int res;
+
+	LOCK (library.mtx);
+	res = library.dirty;
+	UNLOCK (library.mtx);
+
+	return res;
+}
+
+/* Save and free the library. */
+void library_cleanup ()
+{
+	library_save ();
+
+	LOCK (library.mtx);
+
+	if (library.initialized) {
+		while (library.num > 0)
+			free_entry (&library.entries[--library.num]);
+		free (library.entries);
+		library.entries = NULL;
+		library.allocated = 0;
+		library.deleted_num = 0;
+		free_index ();
+		free (library.slots);
+		library.slots = NULL;
+		library.slots_size = 0;
+		library.slots_used = 0;
+		library.initialized = 0;
+	}
+
+	UNLOCK (library.mtx);
+}
+
+/* Start a walk of the whole library: files not seen by the walk are
+ * removed when it ends. */
+void library_begin_walk ()
+{
+	LOCK (library.mtx);
+	library.generation += 1;
+	UNLOCK (library.mtx);
+}
+
+/* Remove files not seen since library_begin_walk(). */
+void library_end_walk ()
+{
+	int i, removed = 0;
+
+	LOCK (library.mtx);
+	for (i = 0; i < library.num; i++) {
+		if (!library.entries[i].deleted
+		        && library.entries[i].generation != library.generation) {
+			delete_entry (i);
+			removed += 1;
+		}
+	}
+	maybe_compact ();
+	UNLOCK (library.mtx);
+
+	if (removed)
+		logit ("Removed %d files from the library", removed);
+}
+
+/* Mark the file as seen by the current walk.  Return non-zero if the
+ * library has tags for it read after its last modification. */
+int library_is_current (const char *file, const time_t mtime)
+{
+	int id, res = 0;
+
+	assert (file != NULL);
+
+	LOCK (library.mtx);
+	if (library.initialized && (id = find_entry (file)) != -1) {
+		library.entries[id].generation = library.generation;
+		res = library.entries[id].mtime == mtime;
+	}
+	UNLOCK (library.mtx);
+
+	return res;
+}
+
+/* Add the file to the library or replace its tags. */
+void library_update (const char *file, const struct file_tags *tags,
+                     const time_t mtime)
+{
+	int id;
+	struct lib_entry e;
+
+	assert (file != NULL);
+	assert (tags != NULL);
+
+	LOCK (library.mtx);
+
+	if (!library.initialized) {
+		UNLOCK (library.mtx);
+		return;
+	}
+
+	if ((id = find_entry (file)) != -1) {
+		delete_entry (id);
+		maybe_compact ();
+	}
+
+	e.file = xstrdup (file);
+	e.tags[LF_TITLE] = tags->title ? xstrdup (tags->title) : NULL;
+	e.tags[LF_ARTIST] = tags->artist ? xstrdup (tags->artist) : NULL;
+	e.tags[LF_ALBUM] = tags->album ? xstrdup (tags->album) : NULL;
+	e.track = tags->track;
+	e.time = (tags->filled & TAGS_TIME) ? tags->time : -1;
+	e.mtime = mtime;
+	e.generation = library.generation;
+	append_entry (&e);
+	library.dirty = 1;
+
+	UNLOCK (library.mtx);
+}
+
+/* Remove the file from the library. */
+void library_remove (const char *file)
+{
+	int id;
+
+	assert (file != NULL);
+
+	LOCK (library.mtx);
+	if (library.initialized && (id = find_entry (file)) != -1) {
+		delete_entry (id);
+		maybe_compact ();
+	}
+	UNLOCK (library.mtx);
+}
+
+/* Remove all files under the directory from the library. */
+void library_remove_under (const char *dir)
+{
+	int i;
+	size_t len;
+
+	assert (dir != NULL);
+
+	len = strlen (dir);
+
+	LOCK (library.mtx);
+	for (i = 0; library.initialized && i < library.num; i++) {
+		const char *file = library.entries[i].file;
+
+		if (!library.entries[i].deleted && !strncmp (file, dir, len)
+		        && file[len] == '/')
+			delete_entry (i);
+	}
+	if (library.initialized)
+		maybe_compact ();
+	UNLOCK (library.mtx);
+}
+
+/* Case insensitive (ASCII only) search for the folded needle. */
+static const char *fold_strstr (const char *hay, const char *needle)
+{
+	for (; *hay; hay++) {
+		const char *h = hay, *n = needle;
+
+		while (*n && fold ((unsigned char)*h) == (unsigned char)*n) {
+			h++;
+			n++;
+		}
+
+		if (!*n)
+			return hay;
+	}
+
+	return NULL;
+}
+
+/* Score the entry for the query words, zero if it doesn't match. */
+static int score_entry (const struct lib_entry *e, char **words,
+                        const int words_num)
+{
+	int i, f, score = 0;
+
+	for (i = 0; i < words_num; i++) {
+		int best = 0;
+
+		for (f = 0; f < LF_COUNT; f++) {
+			const char *field = entry_field (e, f);
+			const char *p;
+			int bonus;
+
+			if (!field || !(p = fold_strstr (field, words[i])))
+				continue;
+
+			if (p == field)
+				bonus = p[strlen (words[i])] ? 4 : 6;
+			else if (!isalnum ((unsigned char)p[-1]))
+				bonus = 2;
+			else
+				bonus = 1;
+
+			best = MAX(best, field_weight[f] * bonus);
+		}
+
+		if (!best)
+			return 0;
+		score += best;
+	}
+
+	return score;
+}
+
+/* Intersect the sorted list of entries with the postings. */
+static int intersect (int *ids, const int num,
+                      const struct gram_postings *p)
+{
+	int i = 0, j = 0, res = 0;
+
+	while (i < num && j < p->num) {
+		if (ids[i] < p->ids[j])
+			i++;
+		else if (ids[i] > p->ids[j])
+			j++;
+		else {
+			ids[res++] = ids[i];
+			i++;
+			j++;
+		}
+	}
+
+	return res;
+}
+
+struct search_hit
+{
+	int id;
+	int score;
+};
+
+static int hit_cmp (const void *a, const void *b)
+{
+	const struct search_hit *ha = (const struct search_hit *)a;
+	const struct search_hit *hb = (const struct search_hit *)b;
+	const struct lib_entry *ea = &library.entries[ha->id];
+	const struct lib_entry *eb = &library.entries[hb->id];
+	int f, rc;
+
+	if (ha->score != hb->score)
+		return hb->score - ha->score;
+
+	for (f = LF_ARTIST; f <= LF_ALBUM; f++) {
+		rc = strcmp (ea->tags[f] ? ea->tags[f] : "",
+		             eb->tags[f] ? eb->tags[f] : "");
+		if (rc)
+			return rc;
+	}
+
+	if (ea->track != eb->track)
+		return ea->track - eb->track;
+
+	return strcmp (ea->file, eb->file);
+}
+
+/* Search the library for entries containing all words of the query in
+ * any of their fields and add the best 'max' ones to the playlist, best
+ * first.  Return the number of results. */
+int library_search (const char *query, const int max, struct plist *results)
+{
+	char *words_buf, *word;
+	char **words;
+	int words_num = 0;
+	int *ids = NULL, ids_num = -1;
+	struct search_hit *hits;
+	int hits_num = 0, i;
+
+	assert (query != NULL);
+	assert (results != NULL);
+
+	words_buf = xstrdup (query);
+	for (i = 0; words_buf[i]; i++)
+		words_buf[i] = fold ((unsigned char)words_buf[i]);
+	words = (char **)xmalloc ((strlen (words_buf) / 2 + 1) * sizeof (char *));
+	for (word = strtok (words_buf, " \t"); word; word = strtok (NULL, " \t"))
+		words[words_num++] = word;
+
+	LOCK (library.mtx);
+
+	if (!library.initialized || !words_num) {
+		UNLOCK (library.mtx);
+		free (words);
+		free (words_buf);
+		return 0;
+	}
+
+	/* Narrow down the candidates using trigrams of the query words. */
+	for (i = 0; i < words_num && ids_num != 0; i++) {
+		const unsigned char *s = (const unsigned char *)words[i];
+
+		for (; s[0] && s[1] && s[2] && ids_num != 0; s++) {
+			const struct gram_postings *p;
+
+			p = library.grams_size
+			    ? find_gram ((s[0] << 16) | (s[1] << 8) | s[2])
+			    : NULL;
+			if (!p || !p->gram)
+				ids_num = 0;
+			else if (ids_num == -1) {
+				ids = (int *)xmalloc (p->num * sizeof (int));
+				memcpy (ids, p->ids, p->num * sizeof (int));
+				ids_num = p->num;
+			}
+			else
+				ids_num = intersect (ids, ids_num, p);
+		}
+	}
+
+	hits = (struct search_hit *)xmalloc (
+	        (ids_num == -1 ? library.num : ids_num) * sizeof (*hits) + 1);
+
+	for (i = 0; i < (ids_num == -1 ? library.num : ids_num); i++) {
+		int id = ids_num == -1 ? i : ids[i];
+		int score;
+
+		if (library.entries[id].deleted)
+			continue;
+
+		score = score_entry (&library.entries[id], words, words_num);
+		if (score) {
+			hits[hits_num].id = id;
+			hits[hits_num].score = score;
+			hits_num++;
+		}
+	}
+
+	qsort (hits, hits_num, sizeof (*hits), hit_cmp);
+
+	for (i = 0; i < hits_num && i < max; i++) {
+		const struct lib_entry *e = &library.entries[hits[i].id];
+		struct file_tags *tags = tags_new ();
+		int n;
+
+		tags->title = e->tags[LF_TITLE] ? xstrdup (e->tags[LF_TITLE]) : NULL;
+		tags->artist = e->tags[LF_ARTIST] ? xstrdup (e->tags[LF_ARTIST]) : NULL;
+		tags->album = e->tags[LF_ALBUM] ? xstrdup (e->tags[LF_ALBUM]) : NULL;
+		tags->track = e->track;
+		tags->filled = TAGS_COMMENTS;
+		if (e->time != -1) {
+			tags->time = e->time;
+			tags->filled |= TAGS_TIME;
+		}
+
+		n = plist_add (results, e->file);
+		plist_set_tags (results, n, tags);
+		results->items[n].mtime = e->mtime;
+		tags_free (tags);
+	}
+
+	UNLOCK (library.mtx);
+
+	free (hits);
+	free (ids);
+	free (words);
+	free (words_buf);
+
+	return MIN(hits_num, max);
+}
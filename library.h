@@ -0,0 +1,31 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <time.h>
+#include "playlist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void library_init ();
+void library_cleanup ();
+void library_save ();
+int library_is_dirty ();
+
+/* Functions used by the library indexer: */
+void library_begin_walk ();
+void library_end_walk ();
+int library_is_current (const char *file, const time_t mtime);
+void library_update (const char *file, const struct file_tags *tags,
+                     const time_t mtime);
+void library_remove (const char *file);
+void library_remove_under (const char *dir);
+
+int library_search (const char *query, const int max, struct plist *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
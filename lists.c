@@ -368,3 +368,22 @@ bool lists_strs_exists (lists_t_strs *list, const char *sought)
 
 	return result;
 }
+
+/* Return true iff both lists have the same strings in the same order. */
+bool lists_strs_equal (const lists_t_strs *a, const lists_t_strs *b)
+{
+	int ix;
+
+	assert (a);
+	assert (b);
+
+	if (lists_strs_size (a) != lists_strs_size (b))
+		return false;
+
+	for (ix = 0; ix < lists_strs_size (a); ix += 1) {
+		if (strcmp (lists_strs_at (a, ix), lists_strs_at (b, ix)))
+			return false;
+	}
+
+	return true;
+}
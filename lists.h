@@ -44,6 +44,7 @@ char **lists_strs_save (const lists_t_strs *list);
 int lists_strs_load (lists_t_strs *list, const char **saved);
 int lists_strs_find (lists_t_strs *list, const char *sought);
 bool lists_strs_exists (lists_t_strs *list, const char *sought);
+bool lists_strs_equal (const lists_t_strs *a, const lists_t_strs *b);
 
 #ifdef __cplusplus
 }
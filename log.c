@@ -14,6 +14,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <assert.h>
@@ -21,6 +22,8 @@
 #include <time.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "common.h"
 #include "lists.h"
@@ -42,8 +45,46 @@ static int log_records_spilt = 0;
 static lists_t_strs *circular_log = NULL;
 static int circular_ptr = 0;
 
+/* Held while writing to the log file or the circular log and while
+ * taking records from the rings. */
 static pthread_mutex_t logging_mtx = PTHREAD_MUTEX_INITIALIZER;
 
+/* Once the log file is open, threads don't write to it themselves: each
+ * one formats its records into its own ring without locking and the log
+ * thread writes them out, so that logging doesn't make the threads wait
+ * for the disk.  Records which don't fit into a full ring are dropped and
+ * counted. */
+#define LOG_RING_SIZE		256	/* must be a power of 2 */
+#define LOG_RECORD_LEN		480
+
+struct log_record {
+	struct timespec time;
+	char text[LOG_RECORD_LEN];	/* "file:line function(): message" */
+};
+
+struct log_ring {
+	struct log_ring *next;
+	volatile unsigned int head;	/* written by the owning thread */
+	volatile unsigned int tail;	/* written under logging_mtx */
+	volatile unsigned int dropped;	/* records which didn't fit */
+	unsigned int dropped_logged;
+	volatile int orphaned;		/* the owning thread has exited */
+	struct log_record records[LOG_RING_SIZE];
+};
+
+/* New rings are added at the head under log_rings_mtx, the list is read
+ * without it.  Only the log thread removes rings. */
+static struct log_ring *volatile log_rings = NULL;
+static pthread_mutex_t log_rings_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+
+static pthread_t log_thread;
+static volatile int log_async = 0;	/* the log thread is running */
+static volatile int log_thread_stop = 0;
+static volatile int log_thread_sleeping = 0;
+static int log_wake_pipe[2] = {-1, -1};
+
 static struct {
 	int sig;
 	const char *name;
@@ -88,15 +129,15 @@ static inline void flush_log (void)
 #endif
 
 #ifndef NDEBUG
-static void locked_logit (const char *file, const int line,
-                          const char *function, const char *msg)
+/* Write a line of the log made at the given time. */
+static void locked_log_text (const struct timespec *utc_time,
+                             const char *text)
 {
 	int len;
 	char *str, time_str[20];
-	struct timespec utc_time;
 	time_t tv_sec;
 	struct tm tm_time;
-	const char fmt[] = "%s.%06ld: %s:%d %s(): %s\n";
+	const char fmt[] = "%s.%06ld: %s\n";
 
 	assert (logging_state == BUFFERING || logging_state == LOGGING);
 	assert (logging_state != BUFFERING || !logfp);
@@ -106,22 +147,18 @@ static void locked_logit (const char *file, const int line,
 	if (logging_state == LOGGING && !logfp)
 		return;
 
-	get_realtime (&utc_time);
-	tv_sec = utc_time.tv_sec;
+	tv_sec = utc_time->tv_sec;
 	localtime_r (&tv_sec, &tm_time);
 	strftime (time_str, sizeof (time_str), "%b %e %T", &tm_time);
 
 	if (logfp && !circular_log) {
-		fprintf (logfp, fmt, time_str, utc_time.tv_nsec / 1000L,
-		                     file, line, function, msg);
+		fprintf (logfp, fmt, time_str, utc_time->tv_nsec / 1000L, text);
 		return;
 	}
 
-	len = snprintf (NULL, 0, fmt, time_str, utc_time.tv_nsec / 1000L,
-	                              file, line, function, msg);
+	len = snprintf (NULL, 0, fmt, time_str, utc_time->tv_nsec / 1000L, text);
 	str = xmalloc (len + 1);
-	snprintf (str, len + 1, fmt, time_str, utc_time.tv_nsec / 1000L,
-	                             file, line, function, msg);
+	snprintf (str, len + 1, fmt, time_str, utc_time->tv_nsec / 1000L, text);
 
 	if (logging_state == BUFFERING) {
 		lists_strs_push (buffered_log, str);
@@ -140,6 +177,20 @@ static void locked_logit (const char *file, const int line,
 }
 #endif
 
+#ifndef NDEBUG
+static void locked_logit (const char *file, const int line,
+                          const char *function, const char *msg)
+{
+	char *text;
+	struct timespec utc_time;
+
+	get_realtime (&utc_time);
+	text = format_msg ("%s:%d %s(): %s", file, line, function, msg);
+	locked_log_text (&utc_time, text);
+	free (text);
+}
+#endif
+
 #ifndef NDEBUG
 static void log_signals_raised (void)
 {
@@ -154,6 +205,314 @@ static void log_signals_raised (void)
 }
 #endif
 
+#ifndef NDEBUG
+static void log_ring_orphan (void *data)
+{
+	struct log_ring *ring = (struct log_ring *)data;
+
+	ring->orphaned = 1;
+}
+#endif
+
+#ifndef NDEBUG
+/* Return the calling thread's ring, creating it if there is none. */
+static struct log_ring *log_ring_get ()
+{
+	struct log_ring *ring;
+
+	ring = (struct log_ring *)pthread_getspecific (log_ring_key);
+	if (ring)
+		return ring;
+
+	ring = (struct log_ring *)xcalloc (1, sizeof (struct log_ring));
+	pthread_setspecific (log_ring_key, ring);
+
+	LOCK(log_rings_mtx);
+	ring->next = log_rings;
+	__sync_synchronize ();
+	log_rings = ring;
+	UNLOCK(log_rings_mtx);
+
+	return ring;
+}
+#endif
+
+#ifndef NDEBUG
+/* Wake the log thread up if it's waiting for records. */
+static void log_thread_wake ()
+{
+	ssize_t rc;
+
+	__sync_synchronize ();
+	if (log_thread_sleeping
+	         && __sync_bool_compare_and_swap (&log_thread_sleeping, 1, 0)) {
+		do {
+			rc = write (log_wake_pipe[1], "", 1);
+		} while (rc == -1 && errno == EINTR);
+	}
+}
+#endif
+
+#ifndef NDEBUG
+/* Put a record into the calling thread's ring, or count it as dropped
+ * if the ring is full. */
+static void ring_logit (const char *file, const int line,
+                        const char *function, const char *format,
+                        va_list va)
+{
+	int len;
+	unsigned int head;
+	struct log_ring *ring;
+	struct log_record *rec;
+
+	ring = log_ring_get ();
+	head = ring->head;
+
+	if (head - ring->tail == LOG_RING_SIZE) {
+		ring->dropped += 1;
+		log_thread_wake ();
+		return;
+	}
+
+	rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+	get_realtime (&rec->time);
+	len = snprintf (rec->text, sizeof (rec->text), "%s:%d %s(): ",
+	                file, line, function);
+	if (len < ssizeof(rec->text)
+	         && vsnprintf (rec->text + len, sizeof (rec->text) - len,
+	                       format, va) >= ssizeof(rec->text) - len)
+		strcpy (rec->text + sizeof (rec->text) - 4, "...");
+
+	/* The record must be complete before the log thread sees it. */
+	__sync_synchronize ();
+	ring->head = head + 1;
+
+	log_thread_wake ();
+}
+#endif
+
+#ifndef NDEBUG
+/* Write out the records from all the rings in the order they were made
+ * and report the dropped ones. */
+static void locked_drain_rings ()
+{
+	unsigned int tail;
+	char *msg;
+	struct log_ring *ring, *oldest;
+	struct log_record *rec, *oldest_rec;
+
+	log_signals_raised ();
+
+	while (1) {
+		oldest = NULL;
+		oldest_rec = NULL;
+		for (ring = log_rings; ring; ring = ring->next) {
+			tail = ring->tail;
+			if (tail == ring->head)
+				continue;
+			__sync_synchronize ();
+			rec = &ring->records[tail & (LOG_RING_SIZE - 1)];
+			if (!oldest_rec || rec->time.tv_sec < oldest_rec->time.tv_sec
+			         || (rec->time.tv_sec == oldest_rec->time.tv_sec
+			             && rec->time.tv_nsec < oldest_rec->time.tv_nsec)) {
+				oldest = ring;
+				oldest_rec = rec;
+			}
+		}
+
+		if (!oldest)
+			break;
+
+		locked_log_text (&oldest_rec->time, oldest_rec->text);
+		__sync_synchronize ();
+		oldest->tail += 1;
+	}
+
+	for (ring = log_rings; ring; ring = ring->next) {
+		unsigned int dropped = ring->dropped;
+
+		if (dropped != ring->dropped_logged) {
+			msg = format_msg ("%u log records dropped",
+			                  dropped - ring->dropped_logged);
+			locked_logit (__FILE__, __LINE__, __func__, msg);
+			free (msg);
+			ring->dropped_logged = dropped;
+		}
+	}
+}
+#endif
+
+#ifndef NDEBUG
+/* Free the rings of exited threads once they are empty. */
+static void locked_free_orphans ()
+{
+	struct log_ring *ring, **prev;
+
+	LOCK(log_rings_mtx);
+	prev = (struct log_ring **)&log_rings;
+	while ((ring = *prev)) {
+		if (ring->orphaned && ring->tail == ring->head
+		                   && ring->dropped == ring->dropped_logged) {
+			*prev = ring->next;
+			free (ring);
+		}
+		else
+			prev = &ring->next;
+	}
+	UNLOCK(log_rings_mtx);
+}
+#endif
+
+#ifndef NDEBUG
+static bool log_rings_pending ()
+{
+	struct log_ring *ring;
+
+	for (ring = log_rings; ring; ring = ring->next) {
+		if (ring->tail != ring->head || ring->dropped != ring->dropped_logged)
+			return true;
+	}
+
+	return false;
+}
+#endif
+
+#ifndef NDEBUG
+static void *log_thread_main (void *unused ATTR_UNUSED)
+{
+	char buf[16];
+	ssize_t rc;
+
+	while (1) {
+		LOCK(logging_mtx);
+		locked_drain_rings ();
+		flush_log ();
+		locked_free_orphans ();
+		UNLOCK(logging_mtx);
+
+		if (log_thread_stop)
+			break;
+
+		/* Producers wake us up only after seeing this flag, so check
+		 * for records which came before it was set. */
+		log_thread_sleeping = 1;
+		__sync_synchronize ();
+		if ((log_thread_stop || log_rings_pending ())
+		         && __sync_bool_compare_and_swap (&log_thread_sleeping, 1, 0))
+			continue;
+
+		do {
+			rc = read (log_wake_pipe[0], buf, sizeof (buf));
+		} while (rc == -1 && errno == EINTR);
+	}
+
+	return NULL;
+}
+#endif
+
+#ifndef NDEBUG
+static void log_atfork_prepare ()
+{
+	LOCK(logging_mtx);
+}
+
+static void log_atfork_parent ()
+{
+	UNLOCK(logging_mtx);
+}
+
+/* The log thread doesn't exist in the child and the records in the rings
+ * are the parent's to write. */
+static void log_atfork_child ()
+{
+	struct log_ring *ring;
+
+	log_async = 0;
+	for (ring = log_rings; ring; ring = ring->next) {
+		ring->tail = ring->head;
+		ring->dropped_logged = ring->dropped;
+	}
+	UNLOCK(logging_mtx);
+}
+#endif
+
+#ifndef NDEBUG
+static void log_ring_init ()
+{
+	int rc;
+
+	rc = pthread_key_create (&log_ring_key, log_ring_orphan);
+	if (rc)
+		fatal ("Can't create the log ring key: %s", xstrerror (rc));
+
+	rc = pthread_atfork (log_atfork_prepare, log_atfork_parent,
+	                     log_atfork_child);
+	if (rc)
+		fatal ("pthread_atfork() failed: %s", xstrerror (rc));
+}
+#endif
+
+#ifndef NDEBUG
+/* Start the thread which writes the log. */
+static void log_thread_start ()
+{
+	int rc;
+
+	assert (!log_async);
+
+	rc = pthread_once (&log_ring_once, log_ring_init);
+	if (rc)
+		fatal ("pthread_once() failed: %s", xstrerror (rc));
+
+	if (pipe (log_wake_pipe) == -1) {
+		log_errno ("Can't create the log thread pipe", errno);
+		return;
+	}
+	fcntl (log_wake_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl (log_wake_pipe[1], F_SETFD, FD_CLOEXEC);
+	fcntl (log_wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+	log_thread_stop = 0;
+	log_thread_sleeping = 0;
+	rc = pthread_create (&log_thread, NULL, log_thread_main, NULL);
+	if (rc) {
+		char *err = xstrerror (rc);
+		logit ("Can't create the log thread: %s", err);
+		free (err);
+		close (log_wake_pipe[0]);
+		close (log_wake_pipe[1]);
+		return;
+	}
+
+	log_async = 1;
+}
+#endif
+
+#ifndef NDEBUG
+/* Stop the log thread after it has written all records. */
+static void log_thread_join ()
+{
+	int rc;
+
+	if (!log_async)
+		return;
+
+	log_async = 0;
+	log_thread_stop = 1;
+	log_thread_wake ();
+
+	rc = pthread_join (log_thread, NULL);
+	if (rc) {
+		char *err = xstrerror (rc);
+		logit ("Can't join the log thread: %s", err);
+		free (err);
+	}
+
+	close (log_wake_pipe[0]);
+	close (log_wake_pipe[1]);
+}
+#endif
+
 /* Put something into the log.  If built with logging disabled,
  * this function is provided as a stub so independant plug-ins
  * configured with logging enabled can still resolve it. */
@@ -167,6 +526,14 @@ void internal_logit (const char *file LOGIT_ONLY,
 	char *msg;
 	va_list va;
 
+	if (log_async) {
+		va_start (va, format);
+		ring_logit (file, line, function, format, va);
+		va_end (va);
+		errno = saved_errno;
+		return;
+	}
+
 	LOCK(logging_mtx);
 
 	if (!logfp) {
@@ -243,6 +610,9 @@ void log_init_stream (FILE *f LOGIT_ONLY, const char *fn LOGIT_ONLY)
 
 end:
 	UNLOCK(logging_mtx);
+
+	if (logfp)
+		log_thread_start ();
 #endif
 }
 
@@ -309,6 +679,8 @@ void log_circular_log ()
 
 	LOCK(logging_mtx);
 
+	locked_drain_rings ();
+
 	fprintf (logfp, "\n* Circular Log Starts *\n\n");
 
 	for (ix = circular_ptr; ix < lists_strs_size (circular_log); ix += 1)
@@ -351,8 +723,14 @@ void log_circular_stop ()
 void log_close ()
 {
 #ifndef NDEBUG
+	log_thread_join ();
+
 	LOCK(logging_mtx);
 
+	/* Records put into the rings while the thread was stopping. */
+	if (logfp)
+		locked_drain_rings ();
+
 	if (!(logfp == stdout || logfp == stderr || logfp == NULL)) {
 		fclose (logfp);
 		logfp = NULL;
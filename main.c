@@ -87,6 +87,7 @@ struct parameters
 	char *toggle;
 	char *on;
 	char *off;
+	char *search;
 };
 
 /* Connect to the server, return fd of the socket or -1 on error. */
@@ -211,8 +212,10 @@ static void start_moc (const struct parameters *params, lists_t_strs *args)
 		}
 	}
 
-	if (params->only_server)
+	if (params->only_server) {
 		send_int (server_sock, CMD_DISCONNECT);
+		sock_flush (server_sock);
+	}
 	else {
 		xsignal (SIGPIPE, SIG_IGN);
 		if (!ping_server (server_sock))
@@ -226,11 +229,35 @@ static void start_moc (const struct parameters *params, lists_t_strs *args)
 	close (server_sock);
 }
 
+/* Return != 0 if only the status (-i, -Q) is requested. */
+static int only_status_requested (const struct parameters *params)
+{
+	return !(params->playit || params->clear || params->append
+			|| params->enqueue || params->play
+			|| params->seek_by || params->jump_type
+			|| params->adj_volume || params->toggle
+			|| params->on || params->off || params->search
+			|| params->exit || params->stop || params->pause
+			|| params->next || params->previous
+			|| params->unpause || params->toggle_pause);
+}
+
 /* Send commands requested in params to the server. */
 static void server_command (struct parameters *params, lists_t_strs *args)
 {
 	int sock;
 
+	/* The status can be read from the server's status page without
+	 * connecting. */
+	if (only_status_requested (params) && interface_cmdline_status_page ()) {
+		if (params->get_file_info)
+			interface_cmdline_file_info (-1);
+		if (params->get_formatted_info)
+			interface_cmdline_formatted_info (-1,
+					params->formatted_info_param);
+		return;
+	}
+
 	if ((sock = server_connect()) == -1)
 		fatal ("The server is not running!");
 
@@ -266,6 +293,8 @@ static void server_command (struct parameters *params, lists_t_strs *args)
 		interface_cmdline_set (sock, params->on, 1);
 	if (params->off)
 		interface_cmdline_set (sock, params->off, 0);
+	if (params->search)
+		interface_cmdline_search (sock, params->search);
 	if (params->exit) {
 		if (!send_int(sock, CMD_QUIT))
 			fatal ("Can't send command!");
@@ -309,6 +338,9 @@ static void server_command (struct parameters *params, lists_t_strs *args)
 			fatal ("Can't send commands!");
 	}
 
+	if (!sock_flush(sock))
+		fatal ("Can't send commands!");
+
 	close (sock);
 }
 
@@ -549,6 +581,8 @@ static struct poptOption server_opts[] = {
 			"Print information about the file currently playing", NULL},
 	{"format", 'Q', POPT_ARG_STRING, &params.formatted_info_param, CL_GETINFO,
 			"Print formatted information about the file currently playing", "FORMAT"},
+	{"search", 0, POPT_ARG_STRING, &params.search, CL_NOIFACE,
+			"Print files in the library matching the query", "QUERY"},
 	POPT_TABLEEND
 };
 
@@ -1252,7 +1286,6 @@ int main (int argc, const char *argv[])
 
 	io_init ();
 	rcc_init ();
-	decoder_init (params.debug);
 	srand (time(NULL));
 
 	if (params.allow_iface)
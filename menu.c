@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
 #include "common.h"
@@ -25,12 +26,30 @@
 #include "rbtree.h"
 #include "utf8.h"
 
+/* Number of buckets of the trigram index. */
+#define TRIGRAM_BUCKETS	65536
+
+/* Trigram index of the menu used for filtering: for each bucket of
+ * lowercase trigrams of the titles and file names, the positions of the
+ * items containing such a trigram in ascending order. */
+struct menu_trigrams
+{
+	int start[TRIGRAM_BUCKETS + 1];	/* items of bucket b are
+					   items[start[b]..start[b+1]-1] */
+	int *items;
+	unsigned int titles_serial;	/* titles_serial when built */
+};
+
+/* Incremented on every change of an item title, an index built before
+ * the change is not valid. */
+static unsigned int titles_serial = 0;
+
 /* Draw menu item on a given position from the top of the menu. */
-static void draw_item (const struct menu *menu, const struct menu_item *mi,
+static void draw_item (const struct menu *menu, struct menu_item *mi,
 		const int pos, const int item_info_pos, int title_space,
 		const int number_space, const int draw_selected)
 {
-	int title_width, queue_pos_len = 0;
+	int queue_pos_len = 0;
 	int ix, x;
 	int y ATTR_UNUSED;		/* OpenBSD flags this as unused. */
 	char buf[32];
@@ -74,19 +93,28 @@ static void draw_item (const struct menu *menu, const struct menu_item *mi,
 		title_space -= queue_pos_len;
 	}
 
-	title_width = strwidth (mi->title);
+	/* Cut and convert the title only when it or its space changes. */
+	if (!mi->title_shown || mi->title_shown_space != title_space) {
+		if (mi->title_width == -1)
+			mi->title_width = strwidth (mi->title);
 
-	getyx (menu->win, y, x);
-	if (title_width <= title_space || mi->align == MENU_ALIGN_LEFT)
-		xwaddnstr (menu->win, mi->title, title_space);
-	else {
-		char *ptr;
+		free (mi->title_shown);
+		if (mi->title_width <= title_space
+				|| mi->align == MENU_ALIGN_LEFT)
+			mi->title_shown = xstrhead (mi->title, title_space);
+		else {
+			char *ptr;
 
-		ptr = xstrtail (mi->title, title_space);
-		xwaddstr (menu->win, ptr);
-		free (ptr);
+			ptr = xstrtail (mi->title, title_space);
+			mi->title_shown = display_iconv_str (ptr);
+			free (ptr);
+		}
+		mi->title_shown_space = title_space;
 	}
 
+	getyx (menu->win, y, x);
+	waddstr (menu->win, mi->title_shown);
+
 	/* Fill the remainder of the title field with spaces. */
 	if (mi == menu->selected) {
 		getyx (menu->win, y, ix);
@@ -123,45 +151,55 @@ static void draw_item (const struct menu *menu, const struct menu_item *mi,
 		xwprintw (menu->win, "[%5s]", mi->time);
 	else if (menu->show_format && mi->format[0])
 		xwprintw (menu->win, "[%3s]", mi->format);
+
+	mi->changed = 0;
 }
 
-void menu_draw (const struct menu *menu, const int active)
+/* Compute the width of the title field, the position of the information
+ * about the file and the width of the item number. */
+static void menu_layout (const struct menu *menu, int *title_width,
+		int *info_pos, int *number_space)
 {
-	struct menu_item *mi;
-	int title_width;
-	int info_pos;
-	int number_space = 0;
-
-	assert (menu != NULL);
-
 	if (menu->number_items) {
 		int count = menu->nitems / 10;
 
-		number_space = 2; /* begin from 1 digit and a space char */
+		*number_space = 2; /* begin from 1 digit and a space char */
 		while (count) {
 			count /= 10;
-			number_space++;
+			(*number_space)++;
 		}
 	}
 	else
-		number_space = 0;
+		*number_space = 0;
 
 	if (menu->show_time || menu->show_format) {
-		title_width = menu->width - 2; /* -2 for brackets */
+		*title_width = menu->width - 2; /* -2 for brackets */
 		if (menu->show_time)
-			title_width -= 5; /* 00:00 */
+			*title_width -= 5; /* 00:00 */
 		if (menu->show_format)
-			title_width -= 3; /* MP3 */
+			*title_width -= 3; /* MP3 */
 		if (menu->show_time && menu->show_format)
-			title_width--; /* for | */
-		info_pos = title_width;
+			(*title_width)--; /* for | */
+		*info_pos = *title_width;
 	}
 	else {
-		title_width = menu->width;
-		info_pos = title_width;
+		*title_width = menu->width;
+		*info_pos = *title_width;
 	}
 
-	title_width -= number_space;
+	*title_width -= *number_space;
+}
+
+void menu_draw (const struct menu *menu, const int active)
+{
+	struct menu_item *mi;
+	int title_width;
+	int info_pos;
+	int number_space;
+
+	assert (menu != NULL);
+
+	menu_layout (menu, &title_width, &info_pos, &number_space);
 
 	for (mi = menu->top; mi && mi->num - menu->top->num < menu->height;
 			mi = mi->next)
@@ -170,6 +208,33 @@ void menu_draw (const struct menu *menu, const int active)
 				number_space, active);
 }
 
+/* Draw again only visible items which have changed since they were drawn.
+ * The rest of the menu must be as drawn by menu_draw(). */
+void menu_draw_changed (const struct menu *menu, const int active)
+{
+	struct menu_item *mi;
+	int title_width;
+	int info_pos;
+	int number_space;
+
+	assert (menu != NULL);
+
+	menu_layout (menu, &title_width, &info_pos, &number_space);
+
+	for (mi = menu->top; mi && mi->num - menu->top->num < menu->height;
+			mi = mi->next) {
+		int pos = mi->num - menu->top->num + menu->posy;
+
+		if (!mi->changed)
+			continue;
+
+		wattrset (menu->win, menu->bg_attr);
+		mvwhline (menu->win, pos, menu->posx, ' ', menu->width);
+		draw_item (menu, mi, pos, menu->posx + info_pos, title_width,
+				number_space, active);
+	}
+}
+
 /* Move the cursor to the selected file. */
 void menu_set_cursor (const struct menu *m)
 {
@@ -214,9 +279,12 @@ struct menu *menu_new (WINDOW *win, const int posx, const int posy,
 	menu->win = win;
 	menu->items = NULL;
 	menu->nitems = 0;
+	menu->index = NULL;
+	menu->index_size = 0;
 	menu->top = NULL;
 	menu->last = NULL;
 	menu->selected = NULL;
+	menu->scroll_dir = 1;
 	menu->posx = posx;
 	menu->posy = posy;
 	menu->width = width;
@@ -228,9 +296,12 @@ struct menu *menu_new (WINDOW *win, const int posx, const int posy,
 	menu->info_attr_sel = A_NORMAL;
 	menu->info_attr_marked = A_NORMAL;
 	menu->info_attr_sel_marked = A_NORMAL;
+	menu->bg_attr = A_NORMAL;
 	menu->number_items = 0;
 
 	menu->search_tree = rb_tree_new (rb_compare, rb_fname_compare, NULL);
+	menu->trigrams = NULL;
+	menu->filter = NULL;
 
 	return menu;
 }
@@ -259,12 +330,22 @@ struct menu_item *menu_add (struct menu *menu, const char *title,
 	mi->time[0] = 0;
 	mi->format[0] = 0;
 	mi->queue_pos = 0;
+	mi->changed = 1;
+	mi->title_width = -1;
+	mi->title_shown = NULL;
 
 	mi->next = NULL;
 	mi->prev = menu->last;
 	if (menu->last)
 		menu->last->next = mi;
 
+	if (menu->nitems == menu->index_size) {
+		menu->index_size = menu->index_size ? menu->index_size * 2 : 64;
+		menu->index = (struct menu_item **)xrealloc (menu->index,
+				menu->index_size * sizeof(struct menu_item *));
+	}
+	menu->index[mi->num] = mi;
+
 	if (!menu->items)
 		menu->items = mi;
 	if (!menu->top)
@@ -275,6 +356,7 @@ struct menu_item *menu_add (struct menu *menu, const char *title,
 	if (file)
 		rb_insert (menu->search_tree, (void *)mi);
 
+	menu_filter_end (menu);
 	menu->last = mi;
 	menu->nitems++;
 
@@ -302,30 +384,23 @@ static struct menu_item *menu_add_from_item (struct menu *menu,
 	return new;
 }
 
-static struct menu_item *get_item_relative (struct menu_item *mi,
-		int to_move)
+/* Return the item to_move positions away from mi, or the first/last item
+ * if there are not so many items. */
+static struct menu_item *get_item_relative (const struct menu *menu,
+		struct menu_item *mi, int to_move)
 {
-	assert (mi != NULL);
-
-	while (to_move) {
-		struct menu_item *prev = mi;
+	int num;
 
-		if (to_move > 0) {
-			mi = mi->next;
-			to_move--;
-		}
-		else {
-			mi = mi->prev;
-			to_move++;
-		}
+	assert (menu != NULL);
+	assert (mi != NULL);
 
-		if (!mi) {
-			mi = prev;
-			break;
-		}
-	}
+	num = mi->num + to_move;
+	if (num < 0)
+		num = 0;
+	else if (num >= menu->nitems)
+		num = menu->nitems - 1;
 
-	return mi;
+	return menu->index[num];
 }
 
 void menu_update_size (struct menu *menu, const int posx, const int posy,
@@ -344,7 +419,7 @@ void menu_update_size (struct menu *menu, const int posx, const int posy,
 
 	if (menu->selected && menu->top
 			&& menu->selected->num >= menu->top->num + menu->height)
-		menu->selected = get_item_relative (menu->top,
+		menu->selected = get_item_relative (menu, menu->top,
 				menu->height - 1);
 }
 
@@ -354,6 +429,7 @@ static void menu_item_free (struct menu_item *mi)
 	assert (mi->title != NULL);
 
 	free (mi->title);
+	free (mi->title_shown);
 	if (mi->file)
 		free (mi->file);
 
@@ -376,6 +452,9 @@ void menu_free (struct menu *menu)
 
 	rb_tree_free (menu->search_tree);
 
+	menu_filter_end (menu);
+	free (menu->filter);
+	free (menu->index);
 	free (menu);
 }
 
@@ -386,43 +465,48 @@ void menu_driver (struct menu *menu, const enum menu_request req)
 	if (menu->nitems == 0)
 		return;
 
+	if (req == REQ_UP || req == REQ_PGUP || req == REQ_BOTTOM)
+		menu->scroll_dir = -1;
+	else
+		menu->scroll_dir = 1;
+
 	if (req == REQ_DOWN && menu->selected->next) {
 		menu->selected = menu->selected->next;
 		if (menu->selected->num >= menu->top->num + menu->height) {
-			menu->top = get_item_relative (menu->selected,
+			menu->top = get_item_relative (menu, menu->selected,
 					-menu->height / 2);
 			if (menu->top->num > menu->nitems - menu->height)
-				menu->top = get_item_relative (menu->last,
+				menu->top = get_item_relative (menu, menu->last,
 						-menu->height + 1);
 		}
 	}
 	else if (req == REQ_UP && menu->selected->prev) {
 		menu->selected = menu->selected->prev;
 		if (menu->top->num > menu->selected->num)
-			menu->top = get_item_relative (menu->selected,
+			menu->top = get_item_relative (menu, menu->selected,
 					-menu->height / 2);
 	}
 	else if (req == REQ_PGDOWN && menu->selected->num < menu->nitems - 1) {
 		if (menu->selected->num + menu->height - 1 < menu->nitems - 1) {
-			menu->selected = get_item_relative (menu->selected,
-					menu->height - 1);
-			menu->top = get_item_relative (menu->top,
+			menu->selected = get_item_relative (menu,
+					menu->selected, menu->height - 1);
+			menu->top = get_item_relative (menu, menu->top,
 					menu->height - 1);
 			if (menu->top->num > menu->nitems - menu->height)
-				menu->top = get_item_relative (menu->last,
+				menu->top = get_item_relative (menu, menu->last,
 						-menu->height + 1);
 		}
 		else {
 			menu->selected = menu->last;
-			menu->top = get_item_relative (menu->last,
+			menu->top = get_item_relative (menu, menu->last,
 					-menu->height + 1);
 		}
 	}
 	else if (req == REQ_PGUP && menu->selected->prev) {
 		if (menu->selected->num - menu->height + 1 > 0) {
-			menu->selected = get_item_relative (menu->selected,
-					-menu->height + 1);
-			menu->top = get_item_relative (menu->top,
+			menu->selected = get_item_relative (menu,
+					menu->selected, -menu->height + 1);
+			menu->top = get_item_relative (menu, menu->top,
 					-menu->height + 1);
 		}
 		else {
@@ -436,7 +520,7 @@ void menu_driver (struct menu *menu, const enum menu_request req)
 	}
 	else if (req == REQ_BOTTOM) {
 		menu->selected = menu->last;
-		menu->top = get_item_relative (menu->selected,
+		menu->top = get_item_relative (menu, menu->selected,
 				-menu->height + 1);
 	}
 }
@@ -455,10 +539,10 @@ static void make_item_visible (struct menu *menu, struct menu_item *mi)
 	assert (mi != NULL);
 
 	if (mi->num < menu->top->num || mi->num >= menu->top->num + menu->height) {
-		menu->top = get_item_relative(mi, -menu->height/2);
+		menu->top = get_item_relative (menu, mi, -menu->height/2);
 
 		if (menu->top->num > menu->nitems - menu->height)
-			menu->top = get_item_relative (menu->last,
+			menu->top = get_item_relative (menu, menu->last,
 					-menu->height + 1);
 	}
 
@@ -496,15 +580,12 @@ void menu_setcurritem_title (struct menu *menu, const char *title)
 static struct menu_item *menu_find_by_position (struct menu *menu,
 		const int num)
 {
-	struct menu_item *mi;
-
 	assert (menu != NULL);
 
-	mi = menu->top;
-	while (mi && mi->num != num)
-		mi = mi->next;
+	if (num < 0 || num >= menu->nitems)
+		return NULL;
 
-	return mi;
+	return menu->index[num];
 }
 
 void menu_set_state (struct menu *menu, const struct menu_state *st)
@@ -515,7 +596,8 @@ void menu_set_state (struct menu *menu, const struct menu_state *st)
 		menu->selected = menu->last;
 
 	if (!(menu->top = menu_find_by_position(menu, st->top_item)))
-		menu->top = get_item_relative (menu->last, menu->height + 1);
+		menu->top = get_item_relative (menu, menu->last,
+				menu->height + 1);
 }
 
 void menu_set_items_numbering (struct menu *menu, const int number)
@@ -539,8 +621,167 @@ void menu_unmark_item (struct menu *menu)
 	menu->marked = NULL;
 }
 
-/* Make a new menu from elements matching pattern. */
-struct menu *menu_filter_pattern (const struct menu *menu, const char *pattern)
+static int trigram_bucket (const char *s)
+{
+	unsigned int key;
+
+	key = tolower ((unsigned char)s[0]) << 16
+		| tolower ((unsigned char)s[1]) << 8
+		| tolower ((unsigned char)s[2]);
+
+	return (key * 2654435761U) >> 16 & (TRIGRAM_BUCKETS - 1);
+}
+
+/* Return the file name of the item without the path or NULL. */
+static const char *item_file_name (const struct menu_item *mi)
+{
+	const char *slash;
+
+	if (!mi->file)
+		return NULL;
+
+	slash = strrchr (mi->file, '/');
+
+	return slash ? slash + 1 : mi->file;
+}
+
+/* Add the item at position num to the buckets of the string's trigrams,
+ * or only count it if items is NULL.  last[] holds the last item added to
+ * each bucket. */
+static void trigrams_add_str (const char *s, const int num, int *pos,
+		int *last, int *items)
+{
+	if (!s)
+		return;
+
+	for (; s[0] && s[1] && s[2]; s++) {
+		int b = trigram_bucket (s);
+
+		if (last[b] != num) {
+			last[b] = num;
+			if (items)
+				items[pos[b]] = num;
+			pos[b]++;
+		}
+	}
+}
+
+/* Build the trigram index of the menu. */
+static struct menu_trigrams *trigrams_build (const struct menu *menu)
+{
+	struct menu_trigrams *t;
+	int *pos, *last;
+	int i, b;
+
+	t = (struct menu_trigrams *)xmalloc (sizeof(struct menu_trigrams));
+	pos = (int *)xcalloc (TRIGRAM_BUCKETS, sizeof(int));
+	last = (int *)xmalloc (TRIGRAM_BUCKETS * sizeof(int));
+
+	/* Count the items in each bucket... */
+	for (b = 0; b < TRIGRAM_BUCKETS; b++)
+		last[b] = -1;
+	for (i = 0; i < menu->nitems; i++) {
+		trigrams_add_str (menu->index[i]->title, i, pos, last, NULL);
+		trigrams_add_str (item_file_name (menu->index[i]), i, pos,
+				last, NULL);
+	}
+
+	t->start[0] = 0;
+	for (b = 0; b < TRIGRAM_BUCKETS; b++) {
+		t->start[b + 1] = t->start[b] + pos[b];
+		pos[b] = t->start[b];
+		last[b] = -1;
+	}
+
+	/* ...and fill them. */
+	t->items = (int *)xmalloc ((t->start[TRIGRAM_BUCKETS] + 1)
+			* sizeof(int));
+	for (i = 0; i < menu->nitems; i++) {
+		trigrams_add_str (menu->index[i]->title, i, pos, last,
+				t->items);
+		trigrams_add_str (item_file_name (menu->index[i]), i, pos,
+				last, t->items);
+	}
+
+	t->titles_serial = titles_serial;
+
+	free (pos);
+	free (last);
+
+	return t;
+}
+
+/* Return a bitmap of items which have all trigrams of the pattern (it
+ * must have at least 3 characters), these are candidates for matching
+ * it. */
+static unsigned int *trigrams_candidates (const struct menu *menu,
+		const char *pattern)
+{
+	const struct menu_trigrams *t = menu->trigrams;
+	int words = (menu->nitems + 31) / 32;
+	unsigned int *cand, *bits;
+	const char *s;
+	int i, w;
+
+	cand = (unsigned int *)xmalloc (words * sizeof(unsigned int));
+	bits = (unsigned int *)xmalloc (words * sizeof(unsigned int));
+	for (w = 0; w < words; w++)
+		cand[w] = ~0U;
+
+	for (s = pattern; s[0] && s[1] && s[2]; s++) {
+		int b = trigram_bucket (s);
+
+		memset (bits, 0, words * sizeof(unsigned int));
+		for (i = t->start[b]; i < t->start[b + 1]; i++)
+			bits[t->items[i] / 32] |= 1U << (t->items[i] % 32);
+
+		for (w = 0; w < words; w++)
+			cand[w] &= bits[w];
+	}
+
+	free (bits);
+
+	return cand;
+}
+
+/* Does the item's title or file name contain the pattern? */
+static int item_matches (const struct menu_item *mi, const char *pattern)
+{
+	const char *name;
+
+	if (strcasestr (mi->title, pattern))
+		return 1;
+
+	name = item_file_name (mi);
+
+	return name && strcasestr (name, pattern);
+}
+
+/* Can the filtered menu be filtered further instead of the whole menu to
+ * get the items matching the pattern? */
+int menu_filter_narrows (const struct menu *menu, const char *pattern)
+{
+	assert (menu != NULL);
+	assert (pattern != NULL);
+
+	return menu->filter && strcasestr (pattern, menu->filter);
+}
+
+/* Free the index used for filtering the menu. */
+void menu_filter_end (struct menu *menu)
+{
+	assert (menu != NULL);
+
+	if (menu->trigrams) {
+		free (menu->trigrams->items);
+		free (menu->trigrams);
+		menu->trigrams = NULL;
+	}
+}
+
+/* Make a new menu from elements matching pattern.  A filtered menu is
+ * searched item by item, the whole menu uses its trigram index. */
+struct menu *menu_filter_pattern (struct menu *menu, const char *pattern)
 {
 	struct menu *new;
 	const struct menu_item *mi;
@@ -556,10 +797,37 @@ struct menu *menu_filter_pattern (const struct menu *menu, const char *pattern)
 	menu_set_info_attr_sel (new, menu->info_attr_sel);
 	menu_set_info_attr_marked (new, menu->info_attr_marked);
 	menu_set_info_attr_sel_marked (new, menu->info_attr_sel_marked);
+	menu_set_bg_attr (new, menu->bg_attr);
+
+	if (!menu->filter && strlen (pattern) >= 3) {
+		unsigned int *cand;
+		int i;
+
+		if (menu->trigrams
+				&& menu->trigrams->titles_serial != titles_serial)
+			menu_filter_end (menu);
+		if (!menu->trigrams)
+			menu->trigrams = trigrams_build (menu);
+
+		cand = trigrams_candidates (menu, pattern);
+		for (i = 0; i < menu->nitems; i++) {
+			if (!cand[i / 32]) {
+				i |= 31;
+				continue;
+			}
+			if (cand[i / 32] & 1U << (i % 32)
+					&& item_matches (menu->index[i], pattern))
+				menu_add_from_item (new, menu->index[i]);
+		}
+		free (cand);
+	}
+	else {
+		for (mi = menu->items; mi; mi = mi->next)
+			if (item_matches (mi, pattern))
+				menu_add_from_item (new, mi);
+	}
 
-	for (mi = menu->items; mi; mi = mi->next)
-		if (strcasestr(mi->title, pattern))
-			menu_add_from_item (new, mi);
+	new->filter = xstrdup (pattern);
 
 	if (menu->marked)
 		menu_mark_item (new, menu->marked->file);
@@ -572,6 +840,7 @@ void menu_item_set_attr_normal (struct menu_item *mi, const int attr)
 	assert (mi != NULL);
 
 	mi->attr_normal = attr;
+	mi->changed = 1;
 }
 
 void menu_item_set_attr_sel (struct menu_item *mi, const int attr)
@@ -579,6 +848,7 @@ void menu_item_set_attr_sel (struct menu_item *mi, const int attr)
 	assert (mi != NULL);
 
 	mi->attr_sel = attr;
+	mi->changed = 1;
 }
 
 void menu_item_set_attr_sel_marked (struct menu_item *mi, const int attr)
@@ -586,6 +856,7 @@ void menu_item_set_attr_sel_marked (struct menu_item *mi, const int attr)
 	assert (mi != NULL);
 
 	mi->attr_sel_marked = attr;
+	mi->changed = 1;
 }
 
 void menu_item_set_attr_marked (struct menu_item *mi, const int attr)
@@ -593,6 +864,7 @@ void menu_item_set_attr_marked (struct menu_item *mi, const int attr)
 	assert (mi != NULL);
 
 	mi->attr_marked = attr;
+	mi->changed = 1;
 }
 
 void menu_item_set_time (struct menu_item *mi, const char *time)
@@ -602,6 +874,7 @@ void menu_item_set_time (struct menu_item *mi, const char *time)
 	mi->time[sizeof(mi->time)-1] = 0;
 	strncpy (mi->time, time, sizeof(mi->time));
 	assert (mi->time[sizeof(mi->time)-1] == 0);
+	mi->changed = 1;
 }
 
 void menu_item_set_format (struct menu_item *mi, const char *format)
@@ -614,6 +887,7 @@ void menu_item_set_format (struct menu_item *mi, const char *format)
 			sizeof(mi->format));
 	assert (mi->format[sizeof(mi->format)-1]
 			== 0);
+	mi->changed = 1;
 }
 
 void menu_item_set_queue_pos (struct menu_item *mi, const int pos)
@@ -621,6 +895,7 @@ void menu_item_set_queue_pos (struct menu_item *mi, const int pos)
 	assert (mi != NULL);
 
 	mi->queue_pos = pos;
+	mi->changed = 1;
 }
 
 void menu_set_show_time (struct menu *menu, const int t)
@@ -665,6 +940,13 @@ void menu_set_info_attr_sel_marked (struct menu *menu, const int attr)
 	menu->info_attr_sel_marked = attr;
 }
 
+void menu_set_bg_attr (struct menu *menu, const int attr)
+{
+	assert (menu != NULL);
+
+	menu->bg_attr = attr;
+}
+
 enum file_type menu_item_get_type (const struct menu_item *mi)
 {
 	assert (mi != NULL);
@@ -686,6 +968,11 @@ void menu_item_set_title (struct menu_item *mi, const char *title)
 	if (mi->title)
 		free (mi->title);
 	mi->title = xstrdup (title);
+	mi->changed = 1;
+	mi->title_width = -1;
+	free (mi->title_shown);
+	mi->title_shown = NULL;
+	titles_serial++;
 }
 
 int menu_nitems (const struct menu *menu)
@@ -721,17 +1008,67 @@ void menu_mark_item (struct menu *menu, const char *file)
 		menu->marked = item;
 }
 
-static void menu_renumber_items (struct menu *menu)
+/* Close the gap in the index left by the item at this position and
+ * renumber the items after it. */
+static void menu_renumber_items (struct menu *menu, const int from)
 {
-	int i = 0;
-	struct menu_item *mi;
+	int i;
 
 	assert (menu != NULL);
+	assert (from >= 0);
 
-	for (mi = menu->items; mi; mi = mi->next)
-		mi->num = i++;
+	memmove (menu->index + from, menu->index + from + 1,
+			(menu->nitems - from) * sizeof(struct menu_item *));
 
-	assert (i == menu->nitems);
+	for (i = from; i < menu->nitems; i++)
+		menu->index[i]->num = i;
+}
+
+/* Move the items added from position 'from' on to their places among the
+ * items before them, which must be in order.  Only the new items are
+ * sorted, the selected and top items stay the same.  cmp() gets pointers
+ * to two menu item pointers, like qsort(). */
+void menu_merge_items (struct menu *menu, const int from,
+		int (*cmp) (const void *a, const void *b))
+{
+	struct menu_item **merged;
+	int i, a, b;
+
+	assert (menu != NULL);
+	assert (from >= 0 && from <= menu->nitems);
+	assert (cmp != NULL);
+
+	if (from == menu->nitems)
+		return;
+
+	qsort (menu->index + from, menu->nitems - from,
+			sizeof(struct menu_item *), cmp);
+
+	merged = (struct menu_item **)xmalloc (menu->index_size
+			* sizeof(struct menu_item *));
+	for (i = a = 0, b = from; i < menu->nitems; i++) {
+		if (b == menu->nitems || (a < from
+				&& cmp (&menu->index[a], &menu->index[b]) <= 0))
+			merged[i] = menu->index[a++];
+		else
+			merged[i] = menu->index[b++];
+
+		if (merged[i]->num != i) {
+			merged[i]->num = i;
+			merged[i]->changed = 1;
+		}
+		merged[i]->prev = i ? merged[i - 1] : NULL;
+		if (i)
+			merged[i - 1]->next = merged[i];
+	}
+	merged[menu->nitems - 1]->next = NULL;
+
+	free (menu->index);
+	menu->index = merged;
+	menu->items = merged[0];
+	menu->last = merged[menu->nitems - 1];
+
+	menu_filter_end (menu);
 }
 
 static void menu_delete (struct menu *menu, struct menu_item *mi)
@@ -760,7 +1097,8 @@ static void menu_delete (struct menu *menu, struct menu_item *mi)
 		rb_delete (menu->search_tree, mi->file);
 
 	menu->nitems--;
-	menu_renumber_items (menu);
+	menu_renumber_items (menu, mi->num);
+	menu_filter_end (menu);
 
 	menu_item_free (mi);
 }
@@ -783,6 +1121,9 @@ void menu_item_set_align (struct menu_item *mi, const enum menu_align align)
 	assert (mi != NULL);
 
 	mi->align = align;
+	mi->changed = 1;
+	free (mi->title_shown);
+	mi->title_shown = NULL;
 }
 
 void menu_setcurritem_file (struct menu *menu, const char *file)
@@ -858,6 +1199,9 @@ static void menu_items_swap (struct menu *menu, struct menu_item *mi1,
 	t = mi1->num;
 	mi1->num = mi2->num;
 	mi2->num = t;
+	menu->index[mi1->num] = mi1;
+	menu->index[mi2->num] = mi2;
+	menu_filter_end (menu);
 
 	if (menu->top == mi1)
 		menu->top = mi2;
@@ -903,3 +1247,35 @@ void menu_make_visible (struct menu *menu, const char *file)
 	if ((mi = menu_find(menu, file)))
 		make_item_visible (menu, mi);
 }
+
+/* Add the files of the visible items to the list, followed by up to
+ * prefetch items beyond them in the direction of the last move. */
+void menu_get_visible_files (const struct menu *menu, const int prefetch,
+		lists_t_strs *files)
+{
+	int first, end, i;
+
+	assert (menu != NULL);
+	assert (files != NULL);
+
+	if (!menu->top)
+		return;
+
+	first = menu->top->num;
+	end = MIN(first + menu->height, menu->nitems);
+
+	for (i = first; i < end; i++)
+		if (menu->index[i]->file)
+			lists_strs_append (files, menu->index[i]->file);
+
+	if (menu->scroll_dir < 0) {
+		for (i = first - 1; i >= 0 && i >= first - prefetch; i--)
+			if (menu->index[i]->file)
+				lists_strs_append (files, menu->index[i]->file);
+	}
+	else {
+		for (i = end; i < menu->nitems && i < end + prefetch; i++)
+			if (menu->index[i]->file)
+				lists_strs_append (files, menu->index[i]->file);
+	}
+}
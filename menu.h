@@ -15,6 +15,7 @@
 
 #include "files.h"
 #include "rbtree.h"
+#include "lists.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,15 +61,27 @@ struct menu_item
 	char format[FILE_FORMAT_SZ];		/* File format */
 	int queue_pos;				/* Position in the queue */
 
+	int changed;		/* changed since it was drawn */
+
+	/* The title as last drawn: its width, the title cut to the space
+	 * it had and converted for the terminal (or NULL) and the space. */
+	int title_width;
+	char *title_shown;
+	int title_shown_space;
+
 	struct menu_item *next;
 	struct menu_item *prev;
 };
 
+struct menu_trigrams;
+
 struct menu
 {
 	WINDOW *win;
 	struct menu_item *items;
 	int nitems;		/* number of present items */
+	struct menu_item **index;	/* items by position (num) */
+	int index_size;		/* allocated size of the index */
 	struct menu_item *top;	/* first visible item */
 	struct menu_item *last;	/* last item in the menu */
 
@@ -79,6 +92,7 @@ struct menu
 	int height;
 
 	struct menu_item *selected;	/* selected item */
+	int scroll_dir;		/* direction of the last move: 1 down, -1 up */
 	struct menu_item *marked;	/* index of the marked item or -1 */
 
 	/* Flags for displaying information about the file. */
@@ -89,9 +103,12 @@ struct menu
 	int info_attr_sel;
 	int info_attr_marked;
 	int info_attr_sel_marked;
+	int bg_attr;		/* attributes of the empty space */
 	int number_items; /* display item number (position) */
 
 	struct rb_tree *search_tree; /* RB tree for searching by file name */
+	struct menu_trigrams *trigrams; /* index for filtering or NULL */
+	char *filter;		/* pattern if this is a filtered menu */
 };
 
 /* Menu state: relative (to the first item) positions of the top and selected
@@ -121,19 +138,23 @@ void menu_driver (struct menu *menu, const enum menu_request req);
 void menu_setcurritem_title (struct menu *menu, const char *title);
 void menu_setcurritem_file (struct menu *menu, const char *file);
 void menu_draw (const struct menu *menu, const int active);
+void menu_draw_changed (const struct menu *menu, const int active);
 void menu_mark_item (struct menu *menu, const char *file);
 void menu_set_state (struct menu *menu, const struct menu_state *st);
 void menu_get_state (const struct menu *menu, struct menu_state *st);
 void menu_update_size (struct menu *menu, const int posx, const int posy,
 		const int width, const int height);
 void menu_unmark_item (struct menu *menu);
-struct menu *menu_filter_pattern (const struct menu *menu, const char *pattern);
+struct menu *menu_filter_pattern (struct menu *menu, const char *pattern);
+int menu_filter_narrows (const struct menu *menu, const char *pattern);
+void menu_filter_end (struct menu *menu);
 void menu_set_show_time (struct menu *menu, const int t);
 void menu_set_show_format (struct menu *menu, const bool t);
 void menu_set_info_attr_normal (struct menu *menu, const int attr);
 void menu_set_info_attr_sel (struct menu *menu, const int attr);
 void menu_set_info_attr_marked (struct menu *menu, const int attr);
 void menu_set_info_attr_sel_marked (struct menu *menu, const int attr);
+void menu_set_bg_attr (struct menu *menu, const int attr);
 void menu_set_items_numbering (struct menu *menu, const int number);
 enum file_type menu_item_get_type (const struct menu_item *mi);
 char *menu_item_get_file (const struct menu_item *mi);
@@ -142,11 +163,15 @@ void menu_item_set_title (struct menu_item *mi, const char *title);
 int menu_nitems (const struct menu *menu);
 struct menu_item *menu_find (struct menu *menu, const char *fname);
 void menu_del_item (struct menu *menu, const char *fname);
+void menu_merge_items (struct menu *menu, const int from,
+		int (*cmp) (const void *a, const void *b));
 void menu_item_set_align (struct menu_item *mi, const enum menu_align align);
 int menu_is_visible (const struct menu *menu, const struct menu_item *mi);
 void menu_swap_items (struct menu *menu, const char *file1, const char *file2);
 void menu_make_visible (struct menu *menu, const char *file);
 void menu_set_cursor (const struct menu *m);
+void menu_get_visible_files (const struct menu *menu, const int prefetch,
+		lists_t_strs *files);
 
 #ifdef __cplusplus
 }
@@ -561,6 +561,9 @@ void options_init ()
 	add_bool ("StartInMusicDir", false);
 	add_int  ("CircularLogSize", 0, CHECK_RANGE(1), 0, INT_MAX);
 	add_symb ("Sort", "FileName", CHECK_SYMBOL(1), "FileName");
+	add_list ("PlaylistSortKeys", "Artist:Album:Track:Title:FileName",
+	          CHECK_DISCRETE(6), "Artist", "Album", "Track", "Title",
+	                             "FileName", "Time");
 	add_bool ("ShowStreamErrors", false);
 	add_bool ("MP3IgnoreCRCErrors", true);
 	add_bool ("Repeat", false);
@@ -672,6 +675,8 @@ void options_init ()
 	add_bool ("Allow24bitOutput", false);
 	add_bool ("UseRealtimePriority", false);
 	add_int  ("TagsCacheSize", 256, CHECK_RANGE(1), 0, INT_MAX);
+	add_bool ("LibraryIndexer", false);
+	add_int  ("MaxClients", 32, CHECK_RANGE(1), 1, 1024);
 	add_bool ("PlaylistNumbering", true);
 
 	add_list ("Layout1", "directory(0,0,50%,100%):playlist(50%,0,FILL,100%)",
@@ -682,6 +687,7 @@ void options_init ()
 
 	add_bool ("FollowPlayedFile", true);
 	add_bool ("CanStartInPlaylist", true);
+	add_bool ("Tickless", false);
 	add_str  ("ExecCommand1", NULL, CHECK_NONE);
 	add_str  ("ExecCommand2", NULL, CHECK_NONE);
 	add_str  ("ExecCommand3", NULL, CHECK_NONE);
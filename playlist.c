@@ -31,7 +31,6 @@
 #include "log.h"
 #include "options.h"
 #include "files.h"
-#include "rbtree.h"
 #include "utf8.h"
 #include "rcc.h"
 
@@ -117,23 +116,113 @@ struct file_tags *tags_dup (const struct file_tags *tags)
 	return dtags;
 }
 
-static int rb_compare (const void *a, const void *b, const void *adata)
+/* Values of the index slots other than item numbers. */
+#define INDEX_EMPTY	(-1)
+#define INDEX_REMOVED	(-2)
+
+static unsigned int fname_hash (const char *file)
+{
+	unsigned int h = 2166136261u;
+
+	while (*file) {
+		h ^= (unsigned char)*file++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* Find the index slot for the file: the one holding it or the free one
+ * where it belongs. */
+static int index_find_slot (const struct plist *plist, const char *file)
+{
+	int i, removed = -1;
+	const int mask = plist->index_size - 1;
+
+	i = fname_hash (file) & mask;
+	while (plist->index[i] != INDEX_EMPTY) {
+		if (plist->index[i] == INDEX_REMOVED) {
+			if (removed == -1)
+				removed = i;
+		}
+		else if (!strcmp (plist->items[plist->index[i]].file, file))
+			return i;
+
+		i = (i + 1) & mask;
+	}
+
+	return removed != -1 ? removed : i;
+}
+
+/* Make the file name of the item point to it in the index. */
+static void index_put (struct plist *plist, const int num)
+{
+	int slot;
+
+	slot = index_find_slot (plist, plist->items[num].file);
+	if (plist->index[slot] == INDEX_EMPTY)
+		plist->index_used++;
+	plist->index[slot] = num;
+}
+
+/* Rebuild the index from scratch, making it big enough for the given
+ * number of items. */
+static void index_resize (struct plist *plist, const int num)
+{
+	int i, size = INIT_SIZE;
+
+	while (size < 2 * num)
+		size *= 2;
+
+	if (size != plist->index_size) {
+		free (plist->index);
+		plist->index = (int *)xmalloc (size * sizeof (int));
+		plist->index_size = size;
+	}
+
+	for (i = 0; i < size; i++)
+		plist->index[i] = INDEX_EMPTY;
+	plist->index_used = 0;
+
+	/* Later items with the same file win, like in plist_add(). */
+	for (i = 0; i < plist->num; i++)
+		if (plist->items[i].file)
+			index_put (plist, i);
+}
+
+/* Rebuild the index from scratch. */
+static void index_rebuild (struct plist *plist)
+{
+	index_resize (plist, plist->num);
+}
+
+/* Add the item to the index. */
+static void index_add (struct plist *plist, const int num)
+{
+	if (4 * (plist->index_used + 1) > 3 * plist->index_size)
+		index_rebuild (plist);
+	else
+		index_put (plist, num);
+}
+
+/* Remove the file from the index. */
+static void index_remove (struct plist *plist, const char *file)
 {
-	struct plist *plist = (struct plist *)adata;
-	int pos_a = (intptr_t)a;
-	int pos_b = (intptr_t)b;
+	int slot;
 
-	return strcoll (plist->items[pos_a].file, plist->items[pos_b].file);
+	slot = index_find_slot (plist, file);
+	if (plist->index[slot] >= 0)
+		plist->index[slot] = INDEX_REMOVED;
 }
 
-static int rb_fname_compare (const void *key, const void *data,
-                             const void *adata)
+/* Return the item number for the file from the index or -1. */
+static int index_lookup (const struct plist *plist, const char *file)
 {
-	struct plist *plist = (struct plist *)adata;
-	const char *fname = (const char *)key;
-	const int pos = (intptr_t)data;
+	int slot;
+
+	slot = index_find_slot (plist, file);
 
-	return strcoll (fname, plist->items[pos].file);
+	return plist->index[slot] >= 0 ? plist->index[slot] : -1;
 }
 
 /* Return 1 if an item has 'deleted' flag. */
@@ -153,9 +242,11 @@ void plist_init (struct plist *plist)
 	plist->items = (struct plist_item *)xmalloc (sizeof(struct plist_item)
 			* INIT_SIZE);
 	plist->serial = -1;
-	plist->search_tree = rb_tree_new (rb_compare, rb_fname_compare, plist);
 	plist->total_time = 0;
 	plist->items_with_time = 0;
+	plist->index = NULL;
+	plist->index_size = 0;
+	index_rebuild (plist);
 }
 
 /* Create a new playlist item with empty fields. */
@@ -172,6 +263,7 @@ struct plist_item *plist_new_item ()
 	item->tags = NULL;
 	item->mtime = (time_t)-1;
 	item->queue_pos = 0;
+	item->tags_asked = 0;
 
 	return item;
 }
@@ -198,18 +290,86 @@ int plist_add (struct plist *plist, const char *file_name)
 	plist->items[plist->num].mtime = (file_name ? get_mtime(file_name)
 			: (time_t)-1);
 	plist->items[plist->num].queue_pos = 0;
-
-	if (file_name) {
-		rb_delete (plist->search_tree, file_name);
-		rb_insert (plist->search_tree, (void *)(intptr_t)plist->num);
-	}
+	plist->items[plist->num].tags_asked = 0;
 
 	plist->num++;
 	plist->not_deleted++;
 
+	if (file_name)
+		index_add (plist, plist->num - 1);
+
 	return plist->num - 1;
 }
 
+/* Move count items to the end of the playlist, indexing them on the way.
+ * Items for files already on the playlist are skipped and their fields
+ * freed.  The items must have the file, type and mtime set.  Return the
+ * number of items added. */
+int plist_add_items (struct plist *plist, struct plist_item *items,
+		const int count)
+{
+	int i, added = 0;
+
+	assert (plist != NULL);
+	assert (count >= 0);
+
+	if (plist->allocated < plist->num + count) {
+		while (plist->allocated < plist->num + count)
+			plist->allocated *= 2;
+		plist->items = (struct plist_item *)xrealloc (plist->items,
+				sizeof(struct plist_item) * plist->allocated);
+	}
+
+	if (4 * (plist->index_used + count) > 3 * plist->index_size)
+		index_resize (plist, plist->num + count);
+
+	for (i = 0; i < count; i++) {
+		struct plist_item *item = &plist->items[plist->num];
+
+		assert (items[i].file != NULL);
+
+		if (plist_find_fname (plist, items[i].file) != -1) {
+			plist_free_item_fields (&items[i]);
+			continue;
+		}
+
+		*item = items[i];
+		item->deleted = 0;
+		item->queue_pos = 0;
+
+		if (item->tags && item->tags->time != -1) {
+			plist->total_time += item->tags->time;
+			plist->items_with_time++;
+		}
+
+		plist->num++;
+		plist->not_deleted++;
+		index_put (plist, plist->num - 1);
+		added++;
+	}
+
+	return added;
+}
+
+/* Return a hash of the files of the first count non-deleted items, in
+ * order. */
+int plist_files_hash (const struct plist *plist, const int count)
+{
+	unsigned int h = 2166136261u;
+	int i, n = 0;
+
+	assert (plist != NULL);
+
+	for (i = 0; i < plist->num && n < count; i++) {
+		if (plist->items[i].deleted)
+			continue;
+		h = (h ^ fname_hash (plist->items[i].file)) * 16777619u;
+		n++;
+	}
+
+	return (int)h;
+}
+
 /* Copy all fields of item src to dst. */
 void plist_item_copy (struct plist_item *dst, const struct plist_item *src)
 {
@@ -221,6 +381,7 @@ void plist_item_copy (struct plist_item *dst, const struct plist_item *src)
 	dst->title_tags = xstrdup (src->title_tags);
 	dst->mtime = src->mtime;
 	dst->queue_pos = src->queue_pos;
+	dst->tags_asked = src->tags_asked;
 
 	if (src->tags)
 		dst->tags = tags_dup (src->tags);
@@ -316,7 +477,7 @@ void plist_clear (struct plist *plist)
 	plist->allocated = INIT_SIZE;
 	plist->num = 0;
 	plist->not_deleted = 0;
-	rb_tree_clear (plist->search_tree);
+	index_rebuild (plist);
 	plist->total_time = 0;
 	plist->items_with_time = 0;
 }
@@ -330,61 +491,87 @@ void plist_free (struct plist *plist)
 	free (plist->items);
 	plist->allocated = 0;
 	plist->items = NULL;
-	rb_tree_free (plist->search_tree);
+	free (plist->index);
+	plist->index = NULL;
+	plist->index_size = 0;
+}
+
+static int fname_cmp (const void *a, const void *b)
+{
+	return strcoll (((const struct plist_item *)a)->file,
+	                ((const struct plist_item *)b)->file);
 }
 
-/* Sort the playlist by file names. */
+/* Sort the playlist by file names, removing deleted and duplicated items.
+ * Items added after the last sort are sorted and merged with the already
+ * sorted ones, so sorting a playlist growing in chunks is cheap. */
 void plist_sort_fname (struct plist *plist)
 {
-	struct plist_item *sorted;
-	struct rb_node *x;
-	int n;
+	struct plist_item *items, *sorted;
+	int i, n, k, a, b;
 
 	if (plist_count(plist) == 0)
 		return;
 
-	sorted = (struct plist_item *)xmalloc (plist_count(plist) *
-			sizeof(struct plist_item));
+	/* Drop deleted items. */
+	items = plist->items;
+	for (i = n = 0; i < plist->num; i++) {
+		if (items[i].deleted)
+			plist_free_item_fields (&items[i]);
+		else
+			items[n++] = items[i];
+	}
 
-	x = rb_min (plist->search_tree);
-	assert (!rb_is_null(x));
+	/* Find the sorted beginning, sort the rest and merge them. */
+	for (k = 1; k < n && fname_cmp (&items[k - 1], &items[k]) <= 0; k++)
+		;
 
-	while (plist_deleted(plist, (intptr_t)rb_get_data (x)))
-		x = rb_next (x);
+	if (k < n) {
+		qsort (items + k, n - k, sizeof (struct plist_item), fname_cmp);
 
-	sorted[0] = plist->items[(intptr_t)rb_get_data (x)];
-	rb_set_data (x, NULL);
+		sorted = (struct plist_item *)xmalloc (n *
+				sizeof (struct plist_item));
+		for (i = a = 0, b = k; a < k || b < n; i++) {
+			if (b == n || (a < k && fname_cmp (&items[a], &items[b]) <= 0))
+				sorted[i] = items[a++];
+			else
+				sorted[i] = items[b++];
+		}
+
+		memcpy (items, sorted, sizeof (struct plist_item) * n);
+		free (sorted);
+	}
 
-	n = 1;
-	while (!rb_is_null(x = rb_next(x))) {
-		if (!plist_deleted(plist, (intptr_t)rb_get_data (x))) {
-			sorted[n] = plist->items[(intptr_t)rb_get_data (x)];
-			rb_set_data (x, (void *)(intptr_t)n++);
+	/* Drop duplicates, which are next to each other now. */
+	for (i = k = 1; i < n; i++) {
+		if (!strcmp (items[i].file, items[k - 1].file)) {
+			if (items[i].tags && items[i].tags->time != -1) {
+				plist->total_time -= items[i].tags->time;
+				plist->items_with_time--;
+			}
+			plist_free_item_fields (&items[i]);
 		}
+		else
+			items[k++] = items[i];
 	}
+	n = k;
 
 	plist->num = n;
 	plist->not_deleted = n;
-
-	memcpy (plist->items, sorted, sizeof(struct plist_item) * n);
-	free (sorted);
+	index_rebuild (plist);
 }
 
 /* Find an item in the list.  Return the index or -1 if not found. */
 int plist_find_fname (struct plist *plist, const char *file)
 {
-	struct rb_node *x;
+	int num;
 
 	assert (plist != NULL);
 	assert (file != NULL);
 
-	x = rb_search (plist->search_tree, file);
+	num = index_lookup (plist, file);
 
-	if (rb_is_null(x))
-		return -1;
-
-	return !plist_deleted(plist, (intptr_t)rb_get_data (x)) ?
-                                 (intptr_t)rb_get_data (x) : -1;
+	return num != -1 && !plist_deleted(plist, num) ? num : -1;
 }
 
 /* Find an item in the list; also find deleted items.  If there is more than
@@ -433,143 +620,272 @@ const char *plist_get_next_dead_entry (const struct plist *plist,
 	return NULL;
 }
 
-#define if_not_empty(str)	(tags && (str) && (*str) ? (str) : NULL)
+/* Title format strings are compiled into a list of operations, so
+ * building titles for many items doesn't parse the format again. */
+enum title_op_type
+{
+	TITLE_OP_TEXT,		/* literal text */
+	TITLE_OP_FIELD,		/* value of a tag */
+	TITLE_OP_COND		/* %(x:true:false) */
+};
 
-static char *title_expn_subs(char fmt, const struct file_tags *tags)
+struct title_op
+{
+	enum title_op_type type;
+	char field;		/* the tag for TITLE_OP_FIELD and TITLE_OP_COND */
+	int text;		/* TITLE_OP_TEXT: offset of the text... */
+	int len;		/* ...and its length */
+	int true_ops;		/* TITLE_OP_COND: number of the following ops
+				   for the true and false branch */
+	int false_ops;
+};
+
+struct title_format
 {
-	static char track[16];
+	char *fmt;		/* the source format string */
+	struct title_op *ops;
+	int ops_num;
+	int ops_allocated;
+	char *text;		/* literal text of all TITLE_OP_TEXT ops */
+	int text_len;
+};
 
-	switch (fmt) {
-		case 'n':
-			if (!tags || tags->track == -1)
-				break;
-			snprintf (track, sizeof(track), "%d", tags->track);
-			return track;
-		case 'a':
-			return if_not_empty (tags->artist);
-		case 'A':
-			return if_not_empty (tags->album);
-		case 't':
-			return if_not_empty (tags->title);
-		default:
-			fatal ("Error parsing format string!");
+/* Number of compiled format strings kept. */
+#define TITLE_FORMATS_CACHED	4
+
+static struct title_format *title_formats[TITLE_FORMATS_CACHED];
+static int title_formats_next;
+
+static void title_format_free (struct title_format *tf)
+{
+	free (tf->fmt);
+	free (tf->ops);
+	free (tf->text);
+	free (tf);
+}
+
+static int title_op_add (struct title_format *tf,
+		const enum title_op_type type)
+{
+	if (tf->ops_num == tf->ops_allocated) {
+		tf->ops_allocated = tf->ops_allocated ? 2 * tf->ops_allocated : 8;
+		tf->ops = (struct title_op *)xrealloc (tf->ops,
+				tf->ops_allocated * sizeof(struct title_op));
 	}
 
-	return NULL;
+	memset (&tf->ops[tf->ops_num], 0, sizeof(struct title_op));
+	tf->ops[tf->ops_num].type = type;
+
+	return tf->ops_num++;
+}
+
+/* Append a literal character to the text op *text, add the op if it's
+ * -1. */
+static void title_add_char (struct title_format *tf, int *text, const char c)
+{
+	if (*text == -1) {
+		*text = title_op_add (tf, TITLE_OP_TEXT);
+		tf->ops[*text].text = tf->text_len;
+	}
+
+	tf->text[tf->text_len++] = c;
+	tf->ops[*text].len++;
+}
+
+static void check_title_field (const char field)
+{
+	if (!strchr ("naAt", field))
+		fatal ("Error parsing format string!");
 }
 
-static inline void check_zero (const char *x)
+static inline void check_end (const char *x, const char *end)
 {
-	if (*x == '\0')
+	if (x >= end)
 		fatal ("Unexpected end of title expression!");
 }
 
-/* Generate a title from fmt. */
-static void do_title_expn (char *dest, int size, const char *fmt,
-		const struct file_tags *tags)
+/* Find the end of a ternary expression branch: the first not escaped
+ * character c. */
+static const char *title_branch_end (const char *fmt, const char *end,
+		const char c)
 {
-	const char *h;
-	int free = --size;
-	short escape = 0;
+	int escape = 0;
+
+	while (escape || *fmt != c) {
+		if (escape)
+			escape = 0;
+		else if (*fmt == '\\')
+			escape = 1;
+		check_end (++fmt, end);
+	}
+
+	return fmt;
+}
 
-	dest[0] = 0;
+/* Compile the format string from fmt to end appending ops to tf. */
+static void title_compile (struct title_format *tf, const char *fmt,
+		const char *end)
+{
+	int escape = 0;
+	int text = -1;
 
-	while (free > 0 && *fmt) {
+	while (fmt < end) {
 		if (*fmt == '%' && !escape) {
-			check_zero(++fmt);
+			check_end (++fmt, end);
+			text = -1;
 
-			/* do ternary expansion
-			 * format: %(x:true:false)
-			 */
+			/* ternary expansion, format: %(x:true:false) */
 			if (*fmt == '(') {
-				char separator, expr[256];
-				int expr_pos = 0;
-
-				check_zero(++fmt);
-				h = title_expn_subs(*fmt, tags);
-
-				check_zero(++fmt);
-				separator = *fmt;
-
-				check_zero(++fmt);
-
-				if(h) { /* true */
-
-					/* copy the expression */
-					while (escape || *fmt != separator) {
-						if (expr_pos == sizeof(expr)-2)
-							fatal ("Nested ternary expression too long!");
-						expr[expr_pos++] = *fmt;
-						if (*fmt == '\\')
-							escape = 1;
-						else
-							escape = 0;
-						check_zero(++fmt);
-					}
-					expr[expr_pos] = '\0';
-
-					/* eat the rest */
-					while (escape || *fmt != ')') {
-						if (escape)
-							escape = 0;
-						else if (*fmt == '\\')
-							escape = 1;
-						check_zero(++fmt);
-					}
-				}
-				else { /* false */
-
-					/* eat the truth :-) */
-					while (escape || *fmt != separator) {
-						if (escape)
-							escape = 0;
-						else if (*fmt == '\\')
-							escape = 1;
-						check_zero(++fmt);
-					}
-
-					check_zero(++fmt);
-
-					/* copy the expression */
-					while (escape || *fmt != ')') {
-						if (expr_pos == sizeof(expr)-2)
-							fatal ("Ternary expression too long!");
-						expr[expr_pos++] = *fmt;
-						if (*fmt == '\\')
-							escape = 1;
-						else
-							escape = 0;
-						check_zero(++fmt);
-					}
-					expr[expr_pos] = '\0';
-				}
-
-				do_title_expn((dest + size - free),
-					      free, expr, tags);
-				free -= strlen(dest + size - free);
+				const char *true_start, *true_end;
+				const char *false_start, *false_end;
+				int cond, field;
+
+				check_end (++fmt, end);
+				field = *fmt;
+				check_title_field (field);
+
+				check_end (++fmt, end);
+				check_end (++fmt, end);
+				true_start = fmt;
+				true_end = title_branch_end (fmt, end, fmt[-1]);
+
+				false_start = true_end + 1;
+				check_end (false_start, end);
+				false_end = title_branch_end (false_start, end, ')');
+
+				cond = title_op_add (tf, TITLE_OP_COND);
+				tf->ops[cond].field = field;
+				title_compile (tf, true_start, true_end);
+				tf->ops[cond].true_ops = tf->ops_num - cond - 1;
+				title_compile (tf, false_start, false_end);
+				tf->ops[cond].false_ops = tf->ops_num - cond - 1
+					- tf->ops[cond].true_ops;
+
+				fmt = false_end;
 			}
 			else {
-				h = title_expn_subs(*fmt, tags);
+				int op;
 
-				if (h) {
-					strncat(dest, h, free-1);
-					free -= strlen (h);
-				}
+				check_title_field (*fmt);
+				op = title_op_add (tf, TITLE_OP_FIELD);
+				tf->ops[op].field = *fmt;
 			}
 		}
 		else if (*fmt == '\\' && !escape)
 			escape = 1;
 		else {
-			dest[size - free] = *fmt;
-			dest[size - free + 1] = 0;
-			--free;
+			title_add_char (tf, &text, *fmt);
 			escape = 0;
 		}
 		fmt++;
 	}
+}
+
+/* Get the compiled format string, compile it if it's not cached. */
+static const struct title_format *get_title_format (const char *fmt)
+{
+	struct title_format *tf;
+	int i;
+
+	for (i = 0; i < TITLE_FORMATS_CACHED; i++)
+		if (title_formats[i] && !strcmp (title_formats[i]->fmt, fmt))
+			return title_formats[i];
+
+	tf = (struct title_format *)xcalloc (1, sizeof(struct title_format));
+	tf->fmt = xstrdup (fmt);
+	tf->text = (char *)xmalloc (strlen (fmt) + 1);
+	title_compile (tf, fmt, fmt + strlen (fmt));
 
-	free = MAX(free, 0); /* Possible integer overflow? */
-	dest[size - free] = '\0';
+	if (title_formats[title_formats_next])
+		title_format_free (title_formats[title_formats_next]);
+	title_formats[title_formats_next] = tf;
+	title_formats_next = (title_formats_next + 1) % TITLE_FORMATS_CACHED;
+
+	return tf;
+}
+
+/* Get the value of the tag for the format string; NULL if it's empty. */
+static const char *title_field (const char field,
+		const struct file_tags *tags, char *track)
+{
+	const char *str = NULL;
+
+	if (!tags)
+		return NULL;
+
+	switch (field) {
+		case 'n':
+			if (tags->track == -1)
+				return NULL;
+			sprintf (track, "%d", tags->track);
+			return track;
+		case 'a':
+			str = tags->artist;
+			break;
+		case 'A':
+			str = tags->album;
+			break;
+		case 't':
+			str = tags->title;
+			break;
+	}
+
+	return str && *str ? str : NULL;
+}
+
+/* Render ops into dest at *pos (not beyond size - 1). */
+static void title_render (const struct title_format *tf, int op, int end,
+		const struct file_tags *tags, char *dest, int size, int *pos)
+{
+	char track[16];
+
+	while (op < end) {
+		const struct title_op *o = &tf->ops[op++];
+		const char *str;
+		int len;
+
+		switch (o->type) {
+			case TITLE_OP_TEXT:
+				len = MIN(o->len, size - 1 - *pos);
+				memcpy (dest + *pos, tf->text + o->text, len);
+				*pos += len;
+				break;
+			case TITLE_OP_FIELD:
+				if ((str = title_field (o->field, tags, track))) {
+					len = strlen (str);
+					len = MIN(len, size - 1 - *pos);
+					memcpy (dest + *pos, str, len);
+					*pos += len;
+				}
+				break;
+			case TITLE_OP_COND:
+				if (title_field (o->field, tags, track))
+					title_render (tf, op, op + o->true_ops, tags,
+					              dest, size, pos);
+				else
+					title_render (tf, op + o->true_ops,
+					              op + o->true_ops + o->false_ops,
+					              tags, dest, size, pos);
+				op += o->true_ops + o->false_ops;
+				break;
+		}
+	}
+}
+
+/* Build file title from struct file_tags into dest of the given size. */
+void build_title_into (char *dest, const int size,
+		const struct file_tags *tags, const char *fmt)
+{
+	const struct title_format *tf;
+	int pos = 0;
+
+	assert (dest != NULL);
+	assert (size > 0);
+	assert (fmt != NULL);
+
+	tf = get_title_format (fmt);
+	title_render (tf, 0, tf->ops_num, tags, dest, size, &pos);
+	dest[pos] = '\0';
 }
 
 /* Build file title from struct file_tags. Returned memory is malloc()ed. */
@@ -577,7 +893,7 @@ char *build_title_with_format (const struct file_tags *tags, const char *fmt)
 {
 	char title[512];
 
-	do_title_expn (title, sizeof(title), fmt, tags);
+	build_title_into (title, sizeof(title), tags, fmt);
 	return xstrdup (title);
 }
 
@@ -677,14 +993,15 @@ void plist_set_file (struct plist *plist, const int num, const char *file)
 	assert (file != NULL);
 
 	if (plist->items[num].file) {
-		rb_delete (plist->search_tree, file);
+		if (index_lookup (plist, plist->items[num].file) == num)
+			index_remove (plist, plist->items[num].file);
 		free (plist->items[num].file);
 	}
 
 	plist->items[num].file = xstrdup (file);
 	plist->items[num].type = file_type (file);
 	plist->items[num].mtime = get_mtime (file);
-	rb_insert (plist->search_tree, (void *)(intptr_t)num);
+	index_add (plist, num);
 }
 
 /* Add the content of playlist b to a by copying items. */
@@ -783,10 +1100,27 @@ void plist_shuffle (struct plist *plist)
 	for (i = 0; i < plist->num; i += 1)
 		plist_swap (plist, i, (rand () / (float)RAND_MAX) * (plist->num - 1));
 
-	rb_tree_clear (plist->search_tree);
+	index_rebuild (plist);
+}
+
+/* Put the items in the given order: order[i] is the number of the item to
+ * be at position i, for all plist->num items. */
+void plist_reorder (struct plist *plist, const int *order)
+{
+	struct plist_item *items;
+	int i;
+
+	assert (plist != NULL);
+	assert (order != NULL);
 
+	items = (struct plist_item *)xmalloc (plist->allocated
+			* sizeof(struct plist_item));
 	for (i = 0; i < plist->num; i++)
-		rb_insert (plist->search_tree, (void *)(intptr_t)i);
+		items[i] = plist->items[order[i]];
+
+	free (plist->items);
+	plist->items = items;
+	index_rebuild (plist);
 }
 
 /* Swap the first item on the playlist with the item with file fname. */
@@ -800,11 +1134,8 @@ void plist_swap_first_fname (struct plist *plist, const char *fname)
 	i = plist_find_fname (plist, fname);
 
 	if (i != -1 && i != 0) {
-		rb_delete (plist->search_tree, fname);
-		rb_delete (plist->search_tree, plist->items[0].file);
 		plist_swap (plist, 0, i);
-		rb_insert (plist->search_tree, NULL);
-		rb_insert (plist->search_tree, (void *)(intptr_t)i);
+		index_rebuild (plist);
 	}
 }
 
@@ -919,24 +1250,23 @@ struct file_tags *plist_get_tags (const struct plist *plist, const int num)
 void plist_swap_files (struct plist *plist, const char *file1,
 		const char *file2)
 {
-	struct rb_node *x1, *x2;
+	int slot1, slot2;
 
 	assert (plist != NULL);
 	assert (file1 != NULL);
 	assert (file2 != NULL);
 
-	x1 = rb_search (plist->search_tree, file1);
-	x2 = rb_search (plist->search_tree, file2);
+	slot1 = index_find_slot (plist, file1);
+	slot2 = index_find_slot (plist, file2);
 
-	if (!rb_is_null(x1) && !rb_is_null(x2)) {
-		const void *t;
+	if (plist->index[slot1] >= 0 && plist->index[slot2] >= 0) {
+		int t;
 
-		plist_swap (plist, (intptr_t)rb_get_data (x1),
-		                   (intptr_t)rb_get_data (x2));
+		plist_swap (plist, plist->index[slot1], plist->index[slot2]);
 
-		t = rb_get_data (x1);
-		rb_set_data (x1, rb_get_data (x2));
-		rb_set_data (x2, t);
+		t = plist->index[slot1];
+		plist->index[slot1] = plist->index[slot2];
+		plist->index[slot2] = t;
 	}
 }
 
@@ -954,3 +1284,41 @@ int plist_get_position (const struct plist *plist, int num)
 
 	return pos;
 }
+
+/* Is it worth removing deleted items with plist_compact()? */
+int plist_needs_compaction (const struct plist *plist)
+{
+	int deleted;
+
+	assert (plist != NULL);
+
+	deleted = plist->num - plist->not_deleted;
+
+	return deleted > INIT_SIZE && deleted > plist->not_deleted;
+}
+
+/* Remove deleted items keeping the order of the others.  Item numbers
+ * change, so return the new number of item 'num' (-1 if it's -1 or was
+ * deleted) for the caller to update the numbers it holds. */
+int plist_compact (struct plist *plist, const int num)
+{
+	int i, n, new_num = -1;
+
+	assert (plist != NULL);
+	assert (num == -1 || LIMIT(num, plist->num));
+
+	for (i = n = 0; i < plist->num; i++) {
+		if (plist->items[i].deleted)
+			plist_free_item_fields (&plist->items[i]);
+		else {
+			if (i == num)
+				new_num = n;
+			plist->items[n++] = plist->items[i];
+		}
+	}
+
+	plist->num = n;
+	index_rebuild (plist);
+
+	return new_num;
+}
@@ -3,8 +3,6 @@
 
 #include <sys/types.h>
 
-#include "rbtree.h"
-
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -46,6 +44,7 @@ struct plist_item
 	short deleted;
 	time_t mtime;		/* modification time */
 	int queue_pos;		/* position in the queue */
+	int tags_asked;		/* tags requested from the server (TAGS_*) */
 };
 
 struct plist
@@ -58,12 +57,17 @@ struct plist
 	int total_time;		/* Total time for files on the playlist */
 	int items_with_time;	/* Number of items for which the time is set. */
 
-	struct rb_tree *search_tree;
+	/* Hash table of item numbers by file name (open addressing). */
+	int *index;
+	int index_size;		/* number of slots, a power of 2 */
+	int index_used;		/* number of slots ever used */
 };
 
 void plist_init (struct plist *plist);
 int plist_add (struct plist *plist, const char *file_name);
 int plist_add_from_item (struct plist *plist, const struct plist_item *item);
+int plist_add_items (struct plist *plist, struct plist_item *items,
+		const int count);
 char *plist_get_file (const struct plist *plist, int i);
 int plist_next (struct plist *plist, int num);
 int plist_prev (struct plist *plist, int num);
@@ -77,6 +81,8 @@ void tags_clear (struct file_tags *tags);
 void tags_copy (struct file_tags *dst, const struct file_tags *src);
 struct file_tags *tags_dup (const struct file_tags *tags);
 void tags_free (struct file_tags *tags);
+void build_title_into (char *dest, const int size,
+		const struct file_tags *tags, const char *fmt);
 char *build_title_with_format (const struct file_tags *tags, const char *fmt);
 char *build_title (const struct file_tags *tags);
 int plist_count (const struct plist *plist);
@@ -93,6 +99,7 @@ int get_item_time (const struct plist *plist, const int i);
 int plist_total_time (const struct plist *plisti, int *all_files);
 void plist_shuffle (struct plist *plist);
 void plist_swap_first_fname (struct plist *plist, const char *fname);
+void plist_reorder (struct plist *plist, const int *order);
 struct plist_item *plist_new_item ();
 void plist_free_item_fields (struct plist_item *item);
 void plist_set_serial (struct plist *plist, const int serial);
@@ -111,6 +118,9 @@ struct file_tags *plist_get_tags (const struct plist *plist, const int num);
 void plist_swap_files (struct plist *plist, const char *file1,
 		const char *file2);
 int plist_get_position (const struct plist *plist, int num);
+int plist_needs_compaction (const struct plist *plist);
+int plist_compact (struct plist *plist, const int num);
+int plist_files_hash (const struct plist *plist, const int count);
 
 #ifdef __cplusplus
 }
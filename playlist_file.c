@@ -16,13 +16,22 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <strings.h>
 #include <ctype.h>
 #include <errno.h>
 #include <assert.h>
 
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
 #define DEBUG
 
 #include "common.h"
@@ -34,6 +43,9 @@
 #include "interface.h"
 #include "decoder.h"
 
+/* Don't start a thread for fewer files to stat() when loading a playlist. */
+#define STAT_ITEMS_PER_THREAD	1024
+
 int is_plist_file (const char *name)
 {
 	const char *ext = ext_pos (name);
@@ -44,334 +56,653 @@ int is_plist_file (const char *name)
 	return 0;
 }
 
-static void make_path (char *buf, const int buf_size,
-		const char *cwd, char *path)
+/* A playlist file's content, mapped into memory or read if it can't be. */
+struct plist_data
+{
+	int fd;
+	char *data;
+	size_t size;
+	int mapped;
+};
+
+/* Parsing position in the playlist data. */
+struct plist_parser
+{
+	const char *pos;
+	const char *end;
+	const char *cwd;
+	size_t cwd_len;
+};
+
+/* Items read from the playlist, before they are added to it. */
+struct plist_items
+{
+	struct plist_item *items;
+	int num;
+	int allocated;
+};
+
+/* Open, lock and map the playlist file.  Return 0 on error. */
+static int plist_data_open (struct plist_data *pd, const char *fname)
 {
-	if (file_type(path) == F_URL) {
-		strncpy (buf, path, buf_size);
-		buf[buf_size-1] = 0;
-		return;
+	struct stat st;
+	struct flock read_lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET};
+
+	pd->data = NULL;
+	pd->size = 0;
+	pd->mapped = 0;
+
+	pd->fd = open (fname, O_RDONLY);
+	if (pd->fd == -1) {
+		error_errno ("Can't open playlist file", errno);
+		return 0;
+	}
+
+	/* Lock gets released by close(). */
+	if (fcntl (pd->fd, F_SETLKW, &read_lock) == -1)
+		log_errno ("Can't lock the playlist file", errno);
+
+	if (fstat (pd->fd, &st) == -1) {
+		error_errno ("Can't stat playlist file", errno);
+		close (pd->fd);
+		return 0;
+	}
+
+	if (st.st_size == 0)
+		return 1;
+
+	if ((uint64_t)st.st_size > SIZE_MAX) {
+		error ("Playlist file is too big");
+		close (pd->fd);
+		return 0;
+	}
+
+	pd->size = (size_t)st.st_size;
+
+#ifdef HAVE_MMAP
+	pd->data = mmap (0, pd->size, PROT_READ, MAP_PRIVATE, pd->fd, 0);
+	if (pd->data != MAP_FAILED) {
+		pd->mapped = 1;
+		return 1;
 	}
+	log_errno ("mmap() failed", errno);
+#endif
 
-	if (path[0] != '/')
-		strcpy (buf, cwd);
+	pd->data = (char *)xmalloc (pd->size);
+	if (read (pd->fd, pd->data, pd->size) != (ssize_t)pd->size) {
+		error_errno ("Can't read playlist file", errno);
+		free (pd->data);
+		close (pd->fd);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void plist_data_close (struct plist_data *pd)
+{
+#ifdef HAVE_MMAP
+	if (pd->mapped)
+		munmap (pd->data, pd->size);
 	else
+#endif
+		free (pd->data);
+
+	close (pd->fd);
+}
+
+static void plist_parser_init (struct plist_parser *p,
+		const struct plist_data *pd, const char *cwd)
+{
+	p->pos = pd->data;
+	p->end = pd->data + pd->size;
+	p->cwd = cwd;
+	p->cwd_len = cwd ? strlen (cwd) : 0;
+}
+
+/* Return the next line and put its length without the line terminator in
+ * len.  Return NULL at the end of data. */
+static const char *next_line (struct plist_parser *p, size_t *len)
+{
+	const char *line = p->pos;
+	const char *nl;
+
+	if (p->pos >= p->end)
+		return NULL;
+
+	nl = memchr (p->pos, '\n', p->end - p->pos);
+	if (nl) {
+		*len = nl - line;
+		p->pos = nl + 1;
+	}
+	else {
+		*len = p->end - line;
+		p->pos = p->end;
+	}
+
+	if (*len > 0 && line[*len - 1] == '\r')
+		(*len)--;
+
+	return line;
+}
+
+static int starts_with (const char *line, const size_t len, const char *prefix)
+{
+	size_t plen = strlen (prefix);
+
+	return len >= plen && !memcmp (line, prefix, plen);
+}
+
+/* Return the length of the string without white chars at the end. */
+static size_t strip_len (const char *str, size_t len)
+{
+	while (len > 0 && isblank(str[len - 1]))
+		len--;
+
+	return len;
+}
+
+static char *xstrndup (const char *str, const size_t len)
+{
+	char *res = (char *)xmalloc (len + 1);
+
+	memcpy (res, str, len);
+	res[len] = 0;
+
+	return res;
+}
+
+/* Return 1 if resolve_path() would not change the absolute path. */
+static int is_clean_path (const char *path, const size_t len)
+{
+	if (len < 2 || path[len - 1] == '/')
+		return 0;
+	if ((len >= 2 && !memcmp (path + len - 2, "/.", 2))
+			|| (len >= 3 && !memcmp (path + len - 3, "/..", 3)))
+		return 0;
+
+	return !strstr (path, "//") && !strstr (path, "/./")
+		&& !strstr (path, "/../");
+}
+
+/* Make the malloc()ed absolute path of the file from the playlist.  Most
+ * paths need no resolving, so resolve_path() is used only for those which
+ * do.  Return NULL if the path is too long. */
+static char *make_path (const struct plist_parser *p, const char *file,
+		const size_t len)
+{
+	char path[PATH_MAX + 1];
+	char buf[2 * PATH_MAX];
+	size_t buf_len;
+
+	if (len > PATH_MAX)
+		return NULL;
+
+	memcpy (path, file, len);
+	path[len] = 0;
+
+	if (is_url (path))
+		return xstrdup (path);
+
+	if (path[0] == '/') {
+		if (is_clean_path (path, len))
+			return xstrdup (path);
 		strcpy (buf, "/");
+	}
+	else {
+		buf_len = p->cwd_len + 1 + len;
+		if (buf_len < sizeof(buf)) {
+			memcpy (buf, p->cwd, p->cwd_len);
+			buf[p->cwd_len] = '/';
+			memcpy (buf + p->cwd_len + 1, path, len + 1);
+			if (is_clean_path (buf, buf_len))
+				return xstrdup (buf);
+		}
+		strcpy (buf, p->cwd);
+	}
+
+	resolve_path (buf, sizeof(buf), path);
 
-	resolve_path (buf, buf_size, path);
+	return xstrdup (buf);
 }
 
-/* Strip white chars from the end of a string. */
-static void strip_string (char *str)
+static struct plist_item *items_add (struct plist_items *items, char *file)
 {
-	char *c = str;
-	char *last_non_white = str;
+	struct plist_item *item;
 
-	while (*c) {
-		if (!isblank(*c))
-			last_non_white = c;
-		c++;
+	if (items->num == items->allocated) {
+		items->allocated = items->allocated ? items->allocated * 2 : 256;
+		items->items = (struct plist_item *)xrealloc (items->items,
+				items->allocated * sizeof(struct plist_item));
 	}
 
-	if (c > last_non_white)
-		*(last_non_white + 1) = 0;
+	item = &items->items[items->num++];
+	memset (item, 0, sizeof(struct plist_item));
+	item->file = file;
+	item->type = F_OTHER;
+	item->mtime = (time_t)-1;
+
+	return item;
+}
+
+static void item_set_time (struct plist_item *item, const int time)
+{
+	if (!item->tags)
+		item->tags = tags_new ();
+	item->tags->time = time;
+	item->tags->filled |= TAGS_TIME;
+}
+
+/* Items for which stat_items_thread() gets the type and mtime. */
+struct stat_job
+{
+	pthread_t tid;
+	struct plist_item *items;
+	int num;
+};
+
+static void *stat_items_thread (void *data)
+{
+	struct stat_job *job = (struct stat_job *)data;
+	int i;
+
+	for (i = 0; i < job->num; i++)
+		job->items[i].type = file_type_mtime (job->items[i].file,
+		                                      &job->items[i].mtime);
+
+	return NULL;
+}
+
+/* Fill the type and mtime of the items.  This means a stat() for every
+ * file, so a few threads do it for long lists. */
+static void stat_items (struct plist_items *items)
+{
+	struct stat_job *jobs;
+	int i, jobs_num, started, rc;
+	long cpus;
+
+	cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	jobs_num = CLAMP(1, MIN(cpus, items->num / STAT_ITEMS_PER_THREAD), 8);
+	jobs = (struct stat_job *)xmalloc (jobs_num * sizeof(struct stat_job));
+
+	for (i = 0; i < jobs_num; i++) {
+		int first = (int)((long)items->num * i / jobs_num);
+		int last = (int)((long)items->num * (i + 1) / jobs_num);
+
+		jobs[i].items = items->items + first;
+		jobs[i].num = last - first;
+	}
+
+	/* The first part is done by this thread. */
+	started = 1;
+	for (i = 1; i < jobs_num; i++) {
+		rc = pthread_create (&jobs[i].tid, NULL, stat_items_thread,
+		                     &jobs[i]);
+		if (rc != 0) {
+			log_errno ("Can't create thread", rc);
+			break;
+		}
+		started++;
+	}
+
+	/* Do the jobs of threads which couldn't be created here too. */
+	stat_items_thread (&jobs[0]);
+	for (i = started; i < jobs_num; i++)
+		stat_items_thread (&jobs[i]);
+
+	for (i = 1; i < started; i++) {
+		rc = pthread_join (jobs[i].tid, NULL);
+		if (rc != 0)
+			fatal ("pthread_join() on playlist loading thread "
+			       "failed: %s", xstrerror (rc));
+	}
+
+	free (jobs);
+}
+
+/* Add the items read from a playlist file to the playlist.  Return the
+ * number of items added. */
+static int add_items (struct plist *plist, struct plist_items *items)
+{
+	int added;
+
+	stat_items (items);
+	added = plist_add_items (plist, items->items, items->num);
+	free (items->items);
+
+	return added;
 }
 
 /* Load M3U file into plist.  Return the number of items read. */
 static int plist_load_m3u (struct plist *plist, const char *fname,
 		const char *cwd, const int load_serial)
 {
-	FILE *file;
-	char *line = NULL;
-	int last_added = -1;
-	int after_extinf = 0;
-	int added = 0;
-	struct flock read_lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET};
-
-	file = fopen (fname, "r");
-	if (!file) {
-		error_errno ("Can't open playlist file", errno);
+	struct plist_data pd;
+	struct plist_parser p;
+	struct plist_items items = {NULL, 0, 0};
+	struct plist_item *extinf = NULL;
+	const char *line;
+	size_t len;
+
+	if (!plist_data_open (&pd, fname))
 		return 0;
-	}
 
-	/* Lock gets released by fclose(). */
-	if (fcntl (fileno (file), F_SETLKW, &read_lock) == -1)
-		log_errno ("Can't lock the playlist file", errno);
+	plist_parser_init (&p, &pd, cwd);
 
-	while ((line = read_line (file))) {
-		if (!strncmp (line, "#EXTINF:", sizeof("#EXTINF:") - 1)) {
-			char *comma, *num_err;
-			char time_text[10] = "";
+	while ((line = next_line (&p, &len))) {
+		if (starts_with (line, len, "#EXTINF:")) {
+			const char *time_text = line + sizeof("#EXTINF:") - 1;
+			const char *comma;
+			char time_buf[10], *num_err;
+			size_t time_len;
 			int time_sec;
 
-			if (after_extinf) {
+			if (extinf) {
 				error ("Broken M3U file: double #EXTINF!");
-				plist_delete (plist, last_added);
-				goto err;
+				break;
 			}
 
 			/* Find the comma */
-			comma = strchr (line + (sizeof("#EXTINF:") - 1), ',');
+			comma = memchr (time_text, ',', line + len - time_text);
 			if (!comma) {
 				error ("Broken M3U file: no comma in #EXTINF!");
-				goto err;
+				break;
 			}
 
 			/* Get the time string */
-			time_text[sizeof(time_text) - 1] = 0;
-			strncpy (time_text, line + sizeof("#EXTINF:") - 1,
-			         MIN(comma - line - (sizeof("#EXTINF:") - 1),
-			         sizeof(time_text)));
-			if (time_text[sizeof(time_text) - 1]) {
+			time_len = comma - time_text;
+			if (time_len >= sizeof(time_buf)) {
 				error ("Broken M3U file: wrong time!");
-				goto err;
+				break;
 			}
+			memcpy (time_buf, time_text, time_len);
+			time_buf[time_len] = 0;
 
 			/* Extract the time. */
-			time_sec = strtol (time_text, &num_err, 10);
+			time_sec = strtol (time_buf, &num_err, 10);
 			if (*num_err) {
 				error ("Broken M3U file: time is not a number!");
-				goto err;
+				break;
 			}
 
-			after_extinf = 1;
-			last_added = plist_add (plist, NULL);
-			plist_set_title_tags (plist, last_added, comma + 1);
-
-			if (*time_text)
-				plist_set_item_time (plist, last_added, time_sec);
+			/* The file is filled in by the next line. */
+			extinf = items_add (&items, NULL);
+			extinf->title_tags = xstrndup (comma + 1,
+			                               line + len - comma - 1);
+			if (time_len)
+				item_set_time (extinf, time_sec);
 		}
-		else if (line[0] != '#') {
-			char path[2 * PATH_MAX];
-
-			strip_string (line);
-			if (strlen (line) <= PATH_MAX) {
-				make_path (path, sizeof(path), cwd, line);
-
-				if (plist_find_fname (plist, path) == -1) {
-					if (after_extinf)
-						plist_set_file (plist, last_added, path);
-					else
-						plist_add (plist, path);
-					added += 1;
-				}
-				else if (after_extinf)
-					plist_delete (plist, last_added);
+		else if (len > 0 && line[0] != '#') {
+			char *path;
+
+			path = make_path (&p, line, strip_len (line, len));
+
+			if (extinf && path)
+				extinf->file = path;
+			else if (extinf) {
+				plist_free_item_fields (extinf);
+				items.num--;
 			}
-			else if (after_extinf)
-				plist_delete (plist, last_added);
+			else if (path)
+				items_add (&items, path);
 
-			after_extinf = 0;
+			extinf = NULL;
 		}
-		else if (load_serial &&
-		         !strncmp (line, "#MOCSERIAL: ", sizeof("#MOCSERIAL: ") - 1)) {
-			char *serial_str = line + sizeof("#MOCSERIAL: ") - 1;
+		else if (load_serial && starts_with (line, len, "#MOCSERIAL: ")) {
+			const char *serial_str = line + sizeof("#MOCSERIAL: ") - 1;
+			char buf[32], *err;
+			size_t serial_len = line + len - serial_str;
+			long serial;
 
-			if (serial_str[0]) {
-				char *err;
-				long serial;
+			if (serial_len > 0 && serial_len < sizeof(buf)) {
+				memcpy (buf, serial_str, serial_len);
+				buf[serial_len] = 0;
 
-				serial = strtol (serial_str, &err, 0);
+				serial = strtol (buf, &err, 0);
 				if (!*err) {
 					plist_set_serial (plist, serial);
 					logit ("Got MOCSERIAL tag with serial %ld", serial);
 				}
 			}
 		}
-		free (line);
 	}
 
-err:
-	free (line);
-	fclose (file);
-	return added;
+	/* Drop the #EXTINF item without a file. */
+	if (extinf) {
+		plist_free_item_fields (extinf);
+		items.num--;
+	}
+
+	plist_data_close (&pd);
+
+	return add_items (plist, &items);
 }
 
-/* Return 1 if the line contains only blank characters, 0 otherwise. */
-static int is_blank_line (const char *l)
+/* Value of a PLS file entry. */
+struct pls_value
 {
-	while (*l && isblank(*l))
-		l++;
+	const char *str;
+	size_t len;
+};
 
-	if (*l)
-		return 0;
-	return 1;
+/* Values of one PLS file entry. */
+struct pls_entry
+{
+	struct pls_value file;
+	struct pls_value title;
+	struct pls_value length;
+};
+
+/* Return 1 if the line contains only blank characters, 0 otherwise. */
+static int is_blank_line (const char *l, const size_t len)
+{
+	return strip_len (l, len) == 0;
 }
 
-/* Read a value from the given section from .INI file.  File should be opened
- * and seeking will be performed on it.  Return the malloc()ed value or NULL
- * if not present or error occurred. */
-static char *read_ini_value (FILE *file, const char *section, const char *key)
+/* Parse the next line of the [playlist] section of a PLS file putting the
+ * key and the value in key and value.  Return 1 if a key was read, 0 at the
+ * end of the section and -1 on error. */
+static int pls_next_value (struct plist_parser *p, int *in_section,
+		struct pls_value *key, struct pls_value *value)
 {
-	char *line = NULL;
-	int in_section = 0;
-	char *value = NULL;
-	int key_len;
+	const char *line;
+	size_t len;
 
-	if (fseek(file, 0, SEEK_SET)) {
-		error_errno ("File fseek() error", errno);
-		return NULL;
-	}
+	while ((line = next_line (p, &len))) {
+		const char *eq, *v, *end = line + len;
 
-	key_len = strlen (key);
+		if (len > 0 && line[0] == '[') {
+			const char *close;
 
-	while ((line = read_line(file))) {
-		if (line[0] == '[') {
-			if (in_section) {
+			/* we are outside of the interesting section */
+			if (*in_section)
+				return 0;
 
-				/* we are outside of the interesting section */
-				free (line);
-				break;
+			close = memchr (line, ']', len);
+			if (!close) {
+				error ("Parse error in the INI file");
+				return -1;
 			}
-			else {
-				char *close = strchr (line, ']');
 
-				if (!close) {
-					error ("Parse error in the INI file");
-					free (line);
-					break;
-				}
+			*in_section = close - line - 1 == sizeof("playlist") - 1
+				&& !strncasecmp (line + 1, "playlist",
+				                 sizeof("playlist") - 1);
+			continue;
+		}
 
-				if (!strncasecmp(line + 1, section,
-							close - line - 1))
-					in_section = 1;
-			}
+		if (!*in_section || (len > 0 && line[0] == '#')
+				|| is_blank_line (line, len))
+			continue;
+
+		eq = memchr (line, '=', len);
+		if (!eq || strip_len (line, eq - line) == 0) {
+			error ("Parse error in the INI file");
+			return -1;
 		}
-		else if (in_section && line[0] != '#' && !is_blank_line(line)) {
-			char *t, *t2;
 
-			t2 = t = strchr (line, '=');
+		key->str = line;
+		key->len = strip_len (line, eq - line);
 
-			if (!t) {
-				error ("Parse error in the INI file");
-				free (line);
-				break;
-			}
+		v = eq + 1;
+		while (v < end && isblank(*v))
+			v++;
 
-			/* go back to the last char in the name */
-			while (t2 >= t && (isblank(*t2) || *t2 == '='))
-				t2--;
+		if (v < end && *v == '"') {
+			const char *q = memchr (v + 1, '"', end - v - 1);
 
-			if (t2 == t) {
+			if (!q) {
 				error ("Parse error in the INI file");
-				free (line);
-				break;
+				return -1;
 			}
 
-			if (!strncasecmp(line, key,
-						MAX(t2 - line + 1, key_len))) {
-				value = t + 1;
+			v++;
+			end = q;
+		}
 
-				while (isblank(value[0]))
-					value++;
+		value->str = v;
+		value->len = end - v;
 
-				if (value[0] == '"') {
-					char *q = strchr (value + 1, '"');
+		return 1;
+	}
 
-					if (!q) {
-						error ("Parse error in the INI file");
-						free (line);
-						break;
-					}
+	return 0;
+}
 
-					*q = 0;
-				}
+/* If the key is the prefix followed by a number, return the number.
+ * Otherwise return -1. */
+static long pls_key_num (const struct pls_value *key, const char *prefix)
+{
+	size_t plen = strlen (prefix);
+	size_t i;
+	long num = 0;
 
-				value = xstrdup (value);
-				free (line);
-				break;
-			}
-		}
+	if (key->len <= plen || strncasecmp (key->str, prefix, plen))
+		return -1;
 
-		free (line);
+	for (i = plen; i < key->len; i++) {
+		if (!isdigit ((unsigned char)key->str[i]) || num > INT_MAX / 10)
+			return -1;
+		num = num * 10 + key->str[i] - '0';
 	}
 
-	return value;
+	return num;
 }
 
 /* Load PLS file into plist. Return the number of items read. */
 static int plist_load_pls (struct plist *plist, const char *fname,
 		const char *cwd)
 {
-	FILE *file;
-	char *e, *line = NULL;
-	long i, nitems, added = 0;
-
-	file = fopen (fname, "r");
-	if (!file) {
-		error_errno ("Can't open playlist file", errno);
+	struct plist_data pd;
+	struct plist_parser p;
+	struct plist_items items = {NULL, 0, 0};
+	struct pls_entry *entries;
+	struct pls_value key, value;
+	int in_section, rc;
+	long i, nitems = -1;
+
+	if (!plist_data_open (&pd, fname))
 		return 0;
+
+	/* Find the number of entries first. */
+	plist_parser_init (&p, &pd, cwd);
+	in_section = 0;
+	while ((rc = pls_next_value (&p, &in_section, &key, &value)) == 1) {
+		if (key.len == sizeof("NumberOfEntries") - 1
+				&& !strncasecmp (key.str, "NumberOfEntries",
+				                 key.len)) {
+			char buf[16], *e;
+
+			nitems = -2;
+			if (value.len > 0 && value.len < sizeof(buf)) {
+				memcpy (buf, value.str, value.len);
+				buf[value.len] = 0;
+				nitems = strtol (buf, &e, 10);
+				if (*e || nitems < 0)
+					nitems = -2;
+			}
+			break;
+		}
 	}
 
-	line = read_ini_value (file, "playlist", "NumberOfEntries");
-	if (!line) {
+	if (nitems == -1) {
 
 		/* Assume that it is a pls file version 1 - plist_load_m3u()
 		 * should handle it like an m3u file without the m3u extensions. */
-		fclose (file);
+		plist_data_close (&pd);
 		return plist_load_m3u (plist, fname, cwd, 0);
 	}
 
-	nitems = strtol (line, &e, 10);
-	if (*e) {
+	/* Every entry needs at least a line in the file. */
+	if (nitems == -2 || (size_t)nitems > pd.size) {
 		error ("Broken PLS file");
-		goto err;
+		plist_data_close (&pd);
+		return 0;
+	}
+
+	/* Collect the values of all entries in one pass. */
+	entries = (struct pls_entry *)xcalloc (nitems + 1,
+	                                       sizeof(struct pls_entry));
+	plist_parser_init (&p, &pd, cwd);
+	in_section = 0;
+	while ((rc = pls_next_value (&p, &in_section, &key, &value)) == 1) {
+		struct pls_value *v;
+		long num;
+
+		if ((num = pls_key_num (&key, "File")) >= 1 && num <= nitems)
+			v = &entries[num].file;
+		else if ((num = pls_key_num (&key, "Title")) >= 1
+				&& num <= nitems)
+			v = &entries[num].title;
+		else if ((num = pls_key_num (&key, "Length")) >= 1
+				&& num <= nitems)
+			v = &entries[num].length;
+		else
+			continue;
+
+		/* The first value of the key counts. */
+		if (!v->str)
+			*v = value;
 	}
 
 	for (i = 1; i <= nitems; i++) {
-		int time, last_added;
-		char *pls_file, *pls_title, *pls_length;
-		char key[16], path[2 * PATH_MAX];
+		struct pls_entry *e = &entries[i];
+		struct plist_item *item;
+		char *path;
+		int time = -1;
 
-		sprintf (key, "File%ld", i);
-		pls_file = read_ini_value (file, "playlist", key);
-		if (!pls_file) {
+		if (!e->file.str) {
 			error ("Broken PLS file");
-			goto err;
+			break;
 		}
 
-		sprintf (key, "Title%ld", i);
-		pls_title = read_ini_value (file, "playlist", key);
-
-		sprintf (key, "Length%ld", i);
-		pls_length = read_ini_value (file, "playlist", key);
+		if (e->length.str && e->length.len > 0
+				&& e->length.len < 16) {
+			char buf[16], *err;
 
-		if (pls_length) {
-			time = strtol (pls_length, &e, 10);
-			if (*e)
+			memcpy (buf, e->length.str, e->length.len);
+			buf[e->length.len] = 0;
+			time = strtol (buf, &err, 10);
+			if (*err)
 				time = -1;
 		}
-		else
-			time = -1;
 
-		if (strlen (pls_file) <= PATH_MAX) {
-			make_path (path, sizeof(path), cwd, pls_file);
-			if (plist_find_fname (plist, path) == -1) {
-				last_added = plist_add (plist, path);
+		path = make_path (&p, e->file.str, e->file.len);
+		if (!path)
+			continue;
 
-				if (pls_title && pls_title[0])
-					plist_set_title_tags (plist, last_added, pls_title);
+		item = items_add (&items, path);
+		if (e->title.len > 0)
+			item->title_tags = xstrndup (e->title.str, e->title.len);
+		if (time > 0)
+			item_set_time (item, time);
+	}
 
-				if (time > 0) {
-					plist->items[last_added].tags = tags_new ();
-					plist->items[last_added].tags->time = time;
-					plist->items[last_added].tags->filled |= TAGS_TIME;
-				}
-			}
-		}
+	free (entries);
+	plist_data_close (&pd);
 
-		free (pls_file);
-		if (pls_title)
-			free (pls_title);
-		if (pls_length)
-			free (pls_length);
-		added += 1;
-	}
+	add_items (plist, &items);
 
-err:
-	free (line);
-	fclose (file);
-	return added;
+	return i - 1;
 }
 
 /* Load a playlist into plist. Return the number of items on the list. */
@@ -466,3 +797,298 @@ err:
 		fclose (file);
 	return result;
 }
+
+/* Snapshot of a playlist with the tags and the queue for quick loading.
+ * It's valid only with the m3u playlist file it was saved along with. */
+#define SNAPSHOT_MAGIC		"MOCSNAP"
+#define SNAPSHOT_VERSION	2
+
+/* Header of the snapshot after the magic. */
+struct snapshot_header
+{
+	int version;
+	int64_t plist_mtime;	/* mtime and size of the m3u file */
+	int64_t plist_size;
+	int serial;
+	int num;		/* number of items */
+	int queue_num;		/* number of files in the queue */
+	int hash;		/* plist_files_hash() of the items */
+};
+
+static void snap_write_str (FILE *f, const char *s)
+{
+	int len = s ? (int)strlen (s) : -1;
+
+	fwrite (&len, sizeof (len), 1, f);
+	if (s)
+		fwrite (s, 1, len, f);
+}
+
+static void snap_write_int (FILE *f, const int val)
+{
+	fwrite (&val, sizeof (val), 1, f);
+}
+
+static void snap_write_int64 (FILE *f, const int64_t val)
+{
+	fwrite (&val, sizeof (val), 1, f);
+}
+
+static int snap_read (struct plist_parser *p, void *val, const size_t size)
+{
+	if ((size_t)(p->end - p->pos) < size)
+		return 0;
+	memcpy (val, p->pos, size);
+	p->pos += size;
+
+	return 1;
+}
+
+/* Read a string written by snap_write_str() into the malloc()ed *str
+ * (NULL if it was NULL).  Return 0 on error. */
+static int snap_read_str (struct plist_parser *p, char **str)
+{
+	int len;
+
+	if (!snap_read (p, &len, sizeof (len)) || len < -1
+			|| len > p->end - p->pos)
+		return 0;
+
+	if (len == -1)
+		*str = NULL;
+	else {
+		*str = xstrndup (p->pos, len);
+		p->pos += len;
+	}
+
+	return 1;
+}
+
+/* Save the snapshot of the playlist and the queue into fname.  plist_file
+ * is the m3u file with the same playlist just saved by plist_save().
+ * Return 0 on error. */
+int plist_save_snapshot (const struct plist *plist, const struct plist *queue,
+		const char *fname, const char *plist_file)
+{
+	FILE *file;
+	struct stat st;
+	char *tmp_name;
+	int i, result = 1;
+
+	if (stat (plist_file, &st) == -1) {
+		log_errno ("Can't stat the playlist file", errno);
+		return 0;
+	}
+
+	tmp_name = (char *)xmalloc (strlen (fname) + 5);
+	sprintf (tmp_name, "%s.tmp", fname);
+
+	if (!(file = fopen (tmp_name, "w"))) {
+		log_errno ("Can't write the playlist snapshot", errno);
+		free (tmp_name);
+		return 0;
+	}
+
+	fwrite (SNAPSHOT_MAGIC, 1, sizeof (SNAPSHOT_MAGIC) - 1, file);
+	snap_write_int (file, SNAPSHOT_VERSION);
+	snap_write_int64 (file, st.st_mtime);
+	snap_write_int64 (file, st.st_size);
+	snap_write_int (file, plist_get_serial (plist));
+	snap_write_int (file, plist_count (plist));
+	snap_write_int (file, plist_count (queue));
+	snap_write_int (file, plist_files_hash (plist, plist_count (plist)));
+
+	for (i = 0; i < plist->num; i++) {
+		const struct plist_item *item = &plist->items[i];
+
+		if (item->deleted)
+			continue;
+
+		snap_write_str (file, item->file);
+		snap_write_int (file, item->type);
+		snap_write_int64 (file, item->mtime);
+		snap_write_str (file, item->title_tags);
+
+		if (item->tags) {
+			snap_write_int (file, item->tags->filled);
+			snap_write_int (file, item->tags->time);
+			snap_write_int (file, item->tags->track);
+			snap_write_str (file, item->tags->title);
+			snap_write_str (file, item->tags->artist);
+			snap_write_str (file, item->tags->album);
+		}
+		else
+			snap_write_int (file, -1);
+	}
+
+	for (i = 0; i < queue->num; i++)
+		if (!queue->items[i].deleted)
+			snap_write_str (file, queue->items[i].file);
+
+	if (ferror (file) | fclose (file) || rename (tmp_name, fname) == -1) {
+		log_errno ("Error writing the playlist snapshot", errno);
+		unlink (tmp_name);
+		result = 0;
+	}
+
+	free (tmp_name);
+
+	return result;
+}
+
+/* Read the next playlist item from the snapshot.  Return 0 on error. */
+static int snap_read_item (struct plist_parser *p, struct plist_item *item)
+{
+	int type, filled;
+	int64_t mtime;
+
+	if (!snap_read_str (p, &item->file) || !item->file)
+		return 0;
+
+	if (!snap_read (p, &type, sizeof (type))
+			|| type < F_DIR || type > F_OTHER
+			|| !snap_read (p, &mtime, sizeof (mtime))
+			|| !snap_read_str (p, &item->title_tags)
+			|| !snap_read (p, &filled, sizeof (filled)))
+		return 0;
+
+	item->type = (enum file_type)type;
+	item->mtime = (time_t)mtime;
+
+	if (filled == -1)
+		return 1;
+
+	item->tags = tags_new ();
+	item->tags->filled = filled;
+
+	return snap_read (p, &item->tags->time, sizeof (item->tags->time))
+		&& snap_read (p, &item->tags->track,
+		              sizeof (item->tags->track))
+		&& snap_read_str (p, &item->tags->title)
+		&& snap_read_str (p, &item->tags->artist)
+		&& snap_read_str (p, &item->tags->album);
+}
+
+/* Open the snapshot and read its header if it's valid for the m3u file
+ * plist_file.  Return 0 if the snapshot can't be used. */
+static int snap_open (struct plist_data *pd, struct plist_parser *p,
+		struct snapshot_header *h, const char *fname,
+		const char *plist_file)
+{
+	struct stat st;
+
+	if (stat (plist_file, &st) == -1 || access (fname, R_OK))
+		return 0;
+
+	if (!plist_data_open (pd, fname))
+		return 0;
+
+	plist_parser_init (p, pd, NULL);
+
+	if (pd->size < sizeof (SNAPSHOT_MAGIC) - 1
+			|| memcmp (pd->data, SNAPSHOT_MAGIC,
+			           sizeof (SNAPSHOT_MAGIC) - 1)) {
+		logit ("Not a playlist snapshot file");
+		plist_data_close (pd);
+		return 0;
+	}
+	p->pos += sizeof (SNAPSHOT_MAGIC) - 1;
+
+	if (!snap_read (p, &h->version, sizeof (h->version))
+			|| h->version != SNAPSHOT_VERSION
+			|| !snap_read (p, &h->plist_mtime, sizeof (h->plist_mtime))
+			|| !snap_read (p, &h->plist_size, sizeof (h->plist_size))
+			|| !snap_read (p, &h->serial, sizeof (h->serial))
+			|| !snap_read (p, &h->num, sizeof (h->num))
+			|| !snap_read (p, &h->queue_num, sizeof (h->queue_num))
+			|| !snap_read (p, &h->hash, sizeof (h->hash))
+			|| h->num < 0 || h->queue_num < 0) {
+		logit ("Playlist snapshot is broken or has an old version");
+		plist_data_close (pd);
+		return 0;
+	}
+
+	if (h->plist_mtime != st.st_mtime || h->plist_size != st.st_size) {
+		logit ("Playlist snapshot is out of date");
+		plist_data_close (pd);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Get the serial number, the number of items and their plist_files_hash()
+ * from the snapshot without loading it.  Return 0 if the snapshot can't be
+ * used. */
+int plist_snapshot_info (const char *fname, const char *plist_file,
+		int *serial, int *num, int *hash)
+{
+	struct plist_data pd;
+	struct plist_parser p;
+	struct snapshot_header h;
+
+	if (!snap_open (&pd, &p, &h, fname, plist_file))
+		return 0;
+
+	plist_data_close (&pd);
+
+	*serial = h.serial;
+	*num = h.num;
+	*hash = h.hash;
+
+	return 1;
+}
+
+/* Load the playlist and the queue files from the snapshot if it's valid
+ * for the m3u file plist_file.  Only the files are put on the queue.
+ * Return the number of items loaded, 0 if the snapshot can't be used. */
+int plist_load_snapshot (struct plist *plist, struct plist *queue,
+		const char *fname, const char *plist_file)
+{
+	struct plist_data pd;
+	struct plist_parser p;
+	struct plist_items items = {NULL, 0, 0};
+	struct snapshot_header h;
+	int i, num;
+
+	if (!snap_open (&pd, &p, &h, fname, plist_file))
+		return 0;
+
+	num = h.num;
+
+	for (i = 0; i < num; i++) {
+		struct plist_item *item = items_add (&items, NULL);
+
+		if (!snap_read_item (&p, item))
+			break;
+	}
+
+	if (i < num) {
+		logit ("Playlist snapshot is broken");
+		for (i = 0; i < items.num; i++)
+			plist_free_item_fields (&items.items[i]);
+		free (items.items);
+		plist_data_close (&pd);
+		return 0;
+	}
+
+	for (i = 0; i < h.queue_num; i++) {
+		char *file;
+
+		if (!snap_read_str (&p, &file) || !file)
+			break;
+		if (plist_find_fname (queue, file) == -1)
+			plist_add (queue, file);
+		free (file);
+	}
+
+	plist_data_close (&pd);
+
+	num = plist_add_items (plist, items.items, items.num);
+	free (items.items);
+	plist_set_serial (plist, h.serial);
+
+	logit ("Loaded %d items from the playlist snapshot", num);
+
+	return num;
+}
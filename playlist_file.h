@@ -9,6 +9,12 @@ int plist_load (struct plist *plist, const char *fname, const char *cwd,
 		const int load_serial);
 int plist_save (struct plist *plist, const char *file, const int save_serial);
 int is_plist_file (const char *name);
+int plist_save_snapshot (const struct plist *plist, const struct plist *queue,
+		const char *fname, const char *plist_file);
+int plist_load_snapshot (struct plist *plist, struct plist *queue,
+		const char *fname, const char *plist_file);
+int plist_snapshot_info (const char *fname, const char *plist_file,
+		int *serial, int *num, int *hash);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,435 @@
+/*
+ * MOC - music on console
+ * Copyright (C) 2026 The MOC developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* Sorting the playlist by tags.  For every item a collation key is made
+ * once: strxfrm() of each string field (and the numbers as fixed width
+ * digits) one after another, so comparing two items is a few strcmp()
+ * calls.  Long playlists are sorted by a few threads, each making keys
+ * and sorting its part, and the parts are merged. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define DEBUG
+
+#include "common.h"
+#include "playlist.h"
+#include "playlist_sort.h"
+#include "lists.h"
+#include "log.h"
+
+/* Below this number of items per thread, additional threads are not
+ * worth starting. */
+#define SORT_ITEMS_PER_THREAD	4096
+
+/* Runs shorter than this are sorted by insertion. */
+#define INSERTION_SORT_MAX	16
+
+#define SORT_KEYS_MAX		8
+
+enum sort_key
+{
+	SORT_KEY_ARTIST,
+	SORT_KEY_ALBUM,
+	SORT_KEY_TRACK,
+	SORT_KEY_TITLE,
+	SORT_KEY_FILE,
+	SORT_KEY_TIME
+};
+
+static const char *sort_key_names[] = {
+	"Artist", "Album", "Track", "Title", "FileName", "Time"
+};
+
+struct sort_entry
+{
+	char *key;	/* collation keys of the fields, each ended with '\0' */
+	int num;	/* item number on the playlist */
+};
+
+struct sort_spec
+{
+	enum sort_key keys[SORT_KEYS_MAX];
+	int num;
+};
+
+/* Making keys and sorting a part of the playlist. */
+struct sort_job
+{
+	const struct plist *plist;
+	const struct sort_spec *spec;
+	struct sort_entry *entries;
+	struct sort_entry *tmp;
+	int num;
+};
+
+/* Merging two sorted runs: a (a_num entries) followed by b_num entries
+ * into dst. */
+struct merge_job
+{
+	const struct sort_spec *spec;
+	const struct sort_entry *src;
+	struct sort_entry *dst;
+	int a_num;
+	int b_num;
+};
+
+/* Parse the key names into spec.  Return 0 on an unknown key. */
+static int parse_sort_spec (struct sort_spec *spec, const lists_t_strs *keys)
+{
+	int ix, k;
+
+	spec->num = 0;
+	for (ix = 0; ix < lists_strs_size (keys); ix += 1) {
+		const char *name = lists_strs_at (keys, ix);
+
+		for (k = 0; k < (int)ARRAY_SIZE(sort_key_names); k++)
+			if (!strcasecmp (name, sort_key_names[k]))
+				break;
+
+		if (k == (int)ARRAY_SIZE(sort_key_names)) {
+			logit ("Unknown sort key: %s", name);
+			return 0;
+		}
+
+		if (spec->num < SORT_KEYS_MAX)
+			spec->keys[spec->num++] = (enum sort_key)k;
+	}
+
+	return 1;
+}
+
+/* Append the collation key of str to buf at *len, growing the buffer. */
+static void add_str_key (char **buf, size_t *size, size_t *len,
+		const char *str)
+{
+	size_t n;
+
+	n = strxfrm (*buf + *len, str, *size - *len);
+	if (n >= *size - *len) {
+		*size = *len + n + 64;
+		*buf = (char *)xrealloc (*buf, *size);
+		strxfrm (*buf + *len, str, *size - *len);
+	}
+
+	*len += n + 1;
+}
+
+static void add_int_key (char **buf, size_t *size, size_t *len, int val)
+{
+	char str[16];
+
+	/* -1 means unknown, it goes first. */
+	snprintf (str, sizeof(str), "%011d", val < 0 ? 0 : val + 1);
+	add_str_key (buf, size, len, str);
+}
+
+/* Make the key for the item, the result is malloc()ed. */
+static char *make_key (const struct plist_item *item,
+		const struct sort_spec *spec)
+{
+	const struct file_tags *tags = item->tags;
+	int track = -1, duration = -1;
+	size_t size = 256, len = 0;
+	char *buf = (char *)xmalloc (size);
+	int i;
+
+	/* Without the tags read, the numbers are not set. */
+	if (tags && (tags->filled & TAGS_COMMENTS))
+		track = tags->track;
+	if (tags && (tags->filled & TAGS_TIME))
+		duration = tags->time;
+
+	for (i = 0; i < spec->num; i++) {
+		switch (spec->keys[i]) {
+			case SORT_KEY_ARTIST:
+				add_str_key (&buf, &size, &len, tags && tags->artist
+				             ? tags->artist : "");
+				break;
+			case SORT_KEY_ALBUM:
+				add_str_key (&buf, &size, &len, tags && tags->album
+				             ? tags->album : "");
+				break;
+			case SORT_KEY_TRACK:
+				add_int_key (&buf, &size, &len, track);
+				break;
+			case SORT_KEY_TITLE:
+				if (tags && tags->title)
+					add_str_key (&buf, &size, &len, tags->title);
+				else
+					add_str_key (&buf, &size, &len, item->title_file
+					             ? item->title_file : item->file);
+				break;
+			case SORT_KEY_FILE:
+				add_str_key (&buf, &size, &len, item->file);
+				break;
+			case SORT_KEY_TIME:
+				add_int_key (&buf, &size, &len, duration);
+				break;
+		}
+	}
+
+	return buf;
+}
+
+static int entry_cmp (const struct sort_entry *a, const struct sort_entry *b,
+		const struct sort_spec *spec)
+{
+	const char *ka = a->key;
+	const char *kb = b->key;
+	int i, res;
+
+	for (i = 0; i < spec->num; i++) {
+		if ((res = strcmp (ka, kb)))
+			return res;
+		ka += strlen (ka) + 1;
+		kb += strlen (kb) + 1;
+	}
+
+	return 0;
+}
+
+/* Merge the sorted runs src[0..a_num) and src[a_num..a_num+b_num) into
+ * dst.  Equal entries are taken from the first run, so it's stable. */
+static void merge (struct sort_entry *dst, const struct sort_entry *src,
+		const int a_num, const int b_num, const struct sort_spec *spec)
+{
+	const struct sort_entry *a = src, *a_end = src + a_num;
+	const struct sort_entry *b = a_end, *b_end = a_end + b_num;
+
+	while (a < a_end && b < b_end) {
+		if (entry_cmp (b, a, spec) < 0)
+			*dst++ = *b++;
+		else
+			*dst++ = *a++;
+	}
+
+	while (a < a_end)
+		*dst++ = *a++;
+	while (b < b_end)
+		*dst++ = *b++;
+}
+
+/* Stable merge sort of the entries using tmp (of the same size) as the
+ * temporary space. */
+static void merge_sort (struct sort_entry *entries, struct sort_entry *tmp,
+		const int num, const struct sort_spec *spec)
+{
+	int half;
+
+	if (num <= INSERTION_SORT_MAX) {
+		int i, j;
+
+		for (i = 1; i < num; i++) {
+			struct sort_entry e = entries[i];
+
+			for (j = i; j > 0 && entry_cmp (&e, &entries[j - 1],
+						spec) < 0; j--)
+				entries[j] = entries[j - 1];
+			entries[j] = e;
+		}
+
+		return;
+	}
+
+	half = num / 2;
+	merge_sort (entries, tmp, half, spec);
+	merge_sort (entries + half, tmp + half, num - half, spec);
+
+	/* Already in order, which is common when sorting a sorted list. */
+	if (entry_cmp (&entries[half], &entries[half - 1], spec) >= 0)
+		return;
+
+	memcpy (tmp, entries, num * sizeof(struct sort_entry));
+	merge (entries, tmp, half, num - half, spec);
+}
+
+static void *sort_thread (void *data)
+{
+	struct sort_job *job = (struct sort_job *)data;
+	int i;
+
+	for (i = 0; i < job->num; i++)
+		job->entries[i].key = make_key (
+				&job->plist->items[job->entries[i].num],
+				job->spec);
+
+	merge_sort (job->entries, job->tmp, job->num, job->spec);
+
+	return NULL;
+}
+
+static void *merge_thread (void *data)
+{
+	struct merge_job *job = (struct merge_job *)data;
+
+	merge (job->dst, job->src, job->a_num, job->b_num, job->spec);
+
+	return NULL;
+}
+
+/* Start func for each job (num jobs of the given size) except the first
+ * which is run by this thread, wait for all to finish. */
+static void run_jobs (void *(*func)(void *), void *jobs, const size_t size,
+		const int num)
+{
+	pthread_t *tids;
+	int i, started, rc;
+
+	tids = (pthread_t *)xmalloc (num * sizeof(pthread_t));
+
+	started = 1;
+	for (i = 1; i < num; i++) {
+		rc = pthread_create (&tids[i], NULL, func,
+		                     (char *)jobs + i * size);
+		if (rc != 0) {
+			log_errno ("Can't create thread", rc);
+			break;
+		}
+		started++;
+	}
+
+	/* Do the jobs of threads which couldn't be created here too. */
+	func (jobs);
+	for (i = started; i < num; i++)
+		func ((char *)jobs + i * size);
+
+	for (i = 1; i < started; i++) {
+		rc = pthread_join (tids[i], NULL);
+		if (rc != 0)
+			fatal ("pthread_join() on sorting thread failed: %s",
+			       xstrerror (rc));
+	}
+
+	free (tids);
+}
+
+/* Sort the entries by a few threads.  Return the array with the result,
+ * it's either entries or tmp. */
+static struct sort_entry *sort_entries (const struct plist *plist,
+		struct sort_entry *entries, struct sort_entry *tmp,
+		const int num, const struct sort_spec *spec)
+{
+	struct sort_job *jobs;
+	struct merge_job *merges;
+	int *bounds;
+	int i, runs;
+	long cpus;
+
+	cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	runs = CLAMP(1, MIN(cpus, num / SORT_ITEMS_PER_THREAD), 8);
+
+	jobs = (struct sort_job *)xmalloc (runs * sizeof(struct sort_job));
+	bounds = (int *)xmalloc ((runs + 1) * sizeof(int));
+
+	for (i = 0; i <= runs; i++)
+		bounds[i] = (int)((long)num * i / runs);
+
+	for (i = 0; i < runs; i++) {
+		jobs[i].plist = plist;
+		jobs[i].spec = spec;
+		jobs[i].entries = entries + bounds[i];
+		jobs[i].tmp = tmp + bounds[i];
+		jobs[i].num = bounds[i + 1] - bounds[i];
+	}
+
+	run_jobs (sort_thread, jobs, sizeof(struct sort_job), runs);
+	free (jobs);
+
+	/* Merge the pairs of runs until there is one. */
+	merges = (struct merge_job *)xmalloc (runs * sizeof(struct merge_job));
+	while (runs > 1) {
+		struct sort_entry *swap;
+		int pairs = runs / 2;
+
+		for (i = 0; i < pairs; i++) {
+			merges[i].spec = spec;
+			merges[i].src = entries + bounds[2 * i];
+			merges[i].dst = tmp + bounds[2 * i];
+			merges[i].a_num = bounds[2 * i + 1] - bounds[2 * i];
+			merges[i].b_num = bounds[2 * i + 2] - bounds[2 * i + 1];
+		}
+
+		/* An odd run is just copied. */
+		if (runs % 2)
+			memcpy (tmp + bounds[runs - 1], entries + bounds[runs - 1],
+			        (num - bounds[runs - 1]) * sizeof(struct sort_entry));
+
+		run_jobs (merge_thread, merges, sizeof(struct merge_job), pairs);
+
+		for (i = 0; i <= pairs; i++)
+			bounds[i] = bounds[MIN(2 * i, runs)];
+		runs = (runs + 1) / 2;
+		bounds[runs] = num;
+
+		swap = entries;
+		entries = tmp;
+		tmp = swap;
+	}
+
+	free (merges);
+	free (bounds);
+
+	return entries;
+}
+
+/* Sort the playlist by the given keys (the names from the
+ * PlaylistSortKeys option).  Items with equal keys stay in the same order.
+ * Deleted items are removed.  Return 0 if the keys are invalid. */
+int plist_sort_tags (struct plist *plist, const lists_t_strs *keys)
+{
+	struct sort_spec spec;
+	struct sort_entry *entries, *tmp, *sorted;
+	int *order;
+	int i, n;
+
+	assert (plist != NULL);
+	assert (keys != NULL);
+
+	if (!parse_sort_spec (&spec, keys))
+		return 0;
+
+	if (spec.num == 0 || plist_count (plist) == 0)
+		return 1;
+
+	plist_compact (plist, -1);
+	n = plist->num;
+
+	entries = (struct sort_entry *)xmalloc (n * sizeof(struct sort_entry));
+	tmp = (struct sort_entry *)xmalloc (n * sizeof(struct sort_entry));
+	for (i = 0; i < n; i++)
+		entries[i].num = i;
+
+	sorted = sort_entries (plist, entries, tmp, n, &spec);
+
+	order = (int *)xmalloc (n * sizeof(int));
+	for (i = 0; i < n; i++) {
+		order[i] = sorted[i].num;
+		free (sorted[i].key);
+	}
+
+	plist_reorder (plist, order);
+
+	free (order);
+	free (entries);
+	free (tmp);
+
+	return 1;
+}
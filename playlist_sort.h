@@ -0,0 +1,17 @@
+#ifndef PLAYLIST_SORT_H
+#define PLAYLIST_SORT_H
+
+#include "playlist.h"
+#include "lists.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int plist_sort_tags (struct plist *plist, const lists_t_strs *keys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 
 #include "common.h"
 #include "log.h"
@@ -50,6 +51,32 @@
 			        xstrerror (errno)); \
 	} while (0)
 
+/* Size of the read and write buffers of a socket. */
+#define SOCK_BUF_SIZE	(8 * 1024)
+
+/* Number of slots allocated for the first event in a queue. */
+#define EVENT_QUEUE_SLOTS	16
+
+/* Data read from a socket ahead of time and data to be sent to it.  The
+ * data to be sent are sent when the buffer is full, before reading from
+ * the socket (the other side usually waits for the whole message before
+ * answering) and on sock_flush() at the end of a message.  This way a
+ * message made of many ints and strings is a single send(), and reading
+ * it is a single recv(). */
+struct sock_buf
+{
+	char in[SOCK_BUF_SIZE];
+	size_t in_pos;		/* position of the first unread byte */
+	size_t in_len;		/* number of bytes in the buffer */
+	char out[SOCK_BUF_SIZE];
+	size_t out_len;
+};
+
+/* Buffers of the sockets indexed by the file descriptor.  They are used
+ * only by one thread in the client and in the server. */
+static struct sock_buf **sock_bufs = NULL;
+static int sock_bufs_num = 0;
+
 /* Buffer used to send data in one bigger chunk instead of sending sigle
  * integer, string etc. values. */
 struct packet_buf
@@ -70,48 +97,237 @@ char *socket_name ()
 	return socket_name;
 }
 
-/* Get an integer value from the socket, return == 0 on error. */
-int get_int (int sock, int *i)
+/* Send all buffered data at exit, for clients which send a command and
+ * exit. */
+static void sock_flush_all ()
 {
-	ssize_t res;
+	int i;
 
-	res = recv (sock, i, sizeof(int), 0);
-	if (res == -1)
-		log_errno ("recv() failed when getting int", errno);
+	for (i = 0; i < sock_bufs_num; i++)
+		if (sock_bufs[i] && sock_bufs[i]->out_len)
+			sock_flush (i);
+}
+
+static struct sock_buf *get_sock_buf (const int sock)
+{
+	assert (sock >= 0);
+
+	if (sock >= sock_bufs_num) {
+		int num = MAX(sock + 1, 2 * sock_bufs_num);
+
+		if (sock_bufs_num == 0)
+			atexit (sock_flush_all);
+
+		sock_bufs = (struct sock_buf **)xrealloc (sock_bufs,
+				num * sizeof(struct sock_buf *));
+		memset (sock_bufs + sock_bufs_num, 0,
+		        (num - sock_bufs_num) * sizeof(struct sock_buf *));
+		sock_bufs_num = num;
+	}
+
+	if (!sock_bufs[sock])
+		sock_bufs[sock] = (struct sock_buf *)xcalloc (1,
+				sizeof(struct sock_buf));
+
+	return sock_bufs[sock];
+}
+
+/* Send the buffered data followed by len bytes of data using one writev()
+ * call where possible.  Return 0 on error. */
+static int sock_writev (int sock, struct sock_buf *b, const char *data,
+		size_t len)
+{
+	struct iovec iov[2];
+	int iov_num = 0;
+
+	if (b->out_len) {
+		iov[iov_num].iov_base = b->out;
+		iov[iov_num++].iov_len = b->out_len;
+	}
+	if (len) {
+		iov[iov_num].iov_base = (char *)data;
+		iov[iov_num++].iov_len = len;
+	}
+
+	b->out_len = 0;
+
+	while (iov_num) {
+		ssize_t res = writev (sock, iov, iov_num);
+
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			log_errno ("send() failed", errno);
+			return 0;
+		}
+
+		while (iov_num && (size_t)res >= iov[0].iov_len) {
+			res -= iov[0].iov_len;
+			iov[0] = iov[1];
+			iov_num--;
+		}
+
+		if (iov_num) {
+			iov[0].iov_base = (char *)iov[0].iov_base + res;
+			iov[0].iov_len -= res;
+		}
+	}
+
+	return 1;
+}
+
+/* Queue data to be sent to the socket.  Return 0 on error. */
+static int sock_write (int sock, const void *data, const size_t len)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+
+	if (b->out_len + len <= SOCK_BUF_SIZE) {
+		memcpy (b->out + b->out_len, data, len);
+		b->out_len += len;
+		return 1;
+	}
+
+	return sock_writev (sock, b, data, len);
+}
+
+/* Read len bytes from the socket.  Return 0 on error or end of file. */
+static int sock_read (int sock, void *data, size_t len)
+{
+	struct sock_buf *b;
+	char *pos = (char *)data;
+
+	/* Read even if sending failed, the other side could have sent
+	 * something (like EV_BUSY) before closing the connection. */
+	sock_flush (sock);
+
+	b = get_sock_buf (sock);
+
+	while (len) {
+		ssize_t res;
+		size_t n;
+
+		if (b->in_pos < b->in_len) {
+			n = MIN(len, b->in_len - b->in_pos);
+			memcpy (pos, b->in + b->in_pos, n);
+			b->in_pos += n;
+			pos += n;
+			len -= n;
+			continue;
+		}
+
+		/* Big data don't need to be copied through the buffer. */
+		if (len >= SOCK_BUF_SIZE)
+			res = recv (sock, pos, len, 0);
+		else
+			res = recv (sock, b->in, SOCK_BUF_SIZE, 0);
+
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			log_errno ("recv() failed", errno);
+			return 0;
+		}
+		if (res == 0)
+			return 0;
+
+		if (len >= SOCK_BUF_SIZE) {
+			pos += res;
+			len -= res;
+		}
+		else {
+			b->in_pos = 0;
+			b->in_len = res;
+		}
+	}
+
+	return 1;
+}
+
+/* Send the data buffered for the socket.  Return 0 on error. */
+int sock_flush (int sock)
+{
+	struct sock_buf *b;
+
+	if (sock >= sock_bufs_num || !(b = sock_bufs[sock]) || !b->out_len)
+		return 1;
+
+	return sock_writev (sock, b, NULL, 0);
+}
+
+/* Return the number of bytes read from the socket and not yet used, they
+ * are not seen by select(). */
+int sock_pending (int sock)
+{
+	struct sock_buf *b;
+
+	if (sock >= sock_bufs_num || !(b = sock_bufs[sock]))
+		return 0;
+
+	return b->in_len - b->in_pos;
+}
+
+/* Forget the buffered data of the socket, which is being closed. */
+void sock_buf_free (int sock)
+{
+	if (sock >= 0 && sock < sock_bufs_num && sock_bufs[sock]) {
+		free (sock_bufs[sock]);
+		sock_bufs[sock] = NULL;
+	}
+}
 
-	return res == ssizeof(int) ? 1 : 0;
+/* Get an integer value from the socket, return == 0 on error. */
+int get_int (int sock, int *i)
+{
+	return sock_read (sock, i, sizeof(int));
 }
 
 /* Get an integer value from the socket without blocking. */
 enum noblock_io_status get_int_noblock (int sock, int *i)
 {
+	struct sock_buf *b;
 	ssize_t res;
 	char *err;
 
-	nonblocking (recv, res, sock, i, sizeof (int));
+	if (!sock_flush (sock))
+		return NB_IO_ERR;
+
+	b = get_sock_buf (sock);
+
+	if (b->in_len - b->in_pos < sizeof(int)) {
+		memmove (b->in, b->in + b->in_pos, b->in_len - b->in_pos);
+		b->in_len -= b->in_pos;
+		b->in_pos = 0;
+
+		nonblocking (recv, res, sock, b->in + b->in_len,
+		             SOCK_BUF_SIZE - b->in_len);
+
+		if (res > 0)
+			b->in_len += res;
+		else if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return NB_IO_BLOCK;
+		else {
+			err = xstrerror (errno);
+			logit ("recv() failed when getting int (res %zd): %s",
+			       res, err);
+			free (err);
+			return NB_IO_ERR;
+		}
 
-	if (res == ssizeof (int))
-		return NB_IO_OK;
-	if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
-		return NB_IO_BLOCK;
+		/* The rest of the value is on the way. */
+		if (b->in_len < sizeof(int))
+			return NB_IO_BLOCK;
+	}
 
-	err = xstrerror (errno);
-	logit ("recv() failed when getting int (res %zd): %s", res, err);
-	free (err);
+	memcpy (i, b->in + b->in_pos, sizeof(int));
+	b->in_pos += sizeof(int);
 
-	return NB_IO_ERR;
+	return NB_IO_OK;
 }
 
 /* Send an integer value to the socket, return == 0 on error */
 int send_int (int sock, int i)
 {
-	ssize_t res;
-
-	res = send (sock, &i, sizeof(int), 0);
-	if (res == -1)
-		log_errno ("send() failed", errno);
-
-	return res == ssizeof(int) ? 1 : 0;
+	return sock_write (sock, &i, sizeof(int));
 }
 
 #if 0
@@ -145,7 +361,7 @@ static int send_long (int sock, long i)
 /* Get the string from socket, return NULL on error. The memory is malloced. */
 char *get_str (int sock)
 {
-	int len, nread = 0;
+	int len;
 	char *str;
 
 	if (!get_int(sock, &len))
@@ -157,21 +373,10 @@ char *get_str (int sock)
 	}
 
 	str = (char *)xmalloc (sizeof(char) * (len + 1));
-	while (nread < len) {
-		ssize_t res;
-
-		res = recv (sock, str + nread, len - nread, 0);
-		if (res == -1) {
-			log_errno ("recv() failed when getting string", errno);
-			free (str);
-			return NULL;
-		}
-		if (res == 0) {
-			logit ("Unexpected EOF when getting string");
-			free (str);
-			return NULL;
-		}
-		nread += res;
+	if (!sock_read (sock, str, len)) {
+		logit ("Error when getting string");
+		free (str);
+		return NULL;
 	}
 	str[len] = 0;
 
@@ -186,34 +391,19 @@ int send_str (int sock, const char *str)
 	if (!send_int (sock, len))
 		return 0;
 
-	if (send (sock, str, len, 0) != len)
-		return 0;
-
-	return 1;
+	return sock_write (sock, str, len);
 }
 
 /* Get a time_t value from the socket, return == 0 on error. */
 int get_time (int sock, time_t *i)
 {
-	ssize_t res;
-
-	res = recv (sock, i, sizeof(time_t), 0);
-	if (res == -1)
-		log_errno ("recv() failed when getting time_t", errno);
-
-	return res == ssizeof(time_t) ? 1 : 0;
+	return sock_read (sock, i, sizeof(time_t));
 }
 
 /* Send a time_t value to the socket, return == 0 on error */
 int send_time (int sock, time_t i)
 {
-	ssize_t res;
-
-	res = send (sock, &i, sizeof(time_t), 0);
-	if (res == -1)
-		log_errno ("send() failed", errno);
-
-	return res == ssizeof(time_t) ? 1 : 0;
+	return sock_write (sock, &i, sizeof(time_t));
 }
 
 static struct packet_buf *packet_buf_new ()
@@ -320,19 +510,7 @@ void packet_buf_add_item (struct packet_buf *b, const struct plist_item *item)
 /* Send data to the socket. Return 0 on error. */
 static int send_all (int sock, const char *buf, const size_t size)
 {
-	ssize_t sent;
-	size_t send_pos = 0;
-
-	while (send_pos < size) {
-		sent = send (sock, buf + send_pos, size - send_pos, 0);
-		if (sent < 0) {
-			log_errno ("Error while sending data", errno);
-			return 0;
-		}
-		send_pos += sent;
-	}
-
-	return 1;
+	return sock_write (sock, buf, size);
 }
 
 /* Send a playlist item to the socket. If item == NULL, send empty item mark
@@ -508,47 +686,420 @@ struct move_ev_data *recv_move_ev_data (int sock)
 	return d;
 }
 
-/* Push an event on the queue if it's not already there. */
-void event_push (struct event_queue *q, const int event, void *data)
+struct tag_ev_batch *tag_ev_batch_new ()
 {
-	assert (q != NULL);
+	struct tag_ev_batch *b;
+
+	b = (struct tag_ev_batch *)xmalloc (sizeof(struct tag_ev_batch));
+	b->count = 0;
+	b->size = 0;
+
+	return b;
+}
+
+/* Add a copy of the file's tags to the batch.  Return 0 if the batch has
+ * no room for them. */
+int tag_ev_batch_add (struct tag_ev_batch *b, const char *file,
+                      const struct file_tags *tags)
+{
+	size_t size;
+
+	assert (b != NULL);
+	assert (file != NULL);
+	assert (tags != NULL);
+
+	size = strlen (file) + 6 * sizeof(int)
+	       + (tags->title ? strlen (tags->title) : 0)
+	       + (tags->artist ? strlen (tags->artist) : 0)
+	       + (tags->album ? strlen (tags->album) : 0);
+
+	/* Keep the packet small enough to be sent in one piece. */
+	if (b->count == TAGS_BATCH_MAX
+	        || (b->count > 0 && b->size + size > 8 * 1024))
+		return 0;
+
+	b->items[b->count].file = xstrdup (file);
+	b->items[b->count].tags = tags_dup (tags);
+	b->count += 1;
+	b->size += size;
+
+	return 1;
+}
+
+void free_tag_ev_batch (struct tag_ev_batch *b)
+{
+	int i;
+
+	assert (b != NULL);
 
-	if (!q->head) {
-		q->head = (struct event *)xmalloc (sizeof(struct event));
-		q->head->next = NULL;
-		q->head->type = event;
-		q->head->data = data;
-		q->tail = q->head;
+	for (i = 0; i < b->count; i++) {
+		free (b->items[i].file);
+		tags_free (b->items[i].tags);
+	}
+
+	free (b);
+}
+
+/* Receive the data of EV_FILE_TAGS_BATCH.  Return NULL on error. */
+struct tag_ev_batch *recv_tag_ev_batch (int sock)
+{
+	int count;
+	struct tag_ev_batch *b;
+
+	if (!get_int (sock, &count) || !RANGE(0, count, TAGS_BATCH_MAX)) {
+		logit ("Error while receiving tags batch size");
+		return NULL;
 	}
-	else {
-		assert (q->head != NULL);
-		assert (q->tail != NULL);
-		assert (q->tail->next == NULL);
 
-		q->tail->next = (struct event *)xmalloc (
-				sizeof(struct event));
-		q->tail = q->tail->next;
-		q->tail->next = NULL;
-		q->tail->type = event;
-		q->tail->data = data;
+	b = tag_ev_batch_new ();
+	while (b->count < count) {
+		struct tag_ev_response *r = &b->items[b->count];
+
+		if (!(r->file = get_str (sock))) {
+			logit ("Error while receiving file name");
+			free_tag_ev_batch (b);
+			return NULL;
+		}
+
+		if (!(r->tags = recv_tags (sock))) {
+			logit ("Error while receiving tags");
+			free (r->file);
+			free_tag_ev_batch (b);
+			return NULL;
+		}
+
+		b->count += 1;
 	}
+
+	return b;
 }
 
-/* Remove the first event from the queue (don't free the data field). */
-void event_pop (struct event_queue *q)
+/* Send CMD_GET_FILE_TAGS_BATCH for up to TAGS_BATCH_MAX files in a single
+ * packet.  Return 0 on error. */
+int send_tags_batch_request (int sock, const char **files, int count,
+                             int tags_sel)
+{
+	int i, res = 1;
+	struct packet_buf *b;
+
+	assert (files != NULL);
+	assert (RANGE(1, count, TAGS_BATCH_MAX));
+
+	b = packet_buf_new ();
+	packet_buf_add_int (b, CMD_GET_FILE_TAGS_BATCH);
+	packet_buf_add_int (b, tags_sel);
+	packet_buf_add_int (b, count);
+	for (i = 0; i < count; i++)
+		packet_buf_add_str (b, files[i]);
+
+	if (!send_all (sock, b->buf, b->len)) {
+		logit ("Error when sending tags batch request");
+		res = 0;
+	}
+
+	packet_buf_free (b);
+	return res;
+}
+
+/* Send CMD_ABORT_TAGS_BATCH for the files in a single packet.  Return 0 on
+ * error. */
+int send_tags_abort_batch (int sock, const char **files, int count)
+{
+	int i, res = 1;
+	struct packet_buf *b;
+
+	assert (files != NULL);
+	assert (RANGE(1, count, TAGS_BATCH_MAX));
+
+	b = packet_buf_new ();
+	packet_buf_add_int (b, CMD_ABORT_TAGS_BATCH);
+	packet_buf_add_int (b, count);
+	for (i = 0; i < count; i++)
+		packet_buf_add_str (b, files[i]);
+
+	if (!send_all (sock, b->buf, b->len)) {
+		logit ("Error when sending tags abort request");
+		res = 0;
+	}
+
+	packet_buf_free (b);
+	return res;
+}
+
+/* Send the command or event with the playlist sync base in a single
+ * packet.  Return 0 on error. */
+int send_plist_sync_base (int sock, const int type,
+                          const struct plist_sync_base *base)
+{
+	int res = 1;
+	struct packet_buf *b;
+
+	b = packet_buf_new ();
+	packet_buf_add_int (b, type);
+	packet_buf_add_int (b, base->serial);
+	packet_buf_add_int (b, base->count);
+	packet_buf_add_int (b, base->hash);
+
+	if (!send_all (sock, b->buf, b->len)) {
+		logit ("Error when sending playlist sync base");
+		res = 0;
+	}
+
+	packet_buf_free (b);
+	return res;
+}
+
+/* Receive the playlist sync base.  Return NULL on error. */
+struct plist_sync_base *recv_plist_sync_base (int sock)
+{
+	struct plist_sync_base *base;
+
+	base = (struct plist_sync_base *)xmalloc (sizeof (*base));
+
+	if (!get_int (sock, &base->serial) || !get_int (sock, &base->count)
+			|| !get_int (sock, &base->hash)) {
+		logit ("Error while receiving playlist sync base");
+		free (base);
+		return NULL;
+	}
+
+	return base;
+}
+
+/* Receive data into the buffer.  Return 0 on error. */
+static int recv_all (int sock, char *buf, const size_t size)
+{
+	if (!sock_read (sock, buf, size)) {
+		logit ("Error while receiving data");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Send a chunk of packed playlist items; an empty chunk marks the end of
+ * the playlist and PLIST_CHUNK_ABORT length a failed transfer.  Return 0
+ * on error. */
+int send_plist_chunk (int sock, const char *buf, const int len)
+{
+	if (!send_int (sock, len) || (len > 0 && !send_all (sock, buf, len))) {
+		logit ("Error when sending playlist chunk");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Receive a chunk of packed playlist items into the malloc()ed *buf
+ * (NULL for the end of the playlist mark, then *len is 0, or for
+ * PLIST_CHUNK_ABORT).  Return 0 on error. */
+int recv_plist_chunk (int sock, char **buf, int *len)
+{
+	*buf = NULL;
+
+	if (!get_int (sock, len) || !RANGE(PLIST_CHUNK_ABORT, *len,
+	                                   2 * PLIST_CHUNK_SIZE
+	                                   + 6 * MAX_SEND_STRING)) {
+		logit ("Bad playlist chunk length");
+		return 0;
+	}
+
+	if (*len <= 0)
+		return 1;
+
+	*buf = (char *)xmalloc (*len);
+	if (!recv_all (sock, *buf, *len)) {
+		free (*buf);
+		*buf = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Send the non-deleted items of the playlist after the first 'from' of
+ * them in chunks, each a single packet, and then the end mark.  Return 0
+ * on error. */
+int send_plist_packed (int sock, const struct plist *plist, const int from)
+{
+	int i, skip = from;
+	int res = 1;
+	struct packet_buf *b;
+
+	b = packet_buf_new ();
+
+	for (i = 0; i < plist->num && res; i++) {
+		if (plist_deleted (plist, i) || skip-- > 0)
+			continue;
+
+		packet_buf_add_item (b, &plist->items[i]);
+		packet_buf_add_int (b, plist->items[i].type);
+
+		if (b->len >= PLIST_CHUNK_SIZE) {
+			res = send_plist_chunk (sock, b->buf, b->len);
+			b->len = 0;
+		}
+	}
+
+	if (res && b->len)
+		res = send_plist_chunk (sock, b->buf, b->len);
+	if (res)
+		res = send_plist_chunk (sock, NULL, 0);
+
+	packet_buf_free (b);
+	return res;
+}
+
+/* Read a value of the given size from the chunk. */
+static int chunk_get (const char **pos, const char *end, void *val,
+                      const size_t size)
+{
+	if ((size_t)(end - *pos) < size)
+		return 0;
+	memcpy (val, *pos, size);
+	*pos += size;
+
+	return 1;
+}
+
+/* Read a string from the chunk into the malloc()ed *str, which is NULL
+ * if the string is empty. */
+static int chunk_get_str (const char **pos, const char *end, char **str)
+{
+	int len;
+
+	if (!chunk_get (pos, end, &len, sizeof (len))
+			|| !RANGE(0, len, end - *pos))
+		return 0;
+
+	if (len) {
+		*str = (char *)xmalloc (len + 1);
+		memcpy (*str, *pos, len);
+		(*str)[len] = 0;
+		*pos += len;
+	}
+	else
+		*str = NULL;
+
+	return 1;
+}
+
+/* Read an item sent by send_plist_packed() from the chunk. */
+static int chunk_get_item (const char **pos, const char *end,
+                           struct plist_item *item)
+{
+	struct file_tags *tags;
+	int type;
+
+	memset (item, 0, sizeof (*item));
+	item->tags = tags = tags_new ();
+
+	if (!chunk_get_str (pos, end, &item->file) || !item->file
+			|| !chunk_get_str (pos, end, &item->title_tags)
+			|| !chunk_get_str (pos, end, &tags->title)
+			|| !chunk_get_str (pos, end, &tags->artist)
+			|| !chunk_get_str (pos, end, &tags->album)
+			|| !chunk_get (pos, end, &tags->track, sizeof (int))
+			|| !chunk_get (pos, end, &tags->time, sizeof (int))
+			|| !chunk_get (pos, end, &tags->filled, sizeof (int))
+			|| !chunk_get (pos, end, &item->mtime, sizeof (time_t))
+			|| !chunk_get (pos, end, &type, sizeof (type))
+			|| !RANGE(F_DIR, type, F_OTHER)) {
+		plist_free_item_fields (item);
+		return 0;
+	}
+
+	item->type = (enum file_type)type;
+
+	return 1;
+}
+
+/* Receive items sent by send_plist_packed() and add them to the playlist.
+ * Return 0 on error, -1 if the sender failed and the items added so far
+ * must be thrown away. */
+int recv_plist_packed (int sock, struct plist *plist)
+{
+	struct plist_item *items = NULL;
+	int allocated = 0;
+	char *buf;
+	int len;
+
+	while (recv_plist_chunk (sock, &buf, &len)) {
+		const char *pos = buf, *end = buf + len;
+		int num = 0;
+
+		if (!buf) {
+			free (items);
+			if (len == PLIST_CHUNK_ABORT) {
+				logit ("The playlist transfer was aborted");
+				return -1;
+			}
+			return 1;
+		}
+
+		while (pos < end) {
+			if (num == allocated) {
+				allocated = allocated ? 2 * allocated : 1024;
+				items = (struct plist_item *)xrealloc (items,
+				        allocated * sizeof (struct plist_item));
+			}
+
+			if (!chunk_get_item (&pos, end, &items[num])) {
+				logit ("Broken playlist chunk");
+				while (num > 0)
+					plist_free_item_fields (&items[--num]);
+				free (items);
+				free (buf);
+				return 0;
+			}
+			num++;
+		}
+
+		plist_add_items (plist, items, num);
+		free (buf);
+	}
+
+	free (items);
+	return 0;
+}
+
+/* Push an event on the queue. */
+void event_push (struct event_queue *q, const int event, void *data)
 {
 	struct event *e;
 
 	assert (q != NULL);
-	assert (q->head != NULL);
-	assert (q->tail != NULL);
 
-	e = q->head;
-	q->head = e->next;
-	free (e);
+	if (q->num == q->size) {
+		int size = q->size ? 2 * q->size : EVENT_QUEUE_SLOTS;
+		struct event *slots;
+		int i;
+
+		/* Unwrap the ring into the new slots. */
+		slots = (struct event *)xmalloc (size * sizeof(struct event));
+		for (i = 0; i < q->num; i++)
+			slots[i] = q->slots[(q->first + i) & (q->size - 1)];
+
+		free (q->slots);
+		q->slots = slots;
+		q->size = size;
+		q->first = 0;
+	}
+
+	e = &q->slots[(q->first + q->num) & (q->size - 1)];
+	e->type = event;
+	e->data = data;
+	q->num++;
+}
+
+/* Remove the first event from the queue (don't free the data field). */
+void event_pop (struct event_queue *q)
+{
+	assert (q != NULL);
+	assert (q->num > 0);
 
-	if (q->tail == e)
-		q->tail = NULL; /* the queue is empty */
+	q->first = (q->first + 1) & (q->size - 1);
+	q->num--;
 }
 
 /* Get the pointer to the first item in the queue or NULL if the queue is
@@ -557,7 +1108,17 @@ struct event *event_get_first (struct event_queue *q)
 {
 	assert (q != NULL);
 
-	return q->head;
+	return q->num ? &q->slots[q->first] : NULL;
+}
+
+/* Get the pointer to the event at the given position in the queue, 0 is the
+ * first one. */
+struct event *event_get (struct event_queue *q, const int num)
+{
+	assert (q != NULL);
+	assert (LIMIT(num, q->num));
+
+	return &q->slots[(q->first + num) & (q->size - 1)];
 }
 
 void free_tag_ev_data (struct tag_ev_response *d)
@@ -604,8 +1165,11 @@ void free_event_data (const int type, void *data)
 	}
 	else if (type == EV_FILE_TAGS)
 		free_tag_ev_data ((struct tag_ev_response *)data);
+	else if (type == EV_FILE_TAGS_BATCH)
+		free_tag_ev_batch ((struct tag_ev_batch *)data);
 	else if (type == EV_PLIST_DEL || type == EV_STATUS_MSG
-			|| type == EV_SRV_ERROR || type == EV_QUEUE_DEL)
+			|| type == EV_SRV_ERROR || type == EV_QUEUE_DEL
+			|| type == EV_PLIST_SYNC)
 		free (data);
 	else if (type == EV_PLIST_MOVE || type == EV_QUEUE_MOVE)
 		free_move_ev_data ((struct move_ev_data *)data);
@@ -624,41 +1188,35 @@ void event_queue_free (struct event_queue *q)
 		free_event_data (e->type, e->data);
 		event_pop (q);
 	}
+
+	free (q->slots);
+	event_queue_init (q);
 }
 
 void event_queue_init (struct event_queue *q)
 {
 	assert (q != NULL);
 
-	q->head = NULL;
-	q->tail = NULL;
+	q->slots = NULL;
+	q->size = 0;
+	q->first = 0;
+	q->num = 0;
 }
 
-#if 0
-/* Search for an event of this type and return pointer to it or NULL if there
- * was no such event. */
-struct event *event_search (struct event_queue *q, const int event)
+/* Return != 0 if the queue is empty. */
+int event_queue_empty (const struct event_queue *q)
 {
-	struct event *e;
-
 	assert (q != NULL);
 
-	while ((e = q->head)) {
-		if (e->type == event)
-			return e;
-		e = e->next;
-	}
-
-	return NULL;
+	return q->num == 0 ? 1 : 0;
 }
-#endif
 
-/* Return != 0 if the queue is empty. */
-int event_queue_empty (const struct event_queue *q)
+/* Return the number of events in the queue. */
+int event_queue_count (const struct event_queue *q)
 {
 	assert (q != NULL);
 
-	return q->head == NULL ? 1 : 0;
+	return q->num;
 }
 
 /* Make a packet buffer filled with the event (with data). */
@@ -692,6 +1250,19 @@ static struct packet_buf *make_event_packet (const struct event *e)
 		packet_buf_add_str (b, r->file);
 		packet_buf_add_tags (b, r->tags);
 	}
+	else if (e->type == EV_FILE_TAGS_BATCH) {
+		int i;
+		struct tag_ev_batch *r;
+
+		assert (e->data != NULL);
+		r = e->data;
+
+		packet_buf_add_int (b, r->count);
+		for (i = 0; i < r->count; i++) {
+			packet_buf_add_str (b, r->items[i].file);
+			packet_buf_add_tags (b, r->items[i].tags);
+		}
+	}
 	else if (e->type == EV_PLIST_MOVE || e->type == EV_QUEUE_MOVE) {
 		struct move_ev_data *m;
 
@@ -720,6 +1291,10 @@ enum noblock_io_status event_send_noblock (int sock, struct event_queue *q)
 	assert (q != NULL);
 	assert (!event_queue_empty(q));
 
+	/* Responses sent before must go first. */
+	if (!sock_flush (sock))
+		return NB_IO_ERR;
+
 	b = make_event_packet (event_get_first(q));
 
 	/* We must do it in one send() call to be able to handle blocking. */
@@ -11,13 +11,16 @@ struct event
 {
 	int type;	/* type of the event (one of EV_*) */
 	void *data;	/* optional data associated with the event */
-	struct event *next;
 };
 
+/* FIFO of events in a ring of slots, allocated with the first event and
+ * grown when full. */
 struct event_queue
 {
-	struct event *head;
-	struct event *tail;
+	struct event *slots;
+	int size;	/* number of slots, a power of 2 */
+	int first;	/* slot of the first event */
+	int num;	/* number of events in the queue */
 };
 
 /* Used as data field in the event queue for EV_FILE_TAGS. */
@@ -27,6 +30,21 @@ struct tag_ev_response
 	struct file_tags *tags;
 };
 
+/* Maximum number of records in EV_FILE_TAGS_BATCH and of files in
+ * CMD_GET_FILE_TAGS_BATCH. */
+#define TAGS_BATCH_MAX	64
+
+/* Maximum number of results sent for CMD_LIBRARY_SEARCH. */
+#define LIBRARY_SEARCH_MAX	1000
+
+/* Used as data field in the event queue for EV_FILE_TAGS_BATCH. */
+struct tag_ev_batch
+{
+	int count;
+	size_t size;	/* approximate size of the records when sent */
+	struct tag_ev_response items[TAGS_BATCH_MAX];
+};
+
 /* Used as data field in the event queue for EV_PLIST_MOVE. */
 struct move_ev_data
 {
@@ -35,6 +53,23 @@ struct move_ev_data
 	char *to;
 };
 
+/* What a client has of the playlist when it asks for it with
+ * CMD_PLIST_SYNC, used as data field in the event queue for EV_PLIST_SYNC.
+ * count == -1 means that the client wants only the serial number. */
+struct plist_sync_base
+{
+	int serial;
+	int count;	/* number of items it has */
+	int hash;	/* plist_files_hash() of these items */
+};
+
+/* Packed playlist items are sent in chunks of about this size. */
+#define PLIST_CHUNK_SIZE	(64 * 1024)
+
+/* Length sent instead of the end of the playlist mark when the transfer
+ * failed; the items received so far must be thrown away. */
+#define PLIST_CHUNK_ABORT	(-1)
+
 /* Status of nonblock sending/receiving function. */
 enum noblock_io_status
 {
@@ -63,6 +98,14 @@ enum noblock_io_status
 #define EV_AVG_BITRATE  0x12 /* average bitrate has changed (new song) */
 #define EV_AUDIO_START	0x13 /* playing of audio has started */
 #define EV_AUDIO_STOP	0x14 /* playing of audio has stopped */
+#define EV_FILE_TAGS_BATCH	0x15 /* tags for many files in a response
+					for CMD_GET_FILE_TAGS_BATCH */
+#define EV_PLIST_SYNC	0x16 /* request for sending the playlist with
+				CMD_SEND_PLIST_PACKED, followed by the
+				requesting client's plist_sync_base */
+#define EV_REPLY	0x17 /* followed by the request ID of a CMD_TAGGED
+				command and the command's response, if it
+				has one */
 
 /* Events caused by a client that wants to modify the playlist (see
  * CMD_CLI_PLIST* commands). */
@@ -146,8 +189,27 @@ enum noblock_io_status
 #define CMD_QUEUE_MOVE	0x3d /* move an item in the queue */
 #define CMD_QUEUE_CLEAR	0x3e /* clear the queue */
 #define CMD_GET_QUEUE	0x3f /* request the queue from the server */
+#define CMD_GET_FILE_TAGS_BATCH	0x40 /* get tags for many files, responses
+					come as EV_FILE_TAGS_BATCH */
+#define CMD_LIBRARY_SEARCH	0x41 /* search the library, the best matches
+					are sent like a playlist */
+#define CMD_PLIST_SYNC	0x42 /* get the playlist from one of the clients,
+				only the items we don't have */
+#define CMD_SEND_PLIST_PACKED	0x43 /* send the playlist packed in response
+					for EV_PLIST_SYNC */
+#define CMD_TAGGED	0x44 /* followed by a request ID and a command,
+				answered with EV_REPLY, so that many commands
+				can be sent without waiting for responses */
+#define CMD_TICKLESS	0x45 /* send EV_CTIME only when the time doesn't
+				go on as expected, the client counts it */
+#define CMD_ABORT_TAGS_BATCH	0x46 /* abort the tags requests for the
+					given files, followed by their number
+					and the file names */
 
 char *socket_name ();
+int sock_flush (int sock);
+int sock_pending (int sock);
+void sock_buf_free (int sock);
 int get_int (int sock, int *i);
 enum noblock_io_status get_int_noblock (int sock, int *i);
 int send_int (int sock, int i);
@@ -164,14 +226,31 @@ void event_queue_init (struct event_queue *q);
 void event_queue_free (struct event_queue *q);
 void free_event_data (const int type, void *data);
 struct event *event_get_first (struct event_queue *q);
+struct event *event_get (struct event_queue *q, const int num);
 void event_pop (struct event_queue *q);
 void event_push (struct event_queue *q, const int event, void *data);
 int event_queue_empty (const struct event_queue *q);
+int event_queue_count (const struct event_queue *q);
 enum noblock_io_status event_send_noblock (int sock, struct event_queue *q);
 void free_tag_ev_data (struct tag_ev_response *d);
 void free_move_ev_data (struct move_ev_data *m);
 struct move_ev_data *move_ev_data_dup (const struct move_ev_data *m);
 struct move_ev_data *recv_move_ev_data (int sock);
+struct tag_ev_batch *tag_ev_batch_new ();
+int tag_ev_batch_add (struct tag_ev_batch *b, const char *file,
+                      const struct file_tags *tags);
+void free_tag_ev_batch (struct tag_ev_batch *b);
+struct tag_ev_batch *recv_tag_ev_batch (int sock);
+int send_tags_batch_request (int sock, const char **files, int count,
+                             int tags_sel);
+int send_tags_abort_batch (int sock, const char **files, int count);
+int send_plist_sync_base (int sock, const int type,
+                          const struct plist_sync_base *base);
+struct plist_sync_base *recv_plist_sync_base (int sock);
+int send_plist_packed (int sock, const struct plist *plist, const int from);
+int recv_plist_packed (int sock, struct plist *plist);
+int recv_plist_chunk (int sock, char **buf, int *len);
+int send_plist_chunk (int sock, const char *buf, const int len);
 
 #ifdef __cplusplus
 }
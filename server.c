@@ -18,6 +18,9 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
 #ifdef HAVE_GETRLIMIT
 # include <sys/resource.h>
 #endif
@@ -31,7 +34,9 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <fcntl.h>
 #include <assert.h>
+#include <math.h>
 
 #define DEBUG
 
@@ -44,26 +49,75 @@
 #include "server.h"
 #include "playlist.h"
 #include "tags_cache.h"
+#include "indexer.h"
+#include "library.h"
 #include "files.h"
+#include "decoder.h"
 #include "softmixer.h"
 #include "equalizer.h"
+#include "status_page.h"
 
 #define SERVER_LOG	"mocp_server_log"
-#define PID_FILE	"pid"
+
+/* How a client requested the playlist. */
+#define PLIST_REQ_ITEMS	1	/* with CMD_GET_PLIST */
+#define PLIST_REQ_SYNC	2	/* with CMD_PLIST_SYNC */
+
+/* Client index bits in generated playlist serial numbers; enough for the
+ * MaxClients limit. */
+#define SERIAL_CLIENT_BITS	10
+
+/* Maximum number of events queued for a client.  A client which doesn't
+ * read them is disconnected. */
+#define CLIENT_EVENTS_MAX	8192
+
+#ifdef HAVE_SYS_EPOLL_H
+/* epoll_event.data.u32 values for fds which are not client sockets. */
+#define EP_SERVER_SOCK	((uint32_t)-1)
+#define EP_WAKE_UP	((uint32_t)-2)
+
+/* Maximum number of events fetched by one epoll_wait() call. */
+#define EP_EVENTS	64
+#endif
 
 struct client
 {
 	int socket; 		/* -1 if inactive */
 	int wants_plist_events;	/* requested playlist events? */
+	int wants_tags_batch;	/* send tags as EV_FILE_TAGS_BATCH? */
 	struct event_queue events;
 	pthread_mutex_t events_mtx;
-	int requests_plist;	/* is the client waiting for the playlist? */
+	int requests_plist;	/* is the client waiting for the playlist?
+				   (PLIST_REQ_*) */
 	int can_send_plist;	/* can this client send a playlist? */
 	int lock;		/* is this client locking us? */
 	int serial;		/* used for generating unique serial numbers */
+	int active_pos;		/* position in active_clients[] */
+	int readable;		/* can read a command without blocking? (it's
+				   on the ready_clients[] list) */
+	int writable;		/* can send an event without blocking? */
+	int lagging;		/* events were lost, the client must be
+				   disconnected */
+	int tickless;		/* counts the time itself (CMD_TICKLESS) */
 };
 
-static struct client clients[CLIENTS_MAX];
+/* The clients table, sized by the MaxClients option.  Other threads add
+ * events to clients, so it's never reallocated while the server runs. */
+static struct client *clients = NULL;
+static int clients_max = 0;
+
+/* Indexes of connected clients, so that the server thread doesn't have to
+ * scan the whole table. */
+static int *active_clients = NULL;
+static int active_num = 0;
+
+/* Indexes of clients with input to read (epoll reports only changes). */
+static int *ready_clients = NULL;
+static int ready_num = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+#endif
 
 /* Thread ID of the server thread. */
 static pthread_t server_tid;
@@ -90,6 +144,14 @@ static struct {
 	-1
 };
 
+/* The playing time sent last to tickless clients and when it was sent.
+ * ctime == -1 means that the next time must be sent. */
+static struct {
+	int ctime;
+	double when;
+} ctime_sent = { -1, 0.0 };
+static pthread_mutex_t ctime_sent_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static struct tags_cache *tags_cache;
 
 extern char **environ;
@@ -153,22 +215,67 @@ static void clients_init ()
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++) {
+	clients_max = options_get_int ("MaxClients");
+	clients = (struct client *)xcalloc (clients_max,
+			sizeof(struct client));
+	active_clients = (int *)xcalloc (clients_max, sizeof(int));
+	ready_clients = (int *)xcalloc (clients_max, sizeof(int));
+
+	for (i = 0; i < clients_max; i++) {
 		clients[i].socket = -1;
+		event_queue_init (&clients[i].events);
 		pthread_mutex_init (&clients[i].events_mtx, NULL);
 	}
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/* Register a non-client descriptor for reading with epoll. */
+static int epoll_add (int fd, uint32_t id)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = id;
+
+	return epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &ev) != -1;
+}
+
+/* Create the epoll instance, on failure select() is used. */
+static void epoll_init ()
+{
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		log_errno ("epoll_create1() failed, using select()", errno);
+		return;
+	}
+
+	if (fcntl(wake_up_pipe[0], F_SETFL, O_NONBLOCK) == -1
+			|| !epoll_add(server_sock, EP_SERVER_SOCK)
+			|| !epoll_add(wake_up_pipe[0], EP_WAKE_UP)) {
+		log_errno ("Can't set up epoll, using select()", errno);
+		close (epoll_fd);
+		epoll_fd = -1;
+	}
+}
+#endif
+
 static void clients_cleanup ()
 {
 	int i, rc;
 
-	for (i = 0; i < CLIENTS_MAX; i++) {
+	for (i = 0; i < clients_max; i++) {
 		clients[i].socket = -1;
 		rc = pthread_mutex_destroy (&clients[i].events_mtx);
 		if (rc != 0)
 			log_errno ("Can't destroy events mutex", rc);
 	}
+
+	free (active_clients);
+	free (ready_clients);
+	active_clients = NULL;
+	ready_clients = NULL;
+	active_num = 0;
+	ready_num = 0;
 }
 
 /* Add a client to the list, return 1 if ok, 0 on error (max clients exceeded) */
@@ -176,22 +283,46 @@ static int add_client (int sock)
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket == -1) {
-			clients[i].wants_plist_events = 0;
-			LOCK (clients[i].events_mtx);
-			event_queue_free (&clients[i].events);
-			event_queue_init (&clients[i].events);
-			UNLOCK (clients[i].events_mtx);
-			clients[i].socket = sock;
-			clients[i].requests_plist = 0;
-			clients[i].can_send_plist = 0;
-			clients[i].lock = 0;
-			tags_cache_clear_queue (tags_cache, i);
-			return 1;
+	if (active_num == clients_max)
+		return 0;
+
+	for (i = 0; i < clients_max; i++)
+		if (clients[i].socket == -1)
+			break;
+	assert (i < clients_max);
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd != -1) {
+		struct epoll_event ev;
+
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.u32 = i;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+			log_errno ("Can't add the client to epoll", errno);
+			return 0;
 		}
+	}
+#endif
 
-	return 0;
+	clients[i].wants_plist_events = 0;
+	clients[i].wants_tags_batch = 0;
+	clients[i].tickless = 0;
+	LOCK (clients[i].events_mtx);
+	event_queue_free (&clients[i].events);
+	event_queue_init (&clients[i].events);
+	UNLOCK (clients[i].events_mtx);
+	clients[i].socket = sock;
+	clients[i].requests_plist = 0;
+	clients[i].can_send_plist = 0;
+	clients[i].lock = 0;
+	clients[i].readable = 0;
+	clients[i].writable = 0;
+	clients[i].lagging = 0;
+	clients[i].active_pos = active_num;
+	active_clients[active_num++] = i;
+	tags_cache_clear_queue (tags_cache, i);
+
+	return 1;
 }
 
 /* Return index of a client that has a lock acquired. Return -1 if there is no
@@ -200,9 +331,9 @@ static int locking_client ()
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket != -1 && clients[i].lock)
-			return i;
+	for (i = 0; i < active_num; i++)
+		if (clients[active_clients[i]].lock)
+			return active_clients[i];
 	return -1;
 }
 
@@ -243,16 +374,40 @@ static int client_unlock (struct client *cli)
 /* Return the client index from the clients table. */
 static int client_index (const struct client *cli)
 {
-	int i;
+	assert (cli >= clients && cli < clients + clients_max);
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket == cli->socket)
-			return i;
-	return -1;
+	return cli - clients;
+}
+
+/* Remove the client from the ready_clients[] list. */
+static void clear_readable (struct client *cli)
+{
+	int i, idx = client_index (cli);
+
+	if (!cli->readable)
+		return;
+
+	for (i = 0; i < ready_num; i++)
+		if (ready_clients[i] == idx) {
+			ready_clients[i] = ready_clients[--ready_num];
+			break;
+		}
+	cli->readable = 0;
 }
 
 static void del_client (struct client *cli)
 {
+	int last;
+
+	if (cli->socket == -1)
+		return;
+
+	clear_readable (cli);
+	last = active_clients[--active_num];
+	active_clients[cli->active_pos] = last;
+	clients[last].active_pos = cli->active_pos;
+
+	sock_buf_free (cli->socket);
 	cli->socket = -1;
 	LOCK (cli->events_mtx);
 	event_queue_free (&cli->events);
@@ -411,9 +566,15 @@ void server_init (int debugging, int foreground)
 	log_pthread_stack_size ();
 
 	clients_init ();
+	status_page_create (create_file_name (STATUS_PAGE_FILE));
+#ifdef HAVE_SYS_EPOLL_H
+	epoll_init ();
+#endif
 	audio_initialize ();
-	tags_cache = tags_cache_new (options_get_int("TagsCacheSize"));
+	tags_cache = tags_cache_new (options_get_int("TagsCacheSize"),
+			clients_max);
 	tags_cache_load (tags_cache, create_file_name("cache"));
+	indexer_init (tags_cache);
 
 	server_tid = pthread_self ();
 	xsignal (SIGTERM, sig_exit);
@@ -468,11 +629,128 @@ static int send_data_str (const struct client *cli, const char *str) {
 	return 1;
 }
 
+/* Events which only tell the client to read the current state from the
+ * server and carry no data. */
+static const int state_events[] = {
+	EV_STATE,
+	EV_CTIME,
+	EV_BITRATE,
+	EV_AVG_BITRATE,
+	EV_RATE,
+	EV_CHANNELS,
+	EV_OPTIONS,
+	EV_TAGS,
+	EV_MIXER_CHANGE
+};
+
+/* Return != 0 if a newer event of this type makes an older one useless. */
+static int is_state_event (const int event)
+{
+	size_t i;
+
+	if (event == EV_STATUS_MSG)
+		return 1;
+
+	for (i = 0; i < ARRAY_SIZE(state_events); i++)
+		if (state_events[i] == event)
+			return 1;
+	return 0;
+}
+
+/* Merge the event with the same one waiting in the queue after the last
+ * event which is not a state update, the client will read the current
+ * state when it gets there.  A status message replaces the waiting one.
+ * Return != 0 if the event was merged. */
+static int coalesce_event (struct event_queue *q, const int event,
+		void *data)
+{
+	int i;
+
+	if (!is_state_event(event))
+		return 0;
+
+	for (i = event_queue_count(q) - 1; i >= 0; i--) {
+		struct event *e = event_get (q, i);
+
+		if (e->type == event) {
+			if (event == EV_STATUS_MSG) {
+				free_event_data (e->type, e->data);
+				e->data = data;
+			}
+			return 1;
+		}
+
+		if (!is_state_event(e->type))
+			break;
+	}
+
+	return 0;
+}
+
+/* Make room in the queue of a lagging client: remove all state updates
+ * and put one of each type at the end. */
+static void collapse_state_events (struct event_queue *q)
+{
+	struct event_queue kept;
+	struct event *e;
+	bool seen[ARRAY_SIZE(state_events)];
+	char *status_msg = NULL;
+	size_t i;
+
+	memset (seen, 0, sizeof(seen));
+	event_queue_init (&kept);
+
+	while ((e = event_get_first(q))) {
+		if (e->type == EV_STATUS_MSG) {
+			free (status_msg);
+			status_msg = e->data;
+		}
+		else if (is_state_event(e->type)) {
+			for (i = 0; state_events[i] != e->type; i++)
+				;
+			seen[i] = true;
+		}
+		else
+			event_push (&kept, e->type, e->data);
+		event_pop (q);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(state_events); i++)
+		if (seen[i])
+			event_push (&kept, state_events[i], NULL);
+	if (status_msg)
+		event_push (&kept, EV_STATUS_MSG, status_msg);
+
+	event_queue_free (q);
+	*q = kept;
+}
+
+/* Add the event to the client's queue, events_mtx must be locked. */
+static void queue_event (struct client *cli, const int event, void *data)
+{
+	if (coalesce_event (&cli->events, event, data))
+		return;
+
+	if (event_queue_count(&cli->events) >= CLIENT_EVENTS_MAX)
+		collapse_state_events (&cli->events);
+
+	if (event_queue_count(&cli->events) >= CLIENT_EVENTS_MAX) {
+		if (!cli->lagging)
+			logit ("Client with fd %d doesn't read events",
+			       cli->socket);
+		cli->lagging = 1;
+		free_event_data (event, data);
+		return;
+	}
+
+	event_push (&cli->events, event, data);
+}
+
 /* Add event to the client's queue */
 static void add_event (struct client *cli, const int event, void *data)
 {
 	LOCK (cli->events_mtx);
-	event_push (&cli->events, event, data);
+	queue_event (cli, event, data);
 	UNLOCK (cli->events_mtx);
 }
 
@@ -616,11 +894,108 @@ static inline bool is_plist_event (const int event)
 	return result;
 }
 
+/* Publish the current file and its tags in the status page. */
+static void update_status_file ()
+{
+	struct server_status *st;
+	struct file_tags *tags = NULL;
+	char *file;
+
+	file = audio_get_sname ();
+	if (file && file[0]) {
+		if (is_url (file))
+			tags = audio_get_curr_tags ();
+		else if (tags_cache)
+			tags = tags_cache_get_immediate (tags_cache, file,
+					TAGS_COMMENTS | TAGS_TIME);
+	}
+
+	st = status_page_begin ();
+	if (st) {
+		st->truncated = 0;
+		status_page_set_str (st, st->file, sizeof(st->file), file);
+		status_page_set_str (st, st->title, sizeof(st->title),
+				tags ? tags->title : NULL);
+		status_page_set_str (st, st->artist, sizeof(st->artist),
+				tags ? tags->artist : NULL);
+		status_page_set_str (st, st->album, sizeof(st->album),
+				tags ? tags->album : NULL);
+		st->track = tags ? tags->track : -1;
+		st->time = tags ? tags->time : -1;
+		st->tags_filled = tags ? tags->filled : 0;
+	}
+	status_page_end ();
+
+	if (tags)
+		tags_free (tags);
+	free (file);
+}
+
+/* Parts of the status page to be updated by the server thread. */
+#define STATUS_UPDATE_INFO	1	/* state, time, bitrate etc. */
+#define STATUS_UPDATE_FILE	2	/* the file and its tags */
+
+/* What to update in the status page (STATUS_UPDATE_*).  The events come
+ * from other threads, often with audio locks held, so they only mark what
+ * has changed and the server thread reads it. */
+static volatile int status_update = 0;
+
+/* Mark the status page to be updated for the event. */
+static void update_status_page (const int event)
+{
+	int what;
+
+	switch (event) {
+		case EV_STATE:
+		case EV_TAGS:
+			what = STATUS_UPDATE_INFO | STATUS_UPDATE_FILE;
+			break;
+		case EV_CTIME:
+		case EV_BITRATE:
+		case EV_AVG_BITRATE:
+		case EV_RATE:
+		case EV_CHANNELS:
+			what = STATUS_UPDATE_INFO;
+			break;
+		default:
+			return;
+	}
+
+	if ((__sync_fetch_and_or (&status_update, what) & what) != what)
+		wake_up_server ();
+}
+
+/* Publish the changes of the server's state in the status page. */
+static void flush_status_page ()
+{
+	struct server_status *st;
+	int what = __sync_lock_test_and_set (&status_update, 0);
+
+	if (what & STATUS_UPDATE_FILE)
+		update_status_file ();
+
+	if (!(what & STATUS_UPDATE_INFO))
+		return;
+
+	st = status_page_begin ();
+	if (st) {
+		st->state = audio_get_state ();
+		st->curr_time = MAX(0, audio_get_time ());
+		st->bitrate = sound_info.bitrate;
+		st->avg_bitrate = sound_info.avg_bitrate;
+		st->rate = sound_info.rate;
+		st->channels = sound_info.channels;
+	}
+	status_page_end ();
+}
+
 static void add_event_all (const int event, const void *data)
 {
 	int i;
 	int added = 0;
 
+	update_status_page (event);
+
 	if (event == EV_STATE) {
 		switch (audio_get_state()) {
 			case STATE_PLAY:
@@ -632,7 +1007,7 @@ static void add_event_all (const int event, const void *data)
 		}
 	}
 
-	for (i = 0; i < CLIENTS_MAX; i++) {
+	for (i = 0; i < clients_max; i++) {
 		void *data_copy = NULL;
 
 		if (clients[i].socket == -1)
@@ -677,6 +1052,12 @@ static int flush_events (struct client *cli)
 {
 	enum noblock_io_status st = NB_IO_OK;
 
+	if (cli->lagging) {
+		logit ("Events for client with fd %d were lost, "
+		       "closing the connection", cli->socket);
+		return 0;
+	}
+
 	LOCK (cli->events_mtx);
 	while (!event_queue_empty(&cli->events)
 			&& (st = event_send_noblock(cli->socket, &cli->events))
@@ -684,30 +1065,43 @@ static int flush_events (struct client *cli)
 		;
 	UNLOCK (cli->events_mtx);
 
+	if (st == NB_IO_BLOCK)
+		cli->writable = 0;
+
 	return st != NB_IO_ERR ? 1 : 0;
 }
 
+/* Send events to the client, close the connection on error. */
+static void send_client_events (struct client *cli)
+{
+	debug ("Flushing events for client %d", client_index (cli));
+	if (!flush_events (cli)) {
+		close (cli->socket);
+		del_client (cli);
+	}
+}
+
 /* Send events to clients whose sockets are ready to write. */
 static void send_events (fd_set *fds)
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket != -1
-				&& FD_ISSET(clients[i].socket, fds)) {
-			debug ("Flushing events for client %d", i);
-			if (!flush_events (&clients[i])) {
-				close (clients[i].socket);
-				del_client (&clients[i]);
-			}
-		}
+	/* Backwards, because del_client() moves the last one to i. */
+	for (i = active_num - 1; i >= 0; i--) {
+		struct client *cli = &clients[active_clients[i]];
+
+		if (cli->lagging || FD_ISSET(cli->socket, fds))
+			send_client_events (cli);
+	}
 }
 
 /* End playing and cleanup. */
 static void server_shutdown ()
 {
 	logit ("Server exiting...");
+	status_page_remove ();
 	audio_exit ();
+	indexer_cleanup ();
 	tags_cache_free (tags_cache);
 	tags_cache = NULL;
 	logit ("Running OnServerStop");
@@ -716,6 +1110,8 @@ static void server_shutdown ()
 	unlink (create_file_name(PID_FILE));
 	close (wake_up_pipe[0]);
 	close (wake_up_pipe[1]);
+	free (clients);
+	clients = NULL;
 	logit ("Server exited");
 	log_close ();
 }
@@ -725,6 +1121,8 @@ static void busy (int sock)
 {
 	logit ("Closing connection due to maximum number of clients reached");
 	send_int (sock, EV_BUSY);
+	sock_flush (sock);
+	sock_buf_free (sock);
 	close (sock);
 }
 
@@ -951,9 +1349,9 @@ static int find_sending_plist ()
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket != -1 && clients[i].can_send_plist)
-			return i;
+	for (i = 0; i < active_num; i++)
+		if (clients[active_clients[i]].can_send_plist)
+			return active_clients[i];
 	return -1;
 }
 
@@ -968,7 +1366,7 @@ static int get_client_plist (struct client *cli)
 	 * Here, send 1 if there is a client with the playlist, or 0 if there
 	 * isn't. */
 
-	cli->requests_plist = 1;
+	cli->requests_plist = PLIST_REQ_ITEMS;
 
 	first = find_sending_plist ();
 	if (first == -1) {
@@ -988,14 +1386,48 @@ static int get_client_plist (struct client *cli)
 	return 1;
 }
 
-/* Find the client requesting the playlist. */
-static int find_cli_requesting_plist ()
+/* Handle CMD_PLIST_SYNC. Return 0 on error. */
+static int req_plist_sync (struct client *cli)
+{
+	struct plist_sync_base *base;
+	int first, res = 1;
+
+	if (!(base = recv_plist_sync_base (cli->socket)))
+		return 0;
+
+	debug ("Client with fd %d requests the playlist after %d items",
+	       cli->socket, base->count);
+
+	/* Like get_client_plist(), but the client sending the playlist
+	 * gets what the requesting one has, to send only the rest. */
+
+	cli->requests_plist = PLIST_REQ_SYNC;
+
+	first = find_sending_plist ();
+	if (first == -1) {
+		debug ("No clients with the playlist");
+		cli->requests_plist = 0;
+		if (!send_data_int(cli, 0))
+			res = 0;
+	}
+	else if (!send_data_int(cli, 1))
+		res = 0;
+	else if (!send_plist_sync_base(clients[first].socket, EV_PLIST_SYNC,
+	                               base))
+		res = 0;
+
+	free (base);
+	return res;
+}
+
+/* Find the client requesting the playlist in the given way. */
+static int find_cli_requesting_plist (const int how)
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].requests_plist)
-			return i;
+	for (i = 0; i < active_num; i++)
+		if (clients[active_clients[i]].requests_plist == how)
+			return active_clients[i];
 	return -1;
 }
 
@@ -1003,7 +1435,7 @@ static int find_cli_requesting_plist ()
  * another client to send it (EV_SEND_PLIST). */
 static int req_send_plist (struct client *cli)
 {
-	int requesting = find_cli_requesting_plist ();
+	int requesting = find_cli_requesting_plist (PLIST_REQ_ITEMS);
 	int send_fd;
 	struct plist_item *item;
 	int serial;
@@ -1071,6 +1503,68 @@ static int req_send_plist (struct client *cli)
 	return item ? 1 : 0;
 }
 
+/* Handle CMD_SEND_PLIST_PACKED: the response for EV_PLIST_SYNC.  Pass the
+ * chunks of items to the requesting client without unpacking them. */
+static int req_send_plist_packed (struct client *cli)
+{
+	int requesting = find_cli_requesting_plist (PLIST_REQ_SYNC);
+	int send_fd = -1;
+	int serial, from, len, res;
+	char *chunk;
+
+	debug ("Client with fd %d sends its playlist packed", cli->socket);
+
+	if (!get_int(cli->socket, &serial) || !get_int(cli->socket, &from)) {
+		logit ("Error while getting serial");
+		return 0;
+	}
+
+	if (requesting == -1)
+		logit ("No clients are requesting the playlist");
+	else {
+		send_fd = clients[requesting].socket;
+		if (!send_int(send_fd, EV_DATA) || !send_int(send_fd, serial)
+				|| !send_int(send_fd, from)) {
+			logit ("Error while sending response; disconnecting the client");
+			close (send_fd);
+			del_client (&clients[requesting]);
+			send_fd = -1;
+		}
+	}
+
+	/* As in req_send_plist(), the playlist must be read anyway. */
+	while ((res = recv_plist_chunk(cli->socket, &chunk, &len)) && chunk) {
+		if (send_fd != -1 && !send_plist_chunk(send_fd, chunk, len)) {
+			logit ("Error while sending items; disconnecting the client");
+			close (send_fd);
+			del_client (&clients[requesting]);
+			send_fd = -1;
+		}
+		free (chunk);
+	}
+
+	if (res)
+		logit ("Playlist sent");
+	else
+		logit ("Error while receiving playlist chunk");
+
+	/* Don't let the requesting client take a part of the playlist for
+	 * all of it. */
+	if (send_fd != -1 && !send_plist_chunk(send_fd, NULL,
+	                                       res ? 0 : PLIST_CHUNK_ABORT)) {
+		logit ("Error while sending end of playlist mark; "
+		       "disconnecting the client");
+		close (send_fd);
+		del_client (&clients[requesting]);
+		return 0;
+	}
+
+	if (requesting != -1)
+		clients[requesting].requests_plist = 0;
+
+	return res;
+}
+
 /* Client requested we send the queue so we get it from audio.c and
  * send it to the client. */
 static int req_send_queue (struct client *cli)
@@ -1115,6 +1609,43 @@ static int req_send_queue (struct client *cli)
 	return 1;
 }
 
+/* Handle CMD_LIBRARY_SEARCH: send the best matches of the query from
+ * the library like a playlist. Return 0 on error. */
+static int req_library_search (struct client *cli)
+{
+	char *query;
+	int max, i, res = 1;
+	struct plist results;
+
+	if (!(query = get_str(cli->socket)))
+		return 0;
+	if (!get_int(cli->socket, &max)) {
+		free (query);
+		return 0;
+	}
+
+	plist_init (&results);
+	library_search (query, CLAMP(0, max, LIBRARY_SEARCH_MAX), &results);
+	logit ("Library search for '%s': %d results", query, results.num);
+	free (query);
+
+	if (!send_int(cli->socket, EV_DATA))
+		res = 0;
+
+	for (i = 0; res && i < results.num; i++)
+		res = send_item (cli->socket, &results.items[i]);
+
+	if (res)
+		res = send_item (cli->socket, NULL);
+
+	if (!res)
+		logit ("Error while sending search results");
+
+	plist_free (&results);
+
+	return res;
+}
+
 /* Handle command that synchronises the playlists between interfaces
  * (except forwarding the whole list). Return 0 on error. */
 static int plist_sync_cmd (struct client *cli, const int cmd)
@@ -1208,7 +1739,7 @@ static int gen_serial (const struct client *cli)
 	 * enough since clients use only two playlists. */
 
 	do {
-		serial = (seed << 8) | client_index(cli);
+		serial = (seed << SERIAL_CLIENT_BITS) | client_index(cli);
 		seed = (seed + 1) & 0xFF;
 	} while (serial == audio_plist_get_serial());
 
@@ -1368,6 +1899,35 @@ static int get_file_tags (const int cli_id)
 	return 1;
 }
 
+/* Handle CMD_GET_FILE_TAGS_BATCH. Return 0 on error. */
+static int get_file_tags_batch (const int cli_id)
+{
+	int tags_sel, count, i;
+
+	if (!get_int(clients[cli_id].socket, &tags_sel)
+			|| !get_int(clients[cli_id].socket, &count))
+		return 0;
+
+	if (!RANGE(1, count, TAGS_BATCH_MAX)) {
+		logit ("Bad tags batch size: %d", count);
+		return 0;
+	}
+
+	clients[cli_id].wants_tags_batch = 1;
+
+	for (i = 0; i < count; i++) {
+		char *file;
+
+		if (!(file = get_str(clients[cli_id].socket)))
+			return 0;
+
+		tags_cache_add_request (tags_cache, file, tags_sel, cli_id);
+		free (file);
+	}
+
+	return 1;
+}
+
 static int abort_tags_requests (const int cli_id)
 {
 	char *file;
@@ -1381,6 +1941,36 @@ static int abort_tags_requests (const int cli_id)
 	return 1;
 }
 
+/* Handle CMD_ABORT_TAGS_BATCH. Return 0 on error. */
+static int abort_tags_batch (const int cli_id)
+{
+	char *files[TAGS_BATCH_MAX];
+	int count, i, res = 1;
+
+	if (!get_int(clients[cli_id].socket, &count))
+		return 0;
+
+	if (!RANGE(1, count, TAGS_BATCH_MAX)) {
+		logit ("Bad tags batch size: %d", count);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!(files[i] = get_str(clients[cli_id].socket))) {
+			res = 0;
+			break;
+		}
+	}
+
+	if (res)
+		tags_cache_clear_files (tags_cache, files, count, cli_id);
+
+	while (i > 0)
+		free (files[--i]);
+
+	return res;
+}
+
 /* Handle CMD_LIST_MOVE. Return 0 on error. */
 static int req_list_move (struct client *cli)
 {
@@ -1427,6 +2017,30 @@ static int req_queue_move (const struct client *cli)
 	return 1;
 }
 
+/* Handle CMD_TAGGED: get the request ID and the command, send EV_REPLY
+ * with the ID so that the command's response, if any, follows it.  The
+ * client doesn't wait for it, so it can have many commands on the way.
+ * Return 0 on error. */
+static int req_tagged (struct client *cli, int *cmd)
+{
+	int id;
+
+	if (!get_int(cli->socket, &id) || !get_int(cli->socket, cmd))
+		return 0;
+
+	if (*cmd == CMD_TAGGED) {
+		logit ("Nested CMD_TAGGED from the client");
+		return 0;
+	}
+
+	if (!send_int(cli->socket, EV_REPLY) || !send_int(cli->socket, id)) {
+		logit ("Error when sending EV_REPLY");
+		return 0;
+	}
+
+	return 1;
+}
+
 /* Receive a command from the client and execute it. */
 static void handle_command (const int client_id)
 {
@@ -1441,6 +2055,13 @@ static void handle_command (const int client_id)
 		return;
 	}
 
+	if (cmd == CMD_TAGGED && !req_tagged(cli, &cmd)) {
+		logit ("Failed to get tagged command from the client");
+		close (cli->socket);
+		del_client (cli);
+		return;
+	}
+
 	switch (cmd) {
 		case CMD_QUIT:
 			logit ("Exit request from the client");
@@ -1544,6 +2165,11 @@ static void handle_command (const int client_id)
 			cli->wants_plist_events = 1;
 			logit ("Request for events");
 			break;
+		case CMD_TICKLESS:
+			cli->tickless = 1;
+			debug ("Client with fd %d counts the time itself",
+			       cli->socket);
+			break;
 		case CMD_GET_PLIST:
 			if (!get_client_plist(cli))
 				err = 1;
@@ -1552,6 +2178,14 @@ static void handle_command (const int client_id)
 			if (!req_send_plist(cli))
 				err = 1;
 			break;
+		case CMD_PLIST_SYNC:
+			if (!req_plist_sync(cli))
+				err = 1;
+			break;
+		case CMD_SEND_PLIST_PACKED:
+			if (!req_send_plist_packed(cli))
+				err = 1;
+			break;
 		case CMD_CAN_SEND_PLIST:
 			cli->can_send_plist = 1;
 			break;
@@ -1600,10 +2234,18 @@ static void handle_command (const int client_id)
 			if (!get_file_tags(client_id))
 				err = 1;
 			break;
+		case CMD_GET_FILE_TAGS_BATCH:
+			if (!get_file_tags_batch(client_id))
+				err = 1;
+			break;
 		case CMD_ABORT_TAGS_REQUESTS:
 			if (!abort_tags_requests(client_id))
 				err = 1;
 			break;
+		case CMD_ABORT_TAGS_BATCH:
+			if (!abort_tags_batch(client_id))
+				err = 1;
+			break;
 		case CMD_LIST_MOVE:
 			if (!req_list_move(cli))
 				err = 1;
@@ -1644,6 +2286,10 @@ static void handle_command (const int client_id)
 			if (!req_send_queue(cli))
 				err = 1;
 			break;
+		case CMD_LIBRARY_SEARCH:
+			if (!req_library_search(cli))
+				err = 1;
+			break;
 		default:
 			logit ("Bad command (0x%x) from the client", cmd);
 			err = 1;
@@ -1658,19 +2304,63 @@ static void handle_command (const int client_id)
 
 /* Add clients file descriptors to fds. */
 static void add_clients_fds (fd_set *read, fd_set *write)
+{
+	int i, locker = locking_client ();
+
+	for (i = 0; i < active_num; i++) {
+		struct client *cli = &clients[active_clients[i]];
+
+		if (locker == -1 || is_locking(cli))
+			FD_SET (cli->socket, read);
+
+		LOCK (cli->events_mtx);
+		if (!event_queue_empty(&cli->events))
+			FD_SET (cli->socket, write);
+		UNLOCK (cli->events_mtx);
+	}
+}
+
+/* Return != 0 if the client's next command code was already read and
+ * buffered, select() and epoll don't see it.  A part of it isn't enough,
+ * reading the rest would block until the client sends more. */
+static int cmd_buffered (const struct client *cli)
+{
+	return sock_pending (cli->socket) >= (int)sizeof(int);
+}
+
+/* Add to fds clients which can send us a command and have it already read
+ * and buffered.  Return the number of such clients. */
+static int add_clients_pending (fd_set *fds)
+{
+	int i, num = 0, locker = locking_client ();
+
+	for (i = 0; i < active_num; i++) {
+		struct client *cli = &clients[active_clients[i]];
+
+		if ((locker == -1 || is_locking(cli)) && cmd_buffered(cli)) {
+			FD_SET (cli->socket, fds);
+			num++;
+		}
+	}
+
+	return num;
+}
+
+/* Send responses and events buffered for the clients. */
+static void flush_clients ()
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket != -1) {
-			if (locking_client() == -1 || is_locking(&clients[i]))
-				FD_SET (clients[i].socket, read);
+	for (i = active_num - 1; i >= 0; i--) {
+		struct client *cli = &clients[active_clients[i]];
 
-			LOCK (clients[i].events_mtx);
-			if (!event_queue_empty(&clients[i].events))
-				FD_SET (clients[i].socket, write);
-			UNLOCK (clients[i].events_mtx);
+		if (!sock_flush(cli->socket)) {
+			logit ("Can't send data to the client with fd %d, "
+			       "closing the connection", cli->socket);
+			close (cli->socket);
+			del_client (cli);
 		}
+	}
 }
 
 /* Return the maximum fd from clients and the argument. */
@@ -1681,9 +2371,9 @@ static int max_fd (int max)
 	if (wake_up_pipe[0] > max)
 		max = wake_up_pipe[0];
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket > max)
-			max = clients[i].socket;
+	for (i = 0; i < active_num; i++)
+		if (clients[active_clients[i]].socket > max)
+			max = clients[active_clients[i]].socket;
 	return max;
 }
 
@@ -1692,7 +2382,9 @@ static void handle_clients (fd_set *fds)
 {
 	int i;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
+	/* A command may disconnect another client, so go through the
+	 * table and not the active_clients[] list. */
+	for (i = 0; i < clients_max; i++)
 		if (clients[i].socket != -1
 				&& FD_ISSET(clients[i].socket, fds)) {
 			if (locking_client() == -1
@@ -1708,61 +2400,87 @@ static void handle_clients (fd_set *fds)
 /* Close all client connections sending EV_EXIT. */
 static void close_clients ()
 {
-	int i;
+	while (active_num > 0) {
+		struct client *cli = &clients[active_clients[0]];
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket != -1) {
-			send_int (clients[i].socket, EV_EXIT);
-			close (clients[i].socket);
-			del_client (&clients[i]);
-		}
+		send_int (cli->socket, EV_EXIT);
+		sock_flush (cli->socket);
+		close (cli->socket);
+		del_client (cli);
+	}
 }
 
-/* Handle incoming connections */
-void server_loop ()
+/* Return != 0 if the server loop uses epoll. */
+static int using_epoll ()
+{
+#ifdef HAVE_SYS_EPOLL_H
+	return epoll_fd != -1;
+#else
+	return 0;
+#endif
+}
+
+/* Accept an incoming connection. */
+static void accept_client ()
 {
 	struct sockaddr_un client_name;
 	socklen_t name_len = sizeof (client_name);
+	int client_sock;
 
-	logit ("MOC server started, pid: %d", getpid());
+	debug ("accept()ing connection...");
+	client_sock = accept (server_sock, (struct sockaddr *)&client_name,
+			&name_len);
 
-	assert (server_sock != -1);
+	if (client_sock == -1)
+		fatal ("accept() failed: %s", xstrerror (errno));
+	logit ("Incoming connection");
 
-	log_circular_start ();
+	/* select() can't watch it. */
+	if (!using_epoll() && client_sock >= FD_SETSIZE)
+		busy (client_sock);
+	else if (!add_client(client_sock))
+		busy (client_sock);
+}
 
+/* Server loop using select(), which must be given all the descriptors
+ * each time. */
+static void select_loop ()
+{
 	do {
-		int res;
-		fd_set fds_write, fds_read;
+		int res, pending;
+		fd_set fds_write, fds_read, fds_pending;
+		struct timeval no_wait = { 0, 0 };
+
+		flush_status_page ();
+		decoder_report_errors ();
 
 		FD_ZERO (&fds_read);
 		FD_ZERO (&fds_write);
+		FD_ZERO (&fds_pending);
 		FD_SET (server_sock, &fds_read);
 		FD_SET (wake_up_pipe[0], &fds_read);
 		add_clients_fds (&fds_read, &fds_write);
+		pending = add_clients_pending (&fds_pending);
 
 		res = 0;
 		if (!server_quit)
 			res = select (max_fd(server_sock)+1, &fds_read,
-					&fds_write, NULL, NULL);
+					&fds_write, NULL, pending ? &no_wait : NULL);
+
+		if (pending && res >= 0) {
+			int i;
+
+			for (i = 0; i <= max_fd(server_sock); i++)
+				if (FD_ISSET(i, &fds_pending))
+					FD_SET (i, &fds_read);
+		}
 
 		if (res == -1 && errno != EINTR && !server_quit)
 			fatal ("select() failed: %s", xstrerror (errno));
 
 		if (!server_quit && res >= 0) {
-			if (FD_ISSET(server_sock, &fds_read)) {
-				int client_sock;
-
-				debug ("accept()ing connection...");
-				client_sock = accept (server_sock,
-					(struct sockaddr *)&client_name,
-					&name_len);
-
-				if (client_sock == -1)
-					fatal ("accept() failed: %s", xstrerror (errno));
-				logit ("Incoming connection");
-				if (!add_client(client_sock))
-					busy (client_sock);
-			}
+			if (FD_ISSET(server_sock, &fds_read))
+				accept_client ();
 
 			if (FD_ISSET(wake_up_pipe[0], &fds_read)) {
 				int w;
@@ -1775,18 +2493,186 @@ void server_loop ()
 
 			send_events (&fds_write);
 			handle_clients (&fds_read);
+			flush_clients ();
 		}
 
 		if (server_quit)
 			logit ("Exiting...");
 
 	} while (!server_quit);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Read all pending wake up signals. */
+static void drain_wake_up ()
+{
+	int w[16];
+
+	logit ("Got 'wake up'");
+
+	while (read(wake_up_pipe[0], w, sizeof(w)) > 0)
+		;
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		fatal ("Can't read wake up signal: %s", xstrerror (errno));
+}
+
+/* Return != 0 if a command can be read from the client without blocking
+ * or the connection was closed. */
+static int client_has_input (const struct client *cli)
+{
+	char c;
+
+	if (cmd_buffered(cli))
+		return 1;
+
+	return recv (cli->socket, &c, 1, MSG_PEEK | MSG_DONTWAIT) != -1
+		|| (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+/* Handle one command from each ready client respecting the lock, keep on
+ * the ready list those which have more to read. */
+static void handle_ready_clients ()
+{
+	int i = 0, locker = locking_client ();
+
+	while (i < ready_num) {
+		int idx = ready_clients[i];
+		struct client *cli = &clients[idx];
+
+		if (locker == -1 || locker == idx) {
+			handle_command (idx);
+			locker = locking_client ();
+		}
+
+		if (cli->socket != -1 && !client_has_input(cli))
+			clear_readable (cli);
+
+		/* Go on unless the client was removed from the list. */
+		if (i < ready_num && ready_clients[i] == idx)
+			i++;
+	}
+}
+
+/* Return != 0 if a ready client can be handled now. */
+static int have_ready_clients ()
+{
+	int i, locker;
+
+	if (ready_num == 0)
+		return 0;
+
+	locker = locking_client ();
+	if (locker == -1)
+		return 1;
+
+	for (i = 0; i < ready_num; i++)
+		if (ready_clients[i] == locker)
+			return 1;
+	return 0;
+}
+
+/* Server loop using epoll.  Clients are registered edge-triggered, so
+ * readable and writable states are kept until reading or writing would
+ * block. */
+static void epoll_loop ()
+{
+	struct epoll_event evs[EP_EVENTS];
+
+	while (!server_quit) {
+		int i, res;
+		int woken = 0;
+
+		flush_status_page ();
+		decoder_report_errors ();
+
+		res = epoll_wait (epoll_fd, evs, EP_EVENTS,
+				have_ready_clients() ? 0 : -1);
+
+		if (res == -1) {
+			if (errno != EINTR && !server_quit)
+				fatal ("epoll_wait() failed: %s",
+						xstrerror (errno));
+			continue;
+		}
+
+		for (i = 0; i < res; i++) {
+			uint32_t id = evs[i].data.u32;
+			struct client *cli;
+
+			if (id == EP_SERVER_SOCK) {
+				accept_client ();
+				continue;
+			}
+
+			if (id == EP_WAKE_UP) {
+				drain_wake_up ();
+				woken = 1;
+				continue;
+			}
+
+			cli = &clients[id];
+			if (cli->socket == -1)
+				continue;
+
+			if ((evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					&& !cli->readable) {
+				cli->readable = 1;
+				ready_clients[ready_num++] = id;
+			}
+
+			if (evs[i].events & EPOLLOUT) {
+				cli->writable = 1;
+				if (!woken)
+					send_client_events (cli);
+			}
+		}
+
+		/* Events were queued, send them where we can. */
+		if (woken) {
+			for (i = active_num - 1; i >= 0; i--) {
+				struct client *cli = &clients[active_clients[i]];
+
+				if (cli->writable || cli->lagging)
+					send_client_events (cli);
+			}
+		}
+
+		handle_ready_clients ();
+		flush_clients ();
+	}
+
+	logit ("Exiting...");
+}
+#endif
+
+/* Handle incoming connections */
+void server_loop ()
+{
+	logit ("MOC server started, pid: %d", getpid());
+
+	assert (server_sock != -1);
+
+	update_status_page (EV_STATE);
+	log_circular_start ();
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd != -1)
+		epoll_loop ();
+	else
+#endif
+		select_loop ();
 
 	log_circular_log ();
 	log_circular_stop ();
 
 	close_clients ();
 	clients_cleanup ();
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd != -1) {
+		close (epoll_fd);
+		epoll_fd = -1;
+	}
+#endif
 	close (server_sock);
 	server_sock = -1;
 	server_shutdown ();
@@ -1794,6 +2680,10 @@ void server_loop ()
 
 void set_info_bitrate (const int bitrate)
 {
+	/* It's set every second, don't wake up clients for nothing. */
+	if (bitrate == sound_info.bitrate)
+		return;
+
 	sound_info.bitrate = bitrate;
 	add_event_all (EV_BITRATE, NULL);
 }
@@ -1819,12 +2709,55 @@ void set_info_avg_bitrate (const int avg_bitrate)
 /* Notify the client about change of the player state. */
 void state_change ()
 {
+	/* Tickless clients get the time on the next tick, which is more
+	 * accurate than what they get with CMD_GET_CTIME now. */
+	LOCK (ctime_sent_mtx);
+	ctime_sent.ctime = -1;
+	UNLOCK (ctime_sent_mtx);
+
 	add_event_all (EV_STATE, NULL);
 }
 
+/* Return 1 if tickless clients can't count the new time ctime, because it
+ * doesn't go on like the time they were sent last (seek, pause, stalled
+ * stream). */
+static int ctime_jumped (const int ctime)
+{
+	double now = get_realtime_sec ();
+	int jumped;
+
+	LOCK (ctime_sent_mtx);
+	jumped = ctime_sent.ctime == -1
+		|| fabs ((ctime - ctime_sent.ctime)
+				- (now - ctime_sent.when)) >= 1.0;
+	if (jumped) {
+		ctime_sent.ctime = ctime;
+		ctime_sent.when = now;
+	}
+	UNLOCK (ctime_sent_mtx);
+
+	return jumped;
+}
+
+/* The playing time has changed (called every second while playing). */
 void ctime_change ()
 {
-	add_event_all (EV_CTIME, NULL);
+	int i, added = 0;
+	int jumped = ctime_jumped (MAX(0, audio_get_time ()));
+
+	update_status_page (EV_CTIME);
+
+	for (i = 0; i < clients_max; i++) {
+		if (clients[i].socket == -1
+				|| (clients[i].tickless && !jumped))
+			continue;
+
+		add_event (&clients[i], EV_CTIME, NULL);
+		added++;
+	}
+
+	if (added)
+		wake_up_server ();
 }
 
 void tags_change ()
@@ -1842,9 +2775,32 @@ void tags_response (const int client_id, const char *file,
 {
 	assert (file != NULL);
 	assert (tags != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, clients_max));
+
+	if (clients[client_id].socket != -1
+			&& clients[client_id].wants_tags_batch) {
+		struct client *cli = &clients[client_id];
+		struct event *last = NULL;
+		int num;
+
+		/* Append to the last batch if it's still waiting in the queue,
+		 * so that a burst of responses goes out in a few packets. */
+		LOCK (cli->events_mtx);
+		num = event_queue_count (&cli->events);
+		if (num)
+			last = event_get (&cli->events, num - 1);
+		if (!last || last->type != EV_FILE_TAGS_BATCH
+				|| !tag_ev_batch_add (last->data, file, tags)) {
+			struct tag_ev_batch *batch = tag_ev_batch_new ();
+
+			tag_ev_batch_add (batch, file, tags);
+			queue_event (cli, EV_FILE_TAGS_BATCH, batch);
+		}
+		UNLOCK (cli->events_mtx);
 
-	if (clients[client_id].socket != -1) {
+		wake_up_server ();
+	}
+	else if (clients[client_id].socket != -1) {
 		struct tag_ev_response *data
 			= (struct tag_ev_response *)xmalloc (
 					sizeof(struct tag_ev_response));
@@ -7,7 +7,8 @@ extern "C" {
 
 #include "playlist.h"
 
-#define CLIENTS_MAX	10
+/* Name of the file in the MOC directory holding the server's pid. */
+#define PID_FILE	"pid"
 
 void server_init (int debug, int foreground);
 void server_loop ();
@@ -0,0 +1,239 @@
+/*
+ * MOC - music on console
+ * Copyright (C) 2026 The MOC developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* The status page: a file in the MOC directory mapped by the server, where
+ * it keeps the current state, time, tags etc.  'mocp -i' and 'mocp -Q'
+ * read it instead of asking the server over the socket.
+ *
+ * The page is guarded by a sequence number (seqlock): the writer makes it
+ * odd before changing anything and even again afterwards, a reader copies
+ * the page and retries if the number was odd or changed meanwhile. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <assert.h>
+
+#include "common.h"
+#include "log.h"
+#include "status_page.h"
+
+#define STATUS_PAGE_MAGIC	0x4d4f4353	/* "MOCS" */
+#define STATUS_PAGE_VERSION	1
+
+/* How many times a reader tries to get a consistent copy. */
+#define STATUS_READ_TRIES	1000
+
+struct status_page
+{
+	int magic;
+	int version;
+	int size;		/* sizeof(struct status_page) */
+	pid_t pid;		/* the server's PID */
+	volatile unsigned int seq;
+	struct server_status status;
+};
+
+/* The server's mapping. */
+static struct status_page *page = NULL;
+static char *page_file = NULL;
+static pthread_mutex_t page_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Create the status page file and map it.  Return 0 on error. */
+int status_page_create (const char *file_name)
+{
+	int fd;
+	void *mem;
+
+	assert (file_name != NULL);
+	assert (page == NULL);
+
+	unlink (file_name);
+	fd = open (file_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd == -1) {
+		log_errno ("Can't create the status page", errno);
+		return 0;
+	}
+
+	if (ftruncate (fd, sizeof(struct status_page)) == -1) {
+		log_errno ("Can't set the status page size", errno);
+		close (fd);
+		unlink (file_name);
+		return 0;
+	}
+
+	mem = mmap (NULL, sizeof(struct status_page), PROT_READ | PROT_WRITE,
+	            MAP_SHARED, fd, 0);
+	close (fd);
+	if (mem == MAP_FAILED) {
+		log_errno ("Can't map the status page", errno);
+		unlink (file_name);
+		return 0;
+	}
+
+	page = (struct status_page *)mem;
+	page->size = sizeof(struct status_page);
+	page->version = STATUS_PAGE_VERSION;
+	page->pid = getpid ();
+	page->seq = 0;
+	page->status.state = -1;
+	page->status.curr_time = -1;
+	page->status.bitrate = -1;
+	page->status.avg_bitrate = -1;
+	page->status.rate = -1;
+	page->status.track = -1;
+	page->status.time = -1;
+
+	/* The magic goes last, readers don't look at a page without it. */
+	__sync_synchronize ();
+	page->magic = STATUS_PAGE_MAGIC;
+
+	page_file = xstrdup (file_name);
+
+	return 1;
+}
+
+/* Start changing the status.  Return the status to change (it's NULL if
+ * there is no page) and status_page_end() must be called. */
+struct server_status *status_page_begin ()
+{
+	LOCK (page_mtx);
+
+	if (!page)
+		return NULL;
+
+	page->seq++;
+	__sync_synchronize ();
+
+	return &page->status;
+}
+
+/* Finish changing the status. */
+void status_page_end ()
+{
+	if (page) {
+		page->status.changes++;
+		__sync_synchronize ();
+		page->seq++;
+	}
+
+	UNLOCK (page_mtx);
+}
+
+/* Copy the string to the status field of the given size.  Strings which
+ * don't fit mark the status as truncated. */
+void status_page_set_str (struct server_status *status, char *dst,
+		const size_t size, const char *src)
+{
+	size_t len;
+
+	assert (status != NULL);
+	assert (dst != NULL);
+
+	if (!src)
+		src = "";
+
+	len = strlen (src);
+	if (len >= size) {
+		status->truncated = 1;
+		len = 0;
+	}
+
+	memcpy (dst, src, len);
+	dst[len] = 0;
+}
+
+/* Unmap and remove the status page. */
+void status_page_remove ()
+{
+	LOCK (page_mtx);
+	if (page) {
+		munmap (page, sizeof(struct status_page));
+		page = NULL;
+		unlink (page_file);
+		free (page_file);
+		page_file = NULL;
+	}
+	UNLOCK (page_mtx);
+}
+
+/* Read a consistent copy of the status published by a running server.
+ * Return 0 if there is no usable page. */
+int status_page_read (const char *file_name, struct server_status *status)
+{
+	const struct status_page *p;
+	struct stat st;
+	void *mem;
+	int fd, tries, res = 0;
+
+	assert (file_name != NULL);
+	assert (status != NULL);
+
+	fd = open (file_name, O_RDONLY);
+	if (fd == -1)
+		return 0;
+
+	if (fstat (fd, &st) == -1
+			|| st.st_size != (off_t)sizeof(struct status_page)) {
+		close (fd);
+		return 0;
+	}
+
+	mem = mmap (NULL, sizeof(struct status_page), PROT_READ, MAP_SHARED,
+	            fd, 0);
+	close (fd);
+	if (mem == MAP_FAILED)
+		return 0;
+
+	p = (const struct status_page *)mem;
+	if (p->magic != STATUS_PAGE_MAGIC
+			|| p->version != STATUS_PAGE_VERSION
+			|| p->size != (int)sizeof(struct status_page))
+		goto out;
+
+	/* A page left by a server which has crashed. */
+	if (kill (p->pid, 0) == -1 && errno == ESRCH)
+		goto out;
+
+	for (tries = 0; tries < STATUS_READ_TRIES; tries++) {
+		unsigned int seq = p->seq;
+
+		if (seq & 1) {
+			sched_yield ();
+			continue;
+		}
+
+		__sync_synchronize ();
+		memcpy (status, (const void *)&p->status, sizeof(*status));
+		__sync_synchronize ();
+
+		if (p->seq == seq) {
+			res = status->state != -1 && !status->truncated;
+			break;
+		}
+	}
+
+out:
+	munmap (mem, sizeof(struct status_page));
+	return res;
+}
@@ -0,0 +1,51 @@
+#ifndef STATUS_PAGE_H
+#define STATUS_PAGE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Name of the status page file in the MOC directory. */
+#define STATUS_PAGE_FILE	"status"
+
+#define STATUS_FILE_LEN		4096
+#define STATUS_TAG_LEN		256
+
+/* Status of the server published for 'mocp -i' and 'mocp -Q'. */
+struct server_status
+{
+	unsigned int changes;	/* incremented on every update */
+	int state;		/* STATE_* */
+	int curr_time;
+	int bitrate;
+	int avg_bitrate;
+	int rate;
+	int channels;
+	int truncated;		/* a string didn't fit, the page is not
+				   usable */
+
+	/* The current file and its tags. */
+	char file[STATUS_FILE_LEN];
+	char title[STATUS_TAG_LEN];
+	char artist[STATUS_TAG_LEN];
+	char album[STATUS_TAG_LEN];
+	int track;
+	int time;
+	int tags_filled;	/* TAGS_* */
+};
+
+int status_page_create (const char *file_name);
+struct server_status *status_page_begin ();
+void status_page_end ();
+void status_page_set_str (struct server_status *status, char *dst,
+		const size_t size, const char *src);
+void status_page_remove ();
+int status_page_read (const char *file_name, struct server_status *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
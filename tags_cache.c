@@ -99,8 +99,8 @@ struct tags_cache
 #endif
 
 	int max_items;		/* maximum number of items in the cache. */
-	struct request_queue queues[CLIENTS_MAX]; /* requests queues for each
-						     client */
+	struct request_queue *queues; /* requests queues for each client */
+	int queues_num;		/* number of queues (maximum clients) */
 	int stop_reader_thread; /* request for stopping read thread (if
 				   non-zero) */
 	pthread_cond_t request_cond; /* condition for signalizing new
@@ -108,6 +108,8 @@ struct tags_cache
 	pthread_mutex_t mutex; /* mutex for all above data (except db because
 				  it's thread-safe) */
 	pthread_t reader_thread; /* tid of the reading thread */
+	char *trusted_dir; /* directory kept current by the library indexer
+			      (NULL if none), protected by the mutex */
 };
 
 struct cache_record
@@ -180,6 +182,46 @@ static void request_queue_clear_up_to (struct request_queue *q,
 		q->tail = NULL;
 }
 
+/* Remove one request for each of the files from the queue.  The order of
+ * the files is changed. */
+static void request_queue_clear_files (struct request_queue *q,
+                                       char **files, int count)
+{
+	struct request_queue_node **p;
+
+	assert (q != NULL);
+
+	p = &q->head;
+	q->tail = NULL;
+	while (*p && count) {
+		struct request_queue_node *o = *p;
+		int i;
+
+		for (i = 0; i < count && strcmp (o->file, files[i]); i++)
+			;
+
+		if (i < count) {
+			char *found = files[i];
+
+			files[i] = files[--count];
+			files[count] = found;
+			*p = o->next;
+			free (o->file);
+			free (o);
+		}
+		else {
+			q->tail = o;
+			p = &o->next;
+		}
+	}
+
+	/* Find the tail if we stopped early. */
+	while (*p) {
+		q->tail = *p;
+		p = &(*p)->next;
+	}
+}
+
 static void request_queue_add (struct request_queue *q, const char *file,
                                                             int tags_sel)
 {
@@ -599,6 +641,25 @@ struct file_tags *read_missing_tags (const char *file,
 	return tags;
 }
 
+/* Return non-zero if the library indexer vouches for the cached record of
+ * this file being current, so its modification time need not be checked. */
+#ifdef HAVE_DB_H
+static int is_trusted (struct tags_cache *c, const char *file)
+{
+	int res = 0;
+
+	LOCK (c->mutex);
+	if (c->trusted_dir) {
+		size_t len = strlen (c->trusted_dir);
+
+		res = !strncmp (file, c->trusted_dir, len) && file[len] == '/';
+	}
+	UNLOCK (c->mutex);
+
+	return res;
+}
+#endif
+
 /* Read the selected tags for this file and add it to the cache. */
 #ifdef HAVE_DB_H
 static void *locked_read_add (struct tags_cache *c, const char *file,
@@ -622,9 +683,8 @@ static void *locked_read_add (struct tags_cache *c, const char *file,
 
 		if (cache_record_deserialize (&rec, serialized_cache_rec->data,
 		                              serialized_cache_rec->size, 0)) {
-			time_t curr_mtime = get_mtime (file);
-
-			if (rec.mod_time != curr_mtime) {
+			if (!is_trusted (c, file)
+			             && rec.mod_time != get_mtime (file)) {
 				debug ("Tags in the cache are outdated");
 				tags_free (rec.tags);  /* remove them and reread tags */
 			}
@@ -702,9 +762,9 @@ static void *reader_thread (void *cache_ptr)
 		 * curr_queue: we want to get one request from each queue,
 		 * and then move to the next non-empty queue. */
 		i = curr_queue;
-		while (i < CLIENTS_MAX && request_queue_empty (&c->queues[i]))
+		while (i < c->queues_num && request_queue_empty (&c->queues[i]))
 			i++;
-		if (i == CLIENTS_MAX) {
+		if (i == c->queues_num) {
 			i = 0;
 			while (i < curr_queue && request_queue_empty (&c->queues[i]))
 				i++;
@@ -724,7 +784,7 @@ static void *reader_thread (void *cache_ptr)
 		free (request_file);
 
 		LOCK (c->mutex);
-		curr_queue = (curr_queue + 1) % CLIENTS_MAX;
+		curr_queue = (curr_queue + 1) % c->queues_num;
 	}
 
 	UNLOCK (c->mutex);
@@ -734,7 +794,7 @@ static void *reader_thread (void *cache_ptr)
 	return NULL;
 }
 
-struct tags_cache *tags_cache_new (size_t max_size)
+struct tags_cache *tags_cache_new (size_t max_size, int max_clients)
 {
 	int i, rc;
 	struct tags_cache *result;
@@ -746,7 +806,12 @@ struct tags_cache *tags_cache_new (size_t max_size)
 	result->db = NULL;
 #endif
 
-	for (i = 0; i < CLIENTS_MAX; i++)
+	assert (max_clients > 0);
+
+	result->queues_num = max_clients;
+	result->queues = (struct request_queue *)xcalloc (max_clients,
+			sizeof(struct request_queue));
+	for (i = 0; i < max_clients; i++)
 		request_queue_init (&result->queues[i]);
 
 #if CACHE_DB_FORMAT_VERSION
@@ -755,6 +820,7 @@ struct tags_cache *tags_cache_new (size_t max_size)
 	result->max_items = 0;
 #endif
 	result->stop_reader_thread = 0;
+	result->trusted_dir = NULL;
 	pthread_mutex_init (&result->mutex, NULL);
 
 	rc = pthread_cond_init (&result->request_cond, NULL);
@@ -809,8 +875,11 @@ void tags_cache_free (struct tags_cache *c)
 		fatal ("pthread_join() on cache reader thread failed: %s",
 		        xstrerror (rc));
 
-	for (i = 0; i < CLIENTS_MAX; i++)
+	for (i = 0; i < c->queues_num; i++)
 		request_queue_clear (&c->queues[i]);
+	free (c->queues);
+
+	free (c->trusted_dir);
 
 	rc = pthread_mutex_destroy (&c->mutex);
 	if (rc != 0)
@@ -844,8 +913,9 @@ static void *locked_add_request (struct tags_cache *c, const char *file,
 
 	if (cache_record_deserialize (&rec, serialized_cache_rec->data,
 				serialized_cache_rec->size, 0)) {
-		if (rec.mod_time == get_mtime (file)
-				&& (rec.tags->filled & tags_sel) == tags_sel) {
+		if ((rec.tags->filled & tags_sel) == tags_sel
+				&& (is_trusted (c, file)
+				    || rec.mod_time == get_mtime (file))) {
 			tags_response (client_id, file, rec.tags);
 			tags_free (rec.tags);
 			debug ("Tags are present in the cache");
@@ -867,7 +937,7 @@ void tags_cache_add_request (struct tags_cache *c, const char *file,
 
 	assert (c != NULL);
 	assert (file != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, c->queues_num));
 
 	debug ("Request for tags for '%s' from client %d", file, client_id);
 
@@ -887,7 +957,7 @@ void tags_cache_add_request (struct tags_cache *c, const char *file,
 void tags_cache_clear_queue (struct tags_cache *c, int client_id)
 {
 	assert (c != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, c->queues_num));
 
 	LOCK (c->mutex);
 	request_queue_clear (&c->queues[client_id]);
@@ -901,7 +971,7 @@ void tags_cache_clear_up_to (struct tags_cache *c, const char *file,
                                                       int client_id)
 {
 	assert (c != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, c->queues_num));
 	assert (file != NULL);
 
 	LOCK (c->mutex);
@@ -911,6 +981,22 @@ void tags_cache_clear_up_to (struct tags_cache *c, const char *file,
 	UNLOCK (c->mutex);
 }
 
+/* Remove the pending requests for the given files from the client's queue.
+ * The order of the files is changed. */
+void tags_cache_clear_files (struct tags_cache *c, char **files, int count,
+                                                      int client_id)
+{
+	assert (c != NULL);
+	assert (LIMIT(client_id, c->queues_num));
+	assert (files != NULL);
+
+	LOCK (c->mutex);
+	debug ("Removing requests for %d files for client %d", count,
+			client_id);
+	request_queue_clear_files (&c->queues[client_id], files, count);
+	UNLOCK (c->mutex);
+}
+
 #if defined(HAVE_DB_H) && !defined(NDEBUG)
 static void db_err_cb (const DB_ENV *unused ATTR_UNUSED, const char *errpfx,
                                                          const char *msg)
@@ -1259,3 +1345,164 @@ struct file_tags *tags_cache_get_immediate (struct tags_cache *c,
 
 	return tags;
 }
+
+/* Return the maximum number of records the cache can hold, zero if the
+ * cache is disabled. */
+int tags_cache_size (struct tags_cache *c)
+{
+	assert (c != NULL);
+
+#ifdef HAVE_DB_H
+	if (c->db)
+		return c->max_items;
+#endif
+
+	return 0;
+}
+
+/* Make sure the cache holds the selected tags for the file.  If 'force' is
+ * set, any present record is discarded first (the file is known to have
+ * changed).  Return the tags, read directly from the file if the cache is
+ * disabled.  Used by the library indexer. */
+struct file_tags *tags_cache_refresh (struct tags_cache *c DB_ONLY,
+                                      const char *file, int tags_sel,
+                                      int force DB_ONLY)
+{
+	assert (c != NULL);
+	assert (file != NULL);
+
+#ifdef HAVE_DB_H
+	if (c->max_items && c->db) {
+		if (force)
+			tags_cache_forget (c, file);
+
+		return (struct file_tags *)with_db_lock (locked_read_add, c, file,
+		                                         tags_sel, -1);
+	}
+#endif
+
+	return read_missing_tags (file, NULL, tags_sel);
+}
+
+#ifdef HAVE_DB_H
+static void *locked_forget (struct tags_cache *c, const char *file,
+                            int unused1 ATTR_UNUSED, int unused2 ATTR_UNUSED,
+                            DBT *unused3 ATTR_UNUSED, DBT *unused4 ATTR_UNUSED)
+{
+	tags_cache_remove_rec (c, file);
+
+	return NULL;
+}
+#endif
+
+/* Remove the record for the file from the cache (the file was deleted or
+ * moved away). */
+void tags_cache_forget (struct tags_cache *c DB_ONLY,
+                        const char *file DB_ONLY)
+{
+	assert (c != NULL);
+	assert (file != NULL);
+
+#ifdef HAVE_DB_H
+	if (c->max_items && c->db)
+		with_db_lock (locked_forget, c, file, 0, -1);
+#endif
+}
+
+/* Remove the records for all files under the directory from the cache
+ * (the directory was deleted or moved away). */
+void tags_cache_forget_under (struct tags_cache *c DB_ONLY,
+                              const char *dir DB_ONLY)
+{
+	assert (c != NULL);
+	assert (dir != NULL);
+
+#ifdef HAVE_DB_H
+	if (c->max_items && c->db) {
+		DBC *cur;
+		DBT key, record;
+		lists_t_strs *files;
+		char *prefix;
+		size_t len;
+		int ret, ix;
+
+		prefix = format_msg ("%s/", dir);
+		len = strlen (prefix);
+		files = lists_strs_new (16);
+
+		memset (&key, 0, sizeof (key));
+		memset (&record, 0, sizeof (record));
+		key.data = prefix;
+		key.size = len;
+		key.flags = DB_DBT_MALLOC;
+		record.flags = DB_DBT_MALLOC;
+
+		/* Keys are sorted, so the files under the directory follow
+		 * the first key not below its prefix. */
+		c->db->cursor (c->db, NULL, &cur, 0);
+#if DB_VERSION_MAJOR == 4 && DB_VERSION_MINOR < 6
+		ret = cur->c_get (cur, &key, &record, DB_SET_RANGE);
+#else
+		ret = cur->get (cur, &key, &record, DB_SET_RANGE);
+#endif
+		while (ret == 0) {
+			int under = key.size > len
+			            && !memcmp (key.data, prefix, len);
+
+			if (under) {
+				char *file = (char *)xmalloc (key.size + 1);
+
+				memcpy (file, key.data, key.size);
+				file[key.size] = '\0';
+				lists_strs_push (files, file);
+			}
+
+			free (key.data);
+			free (record.data);
+
+			if (!under)
+				break;
+
+#if DB_VERSION_MAJOR == 4 && DB_VERSION_MINOR < 6
+			ret = cur->c_get (cur, &key, &record, DB_NEXT);
+#else
+			ret = cur->get (cur, &key, &record, DB_NEXT);
+#endif
+		}
+
+		if (ret != 0 && ret != DB_NOTFOUND)
+			log_errno ("Searching for files under a directory failed "
+			           "(cursor)", ret);
+
+#if DB_VERSION_MAJOR == 4 && DB_VERSION_MINOR < 6
+		cur->c_close (cur);
+#else
+		cur->close (cur);
+#endif
+
+		/* Remove them with the cursor closed, under the usual locks. */
+		for (ix = 0; ix < lists_strs_size (files); ix += 1)
+			with_db_lock (locked_forget, c, lists_strs_at (files, ix),
+			              0, -1);
+
+		lists_strs_free (files);
+		free (prefix);
+	}
+#endif
+}
+
+/* Declare that records for files under the directory are kept current by
+ * the library indexer and need no modification time check.  NULL revokes
+ * the declaration. */
+void tags_cache_trust_dir (struct tags_cache *c, const char *dir)
+{
+	assert (c != NULL);
+
+	LOCK (c->mutex);
+	free (c->trusted_dir);
+	c->trusted_dir = dir ? xstrdup (dir) : NULL;
+	UNLOCK (c->mutex);
+
+	if (dir)
+		logit ("Trusting cached tags for files under %s", dir);
+}
@@ -9,13 +9,15 @@ struct file_tags;
 struct tags_cache;
 
 /* Administrative functions: */
-struct tags_cache *tags_cache_new (size_t max_size);
+struct tags_cache *tags_cache_new (size_t max_size, int max_clients);
 void tags_cache_free (struct tags_cache *c);
 
 /* Request queue manipulation functions: */
 void tags_cache_clear_queue (struct tags_cache *c, int client_id);
 void tags_cache_clear_up_to (struct tags_cache *c, const char *file,
                                                       int client_id);
+void tags_cache_clear_files (struct tags_cache *c, char **files, int count,
+                                                      int client_id);
 
 /* Cache DB manipulation functions: */
 void tags_cache_load (struct tags_cache *c, const char *cache_dir);
@@ -24,6 +26,14 @@ void tags_cache_add_request (struct tags_cache *c, const char *file,
 struct file_tags *tags_cache_get_immediate (struct tags_cache *c,
                                   const char *file, int tags_sel);
 
+/* Library indexer support functions: */
+int tags_cache_size (struct tags_cache *c);
+struct file_tags *tags_cache_refresh (struct tags_cache *c, const char *file,
+                                      int tags_sel, int force);
+void tags_cache_forget (struct tags_cache *c, const char *file);
+void tags_cache_forget_under (struct tags_cache *c, const char *dir);
+void tags_cache_trust_dir (struct tags_cache *c, const char *dir);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,147 @@
+#!/bin/bash
+
+#
+# MOC - music on console
+# Copyright (C) 2004-2005 Damian Pietras <daper@daper.net>
+#
+# indexcheck.sh Copyright (C) 2026 The MOC developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+
+MOCP=mocp
+KEEP=false
+WAIT=20
+
+# Clean error termination.
+function die {
+  echo '***' $@ > /dev/stderr
+  exit 1
+}
+
+# Provide usage information.
+function usage () {
+  echo "Usage: ${0##*/} [-k] [MOCP]"
+  echo "       ${0##*/} -h"
+}
+
+# Provide help information.
+function help () {
+  echo
+  echo "MOC library indexer checking tool"
+  echo
+  usage
+  echo
+  echo "  -h|--help       This help information"
+  echo "  -k|--keep       Keep the scratch directory"
+  echo
+  echo "  MOCP            The MOC binary to test (default: 'mocp')"
+  echo
+}
+
+# Run the MOC binary on the scratch MOC directory.
+function moc {
+  $MOCP -M "$DIR/moc" "$@"
+}
+
+# Wait for the line to appear in the server's log file.
+function wait_log () {
+  local i
+
+  for (( i = 0; i < WAIT * 10; i++ ))
+  do
+    grep -q "$1" "$DIR/mocp_server_log" 2> /dev/null && return 0
+    sleep 0.1
+  done
+
+  die "Timed out waiting for '$1' in the server log"
+}
+
+# Play the file and print its title as the server sees it.
+function title () {
+  moc -l "$1" || die "Can't play $1"
+  sleep 1
+  moc -Q %t
+  moc -s
+}
+
+# Set the file's title keeping its modification time.
+function set_title () {
+  local ref="$DIR/mtime"
+
+  touch -r "$1" "$ref"
+  vorbiscomment -w -t "TITLE=$2" "$1" || die "Can't tag $1"
+  touch -r "$ref" "$1"
+}
+
+function cleanup () {
+  moc -x > /dev/null 2>&1
+  $KEEP || rm -rf "$DIR"
+}
+
+# Process command line options.
+for OPTS
+do
+  case $1 in
+   -k|--keep) KEEP=true
+              ;;
+   -h|--help) help
+              exit 0
+              ;;
+          --) shift
+              break
+              ;;
+          -*) echo Unrecognised option: $1
+              usage > /dev/stderr
+              exit 1
+              ;;
+           *) break
+              ;;
+  esac
+  shift
+done
+
+[[ $# -gt 1 ]] && usage > /dev/stderr && exit 1
+[[ $# -eq 1 ]] && MOCP="$1"
+
+for TOOL in sox vorbiscomment
+do
+  which $TOOL > /dev/null 2>&1 || die "The '$TOOL' program is required"
+done
+
+DIR="$(mktemp -d)" || die "Can't create the scratch directory"
+trap cleanup EXIT
+$KEEP && echo "Scratch directory: $DIR"
+
+mkdir -p "$DIR/moc" "$DIR/music/album" "$DIR/away"
+cat > "$DIR/moc/config" <<EOF
+MusicDir = $DIR/music
+LibraryIndexer = yes
+SoundDriver = null
+EOF
+
+FILE="$DIR/music/album/sinewave.ogg"
+sox -n -r 44100 -c 2 "$FILE" synth 5 sine 440 || die "Can't create $FILE"
+set_title "$FILE" Before
+
+# The server's log goes to the current directory.
+cd "$DIR" && moc -D -S > /dev/null || die "Can't start the server"
+wait_log "Library indexed"
+
+RESULT="$(title "$FILE")"
+[[ "$RESULT" == Before ]] || die "Indexed title is '$RESULT', not 'Before'"
+
+# Change the file while its directory is outside the library.
+mv "$DIR/music/album" "$DIR/away/"
+sleep 1
+set_title "$DIR/away/album/sinewave.ogg" After
+mv "$DIR/away/album" "$DIR/music/"
+sleep 1
+
+RESULT="$(title "$FILE")"
+[[ "$RESULT" == After ]] || die "Title after the move back is '$RESULT', not 'After'"
+
+echo "Passed"
@@ -127,6 +127,37 @@ char *xterm_iconv_str (const char *str)
     return iconv_str (xterm_iconv_desc, str);
 }
 
+/* Return a malloc()ed string converted to the terminal's character set. */
+char *display_iconv_str (const char *str)
+{
+	return iconv_str (iconv_desc, str);
+}
+
+/* Return the length of the string if it has only printable ASCII
+ * characters, which take one column each in any character set, or -1. */
+static int ascii_len (const char *str)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)str; *p; p++)
+		if (*p < 0x20 || *p > 0x7e)
+			return -1;
+
+	return p - (const unsigned char *)str;
+}
+
+/* Return a malloc()ed copy of the first len bytes of str. */
+static char *str_head (const char *str, const int len)
+{
+	char *head;
+
+	head = (char *)xmalloc (len + 1);
+	memcpy (head, str, len);
+	head[len] = 0;
+
+	return head;
+}
+
 int xwaddstr (WINDOW *win, const char *str)
 {
 	int res;
@@ -203,9 +234,11 @@ static size_t xmbstowcs (wchar_t *dest, const char *src, size_t len,
 	return count;
 }
 
-int xwaddnstr (WINDOW *win, const char *str, const int n)
+/* Return a malloc()ed string containing the head of 'str' up to a
+ * maximum of 'n' columns, converted to the terminal's character set. */
+char *xstrhead (const char *str, const int n)
 {
-	int res, width, inv_char;
+	int width, inv_char, len;
 	wchar_t *ucs;
 	char *mstr, *lstr;
 	size_t size, num_chars;
@@ -213,6 +246,9 @@ int xwaddnstr (WINDOW *win, const char *str, const int n)
 	assert (n > 0);
 	assert (str != NULL);
 
+	if ((len = ascii_len (str)) != -1)
+		return str_head (str, MIN(len, n));
+
 	mstr = iconv_str (iconv_desc, str);
 
 	size = xmbstowcs (NULL, mstr, -1, NULL) + 1;
@@ -244,11 +280,21 @@ int xwaddnstr (WINDOW *win, const char *str, const int n)
 	else
 		snprintf (lstr, num_chars + 1, "%s", mstr);
 
-	res = waddstr (win, lstr);
-
 	free (ucs);
-	free (lstr);
 	free (mstr);
+
+	return lstr;
+}
+
+int xwaddnstr (WINDOW *win, const char *str, const int n)
+{
+	int res;
+	char *lstr;
+
+	lstr = xstrhead (str, n);
+	res = waddstr (win, lstr);
+	free (lstr);
+
 	return res;
 }
 
@@ -366,9 +412,13 @@ size_t strwidth (const char *s)
 	wchar_t *ucs;
 	size_t size;
 	size_t width;
+	int len;
 
 	assert (s != NULL);
 
+	if ((len = ascii_len (s)) != -1)
+		return len;
+
 	size = xmbstowcs (NULL, s, -1, NULL) + 1;
 	ucs = (wchar_t *)xmalloc (sizeof(wchar_t) * size);
 	xmbstowcs (ucs, s, size, NULL);
@@ -387,10 +437,14 @@ char *xstrtail (const char *str, const int len)
 	size_t size;
 	int width;
 	char *tail;
+	int ascii;
 
 	assert (str != NULL);
 	assert (len > 0);
 
+	if ((ascii = ascii_len (str)) != -1)
+		return xstrdup (str + ascii - MIN(ascii, len));
+
 	size = xmbstowcs(NULL, str, -1, NULL) + 1;
 	ucs = (wchar_t *)xmalloc (sizeof(wchar_t) * size);
 	xmbstowcs (ucs, str, size, NULL);
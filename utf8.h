@@ -35,9 +35,11 @@ int xmvwaddnstr (WINDOW *win, const int y, const int x, const char *str,
 int xwprintw (WINDOW *win, const char *fmt, ...) ATTR_PRINTF(2, 3);
 size_t strwidth (const char *s);
 char *xstrtail (const char *str, const int len);
+char *xstrhead (const char *str, const int n);
 char *iconv_str (const iconv_t desc, const char *str);
 char *files_iconv_str (const char *str);
 char *xterm_iconv_str (const char *str);
+char *display_iconv_str (const char *str);
 
 #ifdef __cplusplus
 }